@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+
+// Player for short looping animations (delta frames).
+//
+// Storing every frame as full imageData[] array takes 109KB per frame. An
+// animation instead starts with one keyframe, every further frame only
+// contains the rectangles that changed against the frame before. The pixels
+// of each rectangle are run-length encoded. The last record leads from the
+// last frame back to the first, so the loop never needs the keyframe again.
+// Only the changed rectangles are sent to the LCD.
+//
+// Use tools/anim_encoder.py to build an animation from an image sequence or
+// an animated GIF.
+//
+// Format (little endian):
+//   header   "ANM1", u16 width, u16 height, u16 frames, u16 frame_ms,
+//            u32 loop_offset (offset of the record after the keyframe)
+//   record   u16 rect count, then per rect:
+//              u16 x, u16 y, u16 w, u16 h, w*h pixels RLE encoded
+//   RLE      u8 n: n < 128  -> n+1 literal pixels follow
+//                  n >= 128 -> the next pixel repeated n-127 times
+//            pixels are RGB565, high byte first (LCD byte order)
+//   records  keyframe (one rect over the full size), then frames-1 deltas,
+//            then the delta from the last frame back to the first
+
+#define ANIM_HEADER_SIZE 16
+#define ANIM_BAND_PIXELS 1024
+
+struct anim_stats {
+  uint32_t frames;
+  uint32_t rects;
+  uint32_t pixels;          // pixels sent to the LCD
+  uint32_t draw_us;         // time of the last frame
+  uint32_t max_draw_us;
+};
+
+struct anim_player {
+  const uint8_t* data;
+  size_t size;
+  uint16_t width;
+  uint16_t height;
+  uint16_t frames;
+  uint16_t frame_ms;
+  uint32_t loop_offset;
+  uint32_t pos;             // next record
+  uint32_t next_ms;         // millis() when the next frame is due
+  anim_stats stats;
+};
+
+// Check the header and rewind to the keyframe, false if data is no animation
+bool anim_open(anim_player& p, const uint8_t* data, size_t size);
+
+// Draw the next frame at x/y (the keyframe on the first call), false on a
+// broken record
+bool anim_draw_next(Adafruit_SPITFT& lcd, anim_player& p, int16_t x, int16_t y);
+
+// Call in loop(): draws the next frame when it is due, returns true if it did
+bool anim_update(Adafruit_SPITFT& lcd, anim_player& p, int16_t x, int16_t y);
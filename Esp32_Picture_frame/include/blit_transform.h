@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+#include "indexed_image.h"
+
+// Rotation, mirroring and scaling while the picture is sent to the LCD.
+//
+// A stored picture no longer has to be exported in exactly the size and
+// orientation of the panel. blit_setup() precomputes two tables: the source
+// offset of every output column and of every output line. Any combination of
+// rotation (0/90/180/270 clockwise), mirroring and nearest-neighbour scaling
+// then costs one table lookup and one add per pixel:
+//
+//   source pixel = data[row_offset[y] + col_offset[x]]
+//
+// For 90/270 degrees the tables simply walk the source by columns instead of
+// lines. The source must allow random access (RGB565 array or indexed image
+// in flash), no framebuffer is needed.
+//
+// Example, a landscape 320x170 picture on the portrait panel:
+//   static blit_transform t;
+//   blit_setup(t, 320, 170, 170, 320, BLIT_ROT_90, false, false);
+//   blit_draw_rgb565(lcd, 0, 0, t, landscapeData);
+
+#define BLIT_MAX_DIM 320            // largest output width / height
+#define BLIT_BAND_PIXELS 1024
+
+enum blit_rotation : uint8_t {
+  BLIT_ROT_0 = 0,
+  BLIT_ROT_90,
+  BLIT_ROT_180,
+  BLIT_ROT_270
+};
+
+struct blit_transform {
+  uint16_t src_w;
+  uint16_t src_h;
+  uint16_t src_stride;              // pixels from one source line to the next
+  uint16_t dst_w;
+  uint16_t dst_h;
+  uint32_t col_offset[BLIT_MAX_DIM];
+  uint32_t row_offset[BLIT_MAX_DIM];
+};
+
+// Compute the tables. dst_w x dst_h is the drawn size, the picture is
+// stretched to it (use blit_fit() to keep the aspect ratio). src_stride 0
+// means src_w. Returns false if the output is larger than BLIT_MAX_DIM.
+bool blit_setup(blit_transform& t, uint16_t src_w, uint16_t src_h, uint16_t dst_w, uint16_t dst_h,
+                blit_rotation rotation, bool mirror_x, bool mirror_y, uint16_t src_stride = 0);
+
+// Largest size with the aspect ratio of the (rotated) source that fits into
+// max_w x max_h. With integer_only the scale is restricted to whole
+// multiples or fractions (1/3, 1/2, 1, 2, 3 ...), which keeps pixels sharp.
+void blit_fit(uint16_t src_w, uint16_t src_h, blit_rotation rotation, uint16_t max_w, uint16_t max_h,
+              bool integer_only, uint16_t& w, uint16_t& h);
+
+// src_stride of an indexed image, 4bit lines are padded to whole bytes
+inline uint16_t blit_indexed_stride(const indexed_image& img)
+{
+  return img.bits_per_pixel == 4 ? indexed_row_bytes(img) * 2 : indexed_row_bytes(img);
+}
+
+// One transformed output line in LCD byte order
+void blit_row_rgb565(const blit_transform& t, const uint16_t* data, uint16_t y, uint16_t* out);
+void blit_row_indexed(const blit_transform& t, const indexed_image& img, const palette_lut& lut,
+                      uint16_t y, uint16_t* out);
+
+// Draw the whole transformed picture at x/y
+void blit_draw_rgb565(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const blit_transform& t,
+                      const uint16_t* data);
+void blit_draw_indexed(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const blit_transform& t,
+                       const indexed_image& img, const palette_lut& lut);
+
+// Background source for the compositor (see compositor.h), fills the screen
+// line with the transformed picture, black outside of it
+struct blit_source {
+  const blit_transform* t;
+  const uint16_t* rgb565;           // either an RGB565 array ...
+  const indexed_image* indexed;     // ... or an indexed image
+  const palette_lut* lut;
+  int16_t x;                        // position on the screen
+  int16_t y;
+};
+void blit_source_row(void* user, int16_t y, uint16_t* out, uint16_t width);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+#include "indexed_image.h"
+#include "jpeg_decoder.h"
+
+// Scanline compositor for overlays (clock, captions) on top of the picture.
+//
+// The esp32dev has no PSRAM, a full 170x320 framebuffer would take 109KB.
+// Instead every line is produced by a background source (image in flash,
+// indexed image, JPEG band), the overlay layers are blended into it and the
+// line is sent to the LCD. Layers are rectangles and text in the 5x7 GFX font,
+// scaled up with anti-aliased edges, both with alpha.
+//
+// When a layer changes only the lines it covers (old and new position) are
+// marked dirty, compositor_draw() with full = false then redraws just those.
+//
+// Example, a clock that is updated once a minute:
+//   compositor comp;
+//   compositor_clear(comp);
+//   compositor_add_rect(comp, 0, 270, 170, 40, 0x0000, 128);   // dark band
+//   int8_t clock = compositor_add_text(comp, 25, 276, 4, 0xFFFF, 255, "12:00");
+//   rgb565_source bg = { imageData, LCD_WIDTH, LCD_HEIGHT };
+//   compositor_draw(lcd, comp, rgb565_row, &bg, true);
+//   ...
+//   compositor_set_text(comp, clock, "12:01");
+//   compositor_draw(lcd, comp, rgb565_row, &bg, false);     // only rows 270-309
+
+#define COMPOSITOR_MAX_LAYERS 8
+#define COMPOSITOR_MAX_TEXT 24
+#define COMPOSITOR_BAND_PIXELS 2048
+
+enum layer_type : uint8_t {
+  LAYER_NONE = 0,
+  LAYER_RECT,
+  LAYER_TEXT
+};
+
+struct overlay_layer {
+  layer_type type;
+  bool visible;
+  int16_t x;
+  int16_t y;
+  int16_t w;
+  int16_t h;
+  uint16_t color;     // RGB565
+  uint8_t alpha;      // 0 = transparent, 255 = opaque
+  uint8_t scale;      // text: size of one font pixel
+  char text[COMPOSITOR_MAX_TEXT + 1];
+};
+
+struct compositor {
+  overlay_layer layers[COMPOSITOR_MAX_LAYERS];
+  int16_t dirty_top;      // first line to redraw, -1 = nothing to do
+  int16_t dirty_bottom;   // last line to redraw
+};
+
+// Fills out with the background pixels of line y (LCD byte order)
+typedef void (*scanline_source_cb)(void* user, int16_t y, uint16_t* out, uint16_t width);
+
+// RGB565 picture in flash as produced by the FileToCArray tool
+struct rgb565_source {
+  const uint16_t* data;
+  uint16_t width;
+  uint16_t height;
+};
+void rgb565_row(void* user, int16_t y, uint16_t* out, uint16_t width);
+
+// Palette-indexed picture, user points to the indexed_image
+void indexed_row(void* user, int16_t y, uint16_t* out, uint16_t width);
+
+void compositor_clear(compositor& comp);
+
+// Add a layer, returns its id or -1 when all layers are used
+int8_t compositor_add_rect(compositor& comp, int16_t x, int16_t y, int16_t w, int16_t h,
+                           uint16_t color, uint8_t alpha);
+int8_t compositor_add_text(compositor& comp, int16_t x, int16_t y, uint8_t scale,
+                           uint16_t color, uint8_t alpha, const char* text);
+
+// Change a layer, the covered lines are marked dirty
+void compositor_set_text(compositor& comp, int8_t id, const char* text);
+void compositor_set_color(compositor& comp, int8_t id, uint16_t color, uint8_t alpha);
+void compositor_move(compositor& comp, int8_t id, int16_t x, int16_t y);
+void compositor_set_visible(compositor& comp, int8_t id, bool visible);
+
+// Blend all layers into one line (LCD byte order)
+void compositor_blend_row(const compositor& comp, int16_t y, uint16_t* row, uint16_t width);
+
+// Mix line other into row (both LCD byte order), alpha 0 = row, 255 = other.
+// Used for cross-fades between two pictures.
+void compositor_mix_row(uint16_t* row, const uint16_t* other, uint16_t width, uint8_t alpha);
+
+// Draw the whole screen (full = true) or only the dirty lines
+void compositor_draw(Adafruit_SPITFT& lcd, compositor& comp, scanline_source_cb source, void* user,
+                     bool full);
+
+// Same with a JPEG as background. The picture is decoded again, but only the
+// bands that contain dirty lines are blended and sent.
+jpeg_result compositor_draw_jpeg(Adafruit_SPITFT& lcd, compositor& comp, jpeg_read_cb read,
+                                 void* user, bool full);
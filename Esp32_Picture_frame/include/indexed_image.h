@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+
+// Palette-indexed images for the picture frame.
+//
+// Instead of storing every pixel as 16bit RGB565 (2 byte/pixel) an image with
+// few colours is stored as 8bit (1 byte/pixel, up to 256 colours) or 4bit
+// (2 pixel/byte, up to 16 colours) indices into a RGB565 palette.
+// The indices are expanded to RGB565 while the image is sent to the LCD, one
+// band of lines at a time, so no full 16bit copy of the image is ever needed.
+//
+// Pixel layout: rows are stored top to bottom, every row starts on a new byte.
+// For 4bit images the left pixel is in the high nibble.
+// Use tools/png_to_indexed.py to convert a picture into this format.
+
+// Number of pixels in the line buffer used while expanding an image
+#define INDEXED_LINE_PIXELS 1024
+
+struct indexed_image {
+  uint16_t width;
+  uint16_t height;
+  uint8_t bits_per_pixel;   // 8 or 4
+  uint16_t palette_size;    // number of entries in palette (max 256 / 16)
+  const uint16_t* palette;  // RGB565 colours as produced by the converter
+  const uint8_t* pixels;    // packed indices, see layout above
+};
+
+// Lookup table used during the blit. The entries are the palette colours in
+// the byte order of the LCD, so the expanded line can be sent without swapping.
+struct palette_lut {
+  uint16_t entries[256];
+  uint16_t size;
+};
+
+// Bytes per stored row of the image
+uint16_t indexed_row_bytes(const indexed_image& img);
+
+// Fill the lookup table from a RGB565 palette
+void build_palette_lut(palette_lut& lut, const uint16_t* palette, uint16_t count);
+
+// Rotate the palette entries first..first+count-1 by step positions, count
+// up to 256 (the whole table), cut at the end of the table.
+// Redrawing the image afterwards gives a colour cycling animation without
+// touching the pixel data.
+void cycle_palette_lut(palette_lut& lut, uint8_t first, uint16_t count, int8_t step);
+
+// Expand count pixels of one image row, starting at column x0, into out
+void expand_indexed_row(const indexed_image& img, uint16_t row, uint16_t x0, uint16_t count,
+                        const palette_lut& lut, uint16_t* out);
+
+// Draw the image at x/y using its own palette
+void draw_indexed_image(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const indexed_image& img);
+
+// Draw the image at x/y using the given lookup table (e.g. a cycled palette)
+void draw_indexed_image(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const indexed_image& img,
+                        const palette_lut& lut);
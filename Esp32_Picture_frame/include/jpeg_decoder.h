@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming baseline JPEG decoder for the picture frame.
+//
+// The picture is decoded one MCU row (8 or 16 lines) at a time into a small
+// band buffer. Every finished band is handed to a callback, which normally
+// writes it straight to the LCD, so the whole picture is never held in RAM.
+//
+// Supported: baseline / extended sequential huffman JPEG, 8bit, grayscale or
+// YCbCr with 4:4:4, 4:2:2 or 4:2:0 sampling, restart markers.
+// Not supported: progressive and arithmetic coded files (re-save those as
+// baseline, tools/jpg_to_header.py does this).
+//
+// The output can be scaled down by 1/2, 1/4 or 1/8 while decoding. At 1/8
+// only the DC coefficient is used and the IDCT is skipped completely.
+
+#define JPEG_INPUT_BUFFER 512
+#define JPEG_FAST_BITS 9
+
+enum jpeg_result {
+  JPEG_OK = 0,
+  JPEG_ERR_READ,         // source ended early
+  JPEG_ERR_FORMAT,       // not a JPEG or corrupt header
+  JPEG_ERR_UNSUPPORTED,  // progressive, 12bit, unusual sampling ...
+  JPEG_ERR_MEMORY,       // band buffer could not be allocated
+  JPEG_ABORTED           // band callback returned false
+};
+
+// Reads up to len bytes into buf, returns the number of bytes read (0 = end)
+typedef size_t (*jpeg_read_cb)(void* user, uint8_t* buf, size_t len);
+
+// Receives one finished band. pixels holds w*h RGB565 values, high byte first
+// (the byte order the LCD expects). Return false to stop decoding.
+typedef bool (*jpeg_band_cb)(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                             uint16_t* pixels);
+
+struct jpeg_huffman {
+  uint16_t fast[1 << JPEG_FAST_BITS]; // (length << 8) | symbol, 0 = longer code
+  uint8_t symbols[256];
+  int32_t maxcode[18];                // largest code of each length, -1 if none
+  int32_t delta[17];                  // index into symbols = code + delta[length]
+};
+
+struct jpeg_component {
+  uint8_t id;
+  uint8_t h;        // horizontal sampling factor
+  uint8_t v;        // vertical sampling factor
+  uint8_t tq;       // quantisation table
+  uint8_t td;       // DC huffman table
+  uint8_t ta;       // AC huffman table
+  int16_t dc_pred;
+};
+
+struct jpeg_decoder {
+  // valid after jpeg_begin()
+  uint16_t width;
+  uint16_t height;
+  uint8_t components;
+
+  // input
+  jpeg_read_cb read;
+  void* user;
+  uint8_t in_buf[JPEG_INPUT_BUFFER];
+  uint16_t in_pos;
+  uint16_t in_len;
+  bool eof;
+
+  // tables from the file header
+  uint16_t quant[4][64];   // zigzag order
+  jpeg_huffman huff[4];    // DC0, DC1, AC0, AC1
+  jpeg_component comp[3];
+  uint16_t restart_interval;
+
+  // entropy decoder state
+  uint32_t bits;
+  int8_t nbits;
+  uint8_t marker;          // marker found inside the entropy coded data, 0 = none
+};
+
+// Read the file header up to the start of the picture data
+jpeg_result jpeg_begin(jpeg_decoder& dec, jpeg_read_cb read, void* user);
+
+// Output size for a given scale (1, 2, 4 or 8)
+uint16_t jpeg_scaled_width(const jpeg_decoder& dec, uint8_t scale);
+uint16_t jpeg_scaled_height(const jpeg_decoder& dec, uint8_t scale);
+
+// Decode the picture, scaled down by 1/scale, and pass it band by band to band_cb.
+// The band buffer (scaled width x MCU height x 2 bytes) is allocated here.
+jpeg_result jpeg_decode(jpeg_decoder& dec, uint8_t scale, jpeg_band_cb band_cb, void* user);
+
+// The same one band per call, for a consumer that pulls the lines (the tile
+// cache). jpeg_band_begin() after jpeg_begin() allocates the band buffer,
+// jpeg_band_next() decodes the next band into it while row < rows,
+// jpeg_band_end() frees it (also after an error).
+struct jpeg_bands {
+  uint8_t scale;
+  uint16_t width;          // of the scaled picture
+  uint16_t height;
+  uint16_t band_h;         // lines of a full band
+  uint16_t row;            // next MCU row
+  uint16_t rows;
+  uint16_t restarts_left;
+  uint16_t y;              // the band in pixels, h lines of width
+  uint16_t h;
+  uint16_t* pixels;
+};
+jpeg_result jpeg_band_begin(jpeg_decoder& dec, uint8_t scale, jpeg_bands& b);
+jpeg_result jpeg_band_next(jpeg_decoder& dec, jpeg_bands& b);
+void jpeg_band_end(jpeg_bands& b);
+
+// jpeg_begin() + jpeg_decode() with one shared decoder instance. The decoder
+// is about 7KB, too big for the stack of the loop task.
+jpeg_result jpeg_decode_stream(jpeg_read_cb read, void* user, uint8_t scale,
+                               jpeg_band_cb band_cb, void* band_user);
+
+// Size of the picture last opened by jpeg_decode_stream()
+uint16_t jpeg_last_width();
+uint16_t jpeg_last_height();
+
+// Sources
+
+// JPEG stored as a byte array in flash
+struct jpeg_memory_source {
+  const uint8_t* data;
+  size_t size;
+  size_t pos;
+};
+size_t jpeg_read_memory(void* user, uint8_t* buf, size_t len);
+
+// Band writers
+
+class Adafruit_SPITFT;
+
+// Visible part of a band of w x h pixels with its top left corner at x/y, on
+// a screen of width x height
+struct jpeg_clip {
+  int16_t x;        // on the screen
+  int16_t y;
+  uint16_t w;
+  uint16_t h;
+  uint16_t skip_x;  // columns and rows of the band left of and above it
+  uint16_t skip_y;
+};
+// false if nothing of the band is on the screen
+bool jpeg_clip_band(int32_t x, int32_t y, uint16_t w, uint16_t h, int16_t width, int16_t height,
+                    jpeg_clip& clip);
+
+// Write the visible part of a band to the LCD. The rows go out in one write
+// when they are on the screen in full, else each row is cut.
+void jpeg_write_band(Adafruit_SPITFT& lcd, int32_t x, int32_t y, uint16_t w, uint16_t h,
+                     uint16_t* pixels);
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+
+// JPEG arriving on a stream, e.g. the body of a HTTP upload. remaining limits
+// the bytes taken from the stream (Content-Length).
+struct jpeg_stream_source {
+  Stream* stream;
+  size_t remaining;
+};
+size_t jpeg_read_stream(void* user, uint8_t* buf, size_t len);
+
+// Decode the picture straight to the LCD at x/y, clipped to the screen (a
+// picture larger than it shows its top left part). Returns the result and
+// prints the decode time on Serial.
+jpeg_result jpeg_draw(Adafruit_SPITFT& lcd, int16_t x, int16_t y, jpeg_read_cb read, void* user,
+                      uint8_t scale = 1);
+jpeg_result jpeg_draw(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const uint8_t* data, size_t size,
+                      uint8_t scale = 1);
+
+// Decode the picture count times at every scale without drawing and print the
+// time per picture, to compare with the LCD transfer time.
+void jpeg_benchmark(const uint8_t* data, size_t size, uint8_t count = 10);
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+#include "compositor.h"
+#include "jpeg_decoder.h"
+#include "stripe_queue.h"
+
+// Rendering on both cores of the ESP32.
+//
+// Without the pipeline decoding, compositing and the SPI transfer run one
+// after another in loop(), and the web server in the same loop() has to wait
+// for the whole picture. Here the work is split in two tasks:
+//
+//   core 0  render task    JPEG decode / background source + overlays
+//                          -> fills stripes of up to 16 lines
+//   core 1  transfer task  stripe -> LCD (SPI), loop() with the web server
+//                          runs on the same core whenever no stripe is ready
+//
+// The tasks are connected by a stripe_queue. While the LCD receives stripe n
+// the render task already produces stripe n+1, so a frame takes about
+// max(render, transfer) instead of render + transfer. When the queue is full
+// the render task sleeps until a stripe has been sent (backpressure).
+//
+// Jobs are started from loop() and run in the background, only one at a
+// time. While a job runs the LCD, the compositor and the background source
+// belong to the pipeline, don't touch them before pipeline_wait().
+//
+// Example, a 2 second cross-fade:
+//   pipeline_begin(lcd);
+//   pipeline_crossfade(comp, rgb565_row, &oldPicture, rgb565_row, &newPicture, 32);
+//   ... web server keeps running ...
+//   pipeline_wait();
+//   pipeline_print_stats(Serial);
+
+#define PIPELINE_RENDER_CORE 0
+#define PIPELINE_TRANSFER_CORE 1    // core of loop() in the Arduino framework
+#define PIPELINE_MAX_WIDTH 320
+
+// Times in microseconds, summed up since the last pipeline_reset_stats()
+struct pipeline_stats {
+  uint32_t jobs;
+  uint32_t frames;
+  uint32_t stripes;
+  uint64_t render_us;         // render task: decoding and compositing
+  uint64_t render_wait_us;    // render task: waiting for a free stripe (queue full)
+  uint64_t transfer_us;       // transfer task: sending stripes
+  uint64_t transfer_wait_us;  // transfer task: waiting for a stripe while a job runs
+  uint32_t last_frame_us;     // time between the last two finished frames
+};
+
+// Start both tasks, returns false if they could not be created
+bool pipeline_begin(Adafruit_SPITFT& lcd);
+
+// Jobs, return false while another job is running. The results are the same
+// as with compositor_draw() / compositor_draw_jpeg().
+bool pipeline_draw(compositor& comp, scanline_source_cb source, void* user, bool full);
+bool pipeline_draw_jpeg(compositor& comp, jpeg_read_cb read, void* user, bool full);
+
+// Full screen cross-fade from one picture to another in steps frames, the
+// overlays are drawn on top of every frame
+bool pipeline_crossfade(compositor& comp, scanline_source_cb from, void* from_user,
+                        scanline_source_cb to, void* to_user, uint8_t steps);
+
+bool pipeline_busy();
+
+// Wait until the running job has been sent completely, returns its result
+// (always JPEG_OK for jobs without JPEG)
+jpeg_result pipeline_wait();
+
+// Counters of both tasks added up, valid until the next call. A reset takes
+// effect at once, each task clears its own counters when it next runs.
+const pipeline_stats& pipeline_get_stats();
+void pipeline_reset_stats();
+void pipeline_print_stats(Print& out);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Lock-free single-producer / single-consumer queue of picture stripes.
+//
+// The render task (producer) fills a stripe directly in its slot and commits
+// it, the transfer task (consumer) sends it to the LCD and releases the slot.
+// head is only written by the producer, tail only by the consumer, so two
+// atomic counters are enough, no mutex and no copy of the pixel data.
+//
+// When all slots are in use stripe_queue_acquire() returns NULL, the producer
+// then has to wait for the consumer (backpressure). The caller decides how
+// to wait (see render_pipeline.cpp).
+
+#define STRIPE_QUEUE_SLOTS 4        // power of two
+#define STRIPE_PIXELS 2816          // 16 lines of up to 176 pixels (one JPEG MCU row)
+
+// stripe flags
+#define STRIPE_FRAME_END 0x01       // last stripe of a frame
+#define STRIPE_JOB_END   0x02       // last stripe of a job, may be empty (h = 0)
+
+struct stripe {
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+  uint8_t flags;
+  uint16_t pixels[STRIPE_PIXELS];   // LCD byte order
+};
+
+struct stripe_queue {
+  stripe slots[STRIPE_QUEUE_SLOTS];
+  std::atomic<uint32_t> head;       // stripes committed by the producer
+  std::atomic<uint32_t> tail;       // stripes released by the consumer
+};
+
+inline void stripe_queue_init(stripe_queue& q)
+{
+  q.head.store(0, std::memory_order_relaxed);
+  q.tail.store(0, std::memory_order_relaxed);
+}
+
+// Producer: free slot to fill, NULL if the queue is full
+inline stripe* stripe_queue_acquire(stripe_queue& q)
+{
+  uint32_t head = q.head.load(std::memory_order_relaxed);
+  if (head - q.tail.load(std::memory_order_acquire) >= STRIPE_QUEUE_SLOTS) return NULL;
+  return &q.slots[head & (STRIPE_QUEUE_SLOTS - 1)];
+}
+
+// Producer: publish the slot returned by stripe_queue_acquire()
+inline void stripe_queue_commit(stripe_queue& q)
+{
+  q.head.store(q.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Consumer: oldest committed stripe, NULL if the queue is empty
+inline stripe* stripe_queue_front(stripe_queue& q)
+{
+  uint32_t tail = q.tail.load(std::memory_order_relaxed);
+  if (q.head.load(std::memory_order_acquire) == tail) return NULL;
+  return &q.slots[tail & (STRIPE_QUEUE_SLOTS - 1)];
+}
+
+// Consumer: give the slot returned by stripe_queue_front() back
+inline void stripe_queue_release(stripe_queue& q)
+{
+  q.tail.store(q.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+inline uint32_t stripe_queue_count(const stripe_queue& q)
+{
+  return q.head.load(std::memory_order_acquire) - q.tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include "jpeg_decoder.h"
+
+// Cache of decoded picture tiles.
+//
+// A tile is one band as the JPEG decoder produces it (one MCU row, 8 or 16
+// lines over the full width). Tiles are kept by (image, tile number, scale)
+// in spare RAM - PSRAM when the board has it, otherwise the internal heap -
+// up to a fixed budget. When the budget is used up the least recently used
+// tiles are dropped.
+//
+// A picture whose tiles are all in the cache is not decoded at all, the bands
+// are copied out of the cache. So a gallery that fits into the budget is
+// decoded once, and transitions that go back and forth between two pictures
+// don't decode in every frame. Only pictures that fit into the budget as a
+// whole are cached: without PSRAM (48KB) that is up to 170x144 pixels, a
+// full screen picture is decoded in every frame (once, see cached_jpeg_row).
+//
+// Hit and miss counters plus the decode time the hits saved are kept in
+// tile_cache_stats. The cache is not thread safe, with the render pipeline
+// use it only from jobs (i.e. from the render task).
+//
+// Example, a slide show of JPEGs in flash with a cross-fade:
+//   tile_cache_begin();
+//   cached_jpeg_source a = { 1, photo1, sizeof(photo1) };
+//   cached_jpeg_source b = { 2, photo2, sizeof(photo2) };
+//   pipeline_crossfade(comp, cached_jpeg_row, &a, cached_jpeg_row, &b, 32);
+
+#define TILE_CACHE_MAX_TILES 128
+#define TILE_CACHE_INTERNAL_BUDGET (48 * 1024)   // without PSRAM
+#define TILE_CACHE_PSRAM_BUDGET (1024 * 1024)    // with PSRAM
+#define TILE_CACHE_MAX_TILE_PIXELS (320 * 16)
+#define TILE_CACHE_STREAMS 2                     // pictures pulled by line at a time (cross-fade)
+
+struct tile_cache_stats {
+  uint32_t hits;              // tiles taken from the cache
+  uint32_t misses;            // tiles that had to be decoded
+  uint32_t evictions;         // tiles dropped to make room
+  uint32_t tiles;             // tiles in the cache now
+  uint32_t bytes;             // memory used by them
+  uint32_t budget;
+  uint64_t decode_us;         // time spent decoding
+  uint64_t saved_us;          // decode time of the tiles served from the cache
+  bool psram;
+};
+
+// Allocate the scratch buffer, budget 0 = default for the board. Returns
+// false if not even the scratch buffer could be allocated.
+bool tile_cache_begin(uint32_t budget = 0);
+
+// Drop all tiles of one image (e.g. after it was replaced), or all tiles
+void tile_cache_forget(uint32_t image);
+void tile_cache_clear();
+
+// Decode a JPEG from memory like jpeg_decode_stream(), but take the bands from
+// the cache if the whole picture is there. image identifies the picture, it
+// must be unique per JPEG (a number or the address of the array).
+jpeg_result tile_cache_decode_jpeg(uint32_t image, const uint8_t* data, size_t size, uint8_t scale,
+                                   jpeg_band_cb band_cb, void* user);
+
+// Background source for the compositor / render pipeline with a JPEG in
+// memory. Lines of cached tiles are copied out of the cache, the others come
+// from a decoder that keeps its place in the picture and caches the bands it
+// passes, so a frame costs at most one decode of the picture. Each of the
+// TILE_CACHE_STREAMS decoders takes about 7KB plus one band, outside of the
+// budget, allocated on first use.
+struct cached_jpeg_source {
+  uint32_t image;
+  const uint8_t* data;
+  size_t size;
+};
+void cached_jpeg_row(void* user, int16_t y, uint16_t* out, uint16_t width);
+
+const tile_cache_stats& tile_cache_get_stats();
+void tile_cache_reset_stats();
+
+#ifdef ARDUINO
+void tile_cache_print_stats(Print& out);
+#endif
@@ -0,0 +1,141 @@
+#include "anim_player.h"
+
+static uint16_t band_buffer[ANIM_BAND_PIXELS];
+
+
+static inline uint16_t read_u16(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+
+static inline uint32_t read_u32(const uint8_t* p)
+{
+  return read_u16(p) | ((uint32_t)read_u16(p + 2) << 16);
+}
+
+
+bool anim_open(anim_player& p, const uint8_t* data, size_t size)
+{
+  if (size < ANIM_HEADER_SIZE || memcmp(data, "ANM1", 4) != 0) return false;
+  p.data = data;
+  p.size = size;
+  p.width = read_u16(data + 4);
+  p.height = read_u16(data + 6);
+  p.frames = read_u16(data + 8);
+  p.frame_ms = read_u16(data + 10);
+  p.loop_offset = read_u32(data + 12);
+  if (p.loop_offset < ANIM_HEADER_SIZE || p.loop_offset > size) return false;
+  p.pos = ANIM_HEADER_SIZE;
+  p.next_ms = 0;
+  memset(&p.stats, 0, sizeof(p.stats));
+  return true;
+}
+
+
+// Decode the RLE pixels of one rectangle and send them, the address window is
+// already set. Returns false if the data ends early or is broken.
+static bool draw_rect_pixels(Adafruit_SPITFT& lcd, anim_player& p, uint32_t count)
+{
+  const uint8_t* data = p.data;
+  uint32_t pos = p.pos;
+  uint16_t fill = 0;
+
+  while (count) {
+    if (pos >= p.size) return false;
+    uint8_t n = data[pos++];
+    uint16_t run = (n < 128) ? n + 1 : n - 127;
+    if (run > count) return false;
+    count -= run;
+
+    if (n < 128) {
+      if (pos + run * 2 > p.size) return false;
+      // pixels are stored in LCD byte order, they are copied as they are
+      while (run) {
+        uint16_t k = min<uint16_t>(run, ANIM_BAND_PIXELS - fill);
+        memcpy(&band_buffer[fill], data + pos, k * 2);
+        pos += k * 2;
+        fill += k;
+        run -= k;
+        if (fill == ANIM_BAND_PIXELS) {
+          lcd.writePixels(band_buffer, fill, true, true);
+          fill = 0;
+        }
+      }
+    } else {
+      if (pos + 2 > p.size) return false;
+      uint16_t color;
+      memcpy(&color, data + pos, 2);
+      pos += 2;
+      while (run) {
+        uint16_t k = min<uint16_t>(run, ANIM_BAND_PIXELS - fill);
+        for (uint16_t i = 0; i < k; i++) band_buffer[fill + i] = color;
+        fill += k;
+        run -= k;
+        if (fill == ANIM_BAND_PIXELS) {
+          lcd.writePixels(band_buffer, fill, true, true);
+          fill = 0;
+        }
+      }
+    }
+  }
+  if (fill) lcd.writePixels(band_buffer, fill, true, true);
+  p.pos = pos;
+  return true;
+}
+
+
+bool anim_draw_next(Adafruit_SPITFT& lcd, anim_player& p, int16_t x, int16_t y)
+{
+  if (x < 0 || y < 0 || x + p.width > lcd.width() || y + p.height > lcd.height()) return false;
+  if (p.pos >= p.size) p.pos = p.loop_offset; // after the record back to frame 0
+  if (p.pos + 2 > p.size) return false;
+
+  uint32_t start = micros();
+  uint16_t rects = read_u16(p.data + p.pos);
+  p.pos += 2;
+
+  bool ok = true;
+  lcd.startWrite();
+  for (uint16_t i = 0; i < rects && ok; i++) {
+    if (p.pos + 8 > p.size) {
+      ok = false;
+      break;
+    }
+    const uint8_t* r = p.data + p.pos;
+    uint16_t rx = read_u16(r);
+    uint16_t ry = read_u16(r + 2);
+    uint16_t rw = read_u16(r + 4);
+    uint16_t rh = read_u16(r + 6);
+    p.pos += 8;
+    if (rx + rw > p.width || ry + rh > p.height) {
+      ok = false;
+      break;
+    }
+    lcd.setAddrWindow(x + rx, y + ry, rw, rh);
+    ok = draw_rect_pixels(lcd, p, (uint32_t)rw * rh);
+    p.stats.pixels += (uint32_t)rw * rh;
+  }
+  lcd.endWrite();
+
+  if (!ok) {
+    p.pos = ANIM_HEADER_SIZE; // start again with the keyframe
+    return false;
+  }
+  p.stats.frames++;
+  p.stats.rects += rects;
+  p.stats.draw_us = micros() - start;
+  if (p.stats.draw_us > p.stats.max_draw_us) p.stats.max_draw_us = p.stats.draw_us;
+  return true;
+}
+
+
+bool anim_update(Adafruit_SPITFT& lcd, anim_player& p, int16_t x, int16_t y)
+{
+  uint32_t now = millis();
+  if (p.next_ms && (int32_t)(now - p.next_ms) < 0) return false;
+  // keep the rhythm, but don't try to catch up after a long pause
+  p.next_ms = ((int32_t)(now - p.next_ms) > p.frame_ms) ? now + p.frame_ms : p.next_ms + p.frame_ms;
+  anim_draw_next(lcd, p, x, y);
+  return true;
+}
@@ -0,0 +1,186 @@
+#include "blit_transform.h"
+
+static uint16_t band_buffer[BLIT_BAND_PIXELS];
+
+
+static inline uint16_t swap_bytes(uint16_t c)
+{
+  return (c >> 8) | (c << 8);
+}
+
+
+// Nearest source pixel for output pixel i of n, sampled at the pixel centre
+static inline uint16_t scale_coord(uint16_t i, uint16_t n, uint16_t src)
+{
+  return ((uint32_t)(2 * i + 1) * src) / (2 * n);
+}
+
+
+bool blit_setup(blit_transform& t, uint16_t src_w, uint16_t src_h, uint16_t dst_w, uint16_t dst_h,
+                blit_rotation rotation, bool mirror_x, bool mirror_y, uint16_t src_stride)
+{
+  if (dst_w == 0 || dst_h == 0 || dst_w > BLIT_MAX_DIM || dst_h > BLIT_MAX_DIM) return false;
+
+  const bool swap = (rotation == BLIT_ROT_90 || rotation == BLIT_ROT_270);
+  const uint16_t rw = swap ? src_h : src_w;   // size of the rotated source
+  const uint16_t rh = swap ? src_w : src_h;
+  const uint32_t stride = src_stride ? src_stride : src_w;
+
+  t.src_w = src_w;
+  t.src_h = src_h;
+  t.src_stride = stride;
+  t.dst_w = dst_w;
+  t.dst_h = dst_h;
+
+  // rx/ry are coordinates in the rotated (and mirrored) source, the switch
+  // turns them back into an offset in the stored picture
+  for (uint16_t x = 0; x < dst_w; x++) {
+    uint16_t rx = scale_coord(x, dst_w, rw);
+    if (mirror_x) rx = rw - 1 - rx;
+    switch (rotation) {
+      case BLIT_ROT_90:  t.col_offset[x] = (src_h - 1 - rx) * stride; break;
+      case BLIT_ROT_180: t.col_offset[x] = src_w - 1 - rx; break;
+      case BLIT_ROT_270: t.col_offset[x] = rx * stride; break;
+      default:           t.col_offset[x] = rx; break;
+    }
+  }
+  for (uint16_t y = 0; y < dst_h; y++) {
+    uint16_t ry = scale_coord(y, dst_h, rh);
+    if (mirror_y) ry = rh - 1 - ry;
+    switch (rotation) {
+      case BLIT_ROT_90:  t.row_offset[y] = ry; break;
+      case BLIT_ROT_180: t.row_offset[y] = (src_h - 1 - ry) * stride; break;
+      case BLIT_ROT_270: t.row_offset[y] = src_w - 1 - ry; break;
+      default:           t.row_offset[y] = ry * stride; break;
+    }
+  }
+  return true;
+}
+
+
+void blit_fit(uint16_t src_w, uint16_t src_h, blit_rotation rotation, uint16_t max_w, uint16_t max_h,
+              bool integer_only, uint16_t& w, uint16_t& h)
+{
+  const bool swap = (rotation == BLIT_ROT_90 || rotation == BLIT_ROT_270);
+  const uint16_t rw = swap ? src_h : src_w;
+  const uint16_t rh = swap ? src_w : src_h;
+
+  if (integer_only) {
+    if (rw <= max_w && rh <= max_h) {
+      uint16_t n = min(max_w / rw, max_h / rh);
+      w = rw * n;
+      h = rh * n;
+    } else {
+      uint16_t d = max((rw + max_w - 1) / max_w, (rh + max_h - 1) / max_h);
+      w = rw / d;
+      h = rh / d;
+    }
+    return;
+  }
+
+  // compare max_w / rw with max_h / rh without division
+  if ((uint32_t)max_w * rh <= (uint32_t)max_h * rw) {
+    w = max_w;
+    h = (uint32_t)rh * max_w / rw;
+  } else {
+    h = max_h;
+    w = (uint32_t)rw * max_h / rh;
+  }
+}
+
+
+void blit_row_rgb565(const blit_transform& t, const uint16_t* data, uint16_t y, uint16_t* out)
+{
+  const uint16_t* src = data + t.row_offset[y];
+  const uint32_t* col = t.col_offset;
+  for (uint16_t x = 0; x < t.dst_w; x++) {
+    out[x] = swap_bytes(src[col[x]]);
+  }
+}
+
+
+void blit_row_indexed(const blit_transform& t, const indexed_image& img, const palette_lut& lut,
+                      uint16_t y, uint16_t* out)
+{
+  const uint32_t base = t.row_offset[y];
+  const uint32_t* col = t.col_offset;
+  const uint16_t* colors = lut.entries;
+
+  if (img.bits_per_pixel == 8) {
+    const uint8_t* src = img.pixels + base;
+    for (uint16_t x = 0; x < t.dst_w; x++) {
+      out[x] = colors[src[col[x]]];
+    }
+    return;
+  }
+
+  // 4bit: offsets count pixels, two per byte, high nibble first
+  for (uint16_t x = 0; x < t.dst_w; x++) {
+    uint32_t off = base + col[x];
+    uint8_t b = img.pixels[off >> 1];
+    out[x] = colors[(off & 1) ? (b & 0x0F) : (b >> 4)];
+  }
+}
+
+
+// Shared band loop of both draw functions
+static void draw_bands(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const blit_transform& t,
+                       const blit_source& src)
+{
+  if (x < 0 || y < 0 || x + t.dst_w > lcd.width() || y + t.dst_h > lcd.height()) return;
+
+  const uint16_t lines_per_band = BLIT_BAND_PIXELS / t.dst_w;
+
+  lcd.startWrite();
+  lcd.setAddrWindow(x, y, t.dst_w, t.dst_h);
+  for (uint16_t line = 0; line < t.dst_h; line += lines_per_band) {
+    uint16_t lines = min<uint16_t>(lines_per_band, t.dst_h - line);
+    for (uint16_t i = 0; i < lines; i++) {
+      uint16_t* out = &band_buffer[i * t.dst_w];
+      if (src.rgb565) {
+        blit_row_rgb565(t, src.rgb565, line + i, out);
+      } else {
+        blit_row_indexed(t, *src.indexed, *src.lut, line + i, out);
+      }
+    }
+    lcd.writePixels(band_buffer, (uint32_t)lines * t.dst_w, true, true);
+  }
+  lcd.endWrite();
+}
+
+
+void blit_draw_rgb565(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const blit_transform& t,
+                      const uint16_t* data)
+{
+  blit_source src = { &t, data, NULL, NULL, x, y };
+  draw_bands(lcd, x, y, t, src);
+}
+
+
+void blit_draw_indexed(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const blit_transform& t,
+                       const indexed_image& img, const palette_lut& lut)
+{
+  blit_source src = { &t, NULL, &img, &lut, x, y };
+  draw_bands(lcd, x, y, t, src);
+}
+
+
+void blit_source_row(void* user, int16_t y, uint16_t* out, uint16_t width)
+{
+  const blit_source* src = (const blit_source*)user;
+  const blit_transform& t = *src->t;
+
+  int16_t line = y - src->y;
+  if (line < 0 || line >= t.dst_h || src->x < 0 || src->x + t.dst_w > width) {
+    memset(out, 0, width * sizeof(uint16_t));
+    return;
+  }
+  memset(out, 0, src->x * sizeof(uint16_t));
+  if (src->rgb565) {
+    blit_row_rgb565(t, src->rgb565, line, out + src->x);
+  } else {
+    blit_row_indexed(t, *src->indexed, *src->lut, line, out + src->x);
+  }
+  uint16_t right = src->x + t.dst_w;
+  memset(out + right, 0, (width - right) * sizeof(uint16_t));
+}
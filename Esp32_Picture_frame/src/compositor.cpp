@@ -0,0 +1,378 @@
+#include "compositor.h"
+
+// The classic 5x7 font of Adafruit GFX, 5 bytes per character, one byte per
+// column, bit 0 is the top row. The table is static inside the library, so it
+// is included here.
+#include <glcdfont.c>
+
+#define FONT_CELL_W 6   // 5 columns + 1 column space
+#define FONT_CELL_H 8
+
+static uint16_t band_buffer[COMPOSITOR_BAND_PIXELS];
+
+
+static inline uint16_t swap_bytes(uint16_t c)
+{
+  return (c >> 8) | (c << 8);
+}
+
+
+// Blend two RGB565 colours, alpha 0..32. All three channels are spread over
+// a 32bit word (green in the upper half) and blended with one multiply.
+static inline uint16_t blend565(uint16_t bg, uint16_t fg, uint8_t alpha)
+{
+  uint32_t b = (bg | ((uint32_t)bg << 16)) & 0x07E0F81F;
+  uint32_t f = (fg | ((uint32_t)fg << 16)) & 0x07E0F81F;
+  uint32_t r = ((((f - b) * alpha) >> 5) + b) & 0x07E0F81F;
+  return (uint16_t)(r | (r >> 16));
+}
+
+
+static void mark_dirty(compositor& comp, int16_t top, int16_t bottom)
+{
+  if (bottom < top) return;
+  if (comp.dirty_top < 0 || top < comp.dirty_top) comp.dirty_top = top;
+  if (bottom > comp.dirty_bottom) comp.dirty_bottom = bottom;
+}
+
+
+static void mark_layer_dirty(compositor& comp, const overlay_layer& l)
+{
+  if (l.type != LAYER_NONE && l.visible) mark_dirty(comp, l.y, l.y + l.h - 1);
+}
+
+
+static overlay_layer* get_layer(compositor& comp, int8_t id)
+{
+  if (id < 0 || id >= COMPOSITOR_MAX_LAYERS) return NULL;
+  if (comp.layers[id].type == LAYER_NONE) return NULL;
+  return &comp.layers[id];
+}
+
+
+static int8_t new_layer(compositor& comp)
+{
+  for (int8_t i = 0; i < COMPOSITOR_MAX_LAYERS; i++) {
+    if (comp.layers[i].type == LAYER_NONE) return i;
+  }
+  return -1;
+}
+
+
+static void set_layer_text(overlay_layer& l, const char* text)
+{
+  strncpy(l.text, text, COMPOSITOR_MAX_TEXT);
+  l.text[COMPOSITOR_MAX_TEXT] = 0;
+  l.w = strlen(l.text) * FONT_CELL_W * l.scale;
+  l.h = FONT_CELL_H * l.scale;
+}
+
+
+void compositor_clear(compositor& comp)
+{
+  memset(comp.layers, 0, sizeof(comp.layers));
+  comp.dirty_top = -1;
+  comp.dirty_bottom = -1;
+}
+
+
+int8_t compositor_add_rect(compositor& comp, int16_t x, int16_t y, int16_t w, int16_t h,
+                           uint16_t color, uint8_t alpha)
+{
+  int8_t id = new_layer(comp);
+  if (id < 0) return -1;
+  overlay_layer& l = comp.layers[id];
+  l.type = LAYER_RECT;
+  l.visible = true;
+  l.x = x;
+  l.y = y;
+  l.w = w;
+  l.h = h;
+  l.color = color;
+  l.alpha = alpha;
+  mark_layer_dirty(comp, l);
+  return id;
+}
+
+
+int8_t compositor_add_text(compositor& comp, int16_t x, int16_t y, uint8_t scale,
+                           uint16_t color, uint8_t alpha, const char* text)
+{
+  int8_t id = new_layer(comp);
+  if (id < 0) return -1;
+  overlay_layer& l = comp.layers[id];
+  l.type = LAYER_TEXT;
+  l.visible = true;
+  l.x = x;
+  l.y = y;
+  l.scale = scale ? scale : 1;
+  l.color = color;
+  l.alpha = alpha;
+  set_layer_text(l, text);
+  mark_layer_dirty(comp, l);
+  return id;
+}
+
+
+void compositor_set_text(compositor& comp, int8_t id, const char* text)
+{
+  overlay_layer* l = get_layer(comp, id);
+  if (!l || l->type != LAYER_TEXT || strncmp(l->text, text, COMPOSITOR_MAX_TEXT) == 0) return;
+  mark_layer_dirty(comp, *l);
+  set_layer_text(*l, text);
+  mark_layer_dirty(comp, *l);
+}
+
+
+void compositor_set_color(compositor& comp, int8_t id, uint16_t color, uint8_t alpha)
+{
+  overlay_layer* l = get_layer(comp, id);
+  if (!l) return;
+  l->color = color;
+  l->alpha = alpha;
+  mark_layer_dirty(comp, *l);
+}
+
+
+void compositor_move(compositor& comp, int8_t id, int16_t x, int16_t y)
+{
+  overlay_layer* l = get_layer(comp, id);
+  if (!l) return;
+  mark_layer_dirty(comp, *l);
+  l->x = x;
+  l->y = y;
+  mark_layer_dirty(comp, *l);
+}
+
+
+void compositor_set_visible(compositor& comp, int8_t id, bool visible)
+{
+  overlay_layer* l = get_layer(comp, id);
+  if (!l || l->visible == visible) return;
+  l->visible = visible;
+  mark_dirty(comp, l->y, l->y + l->h - 1);
+}
+
+
+// ---------------------------------------------------------------------------
+// Blending
+
+static void blend_rect(const overlay_layer& l, uint16_t* row, int16_t x0, int16_t x1)
+{
+  uint8_t a = (l.alpha + 1) >> 3;
+  if (a >= 32) {
+    uint16_t c = swap_bytes(l.color);
+    for (int16_t x = x0; x < x1; x++) row[x] = c;
+    return;
+  }
+  for (int16_t x = x0; x < x1; x++) {
+    row[x] = swap_bytes(blend565(swap_bytes(row[x]), l.color, a));
+  }
+}
+
+
+// Pixel of the text as a 1bit bitmap of strlen * 6 x 8 font pixels
+static inline uint8_t text_bit(const char* text, int len, int px, int py)
+{
+  if (px < 0 || py < 0 || py >= FONT_CELL_H || px >= len * FONT_CELL_W) return 0;
+  int col = px % FONT_CELL_W;
+  if (col >= 5) return 0;
+  uint8_t c = text[px / FONT_CELL_W];
+  return (pgm_read_byte(&font[c * 5 + col]) >> py) & 1;
+}
+
+
+// Text is scaled up by bilinear filtering of the font bitmap followed by a
+// steep ramp around 50% coverage. That gives smooth, anti-aliased edges
+// about one screen pixel wide at any scale without storing a bigger font.
+static void blend_text(const overlay_layer& l, int16_t y, uint16_t* row, int16_t x0, int16_t x1)
+{
+  const int len = strlen(l.text);
+  const int s = l.scale;
+  uint16_t color = l.color;
+  uint16_t layer_alpha = l.alpha + 1;
+
+  // position of this line in the font bitmap, 8.8 fixed point, pixel centres
+  int v = (((y - l.y) * 2 + 1) * 256) / (2 * s) - 128;
+  int iy = v >> 8;
+  int fy = v & 0xFF;
+
+  // vertical interpolation for every font column once per line
+  int16_t col_cov[COMPOSITOR_MAX_TEXT * FONT_CELL_W + 2];
+  for (int px = -1; px <= len * FONT_CELL_W; px++) {
+    int top = text_bit(l.text, len, px, iy);
+    int bottom = text_bit(l.text, len, px, iy + 1);
+    col_cov[px + 1] = top * (256 - fy) + bottom * fy;
+  }
+
+  for (int16_t x = x0; x < x1; x++) {
+    int cov;
+    if (s == 1) {
+      cov = col_cov[(x - l.x) + 1] ? 256 : 0;
+    } else {
+      int u = (((x - l.x) * 2 + 1) * 256) / (2 * s) - 128;
+      int ix = u >> 8;
+      int fx = u & 0xFF;
+      int c = (col_cov[ix + 1] * (256 - fx) + col_cov[ix + 2] * fx) >> 8;
+      // sharpen: edge width one screen pixel instead of one font pixel
+      cov = (c - 128) * s + 128;
+      if (cov <= 0) continue;
+      if (cov > 256) cov = 256;
+    }
+    if (cov == 0) continue;
+    uint8_t a = (cov * layer_alpha) >> 11;
+    if (a >= 32) {
+      row[x] = swap_bytes(color);
+    } else if (a) {
+      row[x] = swap_bytes(blend565(swap_bytes(row[x]), color, a));
+    }
+  }
+}
+
+
+void compositor_blend_row(const compositor& comp, int16_t y, uint16_t* row, uint16_t width)
+{
+  for (int i = 0; i < COMPOSITOR_MAX_LAYERS; i++) {
+    const overlay_layer& l = comp.layers[i];
+    if (l.type == LAYER_NONE || !l.visible) continue;
+    if (y < l.y || y >= l.y + l.h) continue;
+
+    int16_t x0 = max<int16_t>(l.x, 0);
+    int16_t x1 = min<int16_t>(l.x + l.w, width);
+    if (x0 >= x1) continue;
+
+    if (l.type == LAYER_RECT) {
+      blend_rect(l, row, x0, x1);
+    } else {
+      blend_text(l, y, row, x0, x1);
+    }
+  }
+}
+
+
+void compositor_mix_row(uint16_t* row, const uint16_t* other, uint16_t width, uint8_t alpha)
+{
+  uint8_t a = (alpha + 1) >> 3;
+  if (a == 0) return;
+  if (a >= 32) {
+    memcpy(row, other, width * sizeof(uint16_t));
+    return;
+  }
+  for (uint16_t x = 0; x < width; x++) {
+    row[x] = swap_bytes(blend565(swap_bytes(row[x]), swap_bytes(other[x]), a));
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Background sources
+
+void rgb565_row(void* user, int16_t y, uint16_t* out, uint16_t width)
+{
+  const rgb565_source* src = (const rgb565_source*)user;
+  if (y >= src->height) {
+    memset(out, 0, width * sizeof(uint16_t));
+    return;
+  }
+  const uint16_t* in = src->data + (uint32_t)y * src->width;
+  uint16_t n = min<uint16_t>(width, src->width);
+  for (uint16_t x = 0; x < n; x++) out[x] = swap_bytes(in[x]);
+  for (uint16_t x = n; x < width; x++) out[x] = 0;
+}
+
+
+void indexed_row(void* user, int16_t y, uint16_t* out, uint16_t width)
+{
+  const indexed_image* img = (const indexed_image*)user;
+  static palette_lut lut;
+  static const uint16_t* lut_palette = NULL;
+  if (lut_palette != img->palette) {
+    build_palette_lut(lut, img->palette, img->palette_size);
+    lut_palette = img->palette;
+  }
+  if (y >= img->height) {
+    memset(out, 0, width * sizeof(uint16_t));
+    return;
+  }
+  uint16_t n = min<uint16_t>(width, img->width);
+  expand_indexed_row(*img, y, 0, n, lut, out);
+  for (uint16_t x = n; x < width; x++) out[x] = 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Drawing
+
+void compositor_draw(Adafruit_SPITFT& lcd, compositor& comp, scanline_source_cb source, void* user,
+                     bool full)
+{
+  int16_t top = 0;
+  int16_t bottom = lcd.height() - 1;
+  if (!full) {
+    if (comp.dirty_top < 0) return;
+    top = max<int16_t>(comp.dirty_top, 0);
+    bottom = min<int16_t>(comp.dirty_bottom, bottom);
+  }
+  comp.dirty_top = -1;
+  comp.dirty_bottom = -1;
+  if (top > bottom) return;
+
+  const uint16_t width = lcd.width();
+  const int16_t lines_per_band = COMPOSITOR_BAND_PIXELS / width;
+
+  lcd.startWrite();
+  lcd.setAddrWindow(0, top, width, bottom - top + 1);
+  for (int16_t y = top; y <= bottom; y += lines_per_band) {
+    int16_t lines = min<int16_t>(lines_per_band, bottom - y + 1);
+    for (int16_t i = 0; i < lines; i++) {
+      uint16_t* row = &band_buffer[i * width];
+      source(user, y + i, row, width);
+      compositor_blend_row(comp, y + i, row, width);
+    }
+    lcd.writePixels(band_buffer, (uint32_t)lines * width, true, true);
+  }
+  lcd.endWrite();
+}
+
+
+struct jpeg_compose_target {
+  Adafruit_SPITFT* lcd;
+  compositor* comp;
+  int16_t top;
+  int16_t bottom;
+};
+
+
+static bool compose_jpeg_band(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                              uint16_t* pixels)
+{
+  jpeg_compose_target* t = (jpeg_compose_target*)user;
+  int16_t first = max<int16_t>(y, t->top);
+  int16_t last = min<int16_t>(y + h - 1, t->bottom);
+  if (first > last) return true; // nothing to redraw in this band
+  jpeg_clip clip;
+  if (!jpeg_clip_band(x, first, w, last - first + 1, t->lcd->width(), t->lcd->height(), clip)) return true;
+
+  // only the part on the screen is blended, the LCD gets the same clip
+  uint16_t* start = pixels + (first - y) * w;
+  for (uint16_t i = 0; i < clip.h; i++) {
+    compositor_blend_row(*t->comp, clip.y + i, start + i * w, clip.w);
+  }
+  jpeg_write_band(*t->lcd, x, first, w, last - first + 1, start);
+  return true;
+}
+
+
+jpeg_result compositor_draw_jpeg(Adafruit_SPITFT& lcd, compositor& comp, jpeg_read_cb read,
+                                 void* user, bool full)
+{
+  jpeg_compose_target target = { &lcd, &comp, 0, (int16_t)(lcd.height() - 1) };
+  if (!full) {
+    if (comp.dirty_top < 0) return JPEG_OK;
+    target.top = comp.dirty_top;
+    target.bottom = comp.dirty_bottom;
+  }
+  comp.dirty_top = -1;
+  comp.dirty_bottom = -1;
+  return jpeg_decode_stream(read, user, 1, compose_jpeg_band, &target);
+}
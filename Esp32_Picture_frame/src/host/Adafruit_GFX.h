@@ -0,0 +1,91 @@
+#pragma once
+
+// Emulated display for the host build (env:native).
+//
+// Implements the part of the Adafruit GFX / SPITFT interface the picture
+// frame uses, but instead of talking to a LCD the pixels go into an emulated
+// panel memory that can be written to a PPM or PNG file.
+//
+// Every call also counts the SPI traffic the real driver would produce:
+// transactions (CS low .. CS high), command bytes and total bytes. With
+// bus_time_us() this gives the transfer time at the SPI clock of the device,
+// so different rendering strategies can be compared on the PC.
+
+#include "Arduino.h"
+
+class Adafruit_GFX {
+public:
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+  uint8_t getRotation() const { return rotation; }
+
+protected:
+  int16_t _width = 0;   // size with the current rotation
+  int16_t _height = 0;
+  uint8_t rotation = 0;
+};
+
+// SPI traffic as the real driver would send it
+struct emu_stats {
+  uint32_t transactions;  // startWrite() .. endWrite() at the outermost level
+  uint32_t commands;      // command bytes (CASET, RASET, RAMWR, MADCTL ...)
+  uint64_t bytes;         // all bytes incl. commands and parameters
+  uint64_t pixels;        // pixels written to the panel memory
+};
+
+class Adafruit_SPITFT : public Adafruit_GFX {
+public:
+  Adafruit_SPITFT(int8_t cs, int8_t dc, int8_t rst);
+  ~Adafruit_SPITFT();
+
+  // Adafruit interface
+  void setRotation(uint8_t r);
+  void startWrite();
+  void endWrite();
+  void setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+  void writePixels(uint16_t* colors, uint32_t len, bool block = true, bool bigEndian = false);
+  void writeColor(uint16_t color, uint32_t len);
+  void drawPixel(int16_t x, int16_t y, uint16_t color);
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  void fillScreen(uint16_t color);
+  void drawRGBBitmap(int16_t x, int16_t y, const uint16_t* bitmap, int16_t w, int16_t h);
+  void dmaWait() {}
+
+  // Emulator
+  uint16_t panel_width() const { return panel_w; }
+  uint16_t panel_height() const { return panel_h; }
+  uint16_t get_pixel(int16_t x, int16_t y) const;     // RGB565, current rotation
+
+  const emu_stats& stats() const { return traffic; }
+  void reset_stats();
+  uint32_t bus_time_us() const;                          // bytes at spi_hz
+  void print_stats(const char* label) const;
+  uint32_t spi_hz = 40000000;                            // SPI clock of the ESP32 driver
+
+  // Panel content as the sketch drew it, i.e. with the current rotation
+  // applied (how the viewer sees the mounted LCD)
+  bool save_ppm(const char* path) const;
+  bool save_png(const char* path) const;
+  // Number of pixels that differ from a PPM written by save_ppm(), -1 on error
+  long compare_ppm(const char* path) const;
+
+protected:
+  void begin_panel(uint16_t w, uint16_t h);
+
+private:
+  void put_logical(int16_t x, int16_t y, uint16_t color);
+  void write_next(uint16_t color);
+  uint32_t panel_index(int16_t x, int16_t y) const;
+  void rgb_at(int16_t x, int16_t y, uint8_t rgb[3]) const;
+
+  uint16_t* panel = nullptr;
+  uint16_t panel_w = 0;
+  uint16_t panel_h = 0;
+
+  // address window (logical coordinates) and write position
+  uint16_t win_x = 0, win_y = 0, win_w = 0, win_h = 0;
+  uint32_t win_pos = 0;
+  uint8_t write_depth = 0;
+
+  emu_stats traffic = {};
+};
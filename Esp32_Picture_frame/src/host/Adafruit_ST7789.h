@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build: the ST7789 is emulated, see Adafruit_GFX.h in this folder
+#include "Adafruit_GFX.h"
+
+#define ST77XX_BLACK 0x0000
+#define ST77XX_WHITE 0xFFFF
+#define ST77XX_RED 0xF800
+#define ST77XX_GREEN 0x07E0
+#define ST77XX_BLUE 0x001F
+
+class Adafruit_ST7789 : public Adafruit_SPITFT {
+public:
+  Adafruit_ST7789(int8_t cs, int8_t dc, int8_t rst) : Adafruit_SPITFT(cs, dc, rst) {}
+  void init(uint16_t width, uint16_t height) { begin_panel(width, height); }
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+// Minimal stand-in for the Arduino core for the host build (env:native).
+// Only what the picture frame modules need, the sketch itself (main.cpp with
+// WiFi) is not part of the host build.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
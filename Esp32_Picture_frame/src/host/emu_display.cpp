@@ -0,0 +1,401 @@
+#include "Adafruit_GFX.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+// Bytes the ST77xx driver sends for one setAddrWindow():
+// CASET + 4 bytes, RASET + 4 bytes, RAMWR
+#define ADDR_WINDOW_BYTES 11
+#define ADDR_WINDOW_COMMANDS 3
+
+
+// ---------------------------------------------------------------------------
+// Arduino core stand-ins
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start_time).count();
+}
+
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start_time).count();
+}
+
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+
+// ---------------------------------------------------------------------------
+// Panel
+
+Adafruit_SPITFT::Adafruit_SPITFT(int8_t, int8_t, int8_t)
+{
+}
+
+
+Adafruit_SPITFT::~Adafruit_SPITFT()
+{
+  free(panel);
+}
+
+
+void Adafruit_SPITFT::begin_panel(uint16_t w, uint16_t h)
+{
+  free(panel);
+  panel_w = w;
+  panel_h = h;
+  panel = (uint16_t*)calloc((size_t)w * h, sizeof(uint16_t));
+  _width = w;
+  _height = h;
+  rotation = 0;
+  reset_stats(); // init sequence is not of interest
+}
+
+
+void Adafruit_SPITFT::setRotation(uint8_t r)
+{
+  rotation = r & 3;
+  _width = (rotation & 1) ? panel_h : panel_w;
+  _height = (rotation & 1) ? panel_w : panel_h;
+  // MADCTL + 1 parameter in its own transaction
+  traffic.transactions++;
+  traffic.commands++;
+  traffic.bytes += 2;
+}
+
+
+void Adafruit_SPITFT::startWrite()
+{
+  if (write_depth++ == 0) traffic.transactions++;
+}
+
+
+void Adafruit_SPITFT::endWrite()
+{
+  if (write_depth) write_depth--;
+}
+
+
+void Adafruit_SPITFT::setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  win_x = x;
+  win_y = y;
+  win_w = w;
+  win_h = h;
+  win_pos = 0;
+  traffic.commands += ADDR_WINDOW_COMMANDS;
+  traffic.bytes += ADDR_WINDOW_BYTES;
+}
+
+
+// Logical (rotated) coordinates to the index in the panel memory
+uint32_t Adafruit_SPITFT::panel_index(int16_t x, int16_t y) const
+{
+  int px, py;
+  switch (rotation) {
+    case 1:  px = panel_w - 1 - y; py = x; break;
+    case 2:  px = panel_w - 1 - x; py = panel_h - 1 - y; break;
+    case 3:  px = y; py = panel_h - 1 - x; break;
+    default: px = x; py = y; break;
+  }
+  return (uint32_t)py * panel_w + px;
+}
+
+
+void Adafruit_SPITFT::put_logical(int16_t x, int16_t y, uint16_t color)
+{
+  if (x < 0 || y < 0 || x >= _width || y >= _height) return;
+  panel[panel_index(x, y)] = color;
+}
+
+
+// Like the controller, pixels fill the window line by line and wrap around
+void Adafruit_SPITFT::write_next(uint16_t color)
+{
+  if (win_w == 0 || win_h == 0) return;
+  uint32_t pos = win_pos % ((uint32_t)win_w * win_h);
+  put_logical(win_x + pos % win_w, win_y + pos / win_w, color);
+  win_pos++;
+  traffic.pixels++;
+}
+
+
+void Adafruit_SPITFT::writePixels(uint16_t* colors, uint32_t len, bool, bool bigEndian)
+{
+  for (uint32_t i = 0; i < len; i++) {
+    uint16_t c = colors[i];
+    write_next(bigEndian ? (uint16_t)((c >> 8) | (c << 8)) : c);
+  }
+  traffic.bytes += len * 2;
+}
+
+
+void Adafruit_SPITFT::writeColor(uint16_t color, uint32_t len)
+{
+  for (uint32_t i = 0; i < len; i++) write_next(color);
+  traffic.bytes += len * 2;
+}
+
+
+void Adafruit_SPITFT::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+  if (x < 0 || y < 0 || x >= _width || y >= _height) return;
+  startWrite();
+  setAddrWindow(x, y, 1, 1);
+  writeColor(color, 1);
+  endWrite();
+}
+
+
+void Adafruit_SPITFT::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+  if (x < 0) { w += x; x = 0; }
+  if (y < 0) { h += y; y = 0; }
+  if (x + w > _width) w = _width - x;
+  if (y + h > _height) h = _height - y;
+  if (w <= 0 || h <= 0) return;
+  startWrite();
+  setAddrWindow(x, y, w, h);
+  writeColor(color, (uint32_t)w * h);
+  endWrite();
+}
+
+
+void Adafruit_SPITFT::fillScreen(uint16_t color)
+{
+  fillRect(0, 0, _width, _height, color);
+}
+
+
+// Same clipping and transfer pattern as Adafruit_SPITFT::drawRGBBitmap()
+void Adafruit_SPITFT::drawRGBBitmap(int16_t x, int16_t y, const uint16_t* bitmap, int16_t w, int16_t h)
+{
+  int16_t x2, y2;
+  if ((x >= _width) || (y >= _height) || ((x2 = (x + w - 1)) < 0) || ((y2 = (y + h - 1)) < 0))
+    return;
+
+  int16_t bx1 = 0, by1 = 0, save_w = w;
+  if (x < 0) { w += x; bx1 = -x; x = 0; }
+  if (y < 0) { h += y; by1 = -y; y = 0; }
+  if (x2 >= _width) w = _width - x;
+  if (y2 >= _height) h = _height - y;
+
+  const uint16_t* p = bitmap + by1 * save_w + bx1;
+  startWrite();
+  setAddrWindow(x, y, w, h);
+  while (h--) {
+    writePixels((uint16_t*)p, w, true, false);
+    p += save_w;
+  }
+  endWrite();
+}
+
+
+// ---------------------------------------------------------------------------
+// Statistics
+
+void Adafruit_SPITFT::reset_stats()
+{
+  traffic = {};
+}
+
+
+uint32_t Adafruit_SPITFT::bus_time_us() const
+{
+  return (uint32_t)(traffic.bytes * 8 * 1000000ULL / spi_hz);
+}
+
+
+void Adafruit_SPITFT::print_stats(const char* label) const
+{
+  printf("%-24s %8u transactions %8u commands %10llu bytes %10llu pixels %8.2f ms bus time\n",
+         label, (unsigned)traffic.transactions, (unsigned)traffic.commands,
+         (unsigned long long)traffic.bytes, (unsigned long long)traffic.pixels,
+         bus_time_us() / 1000.0);
+}
+
+
+// ---------------------------------------------------------------------------
+// Image files
+
+uint16_t Adafruit_SPITFT::get_pixel(int16_t x, int16_t y) const
+{
+  if (x < 0 || y < 0 || x >= _width || y >= _height) return 0;
+  return panel[panel_index(x, y)];
+}
+
+
+// RGB565 to 8bit per channel, the low bits repeat the high bits like most
+// LCDs do, so white stays 255
+void Adafruit_SPITFT::rgb_at(int16_t x, int16_t y, uint8_t rgb[3]) const
+{
+  uint16_t c = get_pixel(x, y);
+  uint8_t r = c >> 11;
+  uint8_t g = (c >> 5) & 0x3F;
+  uint8_t b = c & 0x1F;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+bool Adafruit_SPITFT::save_ppm(const char* path) const
+{
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  fprintf(f, "P6\n%d %d\n255\n", _width, _height);
+  for (int16_t y = 0; y < _height; y++) {
+    for (int16_t x = 0; x < _width; x++) {
+      uint8_t rgb[3];
+      rgb_at(x, y, rgb);
+      fwrite(rgb, 1, 3, f);
+    }
+  }
+  return fclose(f) == 0;
+}
+
+
+long Adafruit_SPITFT::compare_ppm(const char* path) const
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return -1;
+  unsigned w, h, maxval;
+  if (fscanf(f, "P6 %u %u %u", &w, &h, &maxval) != 3 || (int)w != _width || (int)h != _height) {
+    fclose(f);
+    return -1;
+  }
+  fgetc(f); // single whitespace after the header
+
+  long diff = 0;
+  for (int16_t y = 0; y < _height; y++) {
+    for (int16_t x = 0; x < _width; x++) {
+      uint8_t expected[3], actual[3];
+      if (fread(expected, 1, 3, f) != 3) {
+        fclose(f);
+        return -1;
+      }
+      rgb_at(x, y, actual);
+      if (memcmp(expected, actual, 3) != 0) diff++;
+    }
+  }
+  fclose(f);
+  return diff;
+}
+
+
+// PNG without compression (zlib "stored" blocks), needs no zlib on the PC
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len)
+{
+  if (!crc_table[1]) {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      crc_table[n] = c;
+    }
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+
+static void write_chunk(FILE* f, const char* type, const uint8_t* data, uint32_t len)
+{
+  uint8_t head[8];
+  put_be32(head, len);
+  memcpy(head + 4, type, 4);
+  fwrite(head, 1, 8, f);
+  if (len) fwrite(data, 1, len, f);
+  uint32_t crc = crc32(crc32(0, (const uint8_t*)type, 4), data, len);
+  uint8_t tail[4];
+  put_be32(tail, crc);
+  fwrite(tail, 1, 4, f);
+}
+
+
+bool Adafruit_SPITFT::save_png(const char* path) const
+{
+  // raw scanlines: filter byte 0 + RGB
+  size_t row_bytes = 1 + (size_t)_width * 3;
+  size_t raw_len = row_bytes * _height;
+  uint8_t* raw = (uint8_t*)malloc(raw_len);
+  if (!raw) return false;
+  for (int16_t y = 0; y < _height; y++) {
+    uint8_t* row = raw + y * row_bytes;
+    row[0] = 0;
+    for (int16_t x = 0; x < _width; x++) rgb_at(x, y, row + 1 + x * 3);
+  }
+
+  // zlib stream of stored blocks of at most 65535 bytes
+  size_t blocks = (raw_len + 65534) / 65535;
+  size_t z_len = 2 + raw_len + blocks * 5 + 4;
+  uint8_t* z = (uint8_t*)malloc(z_len);
+  if (!z) {
+    free(raw);
+    return false;
+  }
+  uint8_t* p = z;
+  *p++ = 0x78;
+  *p++ = 0x01;
+  uint32_t a = 1, b = 0;
+  for (size_t pos = 0; pos < raw_len; ) {
+    uint16_t n = (raw_len - pos > 65535) ? 65535 : (uint16_t)(raw_len - pos);
+    *p++ = (pos + n == raw_len) ? 1 : 0;
+    *p++ = n & 0xFF;
+    *p++ = n >> 8;
+    *p++ = ~n & 0xFF;
+    *p++ = (~n >> 8) & 0xFF;
+    memcpy(p, raw + pos, n);
+    for (uint16_t i = 0; i < n; i++) {
+      a = (a + raw[pos + i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    p += n;
+    pos += n;
+  }
+  put_be32(p, (b << 16) | a);
+
+  FILE* f = fopen(path, "wb");
+  bool ok = (f != NULL);
+  if (ok) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, 8, f);
+    uint8_t ihdr[13];
+    put_be32(ihdr, _width);
+    put_be32(ihdr + 4, _height);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // RGB
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // no interlace
+    write_chunk(f, "IHDR", ihdr, 13);
+    write_chunk(f, "IDAT", z, z_len);
+    write_chunk(f, "IEND", NULL, 0);
+    ok = (fclose(f) == 0);
+  }
+  free(z);
+  free(raw);
+  return ok;
+}
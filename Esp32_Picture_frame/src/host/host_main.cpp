@@ -0,0 +1,233 @@
+// Host build of the picture frame (pio run -e native).
+//
+// Renders a picture through the same modules the device uses into the
+// emulated ST7789, writes every step as image file and prints the SPI traffic
+// each rendering strategy would cause on the real bus.
+//
+//   .pio/build/native/program photo.jpg [output prefix] [reference.ppm]
+//
+// With a reference PPM the final frame is compared pixel by pixel, the exit
+// code is the number of differing pixels (0 = identical). Without one it is 1
+// when the LCD after the JPEG steps does not show the decoded picture, the
+// top left part of it for a picture larger than the screen.
+
+#include <stdio.h>
+#include <vector>
+
+#include "Adafruit_ST7789.h"
+#include "blit_transform.h"
+#include "compositor.h"
+#include "jpeg_decoder.h"
+#include "tile_cache.h"
+
+#define LCD_WIDTH  170
+#define LCD_HEIGHT 320
+
+static Adafruit_ST7789 lcd = Adafruit_ST7789(15, 2, 4);
+
+
+static bool load_file(const char* path, std::vector<uint8_t>& data)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  int c;
+  while ((c = fgetc(f)) != EOF) data.push_back((uint8_t)c);
+  fclose(f);
+  return true;
+}
+
+
+// Band writer as used on the device (jpeg_draw)
+static bool band_to_lcd(void*, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t* pixels)
+{
+  jpeg_write_band(lcd, x, y, w, h, pixels);
+  return true;
+}
+
+
+// Collects the decoded picture in a full framebuffer (for the comparison only)
+static bool band_to_buffer(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t* pixels)
+{
+  std::vector<uint16_t>& fb = *(std::vector<uint16_t>*)user;
+  for (uint16_t j = 0; j < h; j++) {
+    for (uint16_t i = 0; i < w; i++) {
+      if (x + i < LCD_WIDTH && y + j < LCD_HEIGHT) {
+        uint16_t c = pixels[j * w + i];
+        fb[(y + j) * LCD_WIDTH + x + i] = (c >> 8) | (c << 8);
+      }
+    }
+  }
+  return true;
+}
+
+
+// Pixels of the LCD outside of the lines skip_top..skip_bottom that are not
+// the decoded picture, a picture larger than the screen must show its top
+// left part
+static long differ_from(const std::vector<uint16_t>& fb, int16_t skip_top = -1, int16_t skip_bottom = -1)
+{
+  long diff = 0;
+  for (int16_t y = 0; y < LCD_HEIGHT; y++) {
+    if (y >= skip_top && y <= skip_bottom) continue;
+    for (int16_t x = 0; x < LCD_WIDTH; x++) diff += lcd.get_pixel(x, y) != fb[y * LCD_WIDTH + x];
+  }
+  return diff;
+}
+
+
+// Cross-fade source as in the render pipeline: two pictures pulled by line
+struct crossfade_source {
+  cached_jpeg_source* from;
+  cached_jpeg_source* to;
+  uint8_t alpha;
+};
+
+
+static void crossfade_row(void* user, int16_t y, uint16_t* out, uint16_t width)
+{
+  static uint16_t other[LCD_WIDTH];
+  crossfade_source* c = (crossfade_source*)user;
+  cached_jpeg_row(c->from, y, out, width);
+  cached_jpeg_row(c->to, y, other, width);
+  compositor_mix_row(out, other, width, c->alpha);
+}
+
+
+static void save(const char* prefix, const char* step)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "%s%s.png", prefix, step);
+  if (!lcd.save_png(path)) printf("could not write %s\n", path);
+}
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    printf("usage: %s picture.jpg [output prefix] [reference.ppm]\n", argv[0]);
+    return -1;
+  }
+  const char* prefix = (argc > 2) ? argv[2] : "frame_";
+
+  std::vector<uint8_t> jpeg;
+  if (!load_file(argv[1], jpeg)) {
+    printf("could not read %s\n", argv[1]);
+    return -1;
+  }
+
+  lcd.init(LCD_WIDTH, LCD_HEIGHT);
+  lcd.setRotation(2);
+  lcd.reset_stats();
+  lcd.fillScreen(ST77XX_BLACK);
+  lcd.print_stats("fillScreen");
+
+  // 1. picture decoded band by band straight to the LCD
+  lcd.reset_stats();
+  jpeg_memory_source src = { jpeg.data(), jpeg.size(), 0 };
+  unsigned long start = micros();
+  jpeg_result res = jpeg_decode_stream(jpeg_read_memory, &src, 1, band_to_lcd, NULL);
+  unsigned long decode_us = micros() - start;
+  if (res != JPEG_OK) {
+    printf("JPEG error %d\n", res);
+    return -1;
+  }
+  printf("JPEG %ux%u decoded in %lu us (host)\n", jpeg_last_width(), jpeg_last_height(), decode_us);
+  lcd.print_stats("jpeg bands");
+  save(prefix, "jpeg");
+
+  // 2. the same picture from a full framebuffer, as drawRGBBitmap() does it
+  std::vector<uint16_t> fb(LCD_WIDTH * LCD_HEIGHT);
+  src.pos = 0;
+  jpeg_decode_stream(jpeg_read_memory, &src, 1, band_to_buffer, &fb);
+  long wrong = differ_from(fb);
+  printf("jpeg bands: %ld pixels differ from the decoded picture\n", wrong);
+  lcd.reset_stats();
+  lcd.drawRGBBitmap(0, 0, fb.data(), LCD_WIDTH, LCD_HEIGHT);
+  lcd.print_stats("drawRGBBitmap");
+
+  // 3. the same picture pixel by pixel, the worst case
+  lcd.reset_stats();
+  for (int16_t y = 0; y < LCD_HEIGHT; y++) {
+    for (int16_t x = 0; x < LCD_WIDTH; x++) lcd.drawPixel(x, y, fb[y * LCD_WIDTH + x]);
+  }
+  lcd.print_stats("drawPixel");
+
+  // 4. clock overlay, full frame and then only the changed lines
+  static compositor comp;
+  compositor_clear(comp);
+  compositor_add_rect(comp, 0, 270, LCD_WIDTH, 40, 0x0000, 128);
+  int8_t clock = compositor_add_text(comp, 25, 276, 4, 0xFFFF, 255, "12:00");
+
+  lcd.reset_stats();
+  src.pos = 0;
+  compositor_draw_jpeg(lcd, comp, jpeg_read_memory, &src, true);
+  lcd.print_stats("overlay full frame");
+  long overlay_wrong = differ_from(fb, 270, 309);
+  printf("overlay: %ld pixels outside of it differ from the decoded picture\n", overlay_wrong);
+  wrong += overlay_wrong;
+  save(prefix, "overlay");
+
+  compositor_set_text(comp, clock, "12:01");
+  lcd.reset_stats();
+  src.pos = 0;
+  compositor_draw_jpeg(lcd, comp, jpeg_read_memory, &src, false);
+  lcd.print_stats("overlay dirty lines");
+  save(prefix, "overlay_update");
+
+  // 5. the framebuffer as landscape picture, rotated back and shrunk to fit
+  static blit_transform t;
+  uint16_t w, h;
+  blit_fit(LCD_WIDTH, LCD_HEIGHT, BLIT_ROT_90, LCD_WIDTH, LCD_HEIGHT, false, w, h);
+  blit_setup(t, LCD_WIDTH, LCD_HEIGHT, w, h, BLIT_ROT_90, false, false);
+  lcd.fillScreen(ST77XX_BLACK);
+  lcd.reset_stats();
+  start = micros();
+  blit_draw_rgb565(lcd, 0, (LCD_HEIGHT - h) / 2, t, fb.data());
+  printf("blit %ux%u rotated in %lu us (host)\n", w, h, micros() - start);
+  lcd.print_stats("blit rotate 90");
+  save(prefix, "rotate");
+
+  // 6. slide show of the same JPEG through the tile cache with the budget of
+  // the esp32dev (no PSRAM): decoded only once if it fits, else once a frame
+  tile_cache_begin();
+  cached_jpeg_source slide = { 1, jpeg.data(), jpeg.size() };
+  compositor_clear(comp);
+  for (int i = 0; i < 3; i++) {
+    start = micros();
+    compositor_draw(lcd, comp, cached_jpeg_row, &slide, true);
+    const tile_cache_stats& cs = tile_cache_get_stats();
+    printf("cached slide %d: %lu us, hits %u, misses %u, saved %lu us, budget %u (host)\n", i,
+           micros() - start, cs.hits, cs.misses, (unsigned long)cs.saved_us, cs.budget);
+  }
+  save(prefix, "cached");
+  long cached_wrong = differ_from(fb);
+  printf("cached slide: %ld pixels differ from the decoded picture\n", cached_wrong);
+  wrong += cached_wrong;
+
+  // 7. cross-fade between it and a second copy, both pulled line by line
+  cached_jpeg_source copy = { 2, jpeg.data(), jpeg.size() };
+  crossfade_source fade = { &slide, &copy, 128 };
+  tile_cache_reset_stats();
+  start = micros();
+  compositor_draw(lcd, comp, crossfade_row, &fade, true);
+  const tile_cache_stats& cs = tile_cache_get_stats();
+  long fade_wrong = differ_from(fb);
+  printf("cross-fade frame: %lu us, hits %u, misses %u, %ld pixels differ (host)\n", micros() - start,
+         cs.hits, cs.misses, fade_wrong);
+  wrong += fade_wrong;
+
+  if (argc > 3) {
+    long diff = lcd.compare_ppm(argv[3]);
+    if (diff < 0) {
+      printf("could not read reference %s\n", argv[3]);
+      return -1;
+    }
+    printf("%ld pixels differ from %s\n", diff, argv[3]);
+    return diff > 255 ? 255 : (int)diff;
+  }
+
+  char path[256];
+  snprintf(path, sizeof(path), "%sfinal.ppm", prefix);
+  lcd.save_ppm(path);
+  return wrong ? 1 : 0;
+}
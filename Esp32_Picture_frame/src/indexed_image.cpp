@@ -0,0 +1,130 @@
+#include "indexed_image.h"
+
+// Line buffer for the expanded pixels, lives in internal RAM so the SPI
+// driver can send it by DMA
+static uint16_t line_buffer[INDEXED_LINE_PIXELS];
+
+
+uint16_t indexed_row_bytes(const indexed_image& img)
+{
+  if (img.bits_per_pixel == 4) {
+    return (img.width + 1) / 2;
+  }
+  return img.width;
+}
+
+
+void build_palette_lut(palette_lut& lut, const uint16_t* palette, uint16_t count)
+{
+  if (count > 256) count = 256;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t c = palette[i];
+    lut.entries[i] = (c >> 8) | (c << 8); // LCD expects the high byte first
+  }
+  // unused entries are black, so a broken index never shows garbage
+  for (uint16_t i = count; i < 256; i++) {
+    lut.entries[i] = 0;
+  }
+  lut.size = count;
+}
+
+
+void cycle_palette_lut(palette_lut& lut, uint8_t first, uint16_t count, int8_t step)
+{
+  if (first + count > 256) count = 256 - first;
+  if (count < 2) return;
+
+  int shift = step % count;
+  if (shift < 0) shift += count;
+  if (shift == 0) return;
+
+  uint16_t tmp[256];
+  for (uint16_t i = 0; i < count; i++) {
+    tmp[(i + shift) % count] = lut.entries[first + i];
+  }
+  memcpy(&lut.entries[first], tmp, count * sizeof(uint16_t));
+}
+
+
+void expand_indexed_row(const indexed_image& img, uint16_t row, uint16_t x0, uint16_t count,
+                        const palette_lut& lut, uint16_t* out)
+{
+  const uint8_t* src = img.pixels + (uint32_t)row * indexed_row_bytes(img);
+  const uint16_t* colors = lut.entries;
+
+  if (img.bits_per_pixel == 8) {
+    src += x0;
+    // unrolled by 4, the loop overhead is a large part of the cost otherwise
+    while (count >= 4) {
+      out[0] = colors[src[0]];
+      out[1] = colors[src[1]];
+      out[2] = colors[src[2]];
+      out[3] = colors[src[3]];
+      out += 4;
+      src += 4;
+      count -= 4;
+    }
+    while (count--) {
+      *out++ = colors[*src++];
+    }
+    return;
+  }
+
+  // 4bit: two pixels per byte, high nibble first
+  src += x0 / 2;
+  if ((x0 & 1) && count) {
+    *out++ = colors[*src++ & 0x0F];
+    count--;
+  }
+  while (count >= 2) {
+    uint8_t b = *src++;
+    out[0] = colors[b >> 4];
+    out[1] = colors[b & 0x0F];
+    out += 2;
+    count -= 2;
+  }
+  if (count) {
+    *out = colors[*src >> 4];
+  }
+}
+
+
+void draw_indexed_image(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const indexed_image& img)
+{
+  static palette_lut lut;
+  build_palette_lut(lut, img.palette, img.palette_size);
+  draw_indexed_image(lcd, x, y, img, lut);
+}
+
+
+void draw_indexed_image(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const indexed_image& img,
+                        const palette_lut& lut)
+{
+  // Clip the image against the screen like drawRGBBitmap() does
+  int16_t x0 = 0;
+  int16_t y0 = 0;
+  int16_t w = img.width;
+  int16_t h = img.height;
+  if (x < 0) { x0 = -x; w += x; x = 0; }
+  if (y < 0) { y0 = -y; h += y; y = 0; }
+  if (x + w > lcd.width()) w = lcd.width() - x;
+  if (y + h > lcd.height()) h = lcd.height() - y;
+  if (w <= 0 || h <= 0) return;
+
+  // Expand as many complete lines as fit into the line buffer, then send them
+  // in one transfer. The clipped width never exceeds the screen width, so at
+  // least one line always fits.
+  uint16_t lines_per_band = INDEXED_LINE_PIXELS / w;
+
+  lcd.startWrite();
+  lcd.setAddrWindow(x, y, w, h);
+  for (int16_t line = 0; line < h; line += lines_per_band) {
+    uint16_t lines = min<int16_t>(lines_per_band, h - line);
+    for (uint16_t i = 0; i < lines; i++) {
+      expand_indexed_row(img, y0 + line + i, x0, w, lut, &line_buffer[i * w]);
+    }
+    // buffer is already big-endian, no byte swap needed
+    lcd.writePixels(line_buffer, (uint32_t)lines * w, true, true);
+  }
+  lcd.endWrite();
+}
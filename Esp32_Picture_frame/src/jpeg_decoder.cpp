@@ -0,0 +1,792 @@
+#include "jpeg_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <Adafruit_GFX.h>
+
+// Position of the n-th coefficient in zigzag order within the 8x8 block
+static const uint8_t zigzag[64 + 16] = {
+   0,  1,  8, 16,  9,  2,  3, 10,
+  17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34,
+  27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36,
+  29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46,
+  53, 60, 61, 54, 47, 55, 62, 63,
+  // a corrupt run may step past the end, these entries catch it
+  63, 63, 63, 63, 63, 63, 63, 63,
+  63, 63, 63, 63, 63, 63, 63, 63
+};
+
+
+// ---------------------------------------------------------------------------
+// Input
+
+static uint8_t next_byte(jpeg_decoder& dec)
+{
+  if (dec.in_pos >= dec.in_len) {
+    if (dec.eof) return 0;
+    dec.in_len = dec.read(dec.user, dec.in_buf, JPEG_INPUT_BUFFER);
+    dec.in_pos = 0;
+    if (dec.in_len == 0) {
+      dec.eof = true;
+      return 0;
+    }
+  }
+  return dec.in_buf[dec.in_pos++];
+}
+
+
+static uint16_t next_word(jpeg_decoder& dec)
+{
+  uint16_t hi = next_byte(dec);
+  return (hi << 8) | next_byte(dec);
+}
+
+
+static void skip_bytes(jpeg_decoder& dec, uint16_t count)
+{
+  while (count-- && !dec.eof) next_byte(dec);
+}
+
+
+// ---------------------------------------------------------------------------
+// Header
+
+static bool build_huffman(jpeg_huffman& h, const uint8_t counts[16])
+{
+  // Canonical huffman codes: codes of one length are consecutive numbers,
+  // the first code of the next length is (last code + 1) << 1
+  memset(h.fast, 0, sizeof(h.fast));
+  int32_t code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; len++) {
+    h.delta[len] = k - code;
+    for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+      if (len <= JPEG_FAST_BITS) {
+        // every lookup index starting with this code maps to the symbol
+        int shift = JPEG_FAST_BITS - len;
+        int first = code << shift;
+        for (int j = 0; j < (1 << shift); j++) {
+          h.fast[first + j] = (len << 8) | h.symbols[k];
+        }
+      }
+    }
+    if (code > (1 << len)) return false; // more codes than fit into len bits
+    h.maxcode[len] = counts[len - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  h.maxcode[17] = 0x7FFFFFFF; // sentinel
+  return true;
+}
+
+
+static jpeg_result read_dqt(jpeg_decoder& dec, int length)
+{
+  while (length > 0) {
+    uint8_t pq_tq = next_byte(dec);
+    uint8_t pq = pq_tq >> 4;
+    uint8_t tq = pq_tq & 0x0F;
+    if (tq > 3) return JPEG_ERR_FORMAT;
+    for (int i = 0; i < 64; i++) {
+      dec.quant[tq][i] = pq ? next_word(dec) : next_byte(dec);
+    }
+    length -= 1 + (pq ? 128 : 64);
+  }
+  return dec.eof ? JPEG_ERR_READ : JPEG_OK;
+}
+
+
+static jpeg_result read_dht(jpeg_decoder& dec, int length)
+{
+  while (length > 0) {
+    uint8_t tc_th = next_byte(dec);
+    uint8_t tc = tc_th >> 4;
+    uint8_t th = tc_th & 0x0F;
+    if (tc > 1 || th > 1) return JPEG_ERR_FORMAT;
+
+    jpeg_huffman& h = dec.huff[tc * 2 + th];
+    uint8_t counts[16];
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+      counts[i] = next_byte(dec);
+      total += counts[i];
+    }
+    if (total > 256) return JPEG_ERR_FORMAT;
+    for (int i = 0; i < total; i++) {
+      h.symbols[i] = next_byte(dec);
+    }
+    if (!build_huffman(h, counts)) return JPEG_ERR_FORMAT;
+    length -= 17 + total;
+  }
+  return dec.eof ? JPEG_ERR_READ : JPEG_OK;
+}
+
+
+static jpeg_result read_sof(jpeg_decoder& dec)
+{
+  if (next_byte(dec) != 8) return JPEG_ERR_UNSUPPORTED; // 12bit precision
+  dec.height = next_word(dec);
+  dec.width = next_word(dec);
+  dec.components = next_byte(dec);
+  if (dec.width == 0 || dec.height == 0) return JPEG_ERR_UNSUPPORTED; // DNL marker
+  if (dec.components != 1 && dec.components != 3) return JPEG_ERR_UNSUPPORTED;
+
+  for (int i = 0; i < dec.components; i++) {
+    jpeg_component& c = dec.comp[i];
+    c.id = next_byte(dec);
+    uint8_t hv = next_byte(dec);
+    c.h = hv >> 4;
+    c.v = hv & 0x0F;
+    c.tq = next_byte(dec) & 0x03;
+  }
+
+  if (dec.components == 1) {
+    // a single component is never interleaved, one block per MCU
+    dec.comp[0].h = dec.comp[0].v = 1;
+  } else {
+    // luma 1x1, 2x1 or 2x2, chroma always 1x1
+    if (dec.comp[0].h < 1 || dec.comp[0].h > 2 || dec.comp[0].v < 1 || dec.comp[0].v > 2)
+      return JPEG_ERR_UNSUPPORTED;
+    for (int i = 1; i < 3; i++) {
+      if (dec.comp[i].h != 1 || dec.comp[i].v != 1) return JPEG_ERR_UNSUPPORTED;
+    }
+  }
+  return dec.eof ? JPEG_ERR_READ : JPEG_OK;
+}
+
+
+static jpeg_result read_sos(jpeg_decoder& dec)
+{
+  uint8_t count = next_byte(dec);
+  if (count != dec.components) return JPEG_ERR_UNSUPPORTED; // non-interleaved scans
+  for (int i = 0; i < count; i++) {
+    uint8_t id = next_byte(dec);
+    uint8_t tables = next_byte(dec);
+    int n = 0;
+    while (n < dec.components && dec.comp[n].id != id) n++;
+    if (n == dec.components) return JPEG_ERR_FORMAT;
+    dec.comp[n].td = (tables >> 4) & 0x01;
+    dec.comp[n].ta = tables & 0x01;
+  }
+  skip_bytes(dec, 3); // spectral selection and successive approximation
+  return dec.eof ? JPEG_ERR_READ : JPEG_OK;
+}
+
+
+jpeg_result jpeg_begin(jpeg_decoder& dec, jpeg_read_cb read, void* user)
+{
+  dec.read = read;
+  dec.user = user;
+  dec.in_pos = 0;
+  dec.in_len = 0;
+  dec.eof = false;
+  dec.width = 0;
+  dec.height = 0;
+  dec.components = 0;
+  dec.restart_interval = 0;
+
+  if (next_byte(dec) != 0xFF || next_byte(dec) != 0xD8) return JPEG_ERR_FORMAT;
+
+  while (!dec.eof) {
+    if (next_byte(dec) != 0xFF) continue;
+    uint8_t marker = next_byte(dec);
+    while (marker == 0xFF) marker = next_byte(dec); // fill bytes
+    if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+    if (marker == 0xD9) return JPEG_ERR_FORMAT; // end of image before any scan
+
+    int length = next_word(dec) - 2;
+    if (length < 0) return JPEG_ERR_FORMAT;
+    jpeg_result res = JPEG_OK;
+
+    switch (marker) {
+      case 0xDB: res = read_dqt(dec, length); break;
+      case 0xC4: res = read_dht(dec, length); break;
+      case 0xC0: // baseline
+      case 0xC1: // extended sequential, huffman coded
+        res = read_sof(dec);
+        break;
+      case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+        return JPEG_ERR_UNSUPPORTED; // progressive, lossless, arithmetic
+      case 0xDD:
+        dec.restart_interval = next_word(dec);
+        break;
+      case 0xDA:
+        if (dec.components == 0) return JPEG_ERR_FORMAT;
+        return read_sos(dec);
+      default: // APPn, COM ...
+        skip_bytes(dec, length);
+        break;
+    }
+    if (res != JPEG_OK) return res;
+  }
+  return JPEG_ERR_READ;
+}
+
+
+uint16_t jpeg_scaled_width(const jpeg_decoder& dec, uint8_t scale)
+{
+  return (dec.width + scale - 1) / scale;
+}
+
+
+uint16_t jpeg_scaled_height(const jpeg_decoder& dec, uint8_t scale)
+{
+  return (dec.height + scale - 1) / scale;
+}
+
+
+// ---------------------------------------------------------------------------
+// Entropy decoding
+
+static void fill_bits(jpeg_decoder& dec)
+{
+  while (dec.nbits <= 24) {
+    uint32_t b = 0;
+    if (!dec.marker) {
+      b = next_byte(dec);
+      if (b == 0xFF) {
+        uint8_t next = next_byte(dec);
+        while (next == 0xFF) next = next_byte(dec);
+        if (next != 0) {
+          // a marker ends the entropy coded segment, feed zeros from now on
+          dec.marker = next;
+          b = 0;
+        }
+      }
+    }
+    dec.bits |= b << (24 - dec.nbits);
+    dec.nbits += 8;
+  }
+}
+
+
+static inline int get_bits(jpeg_decoder& dec, int n)
+{
+  if (dec.nbits < n) fill_bits(dec);
+  int v = dec.bits >> (32 - n);
+  dec.bits <<= n;
+  dec.nbits -= n;
+  return v;
+}
+
+
+// Bits of a coefficient are stored as magnitude category + raw bits,
+// negative values have their top bit cleared
+static inline int extend(int v, int n)
+{
+  return (v < (1 << (n - 1))) ? v - (1 << n) + 1 : v;
+}
+
+
+static int decode_huffman(jpeg_decoder& dec, const jpeg_huffman& h)
+{
+  if (dec.nbits < 16) fill_bits(dec);
+
+  uint16_t e = h.fast[dec.bits >> (32 - JPEG_FAST_BITS)];
+  if (e) {
+    int len = e >> 8;
+    dec.bits <<= len;
+    dec.nbits -= len;
+    return e & 0xFF;
+  }
+
+  // code is longer than the fast lookup
+  int len = JPEG_FAST_BITS + 1;
+  int32_t code = dec.bits >> (32 - len);
+  while (code > h.maxcode[len]) {
+    len++;
+    code = dec.bits >> (32 - len);
+  }
+  if (len > 16) return -1;
+  dec.bits <<= len;
+  dec.nbits -= len;
+  return h.symbols[code + h.delta[len]];
+}
+
+
+// Decode one 8x8 block into coef (natural order, dequantised).
+// With dc_only the AC coefficients are decoded to keep the bit position but
+// not stored.
+static bool decode_block(jpeg_decoder& dec, jpeg_component& c, int16_t coef[64], bool dc_only)
+{
+  const uint16_t* q = dec.quant[c.tq];
+
+  int t = decode_huffman(dec, dec.huff[c.td]);
+  if (t < 0 || t > 11) return false;
+  int diff = t ? extend(get_bits(dec, t), t) : 0;
+  c.dc_pred += diff;
+
+  if (!dc_only) memset(coef, 0, 64 * sizeof(int16_t));
+  coef[0] = c.dc_pred * q[0];
+
+  const jpeg_huffman& ac = dec.huff[2 + c.ta];
+  int k = 1;
+  while (k < 64) {
+    int rs = decode_huffman(dec, ac);
+    if (rs < 0) return false;
+    int r = rs >> 4;
+    int s = rs & 0x0F;
+    if (s == 0) {
+      if (r != 15) break; // end of block
+      k += 16;
+      continue;
+    }
+    k += r;
+    int v = extend(get_bits(dec, s), s);
+    if (!dc_only && k < 64) coef[zigzag[k]] = v * q[k];
+    k++;
+  }
+  return true;
+}
+
+
+static void handle_restart(jpeg_decoder& dec)
+{
+  // drop the rest of the current byte and look for the RSTn marker
+  dec.bits = 0;
+  dec.nbits = 0;
+  if (!dec.marker) {
+    while (!dec.eof) {
+      if (next_byte(dec) != 0xFF) continue;
+      uint8_t m = next_byte(dec);
+      while (m == 0xFF) m = next_byte(dec);
+      if (m >= 0xD0 && m <= 0xD7) break;
+    }
+  }
+  dec.marker = 0;
+  for (int i = 0; i < dec.components; i++) dec.comp[i].dc_pred = 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Inverse DCT
+//
+// Separable integer IDCT (Loeffler/Ligtenberg/Moschytz as in the IJG
+// jidctint.c) with 12 fractional bits.
+
+#define FIX(x) ((int32_t)((x) * 4096 + 0.5))
+
+#define IDCT_1D(s0, s1, s2, s3, s4, s5, s6, s7)          \
+  int32_t p1, p2, p3, p4, p5, t0, t1, t2, t3;            \
+  int32_t x0, x1, x2, x3;                                \
+  p2 = s2;                                               \
+  p3 = s6;                                               \
+  p1 = (p2 + p3) * FIX(0.5411961);                       \
+  t2 = p1 + p3 * FIX(-1.847759065);                      \
+  t3 = p1 + p2 * FIX(0.765366865);                       \
+  t0 = ((int32_t)(s0) + (s4)) * 4096;                    \
+  t1 = ((int32_t)(s0) - (s4)) * 4096;                    \
+  x0 = t0 + t3;                                          \
+  x3 = t0 - t3;                                          \
+  x1 = t1 + t2;                                          \
+  x2 = t1 - t2;                                          \
+  t0 = s7;                                               \
+  t1 = s5;                                               \
+  t2 = s3;                                               \
+  t3 = s1;                                               \
+  p3 = t0 + t2;                                          \
+  p4 = t1 + t3;                                          \
+  p1 = t0 + t3;                                          \
+  p2 = t1 + t2;                                          \
+  p5 = (p3 + p4) * FIX(1.175875602);                     \
+  t0 = t0 * FIX(0.298631336);                            \
+  t1 = t1 * FIX(2.053119869);                            \
+  t2 = t2 * FIX(3.072711026);                            \
+  t3 = t3 * FIX(1.501321110);                            \
+  p1 = p5 + p1 * FIX(-0.899976223);                      \
+  p2 = p5 + p2 * FIX(-2.562915447);                      \
+  p3 = p3 * FIX(-1.961570560);                           \
+  p4 = p4 * FIX(-0.390180644);                           \
+  t3 += p1 + p4;                                         \
+  t2 += p2 + p3;                                         \
+  t1 += p2 + p4;                                         \
+  t0 += p1 + p3;
+
+static inline int min_int(int a, int b)
+{
+  return a < b ? a : b;
+}
+
+
+static inline uint8_t clamp8(int32_t v)
+{
+  if ((uint32_t)v > 255) return v < 0 ? 0 : 255;
+  return v;
+}
+
+
+static void idct_block(const int16_t coef[64], uint8_t out[64])
+{
+  int32_t tmp[64];
+
+  // columns, keeping 2 extra bits of precision
+  for (int i = 0; i < 8; i++) {
+    const int16_t* d = coef + i;
+    int32_t* v = tmp + i;
+    if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[32] == 0 &&
+        d[40] == 0 && d[48] == 0 && d[56] == 0) {
+      // only DC in this column, very common after quantisation
+      int32_t dc = d[0] * 4;
+      v[0] = v[8] = v[16] = v[24] = v[32] = v[40] = v[48] = v[56] = dc;
+      continue;
+    }
+    IDCT_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56])
+    x0 += 512; x1 += 512; x2 += 512; x3 += 512;
+    v[0]  = (x0 + t3) >> 10;
+    v[56] = (x0 - t3) >> 10;
+    v[8]  = (x1 + t2) >> 10;
+    v[48] = (x1 - t2) >> 10;
+    v[16] = (x2 + t1) >> 10;
+    v[40] = (x2 - t1) >> 10;
+    v[24] = (x3 + t0) >> 10;
+    v[32] = (x3 - t0) >> 10;
+  }
+
+  // rows, remove the remaining 1 << 17 scale, round and add the 128 level shift
+  for (int i = 0; i < 8; i++) {
+    const int32_t* v = tmp + i * 8;
+    uint8_t* o = out + i * 8;
+    IDCT_1D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7])
+    const int32_t bias = 65536 + (128 << 17);
+    x0 += bias; x1 += bias; x2 += bias; x3 += bias;
+    o[0] = clamp8((x0 + t3) >> 17);
+    o[7] = clamp8((x0 - t3) >> 17);
+    o[1] = clamp8((x1 + t2) >> 17);
+    o[6] = clamp8((x1 - t2) >> 17);
+    o[2] = clamp8((x2 + t1) >> 17);
+    o[5] = clamp8((x2 - t1) >> 17);
+    o[3] = clamp8((x3 + t0) >> 17);
+    o[4] = clamp8((x3 - t0) >> 17);
+  }
+}
+
+
+// Reduce a decoded 8x8 block to size x size pixels (stride size) by averaging
+static void shrink_block(uint8_t block[64], int size)
+{
+  int step = 8 / size;
+  int area = step * step;
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      int sum = 0;
+      for (int j = 0; j < step; j++) {
+        const uint8_t* p = block + (y * step + j) * 8 + x * step;
+        for (int i = 0; i < step; i++) sum += p[i];
+      }
+      block[y * size + x] = (sum + area / 2) / area;
+    }
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Colour conversion
+
+static inline uint16_t pack_rgb565_be(int r, int g, int b)
+{
+  uint16_t c = ((clamp8(r) & 0xF8) << 8) | ((clamp8(g) & 0xFC) << 3) | (clamp8(b) >> 3);
+  return (c >> 8) | (c << 8);
+}
+
+
+// JFIF YCbCr -> RGB with 16 fractional bits
+static inline uint16_t ycbcr_to_rgb565(int y, int cb, int cr)
+{
+  cb -= 128;
+  cr -= 128;
+  int yy = (y << 16) + 32768;
+  int r = (yy + 91881 * cr) >> 16;
+  int g = (yy - 22554 * cb - 46802 * cr) >> 16;
+  int b = (yy + 116130 * cb) >> 16;
+  return pack_rgb565_be(r, g, b);
+}
+
+
+jpeg_result jpeg_band_begin(jpeg_decoder& dec, uint8_t scale, jpeg_bands& b)
+{
+  b.pixels = NULL;
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) return JPEG_ERR_UNSUPPORTED;
+
+  b.scale = scale;
+  b.width = jpeg_scaled_width(dec, scale);
+  b.height = jpeg_scaled_height(dec, scale);
+  b.band_h = dec.comp[0].v * (8 / scale);
+  b.row = 0;
+  b.rows = (dec.height + 8 * dec.comp[0].v - 1) / (8 * dec.comp[0].v);
+  b.restarts_left = dec.restart_interval;
+  b.y = 0;
+  b.h = 0;
+  b.pixels = (uint16_t*)malloc((size_t)b.width * b.band_h * sizeof(uint16_t));
+  if (!b.pixels) return JPEG_ERR_MEMORY;
+
+  dec.bits = 0;
+  dec.nbits = 0;
+  dec.marker = 0;
+  for (int i = 0; i < dec.components; i++) dec.comp[i].dc_pred = 0;
+  return JPEG_OK;
+}
+
+
+jpeg_result jpeg_band_next(jpeg_decoder& dec, jpeg_bands& b)
+{
+  const int bs = 8 / b.scale;               // size of one block in the output
+  const int hmax = dec.comp[0].h;
+  const int vmax = dec.comp[0].v;
+  const int mcus_x = (dec.width + 8 * hmax - 1) / (8 * hmax);
+  const int mcu_ow = hmax * bs;             // MCU size in the output
+  const int mcu_oh = b.band_h;
+  const int out_w = b.width;
+  const int luma_blocks = hmax * vmax;
+  const bool dc_only = (b.scale == 8);
+  uint16_t* band = b.pixels;
+
+  int16_t coef[64];
+  uint8_t blocks[6][64]; // up to 4 luma + Cb + Cr, bs x bs pixels each
+
+  for (int mx = 0; mx < mcus_x; mx++) {
+    if (dec.restart_interval) {
+      if (b.restarts_left == 0) {
+        handle_restart(dec);
+        b.restarts_left = dec.restart_interval;
+      }
+      b.restarts_left--;
+    }
+
+    // decode all blocks of this MCU
+    int n = 0;
+    for (int ci = 0; ci < dec.components; ci++) {
+      jpeg_component& c = dec.comp[ci];
+      int count = (ci == 0) ? luma_blocks : 1;
+      for (int k = 0; k < count; k++, n++) {
+        if (!decode_block(dec, c, coef, dc_only)) return JPEG_ERR_FORMAT;
+        if (dc_only) {
+          // DC of the IDCT is the average of the block: coef / 8 + 128
+          blocks[n][0] = clamp8(((coef[0] + 4) >> 3) + 128);
+        } else {
+          idct_block(coef, blocks[n]);
+          if (bs < 8) shrink_block(blocks[n], bs);
+        }
+      }
+    }
+
+    // colour convert into the band, chroma is upsampled by repetition
+    int x_base = mx * mcu_ow;
+    int w = min_int(mcu_ow, out_w - x_base);
+    for (int oy = 0; oy < mcu_oh; oy++) {
+      uint16_t* dst = band + oy * out_w + x_base;
+      int luma = (oy / bs) * hmax;
+      int row = (oy % bs) * bs;
+      if (dec.components == 1) {
+        for (int ox = 0; ox < w; ox++) {
+          int y = blocks[luma][row + ox];
+          dst[ox] = pack_rgb565_be(y, y, y);
+        }
+        continue;
+      }
+      const uint8_t* cb = blocks[luma_blocks] + (oy / vmax) * bs;
+      const uint8_t* cr = blocks[luma_blocks + 1] + (oy / vmax) * bs;
+      for (int ox = 0; ox < w; ox++) {
+        int y = blocks[luma + ox / bs][row + ox % bs];
+        int cx = ox / hmax;
+        dst[ox] = ycbcr_to_rgb565(y, cb[cx], cr[cx]);
+      }
+    }
+  }
+
+  b.y = b.row * mcu_oh;
+  b.h = min_int(mcu_oh, b.height - b.y);
+  b.row++;
+  return JPEG_OK;
+}
+
+
+void jpeg_band_end(jpeg_bands& b)
+{
+  free(b.pixels);
+  b.pixels = NULL;
+}
+
+
+jpeg_result jpeg_decode(jpeg_decoder& dec, uint8_t scale, jpeg_band_cb band_cb, void* user)
+{
+  jpeg_bands b;
+  jpeg_result res = jpeg_band_begin(dec, scale, b);
+  while (res == JPEG_OK && b.row < b.rows) {
+    res = jpeg_band_next(dec, b);
+    if (res == JPEG_OK && !band_cb(user, 0, b.y, b.width, b.h, b.pixels)) res = JPEG_ABORTED;
+  }
+  jpeg_band_end(b);
+  return res;
+}
+
+
+static jpeg_decoder shared_decoder;
+
+
+jpeg_result jpeg_decode_stream(jpeg_read_cb read, void* user, uint8_t scale,
+                               jpeg_band_cb band_cb, void* band_user)
+{
+  jpeg_result res = jpeg_begin(shared_decoder, read, user);
+  if (res != JPEG_OK) return res;
+  return jpeg_decode(shared_decoder, scale, band_cb, band_user);
+}
+
+
+uint16_t jpeg_last_width()
+{
+  return shared_decoder.width;
+}
+
+
+uint16_t jpeg_last_height()
+{
+  return shared_decoder.height;
+}
+
+
+// ---------------------------------------------------------------------------
+// Sources
+
+size_t jpeg_read_memory(void* user, uint8_t* buf, size_t len)
+{
+  jpeg_memory_source* src = (jpeg_memory_source*)user;
+  size_t n = src->size - src->pos;
+  if (n > len) n = len;
+  memcpy(buf, src->data + src->pos, n);
+  src->pos += n;
+  return n;
+}
+
+
+bool jpeg_clip_band(int32_t x, int32_t y, uint16_t w, uint16_t h, int16_t width, int16_t height,
+                    jpeg_clip& clip)
+{
+  int32_t x0 = x < 0 ? 0 : x;
+  int32_t y0 = y < 0 ? 0 : y;
+  int32_t x1 = x + w < width ? x + w : width;
+  int32_t y1 = y + h < height ? y + h : height;
+  if (x0 >= x1 || y0 >= y1) return false;
+  clip.x = x0;
+  clip.y = y0;
+  clip.w = x1 - x0;
+  clip.h = y1 - y0;
+  clip.skip_x = x0 - x;
+  clip.skip_y = y0 - y;
+  return true;
+}
+
+
+void jpeg_write_band(Adafruit_SPITFT& lcd, int32_t x, int32_t y, uint16_t w, uint16_t h,
+                     uint16_t* pixels)
+{
+  // a picture larger than the screen shows the part on it
+  jpeg_clip clip;
+  if (!jpeg_clip_band(x, y, w, h, lcd.width(), lcd.height(), clip)) return;
+  uint16_t* start = pixels + clip.skip_y * w + clip.skip_x;
+  lcd.startWrite();
+  lcd.setAddrWindow(clip.x, clip.y, clip.w, clip.h);
+  if (clip.w == w) {
+    lcd.writePixels(start, (uint32_t)w * clip.h, true, true); // already big-endian
+  } else {
+    for (uint16_t row = 0; row < clip.h; row++) lcd.writePixels(start + row * w, clip.w, true, true);
+  }
+  lcd.endWrite();
+}
+
+
+#ifdef ARDUINO
+
+size_t jpeg_read_stream(void* user, uint8_t* buf, size_t len)
+{
+  jpeg_stream_source* src = (jpeg_stream_source*)user;
+  if (len > src->remaining) len = src->remaining;
+  size_t n = src->stream->readBytes(buf, len); // waits up to the stream timeout
+  src->remaining -= n;
+  return n;
+}
+
+
+struct lcd_target {
+  Adafruit_SPITFT* lcd;
+  int16_t x;
+  int16_t y;
+};
+
+
+static bool write_band_to_lcd(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                              uint16_t* pixels)
+{
+  lcd_target* t = (lcd_target*)user;
+  jpeg_write_band(*t->lcd, t->x + x, t->y + y, w, h, pixels);
+  return true;
+}
+
+
+static bool discard_band(void*, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t*)
+{
+  return true;
+}
+
+
+jpeg_result jpeg_draw(Adafruit_SPITFT& lcd, int16_t x, int16_t y, jpeg_read_cb read, void* user,
+                      uint8_t scale)
+{
+  unsigned long start = micros();
+  lcd_target target = { &lcd, x, y };
+  jpeg_result res = jpeg_decode_stream(read, user, scale, write_band_to_lcd, &target);
+
+  Serial.print("JPEG ");
+  Serial.print(jpeg_last_width());
+  Serial.print("x");
+  Serial.print(jpeg_last_height());
+  Serial.print(" 1/");
+  Serial.print(scale);
+  Serial.print(": result ");
+  Serial.print((int)res);
+  Serial.print(", ");
+  Serial.print((micros() - start) / 1000);
+  Serial.println(" ms");
+  return res;
+}
+
+
+jpeg_result jpeg_draw(Adafruit_SPITFT& lcd, int16_t x, int16_t y, const uint8_t* data, size_t size,
+                      uint8_t scale)
+{
+  jpeg_memory_source src = { data, size, 0 };
+  return jpeg_draw(lcd, x, y, jpeg_read_memory, &src, scale);
+}
+
+
+void jpeg_benchmark(const uint8_t* data, size_t size, uint8_t count)
+{
+  for (uint8_t scale = 1; scale <= 8; scale *= 2) {
+    unsigned long start = micros();
+    jpeg_result res = JPEG_OK;
+    for (uint8_t i = 0; i < count && res == JPEG_OK; i++) {
+      jpeg_memory_source src = { data, size, 0 };
+      res = jpeg_decode_stream(jpeg_read_memory, &src, scale, discard_band, NULL);
+    }
+    unsigned long per_image = (micros() - start) / count;
+
+    Serial.print("JPEG benchmark ");
+    Serial.print(jpeg_last_width());
+    Serial.print("x");
+    Serial.print(jpeg_last_height());
+    Serial.print(" 1/");
+    Serial.print(scale);
+    Serial.print(": ");
+    if (res != JPEG_OK) {
+      Serial.print("error ");
+      Serial.println((int)res);
+      return;
+    }
+    Serial.print(per_image);
+    Serial.println(" us per image");
+  }
+}
+
+#endif
@@ -8,25 +8,49 @@
 //  *      c. Data type： uint16_t
 //  *      d. Keep the default settings for other parameters
 //  *      e. Copy the result into the following imageData array
+//  * 3.Pictures with few colours (logos, signs) can be stored palette-indexed instead, which needs 2-4x less flash:
+//  *      python tools/png_to_indexed.py picture.png myImage --bits 4 --size 170x320
+//  *      #include "myImage.h" and draw it with draw_indexed_image(lcd, 0, 0, myImage) (see include/indexed_image.h)
+//  * 4.Photos are best stored as JPEG, a 170x320 photo needs about 10-20KB instead of 109KB:
+//  *      python tools/jpg_to_header.py photo.jpg myPhoto --size 170x320
+//  *      #include "myPhoto.h" and draw it with jpeg_draw(lcd, 0, 0, myPhoto, sizeof(myPhoto)) (see include/jpeg_decoder.h)
+//  *    or upload one from a PC without reflashing:
+//  *      curl --data-binary @photo.jpg http://192.168.4.1/upload
+//  *    the decoding runs on the second core, http://192.168.4.1/pipeline shows the time of every stage
+//  *    a gallery of several photos is decoded only once when drawn through the tile cache:
+//  *      cached_jpeg_source slide = { 1, myPhoto, sizeof(myPhoto) }; pipeline_draw(overlay, cached_jpeg_row, &slide, true);
+//  * 5.Pictures in other sizes or landscape orientation do not have to be converted again, they can be
+//  *   rotated, mirrored and scaled while drawing (see include/blit_transform.h):
+//  *      blit_setup(t, 320, 170, 170, 320, BLIT_ROT_90, false, false); blit_draw_rgb565(lcd, 0, 0, t, imageData);
+//  * 6.Short looping animations are stored as delta frames, only the changed areas of every frame are kept:
+//  *      python tools/anim_encoder.py myAnim loop.gif --size 170x320
+//  *      #include "myAnim.h", anim_open(player, myAnim, sizeof(myAnim)) once and anim_update(lcd, player, 0, 0)
+//  *      in loop() (see include/anim_player.h)
 //  */
 
-// #include <Adafruit_GFX.h>    // Importing the Adafruit_GFX library
-// #include <Adafruit_ST7789.h> // Import the Adafruit_ST7789 library
+#include <Adafruit_GFX.h>    // Importing the Adafruit_GFX library
+#include <Adafruit_ST7789.h> // Import the Adafruit_ST7789 library
+#include "jpeg_decoder.h"
+#include "render_pipeline.h"
+#include "tile_cache.h"
 
-// //Define the size of the screen
-// #define LCD_WIDTH  170
-// #define LCD_HEIGHT 320
+//Define the size of the screen
+#define LCD_WIDTH  170
+#define LCD_HEIGHT 320
 
-// //Define the pins of the ESP32 connected to the LCD
-// #define LCD_MOSI 23  // SDA Pin on ESP32 D23
-// #define LCD_SCLK 18  // SCL Pin on ESP32 D18
-// #define LCD_CS   15  // Chip select control pin on ESP32 D15
-// #define LCD_DC    2  // Data Command control pin on ESP32 D2
-// #define LCD_RST   4  // Reset pin (could connect to RST pin) on ESP32 D4
-// #define LCD_BLK   32  // Black Light Pin on ESP32 D32
+//Define the pins of the ESP32 connected to the LCD
+#define LCD_MOSI 23  // SDA Pin on ESP32 D23
+#define LCD_SCLK 18  // SCL Pin on ESP32 D18
+#define LCD_CS   15  // Chip select control pin on ESP32 D15
+#define LCD_DC    2  // Data Command control pin on ESP32 D2
+#define LCD_RST   4  // Reset pin (could connect to RST pin) on ESP32 D4
+#define LCD_BLK   32  // Black Light Pin on ESP32 D32
 
-// //Create the Adafruit_ST7789 object
-// Adafruit_ST7789 lcd = Adafruit_ST7789(LCD_CS, LCD_DC, LCD_RST);
+//Create the Adafruit_ST7789 object
+Adafruit_ST7789 lcd = Adafruit_ST7789(LCD_CS, LCD_DC, LCD_RST);
+
+// Overlays drawn on top of every picture (clock, captions), see compositor.h
+compositor overlay;
 
 // //This is the image array
 // const uint16_t imageData[] = {
@@ -375,33 +399,98 @@
 
 // Load Wi-Fi library
 #include <WiFi.h>
+#include <gpio_table.h>
+#include <http_core.h>
 
 // Replace with your network credentials
 const char* ssid     = "ESP32-Access-Point";
 const char* password = "123456789";
 
-// Set web server port number to 80
-WiFiServer server(80);
+// Outputs that can be switched from the web page: pin, name in the URL,
+// active low, initial state. Add relay channels here, nothing else to change.
+const gpio_output outputs[] = {
+  { 26, "26", false, false },
+  { 27, "27", false, false },
+};
+gpio_table gpio = GPIO_TABLE(outputs);
+
+// Request body of an upload for the JPEG decoder
+static size_t read_upload(void* user, uint8_t* buf, size_t len)
+{
+  return http_read_body(*(http_request*)user, buf, len);
+}
+
+// A JPEG upload: the picture is the request body, it is decoded straight
+// from the connection onto the screen
+void handle_upload(http_request& req, http_response& res)
+{
+  pipeline_wait();
+  pipeline_draw_jpeg(overlay, read_upload, &req, true);
+  jpeg_result result = pipeline_wait();
+  http_status(res, result == JPEG_OK ? 200 : 415, NULL);
+}
+
+extern http_server web;
+
+// Timings of the render pipeline (render, transfer and waiting per frame)
+// and of the web server. ?clear=1 starts a new measurement of the web
+// server (load test, lib/HttpCore/bench/http_load.cpp).
+void handle_pipeline(http_request& req, http_response& res)
+{
+  http_status(res, 200, "text/plain");
+  pipeline_print_stats(res);
+  tile_cache_print_stats(res);
+  http_print_stats(web, res);
+  if (http_query_int(req, "clear", 0)) http_clear_stats(web);
+}
 
-// Variable to store the HTTP request
-String header;
+// Switches the GPIOs (/26/on, /26/off or several at once with
+// /gpio?on=26,27&off=..., all in the same moment) and shows the page
+void handle_page(http_request& req, http_response& res)
+{
+  char line[160];
+  gpio_table_handle_request(gpio, http_request_line(req, line, sizeof(line)));
 
-// Auxiliar variables to store the current output state
-String output26State = "off";
-String output27State = "off";
+  // Display the HTML web page
+  res.println("<!DOCTYPE html><html>");
+  res.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  res.println("<link rel=\"icon\" href=\"data:,\">");
+  // CSS to style the on/off buttons 
+  // Feel free to change the background-color and font-size attributes to fit your preferences
+  res.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
+  res.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
+  res.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
+  res.println(".button2 {background-color: #555555;}</style></head>");
+  
+  // Web Page Heading
+  res.println("<body><h1>ESP32 Web Server</h1>");
+  
+  // Display current state, and ON/OFF buttons for every output
+  gpio_table_print_buttons(gpio, res);
+  res.println("</body></html>");
+}
 
-// Assign output variables to GPIO pins
-const int output26 = 26;
-const int output27 = 27;
+// Web server on port 80, see http_core.h
+const http_route routes[] = {
+  { HTTP_POST, "/upload", handle_upload },
+  { HTTP_GET, "/pipeline", handle_pipeline },
+  { HTTP_GET, "*", handle_page },
+};
+http_server web = HTTP_SERVER(routes);
 
 void setup() {
   Serial.begin(115200);
-  // Initialize the output variables as outputs
-  pinMode(output26, OUTPUT);
-  pinMode(output27, OUTPUT);
-  // Set outputs to LOW
-  digitalWrite(output26, LOW);
-  digitalWrite(output27, LOW);
+  lcd.init(LCD_WIDTH, LCD_HEIGHT);
+  lcd.setRotation(2);  //The parameters are: 0, 1, 2, 3, representing the rotation of the screen 0°, 90°, 180°, 270°
+  lcd.fillScreen(ST77XX_BLACK);
+  // From here on the LCD is fed by the pipeline tasks: decoding on core 0,
+  // SPI transfer on core 1 next to the web server in loop()
+  compositor_clear(overlay);
+  pipeline_begin(lcd);
+  tile_cache_begin();
+
+  // Initialize the outputs of the table with their initial state
+  gpio_table_begin(gpio);
 
   // Connect to Wi-Fi network with SSID and password
   Serial.print("Setting AP (Access Point)…");
@@ -413,100 +502,12 @@ void setup() {
   Serial.print("AP IP address: ");
   Serial.println(IP);
   
-  server.begin();
+  web.log = &Serial;                 // one line per request
+  http_server_begin(web, 80);
 }
 
 void loop(){
-  WiFiClient client = server.available();   // Listen for incoming clients
-
-  if (client) {                             // If a new client connects,
-    Serial.println("New Client.");          // print a message out in the serial port
-    String currentLine = "";                // make a String to hold incoming data from the client
-    while (client.connected()) {            // loop while the client's connected
-      if (client.available()) {             // if there's bytes to read from the client,
-        char c = client.read();             // read a byte, then
-        Serial.write(c);                    // print it out the serial monitor
-        header += c;
-        if (c == '\n') {                    // if the byte is a newline character
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so send a response:
-          if (currentLine.length() == 0) {
-            // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-            // and a content-type so the client knows what's coming, then a blank line:
-            client.println("HTTP/1.1 200 OK");
-            client.println("Content-type:text/html");
-            client.println("Connection: close");
-            client.println();
-            
-            // turns the GPIOs on and off
-            if (header.indexOf("GET /26/on") >= 0) {
-              Serial.println("GPIO 26 on");
-              output26State = "on";
-              digitalWrite(output26, HIGH);
-            } else if (header.indexOf("GET /26/off") >= 0) {
-              Serial.println("GPIO 26 off");
-              output26State = "off";
-              digitalWrite(output26, LOW);
-            } else if (header.indexOf("GET /27/on") >= 0) {
-              Serial.println("GPIO 27 on");
-              output27State = "on";
-              digitalWrite(output27, HIGH);
-            } else if (header.indexOf("GET /27/off") >= 0) {
-              Serial.println("GPIO 27 off");
-              output27State = "off";
-              digitalWrite(output27, LOW);
-            }
-            
-            // Display the HTML web page
-            client.println("<!DOCTYPE html><html>");
-            client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-            client.println("<link rel=\"icon\" href=\"data:,\">");
-            // CSS to style the on/off buttons 
-            // Feel free to change the background-color and font-size attributes to fit your preferences
-            client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-            client.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
-            client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-            client.println(".button2 {background-color: #555555;}</style></head>");
-            
-            // Web Page Heading
-            client.println("<body><h1>ESP32 Web Server</h1>");
-            
-            // Display current state, and ON/OFF buttons for GPIO 26  
-            client.println("<p>GPIO 26 - State " + output26State + "</p>");
-            // If the output26State is off, it displays the ON button       
-            if (output26State=="off") {
-              client.println("<p><a href=\"/26/on\"><button class=\"button\">ON</button></a></p>");
-            } else {
-              client.println("<p><a href=\"/26/off\"><button class=\"button button2\">OFF</button></a></p>");
-            } 
-               
-            // Display current state, and ON/OFF buttons for GPIO 27  
-            client.println("<p>GPIO 27 - State " + output27State + "</p>");
-            // If the output27State is off, it displays the ON button       
-            if (output27State=="off") {
-              client.println("<p><a href=\"/27/on\"><button class=\"button\">ON</button></a></p>");
-            } else {
-              client.println("<p><a href=\"/27/off\"><button class=\"button button2\">OFF</button></a></p>");
-            }
-            client.println("</body></html>");
-            
-            // The HTTP response ends with another blank line
-            client.println();
-            // Break out of the while loop
-            break;
-          } else { // if you got a newline, then clear currentLine
-            currentLine = "";
-          }
-        } else if (c != '\r') {  // if you got anything else but a carriage return character,
-          currentLine += c;      // add it to the end of the currentLine
-        }
-      }
-    }
-    // Clear the header variable
-    header = "";
-    // Close the connection
-    client.stop();
-    Serial.println("Client disconnected.");
-    Serial.println("");
-  }
-}
\ No newline at end of file
+  // Serve the web page, never waits for a client. The LCD is fed by the
+  // pipeline tasks meanwhile.
+  http_server_poll(web);
+}
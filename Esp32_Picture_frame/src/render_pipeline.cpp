@@ -0,0 +1,413 @@
+// FreeRTOS tasks, only on the device (the host build has a single thread)
+#ifdef ARDUINO
+
+#include "render_pipeline.h"
+
+enum job_type : uint8_t {
+  JOB_NONE = 0,
+  JOB_DRAW,
+  JOB_DRAW_JPEG,
+  JOB_CROSSFADE
+};
+
+struct pipeline_job {
+  job_type type;
+  compositor* comp;
+  bool full;
+  scanline_source_cb source;
+  void* user;
+  scanline_source_cb to;         // cross-fade target
+  void* to_user;
+  jpeg_read_cb read;
+  uint8_t steps;
+};
+
+static Adafruit_SPITFT* lcd = NULL;
+static stripe_queue queue;
+static pipeline_job next_job;         // written by start_job() while job_ready is false
+static std::atomic<bool> job_ready(false); // next_job is complete, for the render task
+static pipeline_job job;              // job of the render task
+static std::atomic<bool> busy(false);
+static volatile jpeg_result job_result = JPEG_OK;
+static volatile uint32_t job_start_us = 0;
+
+// Counters of one task, only written by it. pipeline_reset_stats() counts up
+// stats_reset, the task clears its counters when it sees that and they count
+// as zero until then.
+struct task_stats {
+  pipeline_stats counters;
+  std::atomic<uint32_t> reset;        // stats_reset the counters start at
+};
+static task_stats render_stats;
+static task_stats transfer_stats;
+static std::atomic<uint32_t> stats_reset(0);
+static pipeline_stats stats_sum;      // sum of both, for pipeline_get_stats()
+
+static TaskHandle_t render_task = NULL;
+static TaskHandle_t transfer_task = NULL;
+
+// second line for the cross-fade, only used by the render task
+static uint16_t mix_line[PIPELINE_MAX_WIDTH];
+
+
+// Counters of the calling task, cleared first after pipeline_reset_stats()
+static pipeline_stats& own_stats(task_stats& t)
+{
+  uint32_t n = stats_reset.load(std::memory_order_acquire);
+  if (t.reset.load(std::memory_order_relaxed) != n) {
+    memset(&t.counters, 0, sizeof(t.counters));
+    t.reset.store(n, std::memory_order_release);
+  }
+  return t.counters;
+}
+
+
+// ---------------------------------------------------------------------------
+// Render task (producer)
+
+// Free stripe, sleeps while the queue is full
+static stripe* next_stripe()
+{
+  stripe* s = stripe_queue_acquire(queue);
+  if (s) return s;
+  uint32_t start = micros();
+  while ((s = stripe_queue_acquire(queue)) == NULL) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+  }
+  render_stats.counters.render_wait_us += micros() - start;
+  return s;
+}
+
+
+static void send_stripe()
+{
+  stripe_queue_commit(queue);
+  xTaskNotifyGive(transfer_task);
+}
+
+
+static void render_lines(int16_t top, int16_t bottom, bool crossfade, uint8_t alpha)
+{
+  const uint16_t width = lcd->width();
+  const int16_t lines_per_stripe = STRIPE_PIXELS / width;
+
+  for (int16_t y = top; y <= bottom; y += lines_per_stripe) {
+    stripe* s = next_stripe();
+    s->x = 0;
+    s->y = y;
+    s->w = width;
+    s->h = min<int16_t>(lines_per_stripe, bottom - y + 1);
+    s->flags = (y + s->h > bottom) ? STRIPE_FRAME_END : 0;
+    for (uint16_t i = 0; i < s->h; i++) {
+      uint16_t* row = &s->pixels[i * width];
+      job.source(job.user, y + i, row, width);
+      if (crossfade) {
+        job.to(job.to_user, y + i, mix_line, width);
+        compositor_mix_row(row, mix_line, width, alpha);
+      }
+      compositor_blend_row(*job.comp, y + i, row, width);
+    }
+    send_stripe();
+  }
+}
+
+
+struct jpeg_stripe_target {
+  compositor* comp;
+  int16_t top;
+  int16_t bottom;
+};
+
+
+// JPEG band -> one or more stripes with the overlays blended in
+static bool jpeg_band_to_stripes(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                                 uint16_t* pixels)
+{
+  jpeg_stripe_target* t = (jpeg_stripe_target*)user;
+  int16_t first = max<int16_t>(y, t->top);
+  int16_t last = min<int16_t>(y + h - 1, t->bottom);
+  if (first > last) return true;
+  // a picture larger than the screen shows the part on it
+  jpeg_clip clip;
+  if (!jpeg_clip_band(x, first, w, last - first + 1, lcd->width(), lcd->height(), clip)) return true;
+  last = clip.y + clip.h - 1;
+
+  const uint16_t* src = pixels + (first - y) * w + clip.skip_x;
+  const int16_t lines_per_stripe = STRIPE_PIXELS / clip.w;
+  for (int16_t line = first; line <= last; line += lines_per_stripe) {
+    stripe* s = next_stripe();
+    s->x = clip.x;
+    s->y = line;
+    s->w = clip.w;
+    s->h = min<int16_t>(lines_per_stripe, last - line + 1);
+    s->flags = (line + s->h > t->bottom) ? STRIPE_FRAME_END : 0;
+    for (uint16_t i = 0; i < s->h; i++) {
+      uint16_t* row = &s->pixels[i * clip.w];
+      memcpy(row, src + (line - first + i) * w, clip.w * sizeof(uint16_t));
+      compositor_blend_row(*t->comp, line + i, row, clip.w);
+    }
+    send_stripe();
+  }
+  return true;
+}
+
+
+// Dirty range of the compositor, false if there is nothing to draw
+static bool take_lines(compositor& comp, bool full, int16_t& top, int16_t& bottom)
+{
+  top = 0;
+  bottom = lcd->height() - 1;
+  if (!full) {
+    if (comp.dirty_top < 0) return false;
+    top = max<int16_t>(comp.dirty_top, 0);
+    bottom = min<int16_t>(comp.dirty_bottom, bottom);
+  }
+  comp.dirty_top = -1;
+  comp.dirty_bottom = -1;
+  return top <= bottom;
+}
+
+
+static void run_job()
+{
+  uint32_t start = micros();
+  pipeline_stats& stats = own_stats(render_stats);
+  uint64_t waited = stats.render_wait_us;
+  int16_t top, bottom;
+  jpeg_result res = JPEG_OK;
+
+  switch (job.type) {
+    case JOB_DRAW:
+      if (take_lines(*job.comp, job.full, top, bottom)) render_lines(top, bottom, false, 0);
+      break;
+    case JOB_DRAW_JPEG:
+      if (take_lines(*job.comp, job.full, top, bottom)) {
+        jpeg_stripe_target target = { job.comp, top, bottom };
+        res = jpeg_decode_stream(job.read, job.user, 1, jpeg_band_to_stripes, &target);
+      }
+      break;
+    case JOB_CROSSFADE:
+      take_lines(*job.comp, true, top, bottom);
+      for (uint16_t step = 1; step <= job.steps; step++) {
+        render_lines(top, bottom, true, (uint32_t)step * 255 / job.steps);
+      }
+      break;
+    default:
+      break;
+  }
+  job_result = res;
+  stats.render_us += (micros() - start) - (stats.render_wait_us - waited);
+
+  // empty stripe that tells the transfer task the job is complete
+  stripe* s = next_stripe();
+  s->w = 0;
+  s->h = 0;
+  s->flags = STRIPE_JOB_END;
+  send_stripe();
+}
+
+
+static void render_loop(void*)
+{
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!job_ready.load(std::memory_order_acquire)) continue; // woken by the transfer task
+    job = next_job;
+    job_ready.store(false, std::memory_order_relaxed);
+    run_job();
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Transfer task (consumer)
+
+static void transfer_loop(void*)
+{
+  bool first_frame = true;
+  uint32_t last_frame = 0;
+
+  for (;;) {
+    pipeline_stats& stats = own_stats(transfer_stats);
+    stripe* s = stripe_queue_front(queue);
+    if (!s) {
+      uint32_t start = micros();
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      if (busy) stats.transfer_wait_us += micros() - start;
+      continue;
+    }
+
+    if (s->h) {
+      uint32_t start = micros();
+      lcd->startWrite();
+      lcd->setAddrWindow(s->x, s->y, s->w, s->h);
+      lcd->writePixels(s->pixels, (uint32_t)s->w * s->h, true, true);
+      lcd->endWrite();
+      stats.transfer_us += micros() - start;
+      stats.stripes++;
+    }
+    uint8_t flags = s->flags;
+    stripe_queue_release(queue);
+    xTaskNotifyGive(render_task);
+
+    if (flags & STRIPE_FRAME_END) {
+      uint32_t now = micros();
+      stats.frames++;
+      stats.last_frame_us = now - (first_frame ? job_start_us : last_frame);
+      last_frame = now;
+      first_frame = false;
+    }
+    if (flags & STRIPE_JOB_END) {
+      stats.jobs++;
+      first_frame = true;
+      busy = false;
+    }
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+
+bool pipeline_begin(Adafruit_SPITFT& display)
+{
+  if (render_task) return true;
+  lcd = &display;
+  stripe_queue_init(queue);
+  pipeline_reset_stats();
+
+  // the transfer task has a higher priority than loop() (1), so the LCD is
+  // fed first and the web server gets the rest of the core
+  if (xTaskCreatePinnedToCore(transfer_loop, "lcd_transfer", 4096, NULL, 2, &transfer_task,
+                              PIPELINE_TRANSFER_CORE) != pdPASS) {
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(render_loop, "lcd_render", 8192, NULL, 1, &render_task,
+                              PIPELINE_RENDER_CORE) != pdPASS) {
+    return false;
+  }
+  return true;
+}
+
+
+static bool start_job(const pipeline_job& j)
+{
+  if (!render_task || lcd->width() > PIPELINE_MAX_WIDTH) return false;
+  bool idle = false;
+  if (!busy.compare_exchange_strong(idle, true)) return false;
+  job_start_us = micros();
+  // the render task takes next_job only after job_ready, and clears that
+  // before busy ends, so it is never read half written
+  next_job = j;
+  job_ready.store(true, std::memory_order_release);
+  xTaskNotifyGive(render_task);
+  return true;
+}
+
+
+bool pipeline_draw(compositor& comp, scanline_source_cb source, void* user, bool full)
+{
+  pipeline_job j = {};
+  j.type = JOB_DRAW;
+  j.comp = &comp;
+  j.full = full;
+  j.source = source;
+  j.user = user;
+  return start_job(j);
+}
+
+
+bool pipeline_draw_jpeg(compositor& comp, jpeg_read_cb read, void* user, bool full)
+{
+  pipeline_job j = {};
+  j.type = JOB_DRAW_JPEG;
+  j.comp = &comp;
+  j.full = full;
+  j.read = read;
+  j.user = user;
+  return start_job(j);
+}
+
+
+bool pipeline_crossfade(compositor& comp, scanline_source_cb from, void* from_user,
+                        scanline_source_cb to, void* to_user, uint8_t steps)
+{
+  if (steps == 0) return false;
+  pipeline_job j = {};
+  j.type = JOB_CROSSFADE;
+  j.comp = &comp;
+  j.full = true;
+  j.source = from;
+  j.user = from_user;
+  j.to = to;
+  j.to_user = to_user;
+  j.steps = steps;
+  return start_job(j);
+}
+
+
+bool pipeline_busy()
+{
+  return busy;
+}
+
+
+jpeg_result pipeline_wait()
+{
+  while (busy) delay(1);
+  return job_result;
+}
+
+
+static void add_stats(pipeline_stats& sum, const task_stats& t, uint32_t reset)
+{
+  if (t.reset.load(std::memory_order_acquire) != reset) return; // not cleared yet
+  const pipeline_stats& c = t.counters;
+  sum.jobs += c.jobs;
+  sum.frames += c.frames;
+  sum.stripes += c.stripes;
+  sum.render_us += c.render_us;
+  sum.render_wait_us += c.render_wait_us;
+  sum.transfer_us += c.transfer_us;
+  sum.transfer_wait_us += c.transfer_wait_us;
+  sum.last_frame_us += c.last_frame_us;
+}
+
+
+const pipeline_stats& pipeline_get_stats()
+{
+  uint32_t reset = stats_reset.load(std::memory_order_acquire);
+  memset(&stats_sum, 0, sizeof(stats_sum));
+  add_stats(stats_sum, render_stats, reset);
+  add_stats(stats_sum, transfer_stats, reset);
+  return stats_sum;
+}
+
+
+void pipeline_reset_stats()
+{
+  stats_reset.fetch_add(1, std::memory_order_release);
+}
+
+
+static void print_stage(Print& out, const char* name, uint64_t us, uint32_t count)
+{
+  out.printf("%-16s %8lu ms", name, (unsigned long)(us / 1000));
+  if (count) out.printf("  %6lu us/frame", (unsigned long)(us / count));
+  out.println();
+}
+
+
+void pipeline_print_stats(Print& out)
+{
+  const pipeline_stats& stats = pipeline_get_stats();
+  out.printf("jobs %lu, frames %lu, stripes %lu, last frame %lu us (%.1f fps)\n",
+             (unsigned long)stats.jobs, (unsigned long)stats.frames, (unsigned long)stats.stripes,
+             (unsigned long)stats.last_frame_us,
+             stats.last_frame_us ? 1000000.0f / stats.last_frame_us : 0.0f);
+  print_stage(out, "render", stats.render_us, stats.frames);
+  print_stage(out, "render wait", stats.render_wait_us, stats.frames);
+  print_stage(out, "transfer", stats.transfer_us, stats.frames);
+  print_stage(out, "transfer wait", stats.transfer_wait_us, stats.frames);
+}
+
+#endif
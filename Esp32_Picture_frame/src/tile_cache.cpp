@@ -0,0 +1,401 @@
+#include "tile_cache.h"
+
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#endif
+
+struct tile_entry {
+  bool used;
+  uint8_t scale;
+  uint16_t tile;
+  uint32_t image;
+  uint16_t image_tiles;     // tiles of the whole picture, 0 until it was decoded completely
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+  uint32_t last_use;
+  uint32_t decode_us;       // what it took to decode this tile
+  uint16_t* pixels;         // LCD byte order
+};
+
+static tile_entry entries[TILE_CACHE_MAX_TILES];
+static uint32_t use_clock = 0;
+static tile_cache_stats stats;
+
+// Copy of a tile for the band callback (which may change the pixels)
+static uint16_t* scratch = NULL;
+static tile_entry* last_line = NULL;   // tile of the last cached_jpeg_row() hit
+
+// Decoder pulled line by line by cached_jpeg_row(). It keeps its place in
+// the picture, so the lines that are not in the cache cost one decode per
+// frame, not one per band.
+struct tile_stream {
+  jpeg_decoder* dec;        // allocated on first use
+  jpeg_memory_source src;
+  jpeg_bands bands;         // pixels = the last band, NULL while stopped
+  uint32_t image;
+  bool cacheable;           // the whole picture fits into the budget
+  uint32_t last_use;
+};
+
+static tile_stream streams[TILE_CACHE_STREAMS];
+
+
+static void* cache_alloc(size_t bytes)
+{
+#ifdef ESP32
+  uint32_t caps = stats.psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+  return heap_caps_malloc(bytes, caps | MALLOC_CAP_8BIT);
+#else
+  return malloc(bytes);
+#endif
+}
+
+
+static void drop(tile_entry& e)
+{
+  free(e.pixels);
+  e.pixels = NULL;
+  e.used = false;
+  stats.tiles--;
+  stats.bytes -= (uint32_t)e.w * e.h * sizeof(uint16_t);
+}
+
+
+static tile_entry* find(uint32_t image, uint16_t tile, uint8_t scale)
+{
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    tile_entry& e = entries[i];
+    if (e.used && e.image == image && e.tile == tile && e.scale == scale) return &e;
+  }
+  return NULL;
+}
+
+
+static bool evict_lru()
+{
+  tile_entry* oldest = NULL;
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    tile_entry& e = entries[i];
+    if (e.used && (!oldest || e.last_use < oldest->last_use)) oldest = &e;
+  }
+  if (!oldest) return false;
+  drop(*oldest);
+  stats.evictions++;
+  return true;
+}
+
+
+static tile_entry* free_entry()
+{
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    if (!entries[i].used) return &entries[i];
+  }
+  return NULL;
+}
+
+
+static void insert(uint32_t image, uint16_t tile, uint8_t scale, uint16_t x, uint16_t y,
+                   uint16_t w, uint16_t h, const uint16_t* pixels, uint32_t decode_us)
+{
+  uint32_t bytes = (uint32_t)w * h * sizeof(uint16_t);
+  tile_entry* e = find(image, tile, scale);
+  if (e) drop(*e);
+
+  while (stats.bytes + bytes > stats.budget || !(e = free_entry())) {
+    if (!evict_lru()) return;
+  }
+  e->pixels = (uint16_t*)cache_alloc(bytes);
+  if (!e->pixels) return;
+  memcpy(e->pixels, pixels, bytes);
+  e->used = true;
+  e->image = image;
+  e->tile = tile;
+  e->scale = scale;
+  e->image_tiles = 0;
+  e->x = x;
+  e->y = y;
+  e->w = w;
+  e->h = h;
+  e->last_use = ++use_clock;
+  e->decode_us = decode_us;
+  stats.tiles++;
+  stats.bytes += bytes;
+}
+
+
+// Tile of the picture with line y
+static tile_entry* find_line(uint32_t image, uint8_t scale, int16_t y)
+{
+  tile_entry* e = last_line;
+  if (e && e->used && e->image == image && e->scale == scale && y >= e->y && y < e->y + e->h) return e;
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    e = &entries[i];
+    if (e->used && e->image == image && e->scale == scale && y >= e->y && y < e->y + e->h) {
+      last_line = e;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+
+// After the last band: the tiles can be replayed if all of them are there
+static void mark_complete(uint32_t image, uint8_t scale, uint16_t tiles)
+{
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    tile_entry& e = entries[i];
+    if (e.used && e.image == image && e.scale == scale) e.image_tiles = tiles;
+  }
+}
+
+
+// Whole picture of w x h pixels in tiles of band_h lines within the budget
+static bool fits(uint16_t w, uint16_t h, uint16_t band_h)
+{
+  return (uint32_t)w * band_h <= TILE_CACHE_MAX_TILE_PIXELS &&
+         (uint32_t)w * h * sizeof(uint16_t) <= stats.budget;
+}
+
+
+static void stop_stream(tile_stream& s)
+{
+  jpeg_band_end(s.bands);
+}
+
+
+// Number of tiles if the whole picture is in the cache, else 0
+static uint16_t complete_tiles(uint32_t image, uint8_t scale)
+{
+  tile_entry* first = find(image, 0, scale);
+  if (!first || !first->image_tiles) return 0;
+  for (uint16_t t = 1; t < first->image_tiles; t++) {
+    if (!find(image, t, scale)) return 0;
+  }
+  return first->image_tiles;
+}
+
+
+static void hit(tile_entry& e)
+{
+  e.last_use = ++use_clock;
+  stats.hits++;
+  stats.saved_us += e.decode_us;
+}
+
+
+bool tile_cache_begin(uint32_t budget)
+{
+  if (scratch) return true;
+#ifdef ESP32
+  stats.psram = psramFound();
+  if (!budget) {
+    // leave at least half of the free internal heap to WiFi and the web server
+    budget = stats.psram ? TILE_CACHE_PSRAM_BUDGET
+                         : min<uint32_t>(TILE_CACHE_INTERNAL_BUDGET,
+                                         heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 2);
+  }
+#else
+  if (!budget) budget = TILE_CACHE_INTERNAL_BUDGET;
+#endif
+  stats.budget = budget;
+  scratch = (uint16_t*)malloc(TILE_CACHE_MAX_TILE_PIXELS * sizeof(uint16_t));
+  return scratch != NULL;
+}
+
+
+void tile_cache_forget(uint32_t image)
+{
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    if (entries[i].used && entries[i].image == image) drop(entries[i]);
+  }
+  for (int i = 0; i < TILE_CACHE_STREAMS; i++) {
+    if (streams[i].image == image) stop_stream(streams[i]);
+  }
+}
+
+
+void tile_cache_clear()
+{
+  for (int i = 0; i < TILE_CACHE_MAX_TILES; i++) {
+    if (entries[i].used) drop(entries[i]);
+  }
+  for (int i = 0; i < TILE_CACHE_STREAMS; i++) stop_stream(streams[i]);
+}
+
+
+// ---------------------------------------------------------------------------
+// Decoding through the cache
+
+struct cache_decode {
+  uint32_t image;
+  uint8_t scale;
+  bool cacheable;           // false if the picture is larger than the budget
+  uint16_t tiles;
+  uint32_t last;            // end of the previous band, decode time = now - last
+  jpeg_band_cb band_cb;
+  void* user;
+};
+
+
+static bool cache_band(void* user, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t* pixels)
+{
+  cache_decode* d = (cache_decode*)user;
+  uint32_t decode_us = micros() - d->last;
+  stats.decode_us += decode_us;
+  stats.misses++;
+
+  if (d->tiles == 0) d->cacheable = fits(w, (jpeg_last_height() + d->scale - 1) / d->scale, h);
+  if (d->cacheable) insert(d->image, d->tiles, d->scale, x, y, w, h, pixels, decode_us);
+  d->tiles++;
+
+  bool ok = d->band_cb ? d->band_cb(d->user, x, y, w, h, pixels) : true;
+  d->last = micros();
+  return ok;
+}
+
+
+jpeg_result tile_cache_decode_jpeg(uint32_t image, const uint8_t* data, size_t size, uint8_t scale,
+                                   jpeg_band_cb band_cb, void* user)
+{
+  uint16_t tiles = scratch ? complete_tiles(image, scale) : 0;
+  if (tiles) {
+    for (uint16_t t = 0; t < tiles; t++) {
+      tile_entry& e = *find(image, t, scale);
+      hit(e);
+      memcpy(scratch, e.pixels, (uint32_t)e.w * e.h * sizeof(uint16_t));
+      if (!band_cb(user, e.x, e.y, e.w, e.h, scratch)) return JPEG_ABORTED;
+    }
+    return JPEG_OK;
+  }
+
+  jpeg_memory_source src = { data, size, 0 };
+  cache_decode d = { image, scale, scratch != NULL, 0, (uint32_t)micros(), band_cb, user };
+  jpeg_result res = jpeg_decode_stream(jpeg_read_memory, &src, scale, cache_band, &d);
+
+  // only a complete picture can be replayed from the cache
+  if (res == JPEG_OK && d.cacheable) mark_complete(image, scale, d.tiles);
+  return res;
+}
+
+
+// The picture from its first band on, false if it can't be decoded
+static bool start_stream(tile_stream& s, const cached_jpeg_source& src)
+{
+  stop_stream(s);
+  if (!s.dec) s.dec = (jpeg_decoder*)malloc(sizeof(jpeg_decoder));
+  if (!s.dec) return false;
+  s.image = src.image;
+  s.src = { src.data, src.size, 0 };
+  if (jpeg_begin(*s.dec, jpeg_read_memory, &s.src) != JPEG_OK) return false;
+  if (jpeg_band_begin(*s.dec, 1, s.bands) != JPEG_OK) {
+    stop_stream(s);
+    return false;
+  }
+  s.cacheable = fits(s.bands.width, s.bands.height, s.bands.band_h);
+  return true;
+}
+
+
+// Stream whose band has line y, decoded on from where it is. Only a line
+// above its band starts the picture again (the next frame). NULL below the
+// picture or on an error.
+static tile_stream* stream_line(const cached_jpeg_source& src, int16_t y)
+{
+  tile_stream* s = NULL;
+  for (int i = 0; i < TILE_CACHE_STREAMS && !s; i++) {
+    if (streams[i].bands.pixels && streams[i].image == src.image) s = &streams[i];
+  }
+  if (!s) {
+    // the least recently used one for another picture
+    s = &streams[0];
+    for (int i = 1; i < TILE_CACHE_STREAMS; i++) {
+      if (streams[i].last_use < s->last_use) s = &streams[i];
+    }
+  }
+  s->last_use = ++use_clock;
+
+  jpeg_bands& b = s->bands;
+  if (!b.pixels || s->image != src.image || y < b.y) {
+    if (!start_stream(*s, src)) return NULL;
+  }
+  while (b.h == 0 || y >= b.y + b.h) {
+    if (b.row >= b.rows) return NULL;
+    uint32_t start = micros();
+    if (jpeg_band_next(*s->dec, b) != JPEG_OK) {
+      stop_stream(*s);
+      return NULL;
+    }
+    uint32_t decode_us = micros() - start;
+    stats.decode_us += decode_us;
+    stats.misses++;
+    if (s->cacheable) {
+      insert(src.image, b.row - 1, 1, 0, b.y, b.width, b.h, b.pixels, decode_us);
+      if (b.row == b.rows) mark_complete(src.image, 1, b.rows);
+    }
+  }
+  return s;
+}
+
+
+static void copy_line(const uint16_t* line, uint16_t line_w, uint16_t* out, uint16_t width)
+{
+  uint16_t n = min<uint16_t>(width, line_w);
+  memcpy(out, line, n * sizeof(uint16_t));
+  for (uint16_t x = n; x < width; x++) out[x] = 0;
+}
+
+
+void cached_jpeg_row(void* user, int16_t y, uint16_t* out, uint16_t width)
+{
+  const cached_jpeg_source* src = (const cached_jpeg_source*)user;
+
+  // tiles in the cache are used even if others of the picture were dropped
+  tile_entry* e = find_line(src->image, 1, y);
+  if (e) {
+    if (y == e->y) hit(*e);
+    copy_line(e->pixels + (uint32_t)(y - e->y) * e->w, e->w, out, width);
+    return;
+  }
+  tile_stream* s = stream_line(*src, y);
+  if (s) {
+    const jpeg_bands& b = s->bands;
+    copy_line(b.pixels + (uint32_t)(y - b.y) * b.width, b.width, out, width);
+    return;
+  }
+  memset(out, 0, width * sizeof(uint16_t));
+}
+
+
+// ---------------------------------------------------------------------------
+
+const tile_cache_stats& tile_cache_get_stats()
+{
+  return stats;
+}
+
+
+void tile_cache_reset_stats()
+{
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+  stats.decode_us = 0;
+  stats.saved_us = 0;
+}
+
+
+#ifdef ARDUINO
+void tile_cache_print_stats(Print& out)
+{
+  uint32_t lookups = stats.hits + stats.misses;
+  out.printf("tile cache: %lu tiles, %lu of %lu bytes in %s\n", (unsigned long)stats.tiles,
+             (unsigned long)stats.bytes, (unsigned long)stats.budget, stats.psram ? "PSRAM" : "internal RAM");
+  out.printf("hits %lu, misses %lu (%lu%% hits), evictions %lu\n", (unsigned long)stats.hits,
+             (unsigned long)stats.misses, lookups ? (unsigned long)(100ULL * stats.hits / lookups) : 0UL,
+             (unsigned long)stats.evictions);
+  out.printf("decoding %lu ms, saved by the cache %lu ms\n", (unsigned long)(stats.decode_us / 1000),
+             (unsigned long)(stats.saved_us / 1000));
+}
+#endif
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Convert an image sequence or animated GIF into a delta-frame animation.
+
+Usage:
+    python anim_encoder.py <name> <input> [<input> ...] [--size 170x320] [--frame-ms 50]
+
+Inputs are either one animated GIF or several pictures (frames in the given
+order). Writes <name>.h with the animation as byte array for anim_open()
+(see include/anim_player.h for the format). Needs Pillow.
+"""
+
+import argparse
+import struct
+import sys
+
+from PIL import Image, ImageSequence
+
+BAND_LINES = 8       # changes are searched in bands of this many lines
+MERGE_WASTE = 1.25   # merge bands if the union is at most this much bigger
+
+
+def rgb565_be(r, g, b):
+    c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+    return c >> 8, c & 0xFF
+
+
+def load_frames(inputs, size):
+    frames = []
+    durations = []
+    for path in inputs:
+        img = Image.open(path)
+        for frame in ImageSequence.Iterator(img):
+            durations.append(frame.info.get("duration", 0))
+            frame = frame.convert("RGB")
+            if size:
+                frame = frame.resize(size, Image.LANCZOS)
+            elif frames and frame.size != (width, height):
+                sys.exit("%s: all frames need the same size, use --size" % path)
+            width, height = frame.size
+            rgb = frame.tobytes()
+            frames.append([rgb565_be(*rgb[i : i + 3]) for i in range(0, len(rgb), 3)])
+    return frames, durations, width, height
+
+
+def changed_rects(prev, cur, width, height):
+    """Rectangles (x, y, w, h) that cover all pixels that differ"""
+    bands = []
+    for top in range(0, height, BAND_LINES):
+        x0, x1, y0, y1 = width, -1, height, -1
+        for y in range(top, min(top + BAND_LINES, height)):
+            row = y * width
+            for x in range(width):
+                if prev[row + x] != cur[row + x]:
+                    x0 = min(x0, x)
+                    x1 = max(x1, x)
+                    y0 = min(y0, y)
+                    y1 = max(y1, y)
+        if x1 >= 0:
+            bands.append([x0, y0, x1, y1])
+
+    # merge bands that touch when that does not add too many pixels
+    rects = []
+    for b in bands:
+        if rects:
+            r = rects[-1]
+            if b[1] == r[3] + 1:
+                union = (max(r[2], b[2]) - min(r[0], b[0]) + 1) * (b[3] - r[1] + 1)
+                areas = (r[2] - r[0] + 1) * (r[3] - r[1] + 1) + (b[2] - b[0] + 1) * (b[3] - b[1] + 1)
+                if union <= areas * MERGE_WASTE:
+                    rects[-1] = [min(r[0], b[0]), r[1], max(r[2], b[2]), b[3]]
+                    continue
+        rects.append(b)
+    return [(x0, y0, x1 - x0 + 1, y1 - y0 + 1) for x0, y0, x1, y1 in rects]
+
+
+def rle(pixels):
+    out = bytearray()
+    literal = []
+
+    def flush():
+        while literal:
+            chunk = literal[:128]
+            del literal[:128]
+            out.append(len(chunk) - 1)
+            for p in chunk:
+                out.extend(p)
+
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while i + run < len(pixels) and run < 128 and pixels[i + run] == pixels[i]:
+            run += 1
+        if run >= 3:
+            flush()
+            out.append(127 + run)
+            out.extend(pixels[i])
+        else:
+            literal.extend(pixels[i : i + run])
+        i += run
+    flush()
+    return out
+
+
+def record(frame, rects, width):
+    out = bytearray(struct.pack("<H", len(rects)))
+    for x, y, w, h in rects:
+        out += struct.pack("<HHHH", x, y, w, h)
+        pixels = [frame[(y + j) * width + x + i] for j in range(h) for i in range(w)]
+        out += rle(pixels)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("name")
+    parser.add_argument("inputs", nargs="+")
+    parser.add_argument("--size", default=None, help="resize to WxH, e.g. 170x320")
+    parser.add_argument("--frame-ms", type=int, default=None,
+                        help="time per frame, default from the GIF or 50")
+    args = parser.parse_args()
+
+    size = tuple(int(v) for v in args.size.lower().split("x")) if args.size else None
+    frames, durations, width, height = load_frames(args.inputs, size)
+    frame_ms = args.frame_ms or (durations[0] if durations[0] else 50)
+
+    data = bytearray()
+    data += record(frames[0], [(0, 0, width, height)], width)
+    loop_offset = 16 + len(data)
+    pixels_sent = 0
+    n = len(frames)
+    for i in range(1, n + 1):
+        prev, cur = frames[i - 1], frames[i % n]
+        rects = changed_rects(prev, cur, width, height) if n > 1 else []
+        pixels_sent += sum(w * h for _, _, w, h in rects)
+        data += record(cur, rects, width)
+    header = b"ANM1" + struct.pack("<HHHHI", width, height, n, frame_ms, loop_offset)
+    data = header + data
+
+    name = args.name
+    with open(name + ".h", "w") as out:
+        out.write("#pragma once\n\n#include <stdint.h>\n\n")
+        out.write("// %dx%d, %d frames of %d ms, generated by anim_encoder.py\n"
+                  % (width, height, n, frame_ms))
+        out.write("const uint8_t %s[] = {\n" % name)
+        for i in range(0, len(data), 24):
+            out.write("  " + ", ".join("0x%02x" % b for b in data[i : i + 24]) + ",\n")
+        out.write("};\n")
+
+    full = width * height * 2
+    print("%s.h: %d frames in %d bytes, %.2f full images (%d bytes each), "
+          "%.0f changed pixels per frame"
+          % (name, n, len(data), len(data) / full, full, pixels_sent / max(n, 1)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
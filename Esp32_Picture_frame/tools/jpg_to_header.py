@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Convert a photo into a baseline JPEG byte array for the picture frame.
+
+Usage:
+    python jpg_to_header.py <input> <name> [--size 170x320] [--quality 85]
+
+The picture is re-encoded as baseline JPEG with 4:2:0 sampling (the decoder
+in src/jpeg_decoder.cpp does not read progressive files) and written to
+<name>.h as a const uint8_t array. Needs Pillow.
+"""
+
+import argparse
+import io
+import sys
+
+from PIL import Image
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input")
+    parser.add_argument("name")
+    parser.add_argument("--size", default=None, help="resize to WxH, e.g. 170x320")
+    parser.add_argument("--quality", type=int, default=85)
+    args = parser.parse_args()
+
+    img = Image.open(args.input).convert("RGB")
+    if args.size:
+        w, h = (int(v) for v in args.size.lower().split("x"))
+        img = img.resize((w, h), Image.LANCZOS)
+
+    buf = io.BytesIO()
+    img.save(buf, "JPEG", quality=args.quality, subsampling=2, progressive=False, optimize=True)
+    data = buf.getvalue()
+
+    name = args.name
+    with open(name + ".h", "w") as out:
+        out.write("#pragma once\n\n#include <stdint.h>\n\n")
+        out.write("// %dx%d baseline JPEG, quality %d, generated by jpg_to_header.py\n"
+                  % (img.size[0], img.size[1], args.quality))
+        out.write("const uint8_t %s[] = {\n" % name)
+        for i in range(0, len(data), 24):
+            out.write("  " + ", ".join("0x%02x" % b for b in data[i : i + 24]) + ",\n")
+        out.write("};\n")
+
+    print("%s.h: %d bytes instead of %d as RGB565"
+          % (name, len(data), img.size[0] * img.size[1] * 2), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Convert a picture into a palette-indexed image for the picture frame.
+
+Usage:
+    python png_to_indexed.py <input> <name> [--bits 8|4] [--size 170x320]
+
+Writes <name>.h containing a RGB565 palette, the packed indices and an
+indexed_image descriptor (see include/indexed_image.h). Needs Pillow.
+"""
+
+import argparse
+import sys
+
+from PIL import Image
+
+
+def rgb565(r, g, b):
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input")
+    parser.add_argument("name")
+    parser.add_argument("--bits", type=int, choices=(8, 4), default=8)
+    parser.add_argument("--size", default=None, help="resize to WxH, e.g. 170x320")
+    args = parser.parse_args()
+
+    img = Image.open(args.input).convert("RGB")
+    if args.size:
+        w, h = (int(v) for v in args.size.lower().split("x"))
+        img = img.resize((w, h), Image.LANCZOS)
+
+    colors = 256 if args.bits == 8 else 16
+    img = img.quantize(colors=colors, method=Image.MEDIANCUT, dither=Image.FLOYDSTEINBERG)
+    width, height = img.size
+    raw_palette = img.getpalette()[: colors * 3]
+    used = img.getextrema()[1] + 1
+    palette = [rgb565(*raw_palette[i * 3 : i * 3 + 3]) for i in range(used)]
+
+    data = []
+    pixels = img.load()
+    for y in range(height):
+        if args.bits == 8:
+            data.extend(pixels[x, y] for x in range(width))
+        else:
+            for x in range(0, width, 2):
+                hi = pixels[x, y]
+                lo = pixels[x + 1, y] if x + 1 < width else 0
+                data.append((hi << 4) | lo)
+
+    name = args.name
+    with open(name + ".h", "w") as out:
+        out.write("#pragma once\n\n#include \"indexed_image.h\"\n\n")
+        out.write("// %dx%d, %d bit, %d colours, generated by png_to_indexed.py\n"
+                  % (width, height, args.bits, used))
+        out.write("const uint16_t %s_palette[] = {\n" % name)
+        for i in range(0, len(palette), 12):
+            out.write("  " + ", ".join("0x%04x" % c for c in palette[i : i + 12]) + ",\n")
+        out.write("};\n\n")
+        out.write("const uint8_t %s_pixels[] = {\n" % name)
+        for i in range(0, len(data), 24):
+            out.write("  " + ", ".join("0x%02x" % b for b in data[i : i + 24]) + ",\n")
+        out.write("};\n\n")
+        out.write("const indexed_image %s = { %d, %d, %d, %d, %s_palette, %s_pixels };\n"
+                  % (name, width, height, args.bits, used, name, name))
+
+    rgb_bytes = width * height * 2
+    idx_bytes = len(data) + len(palette) * 2
+    print("%s.h: %d bytes instead of %d (%.1fx smaller)"
+          % (name, idx_bytes, rgb_bytes, rgb_bytes / idx_bytes), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
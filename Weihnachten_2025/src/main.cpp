@@ -6,30 +6,70 @@
 
 // Load Wi-Fi library
 #include <WiFi.h>
+#include <gpio_table.h>
+#include <http_core.h>
 
 // Replace with your network credentials
 const char* ssid     = "ESP32-Access-Point";
 const char* password = "123456789";
 
-// Set web server port number to 80
-WiFiServer server(80);
+// Outputs that can be switched from the web page: pin, name in the URL,
+// active low, initial state. Add relay channels here, nothing else to change.
+const gpio_output outputs[] = {
+  { 26, "26", false, false },
+  { 27, "27", false, false },
+};
+gpio_table gpio = GPIO_TABLE(outputs);
 
-// Variable to store the HTTP request
-String header;
+// Switches the GPIOs (/26/on, /26/off or several at once with
+// /gpio?on=26,27&off=..., all in the same moment) and shows the page
+void handle_page(http_request& req, http_response& res)
+{
+  char line[160];
+  gpio_table_handle_request(gpio, http_request_line(req, line, sizeof(line)));
 
-// Auxiliar variables to store the current output state
-String output26State = "off";
-String output27State = "off";
+  // Display the HTML web page
+  res.println("<!DOCTYPE html><html>");
+  res.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  res.println("<link rel=\"icon\" href=\"data:,\">");
+  // CSS to style the on/off buttons 
+  // Feel free to change the background-color and font-size attributes to fit your preferences
+  res.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
+  res.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
+  res.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
+  res.println(".button2 {background-color: #555555;}</style></head>");
+  
+  // Web Page Heading
+  res.println("<body><h1>ESP32 Web Server</h1>");
+  
+  // Display current state, and ON/OFF buttons for every output
+  gpio_table_print_buttons(gpio, res);
+  res.println("</body></html>");
+}
+
+extern http_server web;
 
-// Assign output variables to GPIO pins
-const int output26 = 26;
-const int output27 = 27;
+// Web server and loop() timing as text, for the load test
+// (lib/HttpCore/bench/http_load.cpp). ?clear=1 starts a new measurement.
+void handle_stats(http_request& req, http_response& res)
+{
+  http_status(res, 200, "text/plain");
+  http_print_stats(web, res);
+  if (http_query_int(req, "clear", 0)) http_clear_stats(web);
+}
+
+// Web server on port 80, see http_core.h
+const http_route routes[] = {
+  { HTTP_GET, "/stats", handle_stats },
+  { HTTP_GET, "*", handle_page },
+};
+http_server web = HTTP_SERVER(routes);
 
 void setup() {
   #if 0
   Serial.begin(115200);
-  // Initialize the output variables as outputs
- 
+  // Initialize the outputs of the table with their initial state
+  gpio_table_begin(gpio);
 
   // Connect to Wi-Fi network with SSID and password
   Serial.print("Setting AP (Access Point)…");
@@ -41,103 +81,14 @@ void setup() {
 
   Serial.print("AP IP address: ");
   Serial.println(IP);
+  web.log = &Serial;                 // one line per request
   #endif  
-  server.begin();
+  http_server_begin(web, 80);
 }
 
 void loop(){
   #if 0
-  WiFiClient client = server.accept();   // Listen for incoming clients
-
-  if (client) {                             // If a new client connects,
-    Serial.println("New Client.");          // print a message out in the serial port
-    String currentLine = "";                // make a String to hold incoming data from the client
-    while (client.connected()) {            // loop while the client's connected
-      if (client.available()) {             // if there's bytes to read from the client,
-        char c = client.read();             // read a byte, then
-        Serial.write(c);                    // print it out the serial monitor
-        header += c;
-        if (c == '\n') {                    // if the byte is a newline character
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so send a response:
-          if (currentLine.length() == 0) {
-            // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-            // and a content-type so the client knows what's coming, then a blank line:
-            client.println("HTTP/1.1 200 OK");
-            client.println("Content-type:text/html");
-            client.println("Connection: close");
-            client.println();
-            
-            // turns the GPIOs on and off
-            if (header.indexOf("GET /26/on") >= 0) {
-              Serial.println("GPIO 26 on");
-              output26State = "on";
-              digitalWrite(output26, HIGH);
-            } else if (header.indexOf("GET /26/off") >= 0) {
-              Serial.println("GPIO 26 off");
-              output26State = "off";
-              digitalWrite(output26, LOW);
-            } else if (header.indexOf("GET /27/on") >= 0) {
-              Serial.println("GPIO 27 on");
-              output27State = "on";
-              digitalWrite(output27, HIGH);
-            } else if (header.indexOf("GET /27/off") >= 0) {
-              Serial.println("GPIO 27 off");
-              output27State = "off";
-              digitalWrite(output27, LOW);
-            }
-            
-            // Display the HTML web page
-            client.println("<!DOCTYPE html><html>");
-            client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-            client.println("<link rel=\"icon\" href=\"data:,\">");
-            // CSS to style the on/off buttons 
-            // Feel free to change the background-color and font-size attributes to fit your preferences
-            client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-            client.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
-            client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-            client.println(".button2 {background-color: #555555;}</style></head>");
-            
-            // Web Page Heading
-            client.println("<body><h1>ESP32 Web Server</h1>");
-            
-            // Display current state, and ON/OFF buttons for GPIO 26  
-            client.println("<p>GPIO 26 - State " + output26State + "</p>");
-            // If the output26State is off, it displays the ON button       
-            if (output26State=="off") {
-              client.println("<p><a href=\"/26/on\"><button class=\"button\">ON</button></a></p>");
-            } else {
-              client.println("<p><a href=\"/26/off\"><button class=\"button button2\">OFF</button></a></p>");
-            } 
-               
-            // Display current state, and ON/OFF buttons for GPIO 27  
-            client.println("<p>GPIO 27 - State " + output27State + "</p>");
-            // If the output27State is off, it displays the ON button       
-            if (output27State=="off") {
-              client.println("<p><a href=\"/27/on\"><button class=\"button\">ON</button></a></p>");
-            } else {
-              client.println("<p><a href=\"/27/off\"><button class=\"button button2\">OFF</button></a></p>");
-            }
-            client.println("</body></html>");
-            
-            // The HTTP response ends with another blank line
-            client.println();
-            // Break out of the while loop
-            break;
-          } else { // if you got a newline, then clear currentLine
-            currentLine = "";
-          }
-        } else if (c != '\r') {  // if you got anything else but a carriage return character,
-          currentLine += c;      // add it to the end of the currentLine
-        }
-      }
-    }
-    // Clear the header variable
-    header = "";
-    // Close the connection
-    client.stop();
-    Serial.println("Client disconnected.");
-    Serial.println("");
-  }
+  // Serve the web page, never waits for a client
+  http_server_poll(web);
   #endif
-}
\ No newline at end of file
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// History of what the controller did (timer triggers, resets, RTC sets,
+// saved changes), kept in a small flash partition over restarts.
+//
+// Records of EVENT_LOG_RECORD bytes: unix time, event code, 16 bit
+// argument and a check byte. The partition is a ring of 4 KB sectors, each
+// starts with a header (sequence number, time of its first record) and is
+// filled in order. When the newest sector is full the oldest one is erased
+// and becomes the newest, so every sector is erased equally often (one
+// erase per EVENT_LOG_PER_SECTOR records). 16 KB hold ~2000 events, a few
+// months at some dozen a day.
+//
+// Adding an event only queues it in RAM, event_log_service() writes the
+// queue from loop() every EVENT_LOG_FLUSH_MS, so check_timers() and the
+// HTTP handlers never wait for the flash.
+//
+// Times only go forward in the log if the RTC does: a query finds its
+// start by binary search over the sector headers, then over the records of
+// that sector.
+//
+// The flash is an interface: the "evlog" partition on the device, RAM in
+// src/host.
+
+#define EVENT_LOG_SECTOR 4096
+#define EVENT_LOG_RECORD 8
+#define EVENT_LOG_HEADER 16
+#define EVENT_LOG_PER_SECTOR ((EVENT_LOG_SECTOR - EVENT_LOG_HEADER) / EVENT_LOG_RECORD)
+#define EVENT_LOG_QUEUE 32            // events between two flushes
+#define EVENT_LOG_FLUSH_MS 10000      // queued events are written after
+#define EVENT_LOG_VERSION 1
+
+// Event codes, the argument in ()
+#define EVENT_BOOT 1                  // (reset reason)
+#define EVENT_TIMER_ON 2              // (timer pair)
+#define EVENT_TIMER_OFF 3             // (timer pair)
+#define EVENT_RTC_SET 4               // (jump in minutes, signed), time is the new one
+#define EVENT_SAVE 5                  // (CHANGE_ bits written to NVS)
+#define EVENT_RESET 6                 // (0 web, 1 serial) default parameters
+#define EVENT_LOST 7                  // (events dropped, queue was full)
+#define EVENT_CODES 8
+
+extern const char* const event_names[EVENT_CODES];
+
+struct event_record {
+  uint32_t time;                      // unix seconds
+  uint8_t code;
+  uint16_t arg;
+};
+
+// Flash of whole sectors. Erased bytes are 0xFF, a write only clears bits.
+struct event_flash {
+  uint32_t size;                      // multiple of EVENT_LOG_SECTOR
+  bool (*read)(const event_flash& f, uint32_t addr, void* buf, size_t len);
+  bool (*write)(const event_flash& f, uint32_t addr, const void* buf, size_t len);
+  bool (*erase)(const event_flash& f, uint32_t addr);   // the sector at addr
+  void* ctx;
+};
+
+struct event_log {
+  const event_flash* flash;           // NULL: events are dropped
+  uint16_t sectors;
+  int16_t head;                       // sector written to, -1 while empty
+  uint16_t next;                      // free record in head
+  uint16_t used;                      // sectors with records
+  uint32_t seq;                       // of head
+  event_record queue[EVENT_LOG_QUEUE];
+  uint8_t queued;
+  uint32_t queued_ms;                 // first event in the queue
+  uint16_t lost;                      // not queued since the last flush
+  uint32_t erases;                    // since begin
+};
+
+// Finds the newest sector and the end of its records. False if the flash
+// has less than 2 sectors.
+bool event_log_begin(event_log& log, const event_flash* flash);
+
+// Queues the event, no flash access
+void event_log_add(event_log& log, uint32_t time, uint8_t code, uint16_t arg, uint32_t now_ms);
+
+// Call from loop(): writes the queue when EVENT_LOG_FLUSH_MS are over or it
+// is half full. True if it wrote.
+bool event_log_service(event_log& log, uint32_t now_ms);
+bool event_log_flush(event_log& log);
+
+// Records in flash now, and how many fit
+uint32_t event_log_count(const event_log& log);
+uint32_t event_log_capacity(const event_log& log);
+
+// Events from a time on, oldest first, then the ones still queued
+struct event_log_reader {
+  uint32_t from;
+  uint16_t order;                     // sectors since the oldest
+  uint16_t count;                     // sectors in use
+  uint16_t slot;
+  uint16_t buf_first;                 // slot of buf[0]
+  uint8_t buf_len;                    // records in buf, 0 = empty
+  uint8_t queue_index;
+  uint8_t buf[32 * EVENT_LOG_RECORD];
+  uint32_t reads;                     // flash reads, for the host test
+};
+
+void event_log_find(const event_log& log, event_log_reader& r, uint32_t from);
+
+// False at the end
+bool event_log_next(const event_log& log, event_log_reader& r, event_record& e);
+
+#ifdef ARDUINO
+// The data partition with this label (partitions.csv), false if there is none
+bool event_flash_partition(event_flash& f, const char* label);
+#endif
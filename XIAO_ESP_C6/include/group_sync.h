@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_color.h"
+
+// Group mode: several controllers in one shop window switch together.
+//
+// The leader sends a beacon by UDP multicast: its clock (unix ms) and the
+// current state of the strip with the group time to apply it. A change is
+// scheduled GROUP_APPLY_DELAY_MS ahead, the leader itself applies it at that
+// time too, so all of them switch in the same millisecond if the clocks
+// agree. The beacon always carries the last state, a follower that missed
+// a change (or starts later) applies it with the next one.
+//
+// Followers discipline their RTC with the beacons: the offset leader - local
+// at receipt is late by the network delay, never early, so the largest
+// offset of the last GROUP_SAMPLES beacons is the best estimate. Large
+// errors set the clock, small ones are corrected in steps of at most
+// GROUP_SLEW_MS per beacon.
+//
+// Only encoding and the clock filter live here, the network is the
+// caller's (WiFiUDP on the device, sockets in src/host).
+
+#define GROUP_PORT 4210
+#define GROUP_ADDRESS 239, 1, 2, 3
+#define GROUP_BEACON_MS 1000          // beacon interval
+#define GROUP_PENDING_BEACON_MS 100   // while a change is scheduled
+#define GROUP_APPLY_DELAY_MS 300      // change applied this long after scheduling
+#define GROUP_SAMPLES 8               // offset filter window
+#define GROUP_STEP_MS 500             // larger errors: set the clock
+#define GROUP_SLEW_MS 20              // else at most this correction per beacon
+#define GROUP_BEACON_SIZE 38
+#define GROUP_VERSION 1
+
+struct group_state {
+  uint16_t seq;                       // new with every scheduled change
+  uint64_t apply_ms;                  // group time (unix ms) to apply it
+  uint32_t fade_ms;                   // brightness fade
+  uint8_t brightness;                 // 0..100 %
+  led_color_setting color;
+};
+
+struct group_beacon {
+  uint8_t group;                      // controllers of other groups ignore it
+  uint16_t seq;                       // beacon number
+  uint64_t time_ms;                   // leader clock when sent
+  group_state state;
+};
+
+// GROUP_BEACON_SIZE bytes, 0 if size is too small
+size_t group_encode(const group_beacon& b, uint8_t* out, size_t size);
+
+// false if it is no beacon (magic, version, length)
+bool group_decode(group_beacon& b, const uint8_t* in, size_t len);
+
+struct group_clock {
+  int32_t sample[GROUP_SAMPLES];      // leader - local in ms, relative to the corrected clock
+  uint8_t count;
+  uint8_t next;
+  bool synced;
+  int32_t error;                      // estimate before the last correction
+  uint32_t beacons;
+  uint32_t steps;                     // clock set instead of slewed
+};
+
+void group_clock_reset(group_clock& c);
+
+// offset = leader time of the beacon - local time at receipt. Returns the
+// correction to add to the local clock.
+int64_t group_clock_sample(group_clock& c, int64_t offset_ms);
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Where loop() allocates from the heap. Blocks freed again in another
+// order than allocated leave holes, after days the largest free block is
+// smaller than a request needs although enough is free. The request and
+// render paths must not allocate in steady state.
+//
+// Always on: the free heap and the largest free block, sampled every
+// HEAP_SAMPLE_EVERY_MS. The lowest values of each HEAP_SAMPLE_MS go into a
+// history of HEAP_HISTORY entries (24 h), GET /heap prints it.
+//
+// With -DHEAP_TRACK_ENABLED=1 (env seeed_xiao_esp32_c6_heap, which wraps
+// malloc, calloc, realloc and free at link time, so new and String are
+// counted too) every allocation is counted in the innermost region open in
+// loop(): the trace points of trace.h are the regions, and each request is
+// one, named by its route. Per region: how often it ran, allocations,
+// bytes, the most allocations in one pass and how far the heap use rose in
+// one pass. Allocations outside of all regions count as "loop", those of
+// other tasks (WiFi, lwIP) as "other tasks". The allocation sites are the
+// return addresses of the calls (String allocates in WString.cpp, the
+// region tells whose String it was), the HEAP_SITES most frequent are kept:
+//
+//   riscv32-esp-elf-addr2line -pfiaC -e .pio/build/seeed_xiao_esp32_c6_heap/firmware.elf 0x42001234
+//
+// GET /heap?clear=1 starts a new count, e.g. after the page is loaded: the
+// counts of the render and request regions then have to stay 0.
+// Allocations in loop() are also trace marks "malloc" in GET /api/trace.
+
+#ifndef HEAP_TRACK_ENABLED
+#define HEAP_TRACK_ENABLED 0
+#endif
+
+#define HEAP_REGIONS 32                 // names, "loop" and "other tasks" included
+#define HEAP_SITES 24
+#define HEAP_DEPTH 8                    // nested regions
+#define HEAP_HISTORY 48
+#define HEAP_SAMPLE_MS 1800000          // per history entry
+#define HEAP_SAMPLE_EVERY_MS 10000      // the largest block walks the heap, not too often
+
+#define HEAP_REGION_LOOP 0
+#define HEAP_REGION_OTHER 1
+
+struct heap_region {
+  const char* name;                     // pointer compared, string constants
+  uint32_t passes;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t bytes;
+  uint32_t max_allocs;                  // in one pass
+  uint32_t peak;                        // rise of the heap use in one pass
+};
+
+struct heap_site {
+  uintptr_t pc;
+  uint8_t region;                       // the site is counted per region
+  uint32_t allocs;
+  uint32_t bytes;
+};
+
+struct heap_level {
+  uint8_t region;
+  int32_t live_start;
+  int32_t high;
+  uint32_t allocs;
+};
+
+struct heap_sample {
+  uint32_t free_min;
+  uint32_t largest_min;
+};
+
+struct heap_stats {
+  heap_region regions[HEAP_REGIONS];
+  uint8_t region_count;
+  uint32_t regions_missed;              // allocations of regions without a slot, in "loop"
+  heap_site sites[HEAP_SITES];
+  uint8_t site_count;
+  uint32_t sites_missed;
+  heap_level stack[HEAP_DEPTH];
+  uint8_t depth;                        // may be over HEAP_DEPTH, those are not counted
+  int32_t live;                         // bytes allocated and not freed since the start
+  int32_t live_max;
+  uint32_t allocs;
+  uint32_t frees;
+
+  heap_sample history[HEAP_HISTORY];    // ring, newest at (samples - 1)
+  uint32_t samples;
+  heap_sample current;                  // of the running HEAP_SAMPLE_MS
+  heap_sample lowest;                   // since the start
+  uint32_t current_ms;                  // start of current, 0 = none
+  uint32_t free_now;
+  uint32_t largest_now;
+};
+
+extern heap_stats heap;
+
+// Called by trace_record(): TRACE_PHASE_BEGIN opens a region, END closes it
+void heap_track_trace(const char* name, uint8_t phase);
+
+// An allocation of size bytes by the code at pc, in the current region or
+// in "other tasks". The wrappers call it, the host tool directly.
+void heap_track_alloc(size_t size, uintptr_t pc, bool other_task);
+void heap_track_free(size_t size, bool other_task);
+
+// New count: regions, sites and totals, not the open regions and history
+void heap_track_clear();
+
+// Free heap and largest free block now
+void heap_track_sample(uint32_t now_ms, uint32_t free_bytes, uint32_t largest);
+
+// Up to n sites with the most allocations, most first
+uint8_t heap_track_top(const heap_site** out, uint8_t n);
+
+#if HEAP_TRACK_ENABLED && defined(ARDUINO)
+// From setup(): allocations of this task count in the regions
+void heap_track_begin();
+#endif
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Color model for the LED strip.
+//
+// Colors come in as RGB, HSV or a color temperature (Kelvin). All of them
+// end up in linear light with 16 bits per channel: the gamma curve, the white
+// balance of the strip and the brightness are one table per channel
+// (8 bit input -> 16 bit linear), rebuilt only when brightness or balance
+// change. The 16 bit value is rounded to the 8 bits of the LED only at the
+// very end. Adafruit_NeoPixel::setBrightness() instead scales the already
+// 8 bit values, so a dim strip has only a handful of levels left per channel
+// and the colors shift.
+//
+// At low brightness 8 bits are too few (a fade steps, dim colors shift): the
+// dither stage keeps a 16 bit frame and spreads the rest below one LED step
+// over the following frames (temporal error diffusion), so the average light
+// has 16 bit resolution. That needs frames at a high rate, a few hundred per
+// second, but only while there is a rest to spread.
+//
+// Per pixel it's a few table lookups and multiplications without branches,
+// cheap enough for hundreds of LEDs at 60 fps (host benchmark: pio run -e
+// native).
+//
+// Example:
+//   led_color_model model;
+//   led_color_begin(model, NEO_GRB);
+//   led_color_set_brightness(model, 0x4000);          // 25%
+//   uint8_t* out = pixels.getPixels();
+//   led_hsv hsv = { 512, 255, 255 };                   // green
+//   led_color_write(model, led_color_hsv(model, hsv), out);
+//   pixels.show();                                     // no setBrightness()
+
+#define LED_GAMMA 2.2f
+#define LED_HUE_MAX 1536          // hue 0..1535, 256 steps per sixth
+#define LED_KELVIN_MIN 1000
+#define LED_KELVIN_MAX 12000
+#define LED_KELVIN_STEP 100
+
+struct led_rgb16 {
+  uint16_t r, g, b;               // linear light, 65535 = full
+};
+
+struct led_hsv {
+  uint16_t h;                     // 0..LED_HUE_MAX-1: 0 red, 512 green, 1024 blue
+  uint8_t s;
+  uint8_t v;
+};
+
+// A color as it is set by the user (web page, NVS), hue in degrees
+#define LED_COLOR_RGB 0
+#define LED_COLOR_HSV 1
+#define LED_COLOR_KELVIN 2
+
+struct led_color_setting {
+  uint8_t mode;                   // LED_COLOR_RGB, LED_COLOR_HSV, LED_COLOR_KELVIN
+  uint8_t red, green, blue;
+  uint16_t hue;                   // 0..359
+  uint8_t sat;
+  uint16_t kelvin;                // LED_KELVIN_MIN..LED_KELVIN_MAX
+};
+
+struct led_color_model {
+  uint16_t lut[3][256];           // 8 bit sRGB -> linear, with balance and brightness
+  uint16_t scale[3];              // balance * brightness for linear input (Kelvin)
+  uint16_t balance[3];            // white balance of the strip, 65535 = 1.0
+  uint16_t brightness;            // 65535 = full
+  uint8_t offset[3];              // byte of r, g, b in the pixel buffer
+};
+
+// type: Adafruit_NeoPixel type (NEO_GRB, NEO_RGB ...) for the byte order
+void led_color_begin(led_color_model& m, uint8_t type);
+
+// White balance of the strip: the measured r, g, b that give neutral white,
+// e.g. 255, 210, 170 for a strip with a strong blue
+void led_color_set_balance(led_color_model& m, uint8_t r, uint8_t g, uint8_t b);
+
+// 0..65535, applied in linear light before rounding to 8 bit
+void led_color_set_brightness(led_color_model& m, uint16_t brightness);
+
+// 8 bit sRGB (as on the web page) -> linear
+inline led_rgb16 led_color_rgb(const led_color_model& m, uint8_t r, uint8_t g, uint8_t b)
+{
+  return { m.lut[0][r], m.lut[1][g], m.lut[2][b] };
+}
+
+// HSV -> 8 bit sRGB, without branches (hue sixths by min/max arithmetic)
+inline void led_hsv_to_rgb8(const led_hsv& hsv, uint8_t& r, uint8_t& g, uint8_t& b)
+{
+  uint32_t s = hsv.s + (hsv.s >> 7);          // 0..256
+  uint32_t v = hsv.v;
+  uint32_t channel[3];
+  // channel n = v * (1 - s * clamp(min(k, 4 - k), 0, 1)), k = (n + h / 60) mod 6
+  static const uint16_t n[3] = { 5 * 256, 3 * 256, 1 * 256 };
+  for (int c = 0; c < 3; c++) {
+    int32_t k = hsv.h + n[c];
+    k -= LED_HUE_MAX & -(int32_t)(k >= LED_HUE_MAX);
+    int32_t t = 1024 - k;
+    t = k + ((t - k) & ((t - k) >> 31));      // min(k, 4 - k)
+    t = 256 + ((t - 256) & ((t - 256) >> 31));  // min(.., 1)
+    t &= ~(t >> 31);                           // max(.., 0)
+    channel[c] = v - ((v * s * (uint32_t)t) >> 16);
+  }
+  r = channel[0];
+  g = channel[1];
+  b = channel[2];
+}
+
+inline led_rgb16 led_color_hsv(const led_color_model& m, const led_hsv& hsv)
+{
+  uint8_t r, g, b;
+  led_hsv_to_rgb8(hsv, r, g, b);
+  return led_color_rgb(m, r, g, b);
+}
+
+// White of a color temperature (LED_KELVIN_MIN..MAX), linear with balance
+// and brightness
+led_rgb16 led_color_kelvin(const led_color_model& m, uint16_t kelvin);
+
+// The setting in linear light, whichever mode it is in
+led_rgb16 led_color_of(const led_color_model& m, const led_color_setting& c);
+
+// Linear 16 bit -> 8 bit, rounded
+inline uint8_t led_quantize(uint16_t v)
+{
+  return (uint32_t)(v - (v >> 8) + 128) >> 8;
+}
+
+// One pixel into the strip buffer (3 bytes, in the order of the strip)
+inline void led_color_write(const led_color_model& m, led_rgb16 c, uint8_t* pixel)
+{
+  pixel[m.offset[0]] = led_quantize(c.r);
+  pixel[m.offset[1]] = led_quantize(c.g);
+  pixel[m.offset[2]] = led_quantize(c.b);
+}
+
+// A whole frame: count HSV pixels -> strip buffer
+void led_color_write_hsv(const led_color_model& m, const led_hsv* in, uint8_t* out, size_t count);
+
+// The same color for count pixels
+void led_color_fill(const led_color_model& m, led_rgb16 c, uint8_t* out, size_t count);
+
+
+// Temporal dithering. The caller owns the buffers (3 values per pixel):
+//   static uint16_t frame[LEDS * 3];
+//   static uint8_t error[LEDS * 3];
+//   led_dither dither;
+//   led_dither_begin(dither, frame, error, LEDS);
+//   led_dither_set(dither, i, led_color_hsv(model, hsv));     // when it changes
+//   bool again = led_dither_write(dither, model, level, pixels.getPixels());
+//   pixels.show();                                            // again: next frame soon
+struct led_dither {
+  uint16_t* frame;                // linear r, g, b per pixel
+  uint8_t* error;                 // rest below one LED step per channel
+  size_t count;
+  uint32_t sum[3];                // of frame per channel, kept by led_dither_set (led_power.h)
+};
+
+void led_dither_begin(led_dither& d, uint16_t* frame, uint8_t* error, size_t count);
+
+inline void led_dither_set(led_dither& d, size_t i, led_rgb16 c)
+{
+  uint16_t* p = d.frame + i * 3;
+  d.sum[0] += c.r - p[0];
+  d.sum[1] += c.g - p[1];
+  d.sum[2] += c.b - p[2];
+  p[0] = c.r;
+  p[1] = c.g;
+  p[2] = c.b;
+}
+
+inline void led_dither_fill(led_dither& d, led_rgb16 c)
+{
+  for (size_t i = 0; i < d.count; i++) led_dither_set(d, i, c);
+}
+
+// Frame * level (65535 = full, applied in 16 bit) into the strip buffer,
+// true if a rest is left, i.e. the next frames differ
+bool led_dither_write(led_dither& d, const led_color_model& m, uint16_t level, uint8_t* out);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_color.h"
+
+// Current limit of the strip, for power supplies smaller than full white.
+//
+// WS2812 style LEDs draw a fixed current per channel while it is on (PWM),
+// so the current of a frame is linear in the channel values:
+//   mA = LEDs * idle + sum over r, g, b of (channel sum / 65535) * level * full
+// led_dither_set() keeps the channel sums up to date per pixel, so the
+// estimate of a frame is three multiplications, not a pass over the strip.
+//
+// If a frame needs more than the budget its level is lowered at once (the
+// supply must not see it), when there is room again the limit comes back
+// over LED_POWER_RELEASE_MS: a smooth dimming, no flicker.
+
+#define LED_POWER_CHANNEL_UA 12000      // one channel at full, WS2812B
+#define LED_POWER_IDLE_UA 700           // per LED, all channels off
+#define LED_POWER_RELEASE_MS 1000       // limit from 0 back to none
+
+// Measured per strip type, kept in NVS
+struct led_power_calibration {
+  uint16_t channel_ua[3];               // r, g, b at full
+  uint16_t idle_ua;                     // per LED
+};
+
+struct led_power {
+  led_power_calibration cal;
+  uint16_t budget_ma;                   // 0 = no limit
+  uint16_t limit;                       // factor on the level, 65535 = none
+  uint16_t target;                      // limit that fits the last frame
+  uint32_t last_ms;
+  uint32_t estimate_ma;                 // last frame, with the limit
+  uint32_t limited_frames;
+};
+
+// Default calibration, no limit until a budget is set
+void led_power_begin(led_power& p);
+
+// Current of the frame in d at level (linear 0..65535), mA
+uint32_t led_power_estimate(const led_power& p, const led_dither& d, uint16_t level);
+
+// Level for the frame in d so it stays within the budget
+uint16_t led_power_apply(led_power& p, const led_dither& d, uint16_t level, uint32_t now_ms);
+
+// The limit is still coming back, the strip needs more frames
+inline bool led_power_releasing(const led_power& p)
+{
+  return p.limit < p.target;
+}
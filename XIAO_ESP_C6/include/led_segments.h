@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_color.h"
+#include "led_vm.h"
+
+// Segments: named index ranges of the strip, each with its own color,
+// brightness and effect. One controller drives several zones this way.
+//
+// The whole strip has the base color (nvm_params), segments are drawn on
+// top of it in their order, a later one wins where they overlap. All of it
+// goes into the 16 bit frame of the dither stage in one pass per frame.
+//
+// led_segment is also the NVS format (one blob, see led_segments_pack), so
+// only fixed size fields in it.
+
+#define LED_SEGMENTS_MAX 8
+#define LED_SEGMENT_NAME 10             // incl. 0
+#define LED_SEGMENTS_VERSION 1          // of the NVS blob
+
+// led_segment.flags
+#define LED_SEGMENT_ON 0x01
+#define LED_SEGMENT_REVERSE 0x02        // effect runs from the end
+#define LED_SEGMENT_MIRROR 0x04         // effect from the middle to both ends
+
+// led_segment.effect
+#define LED_EFFECT_SOLID 0
+#define LED_EFFECT_RAINBOW 1            // hue over the segment, moving
+#define LED_EFFECT_BREATHE 2            // color, brightness up and down
+#define LED_EFFECT_PROGRAM 3            // uploaded program (led_vm.h), else the color
+#define LED_EFFECTS 4
+
+struct led_segment {
+  char name[LED_SEGMENT_NAME];
+  uint16_t start;
+  uint16_t count;
+  uint8_t flags;
+  uint8_t effect;
+  uint8_t speed;                        // 0 = standing, 255 = fastest
+  uint8_t brightness;                   // 0..100 %
+  led_color_setting color;
+};
+
+// Runtime part, not stored
+struct led_segment_state {
+  uint16_t level;                       // brightness, linear 0..65535
+  uint32_t start_ms;                    // effect phase 0
+};
+
+struct led_segments {
+  led_segment seg[LED_SEGMENTS_MAX];
+  led_segment_state state[LED_SEGMENTS_MAX];
+  uint8_t count;
+};
+
+extern const char* const led_effect_names[LED_EFFECTS];
+
+void led_segments_clear(led_segments& s);
+
+// Index of the segment with this name, -1 if none
+int led_segments_find(const led_segments& s, const char* name);
+
+// After a change of seg[i] (brightness, effect): runtime state again
+void led_segments_changed(led_segments& s, int i, uint32_t now_ms);
+
+// Base color into the whole frame, then all segments that are on. The
+// program effect runs vm (may be NULL). True if an effect moves, i.e. the
+// next frame looks different.
+bool led_segments_render(const led_segments& s, const led_color_model& m, led_rgb16 base, led_dither& d,
+                         uint32_t now_ms, led_vm* vm);
+
+// Compact form for NVS: version, count and the segments, size in bytes
+size_t led_segments_pack(const led_segments& s, uint8_t* out, size_t size);
+
+// false if the blob is from another version or broken, s is empty then
+bool led_segments_unpack(led_segments& s, const uint8_t* in, size_t len, uint32_t now_ms);
+
+#define LED_SEGMENTS_BLOB (2 + LED_SEGMENTS_MAX * sizeof(led_segment))
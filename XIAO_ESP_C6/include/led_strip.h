@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_color.h"
+
+// The LED strip as a type: number of LEDs, color order (NEO_xxx of
+// Adafruit_NeoPixel.h) and output are template parameters, the buffers are
+// members of fixed size. The dither stage and the encoding of the bits for
+// the RMT peripheral then know all of it at compile time: the byte offsets
+// of r, g and b are constants, the channel and bit loops are unrolled and
+// without branches, the pixel loop has a constant count. led_dither_write()
+// and Adafruit_NeoPixel::show() look these up per pixel and bit, and show()
+// puts 32 bytes per LED on the stack of loop() for each frame (a 300 LED
+// strip would overflow it).
+//
+//   led_strip<37, NEO_GRB + NEO_KHZ800, led_rmt_output<D10>> strip;
+//   led_strip_begin(strip);
+//   led_dither_set(strip.dither, i, led_color_hsv(model, hsv));
+//   bool again = led_strip_write(strip, level);
+//   led_strip_show(strip);
+//
+// strip.dither is the usual led_dither on the frame of the strip, for the
+// segments, led_power.h and led_dither_set(). The whole strip must fit in
+// LED_STRIP_RAM_MAX bytes, else it doesn't compile.
+//
+// An output has begin() and show(symbols, count); symbols are rmt_data_t
+// (duration0:15, level0:1, duration1:15, level1:1), 24 per LED. Host
+// benchmark: pio run -e native, program strip.
+
+#ifndef LED_STRIP_RAM_MAX
+#define LED_STRIP_RAM_MAX 49152       // about 450 LEDs, 108 bytes each
+#endif
+
+// WS2812 at 800 kHz, RMT ticks of 100 ns: 0 = 0.4 us high, 0.8 us low,
+// 1 = 0.8 us high, 0.4 us low (the timing of Adafruit_NeoPixel)
+#define LED_RMT_HZ 10000000
+#define LED_RMT_SYMBOL(high, low) ((uint32_t)(high) | 1u << 15 | (uint32_t)(low) << 16)
+#define LED_RMT_ZERO LED_RMT_SYMBOL(4, 8)
+#define LED_RMT_ONE LED_RMT_SYMBOL(8, 4)
+
+template <uint16_t LEDS, uint16_t TYPE, class Output>
+struct led_strip {
+  static constexpr size_t count = LEDS;
+  static constexpr size_t bytes = LEDS * 3;
+  static constexpr size_t symbol_count = bytes * 8;
+  // NEO_xxx: bits 5..4 offset of red, 3..2 green, 1..0 blue, 7..6 white
+  static constexpr uint8_t red = (TYPE >> 4) & 3;
+  static constexpr uint8_t green = (TYPE >> 2) & 3;
+  static constexpr uint8_t blue = TYPE & 3;
+
+  static_assert(LEDS > 0, "led_strip: no LEDs");
+  static_assert(((TYPE >> 6) & 3) == red, "led_strip: RGB strips only, no white channel");
+  static_assert((TYPE & 0x0100) == 0, "led_strip: 800 kHz strips only (NEO_KHZ800)");
+  static_assert(red != green && green != blue && blue != red && red < 3 && green < 3 && blue < 3,
+                "led_strip: not a color order");
+
+  uint16_t frame[bytes];          // linear r, g, b per pixel
+  uint8_t error[bytes];           // rest below one LED step
+  uint8_t pixels[bytes];          // in the order of the strip
+  uint32_t symbols[symbol_count]; // one per bit, MSB first
+  led_dither dither;              // on frame and error
+  Output output;
+};
+
+template <uint16_t LEDS, uint16_t TYPE, class Output>
+bool led_strip_begin(led_strip<LEDS, TYPE, Output>& s)
+{
+  static_assert(sizeof(s) <= LED_STRIP_RAM_MAX, "led_strip: more RAM than LED_STRIP_RAM_MAX");
+  led_dither_begin(s.dither, s.frame, s.error, LEDS);
+  for (size_t i = 0; i < s.bytes; i++) s.pixels[i] = 0;
+  return s.output.begin();
+}
+
+// One channel of led_dither_write(), the rest bits of v returned
+inline uint32_t led_strip_channel(uint16_t in, uint8_t& error, uint8_t& out, uint32_t scale)
+{
+  uint32_t v = (in * scale) >> 16;
+  v -= v >> 8;
+  uint32_t sum = v + error;
+  out = sum >> 8;
+  error = sum;
+  return v & 0xFF;
+}
+
+// led_dither_write() of the frame into pixels, the same bytes
+template <uint16_t LEDS, uint16_t TYPE, class Output>
+bool led_strip_write(led_strip<LEDS, TYPE, Output>& s, uint16_t level)
+{
+  typedef led_strip<LEDS, TYPE, Output> strip;
+  uint32_t scale = level + (level >> 15);
+  uint32_t rest = 0;
+  const uint16_t* in = s.frame;
+  uint8_t* error = s.error;
+  uint8_t* out = s.pixels;
+  for (size_t i = 0; i < LEDS; i++, in += 3, error += 3, out += 3) {
+    rest |= led_strip_channel(in[0], error[0], out[strip::red], scale);
+    rest |= led_strip_channel(in[1], error[1], out[strip::green], scale);
+    rest |= led_strip_channel(in[2], error[2], out[strip::blue], scale);
+  }
+  return rest != 0;
+}
+
+// Pixels -> RMT symbols, a bit selects ONE or ZERO by mask, no branch
+template <uint16_t LEDS, uint16_t TYPE, class Output>
+void led_strip_encode(led_strip<LEDS, TYPE, Output>& s)
+{
+  uint32_t* out = s.symbols;
+  for (size_t i = 0; i < s.bytes; i++, out += 8) {
+    uint32_t b = s.pixels[i];
+#pragma GCC unroll 8
+    for (int k = 0; k < 8; k++) out[k] = LED_RMT_ZERO ^ ((LED_RMT_ZERO ^ LED_RMT_ONE) & -((b >> (7 - k)) & 1));
+  }
+}
+
+// Encode and send, returns when the strip has it
+template <uint16_t LEDS, uint16_t TYPE, class Output>
+void led_strip_show(led_strip<LEDS, TYPE, Output>& s)
+{
+  led_strip_encode(s);
+  s.output.show(s.symbols, s.symbol_count);
+}
+
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+// The RMT channel of arduino-esp32 3.x, initialized once (show() of
+// Adafruit_NeoPixel does it per frame)
+template <uint8_t PIN>
+struct led_rmt_output {
+  bool begin() { return rmtInit(PIN, RMT_TX_MODE, RMT_MEM_NUM_BLOCKS_1, LED_RMT_HZ); }
+
+  void show(const uint32_t* symbols, size_t count)
+  {
+    static_assert(sizeof(rmt_data_t) == sizeof(uint32_t), "led_rmt_output: rmt_data_t is not 32 bits");
+    rmtWrite(PIN, (rmt_data_t*)symbols, count, RMT_WAIT_FOR_EVER);
+  }
+};
+
+#endif
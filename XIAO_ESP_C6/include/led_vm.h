@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bytecode for LED effects that are uploaded instead of flashed.
+//
+// A program has two parts: the frame part runs once per frame, the pixel
+// part once per LED and leaves the color in the registers r, g, b (or h, s,
+// v through LED_OP_HSV). Stack machine, numbers are Q16.16 fixed point
+// (65536 = 1.0), angles are in turns (1.0 = full circle).
+//
+// There are no jumps (?: is LED_OP_SEL), so a part runs every instruction
+// exactly once: its length is its cost, the stack depth of every
+// instruction is known. led_vm_load() checks all of it once, at upload,
+// the interpreter then runs without any checks. A program that would need
+// more than LED_VM_BUDGET instructions per frame on a segment is not run
+// there (the segment shows its color).
+//
+// The loaded code is direct threaded: each instruction is the address of
+// its handler (GCC computed goto), no switch per instruction.
+//
+// Blob (NVS, upload): 'V', 'M', version, 0, frame length u16, pixel
+// length u16 (little endian), frame code, pixel code. The compiler is in
+// src/host/led_vm_compile.
+
+#define LED_VM_VERSION 1
+#define LED_VM_CODE_MAX 1024          // blob bytes
+#define LED_VM_CELLS_MAX 400          // instructions of both parts
+#define LED_VM_STACK 16
+#define LED_VM_REGS 16
+#define LED_VM_BUDGET 20000           // instructions per frame and segment
+#define LED_VM_ONE 65536
+
+// Registers: inputs, outputs, then the variables of the program
+#define LED_REG_I 0                   // pixel index 0..n-1
+#define LED_REG_N 1                   // pixels
+#define LED_REG_X 2                   // position 0..1 (i / n)
+#define LED_REG_T 3                   // seconds since the effect started, 0 again after 9 h
+#define LED_REG_R 4                   // output 0..1
+#define LED_REG_G 5
+#define LED_REG_B 6
+#define LED_REG_VARS 7                // first free one
+#define LED_REG_INPUTS 4              // i, n, x, t are read only
+
+// Opcodes. PUSH has a 4 byte operand, LOAD / STORE a register byte.
+enum {
+  LED_OP_END,
+  LED_OP_PUSH,
+  LED_OP_LOAD,
+  LED_OP_STORE,
+  LED_OP_ADD,
+  LED_OP_SUB,
+  LED_OP_MUL,
+  LED_OP_DIV,                         // x / 0 = 0
+  LED_OP_MOD,                         // floored, x % 0 = 0
+  LED_OP_NEG,
+  LED_OP_LT,                          // 1.0 or 0
+  LED_OP_GT,
+  LED_OP_LE,
+  LED_OP_GE,
+  LED_OP_SEL,                         // c, a, b -> c ? a : b
+  LED_OP_MIN,
+  LED_OP_MAX,
+  LED_OP_ABS,
+  LED_OP_FLOOR,
+  LED_OP_FRAC,
+  LED_OP_SIN,                         // of turns, -1..1
+  LED_OP_TRI,                         // 0..1..0 over one turn
+  LED_OP_NOISE,                       // 0..1, fixed per integer part
+  LED_OP_HSV,                         // h (turns), s, v -> r, g, b
+  LED_OPS
+};
+
+struct led_vm_cell {
+  const void* op;                     // handler address
+  int32_t arg;
+};
+
+struct led_vm {
+  led_vm_cell code[LED_VM_CELLS_MAX + 2];   // frame part, END, pixel part, END
+  uint16_t frame_ops;
+  uint16_t pixel_ops;
+  uint16_t pixel_start;               // index in code
+  bool loaded;
+  bool animated;                      // reads t
+  int32_t reg[LED_VM_REGS];
+  int32_t step;                       // x per pixel
+  uint32_t over_budget;               // segments not run
+};
+
+// Checks and loads a blob, error text or NULL. On an error the program
+// before stays.
+const char* led_vm_load(led_vm& vm, const uint8_t* blob, size_t len);
+
+void led_vm_unload(led_vm& vm);
+
+// Instructions of one frame over count pixels
+inline uint32_t led_vm_cost(const led_vm& vm, size_t count)
+{
+  return vm.frame_ops + (uint32_t)vm.pixel_ops * count;
+}
+
+// Frame part with t, n set
+void led_vm_frame(led_vm& vm, uint32_t t_ms, uint16_t count);
+
+// Pixel part for pixel i, color as 8 bit sRGB (like the web colors)
+void led_vm_pixel(led_vm& vm, uint16_t i, uint8_t& r, uint8_t& g, uint8_t& b);
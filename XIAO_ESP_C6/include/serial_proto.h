@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_segments.h"
+
+// Binary control protocol over the USB serial port, the fast way to do what
+// the web API does (no TCP connection, no JSON, no page).
+//
+// Frame on the wire: 0x00, COBS(data + CRC), 0x00. COBS removes every 0x00
+// from the data, so 0x00 only delimits frames and a receiver finds the next
+// frame after any garbage. The debug prints on the same port contain no
+// 0x00, they are dropped by the CRC (CRC-16/CCITT-FALSE, little endian).
+//
+// Request data:  seq, opcode, payload
+// Reply data:    seq, opcode | 0x80, status, payload
+// The seq comes back in the reply. A request with the seq, opcode and
+// payload of the last one (same length and CRC) is a retry (reply lost):
+// the last reply is sent again, nothing is executed twice. Another request
+// with the same seq, e.g. of a restarted client, is executed.
+//
+// SERIAL_BATCH carries several commands in one frame, payload = per command
+// length, opcode, payload. The reply payload is per command length, status,
+// payload. One round trip for e.g. color, brightness and a frame.
+//
+// Numbers are little endian. Payloads:
+//   PING            any bytes, echoed
+//   GET_STATE       -> brightness, color (9), time u32, tz i8, auto_dst,
+//                      2 x timer (enabled, on_h, on_m, off_h, off_m),
+//                      group role, group id, power (10), SNTP server (32,
+//                      0 filled)
+//   SET_BRIGHTNESS  percent 0..100
+//   SET_RGB         r, g, b
+//   SET_HSV         hue u16 (0..359), sat
+//   SET_KELVIN      kelvin u16
+//   SET_TIME        unix time u32
+//   SET_TZ          tz i8 (-12..14), auto_dst
+//   SET_TIMER       pair, enabled, on_h, on_m, off_h, off_m
+//   FRAME           first LED u16, r, g, b per LED. Live picture, replaces
+//                   base color and segments until SERIAL_LIVE_MS without one
+//   SET_SEGMENT     segment (27), created if the name is new
+//   DELETE_SEGMENT  name (without 0)
+//   RESET           default parameters
+//   SET_GROUP       role (0 off, 1 leader, 2 follower), id. After a restart
+//   SET_POWER       power (10)
+//   SET_SNTP        host name or address (without 0, up to 31), none = no
+//                   SNTP
+// color (9):    mode, r, g, b, hue u16, sat, kelvin u16
+// power (10):   budget mA u16 (0 = no limit), r, g, b, idle uA u16
+// segment (27): name (10, 0 filled), start u16, count u16, flags, effect,
+//               speed, brightness, color (9)
+
+#define SERIAL_DATA_MAX 512         // seq + opcode + payload
+#define SERIAL_WIRE_MAX (SERIAL_DATA_MAX + 2 + SERIAL_DATA_MAX / 254 + 3)
+#define SERIAL_LIVE_MS 2500
+#define SERIAL_SEGMENT_SIZE 27
+#define SERIAL_COLOR_SIZE 9
+#define SERIAL_POWER_SIZE 10
+#define SERIAL_SNTP_SIZE 32
+
+#define SERIAL_PING 0x01
+#define SERIAL_GET_STATE 0x02
+#define SERIAL_SET_BRIGHTNESS 0x03
+#define SERIAL_SET_RGB 0x04
+#define SERIAL_SET_HSV 0x05
+#define SERIAL_SET_KELVIN 0x06
+#define SERIAL_SET_TIME 0x07
+#define SERIAL_SET_TZ 0x08
+#define SERIAL_SET_TIMER 0x09
+#define SERIAL_FRAME 0x0A
+#define SERIAL_SET_SEGMENT 0x0B
+#define SERIAL_DELETE_SEGMENT 0x0C
+#define SERIAL_RESET 0x0D
+#define SERIAL_SET_GROUP 0x0E
+#define SERIAL_SET_POWER 0x0F
+#define SERIAL_SET_SNTP 0x10
+#define SERIAL_BATCH 0x7F
+#define SERIAL_REPLY 0x80
+
+// Status in the reply
+#define SERIAL_OK 0
+#define SERIAL_UNKNOWN 1            // opcode
+#define SERIAL_BAD_LENGTH 2
+#define SERIAL_BAD_VALUE 3
+#define SERIAL_FULL 4               // reply or table full
+
+uint16_t serial_crc16(const uint8_t* data, size_t len);
+
+// data + CRC as one frame with delimiters into out, length or 0 if too small
+size_t serial_frame_encode(const uint8_t* data, size_t len, uint8_t* out, size_t size);
+
+// Receiver: bytes in one by one, a checked frame comes out
+struct serial_link {
+  uint8_t buf[SERIAL_WIRE_MAX];
+  size_t len;
+  bool overflow;                    // frame too long, dropped up to the next 0x00
+  uint32_t frames;
+  uint32_t crc_errors;              // also garbage between frames
+  uint32_t overflows;
+};
+
+void serial_link_reset(serial_link& l);
+
+// true if byte completed a frame, data / len without CRC (points into l.buf)
+bool serial_link_input(serial_link& l, uint8_t byte, const uint8_t*& data, size_t& len);
+
+
+// Reply payload, written by the handlers
+struct serial_reply {
+  uint8_t* buf;
+  size_t len;
+  size_t size;
+  bool full;
+};
+
+void serial_put8(serial_reply& r, uint8_t v);
+void serial_put16(serial_reply& r, uint16_t v);
+void serial_put32(serial_reply& r, uint32_t v);
+void serial_put(serial_reply& r, const void* data, size_t len);
+
+inline uint16_t serial_get16(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+inline uint32_t serial_get32(const uint8_t* p)
+{
+  return serial_get16(p) | ((uint32_t)serial_get16(p + 2) << 16);
+}
+
+// color and segment as above, get: false if a value is out of range (the
+// length of the strip is the caller's)
+void serial_put_color(serial_reply& r, const led_color_setting& c);
+bool serial_get_color(const uint8_t* p, led_color_setting& c);
+void serial_put_segment(serial_reply& r, const led_segment& seg);
+bool serial_get_segment(const uint8_t* p, led_segment& seg);
+
+// Commands are a constant table, like the routes of the web server.
+// The handler returns the status, the reply payload goes into out.
+struct serial_command {
+  uint8_t opcode;
+  uint8_t (*handler)(const uint8_t* payload, size_t len, serial_reply& out);
+};
+
+struct serial_server {
+  const serial_command* commands;
+  uint8_t count;
+  serial_link link;
+  bool has_last;
+  uint16_t last_crc;                // of the last request (seq, opcode, payload)
+  size_t last_request;              // its length
+  size_t last_len;                  // encoded last reply in wire
+  uint8_t data[SERIAL_DATA_MAX];    // reply before encoding
+  uint8_t wire[SERIAL_WIRE_MAX];
+  uint32_t requests;
+  uint32_t retries;
+};
+
+#define SERIAL_SERVER(commands) \
+  { commands, sizeof(commands) / sizeof(commands[0]), {}, false, 0, 0, 0, {}, {}, 0, 0 }
+
+void serial_server_begin(serial_server& s);
+
+// One received byte. Returns the number of bytes to send back (in out), 0
+// while no request is complete.
+size_t serial_server_input(serial_server& s, uint8_t byte, const uint8_t*& out);
+
+
+// Batch of commands for SERIAL_BATCH, built by the client
+struct serial_batch {
+  uint8_t buf[SERIAL_DATA_MAX - 2];
+  size_t len;
+  uint8_t count;
+};
+
+void serial_batch_begin(serial_batch& b);
+bool serial_batch_add(serial_batch& b, uint8_t opcode, const uint8_t* payload, size_t len);
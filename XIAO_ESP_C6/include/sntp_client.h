@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// SNTP for the software RTC, and the discipline of its drift.
+//
+// A request to the configured server gives the offset of the RTC against
+// it, corrected by half the round trip. A poll is a burst of SNTP_BURST
+// requests, the answer with the shortest round trip is used: the offset is
+// off by at most half of it, a WiFi retry makes one way slow. Polls start
+// SNTP_POLL_MIN_MS apart and double up to SNTP_POLL_MAX_MS. Large offsets
+// set the clock, small ones move it right away too, it is only a few ms.
+//
+// The crystal behind millis() is off by some ppm, 40 ppm are 3.5 s a day
+// and 41 ms between two polls. The offsets of syncs at least
+// SNTP_DRIFT_MIN_MS apart measure it, a quarter of each measurement goes
+// into the estimate (the temperature moves it, the round trips make it
+// noisy). Between the syncs update_rtc() moves the RTC by one ms every
+// 1e6 / ppm ms, the error stays at a few ms.
+//
+// Only packets and the clock filter live here, the network is the
+// caller's (WiFiUDP on the device, sockets in src/host).
+
+#define SNTP_PORT 123
+#define SNTP_PACKET_SIZE 48
+#define SNTP_TIMEOUT_MS 1500            // no answer: try again after SNTP_RETRY_MS
+#define SNTP_RETRY_MS 30000
+#define SNTP_BURST 4                    // requests per poll
+#define SNTP_BURST_MS 2000              // between them
+#define SNTP_POLL_MIN_MS 64000
+#define SNTP_POLL_MAX_MS 1024000
+#define SNTP_MAX_DELAY_MS 250           // answers with a longer round trip are not used
+#define SNTP_STEP_MS 1000               // larger offsets: set, no drift measurement over them
+#define SNTP_DRIFT_MIN_MS 900000        // drift measured over at least
+#define SNTP_MAX_PPB 500000             // 500 ppm, more is no crystal
+
+struct sntp_result {
+  int64_t offset_ms;                    // server - local
+  uint32_t delay_ms;                    // round trip without the server's time
+  uint8_t stratum;
+};
+
+// Request with local_ms (unix ms) as transmit time, the server returns it
+size_t sntp_request(uint8_t* out, size_t size, uint64_t local_ms);
+
+// Answer to the request sent at t1, received at t4 (local unix ms). False
+// if it is none, not for this request or from an unsynchronized server.
+bool sntp_parse(const uint8_t* in, size_t len, uint64_t t1, uint64_t t4, sntp_result& r);
+
+// Server side, for the stand-in on the host: answer to a request received
+// at t2 and sent at t3 (server unix ms). 0 if the request is none.
+size_t sntp_answer(const uint8_t* in, size_t len, uint64_t t2, uint64_t t3, uint8_t* out, size_t size);
+
+struct sntp_clock {
+  int32_t ppb;                          // millis() runs fast by, corrected in sntp_clock_drift
+  int64_t rest;                         // of the drift correction, ms * 1e9
+  uint64_t since_ms;                    // start of the drift measurement, 0 = none
+  int64_t applied_ms;                   // offsets applied since then
+  uint8_t samples;                      // drift measurements
+  bool synced;
+  sntp_result best;                     // of the burst
+  uint64_t best_ms;                     // local time of best, 0 = none yet
+};
+
+// ppb from NVS, no sync yet
+void sntp_clock_reset(sntp_clock& c, int32_t ppb);
+
+// The clock was set by other means: no drift measurement over it
+void sntp_clock_forget(sntp_clock& c);
+
+// An answer of the burst at local_ms, kept if its round trip is the
+// shortest so far and below SNTP_MAX_DELAY_MS
+void sntp_clock_answer(sntp_clock& c, uint64_t local_ms, const sntp_result& r);
+
+// End of the burst: false without a kept answer, else the ms to move the
+// clock by. Measures the drift over the syncs since since_ms.
+bool sntp_clock_update(sntp_clock& c, int64_t& correction);
+
+// ms to move the clock by after elapsed_ms of millis(), mostly 0
+int32_t sntp_clock_drift(sntp_clock& c, uint32_t elapsed_ms);
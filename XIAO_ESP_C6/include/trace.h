@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Trace points for the timeline of loop(): which part took how long, down
+// to the cycle. Begin / end events with the CPU cycle counter go into a
+// ring buffer in RAM, GET /api/trace returns the last TRACE_EVENTS of them
+// as Chrome trace_event JSON (open in ui.perfetto.dev or chrome://tracing).
+//
+//   void save_segments()
+//   {
+//     TRACE_SCOPE("save_segments");        // begin here, end at the }
+//     ...
+//   TRACE_MARK("stall");                   // a point in time
+//
+// Only the pointer of the name is stored, so names must be string
+// constants. A trace point costs a few dozen cycles, there is no lock:
+// call them from loop() only, not from interrupts or other tasks.
+//
+// With -DTRACE_ENABLED=0 the macros are empty and there is no buffer.
+//
+// The trace points are also the regions of the heap counts (heap_track.h).
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 1024               // power of 2, 12 bytes each on the C6
+#endif
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_MARK 'i'
+
+#include "heap_track.h"
+
+#if TRACE_ENABLED
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be a power of 2");
+
+struct trace_event {
+  uint32_t cycles;
+  const char* name;
+  uint8_t phase;
+};
+
+struct trace_buffer {
+  trace_event events[TRACE_EVENTS];
+  uint32_t next;                        // events written in total
+  bool paused;                          // while it is read
+};
+
+extern trace_buffer trace_buf;
+
+#ifdef ARDUINO
+inline uint32_t trace_cycles()
+{
+  return ESP.getCycleCount();
+}
+#else
+uint32_t trace_cycles();                // host: ns
+#endif
+
+inline void trace_record(const char* name, uint8_t phase)
+{
+#if HEAP_TRACK_ENABLED
+  heap_track_trace(name, phase);
+#endif
+  if (trace_buf.paused) return;
+  trace_event& e = trace_buf.events[trace_buf.next++ & (TRACE_EVENTS - 1)];
+  e.cycles = trace_cycles();
+  e.name = name;
+  e.phase = phase;
+}
+
+struct trace_scope {
+  const char* name;
+  explicit trace_scope(const char* n) : name(n) { trace_record(n, TRACE_PHASE_BEGIN); }
+  ~trace_scope() { trace_record(name, TRACE_PHASE_END); }
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_JOIN(trace_scope_, __LINE__)(name)
+#define TRACE_BEGIN(name) trace_record(name, TRACE_PHASE_BEGIN)
+#define TRACE_END(name) trace_record(name, TRACE_PHASE_END)
+#define TRACE_MARK(name) trace_record(name, TRACE_PHASE_MARK)
+
+// Reads the buffer as JSON in pieces (header, one event each, end), so it
+// can go out through a small buffer. Recording pauses from begin to the
+// last piece.
+struct trace_reader {
+  uint32_t index;                       // next event
+  uint32_t end;
+  uint32_t cycles_per_us;
+  uint32_t last_cycles;
+  uint64_t elapsed;                     // cycles since the first event, over wraps
+  int depth;                            // open begin events
+  uint8_t state;
+};
+
+void trace_read_begin(trace_reader& r, uint32_t cycles_per_us);
+
+// Next piece into out (0 terminated), its length, 0 after the last one
+size_t trace_read(trace_reader& r, char* out, size_t size);
+
+void trace_clear();
+
+#else
+
+#if HEAP_TRACK_ENABLED
+#error "HEAP_TRACK_ENABLED needs the trace points, they are its regions"
+#endif
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_MARK(name) do {} while (0)
+
+#endif
@@ -0,0 +1,299 @@
+#include "event_log.h"
+
+#include <string.h>
+
+const char* const event_names[EVENT_CODES] = {
+  "", "boot", "timer_on", "timer_off", "rtc_set", "save", "reset", "lost",
+};
+
+#define BUF_RECORDS (sizeof(((event_log_reader*)0)->buf) / EVENT_LOG_RECORD)
+
+
+static void put32(uint8_t* p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+
+static uint32_t get32(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint8_t check_byte(const uint8_t* p)
+{
+  uint8_t c = 0x5A;
+  for (int i = 0; i < EVENT_LOG_RECORD - 1; i++) c = (uint8_t)((c << 1) | (c >> 7)) ^ p[i];
+  return c;
+}
+
+
+static bool erased(const uint8_t* p, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+
+// False for an erased or torn record
+static bool decode(const uint8_t* p, event_record& e)
+{
+  if (erased(p, EVENT_LOG_RECORD) || check_byte(p) != p[7]) return false;
+  e.time = get32(p);
+  e.code = p[4];
+  e.arg = p[5] | (p[6] << 8);
+  return true;
+}
+
+
+static uint32_t slot_addr(uint16_t sector, uint16_t slot)
+{
+  return (uint32_t)sector * EVENT_LOG_SECTOR + EVENT_LOG_HEADER + (uint32_t)slot * EVENT_LOG_RECORD;
+}
+
+
+static bool read_header(const event_log& log, uint16_t sector, uint32_t& seq, uint32_t& time)
+{
+  uint8_t h[EVENT_LOG_HEADER];
+  if (!log.flash->read(*log.flash, (uint32_t)sector * EVENT_LOG_SECTOR, h, sizeof(h))) return false;
+  if (h[0] != 'E' || h[1] != 'L' || h[2] != EVENT_LOG_VERSION) return false;
+  seq = get32(h + 4);
+  time = get32(h + 8);
+  return get32(h + 12) == ~seq;
+}
+
+
+static bool slot_used(const event_log& log, uint16_t sector, uint16_t slot)
+{
+  uint8_t p[EVENT_LOG_RECORD];
+  return !log.flash->read(*log.flash, slot_addr(sector, slot), p, sizeof(p)) || !erased(p, sizeof(p));
+}
+
+
+bool event_log_begin(event_log& log, const event_flash* flash)
+{
+  memset(&log, 0, sizeof(log));
+  log.head = -1;
+  if (!flash || flash->size / EVENT_LOG_SECTOR < 2) return false;
+  log.flash = flash;
+  log.sectors = flash->size / EVENT_LOG_SECTOR > 0x7FFF ? 0x7FFF : flash->size / EVENT_LOG_SECTOR;
+
+  for (uint16_t s = 0; s < log.sectors; s++) {
+    uint32_t seq, time;
+    if (!read_header(log, s, seq, time)) continue;
+    log.used++;
+    if (log.head < 0 || seq > log.seq) {
+      log.head = s;
+      log.seq = seq;
+    }
+  }
+  if (log.head < 0) return true;
+  // records are written in order: the first free one by binary search
+  uint16_t lo = 0, hi = EVENT_LOG_PER_SECTOR;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (slot_used(log, log.head, mid)) lo = mid + 1;
+    else hi = mid;
+  }
+  log.next = lo;
+  return true;
+}
+
+
+void event_log_add(event_log& log, uint32_t time, uint8_t code, uint16_t arg, uint32_t now_ms)
+{
+  if (!log.flash) return;
+  if (log.queued == EVENT_LOG_QUEUE) {
+    if (log.lost < 0xFFFF) log.lost++;
+    return;
+  }
+  if (!log.queued) log.queued_ms = now_ms;
+  log.queue[log.queued++] = { time, code, arg };
+}
+
+
+static bool append(event_log& log, const event_record& e)
+{
+  const event_flash& f = *log.flash;
+  if (log.head < 0 || log.next >= EVENT_LOG_PER_SECTOR) {
+    // the oldest sector becomes the newest
+    uint16_t s = log.head < 0 ? 0 : (log.head + 1) % log.sectors;
+    if (!f.erase(f, (uint32_t)s * EVENT_LOG_SECTOR)) return false;
+    log.erases++;
+    uint8_t h[EVENT_LOG_HEADER] = { 'E', 'L', EVENT_LOG_VERSION, 0 };
+    put32(h + 4, log.seq + 1);
+    put32(h + 8, e.time);
+    put32(h + 12, ~(log.seq + 1));
+    if (!f.write(f, (uint32_t)s * EVENT_LOG_SECTOR, h, sizeof(h))) return false;
+    if (log.used < log.sectors) log.used++;
+    log.head = s;
+    log.seq++;
+    log.next = 0;
+  }
+  uint8_t p[EVENT_LOG_RECORD];
+  put32(p, e.time);
+  p[4] = e.code;
+  p[5] = e.arg;
+  p[6] = e.arg >> 8;
+  p[7] = check_byte(p);
+  // a slot that failed is not used again
+  return f.write(f, slot_addr(log.head, log.next++), p, sizeof(p));
+}
+
+
+bool event_log_flush(event_log& log)
+{
+  if (!log.flash || (!log.queued && !log.lost)) return false;
+  bool ok = true;
+  for (uint8_t i = 0; i < log.queued; i++) ok = append(log, log.queue[i]) && ok;
+  if (log.lost) ok = append(log, { log.queue[log.queued - 1].time, EVENT_LOST, log.lost }) && ok;
+  log.queued = 0;
+  log.lost = 0;
+  return ok;
+}
+
+
+bool event_log_service(event_log& log, uint32_t now_ms)
+{
+  if (!log.queued) return false;
+  if (now_ms - log.queued_ms < EVENT_LOG_FLUSH_MS && log.queued < EVENT_LOG_QUEUE / 2) return false;
+  event_log_flush(log);
+  return true;
+}
+
+
+uint32_t event_log_count(const event_log& log)
+{
+  if (log.head < 0) return 0;
+  return (uint32_t)(log.used - 1) * EVENT_LOG_PER_SECTOR + log.next;
+}
+
+
+uint32_t event_log_capacity(const event_log& log)
+{
+  return (uint32_t)log.sectors * EVENT_LOG_PER_SECTOR;
+}
+
+
+// Sector of the order-th oldest
+static uint16_t sector_at(const event_log& log, uint16_t order)
+{
+  return (log.head + log.sectors - log.used + 1 + order) % log.sectors;
+}
+
+
+static uint16_t records_at(const event_log& log, uint16_t order)
+{
+  return order + 1 == log.used ? log.next : EVENT_LOG_PER_SECTOR;
+}
+
+
+static bool read_record(const event_log& log, event_log_reader& r, uint16_t sector, uint16_t slot, event_record& e)
+{
+  uint8_t p[EVENT_LOG_RECORD];
+  r.reads++;
+  return log.flash->read(*log.flash, slot_addr(sector, slot), p, sizeof(p)) && decode(p, e);
+}
+
+
+void event_log_find(const event_log& log, event_log_reader& r, uint32_t from)
+{
+  memset(&r, 0, sizeof(r));
+  r.from = from;
+  if (!log.flash || log.head < 0) return;
+  r.count = log.used;
+
+  // last sector that starts at or before from
+  uint16_t lo = 0, hi = r.count;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    uint32_t seq, time;
+    r.reads++;
+    if (read_header(log, sector_at(log, mid), seq, time) && time <= from) lo = mid + 1;
+    else hi = mid;
+  }
+  r.order = lo ? lo - 1 : 0;
+
+  // first record of it at or after from
+  uint16_t sector = sector_at(log, r.order);
+  lo = 0;
+  hi = records_at(log, r.order);
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    event_record e;
+    if (read_record(log, r, sector, mid, e) && e.time >= from) hi = mid;
+    else lo = mid + 1;
+  }
+  r.slot = lo;
+}
+
+
+bool event_log_next(const event_log& log, event_log_reader& r, event_record& e)
+{
+  while (r.order < r.count) {
+    uint16_t n = records_at(log, r.order);
+    if (r.slot >= n) {
+      r.order++;
+      r.slot = 0;
+      r.buf_len = 0;
+      continue;
+    }
+    if (r.slot < r.buf_first || r.slot >= r.buf_first + r.buf_len) {
+      // records in blocks, one flash read for BUF_RECORDS of them
+      uint16_t len = n - r.slot < (int)BUF_RECORDS ? n - r.slot : BUF_RECORDS;
+      r.reads++;
+      r.buf_len = 0;
+      if (!log.flash->read(*log.flash, slot_addr(sector_at(log, r.order), r.slot), r.buf, len * EVENT_LOG_RECORD)) {
+        r.slot = n;
+        continue;
+      }
+      r.buf_first = r.slot;
+      r.buf_len = len;
+    }
+    const uint8_t* p = r.buf + (r.slot++ - r.buf_first) * EVENT_LOG_RECORD;
+    if (decode(p, e) && e.time >= r.from) return true;
+  }
+  while (r.queue_index < log.queued) {
+    e = log.queue[r.queue_index++];
+    if (e.time >= r.from) return true;
+  }
+  return false;
+}
+
+
+#ifdef ARDUINO
+#include <esp_partition.h>
+
+static bool partition_read(const event_flash& f, uint32_t addr, void* buf, size_t len)
+{
+  return esp_partition_read((const esp_partition_t*)f.ctx, addr, buf, len) == ESP_OK;
+}
+
+
+static bool partition_write(const event_flash& f, uint32_t addr, const void* buf, size_t len)
+{
+  return esp_partition_write((const esp_partition_t*)f.ctx, addr, buf, len) == ESP_OK;
+}
+
+
+static bool partition_erase(const event_flash& f, uint32_t addr)
+{
+  return esp_partition_erase_range((const esp_partition_t*)f.ctx, addr, EVENT_LOG_SECTOR) == ESP_OK;
+}
+
+
+bool event_flash_partition(event_flash& f, const char* label)
+{
+  const esp_partition_t* p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!p) return false;
+  f.size = p->size / EVENT_LOG_SECTOR * EVENT_LOG_SECTOR;
+  f.read = partition_read;
+  f.write = partition_write;
+  f.erase = partition_erase;
+  f.ctx = (void*)p;
+  return true;
+}
+#endif
@@ -0,0 +1,134 @@
+#include "group_sync.h"
+
+#include <string.h>
+
+
+static uint8_t* put16(uint8_t* p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+
+static uint8_t* put32(uint8_t* p, uint32_t v)
+{
+  return put16(put16(p, v), v >> 16);
+}
+
+
+static uint8_t* put64(uint8_t* p, uint64_t v)
+{
+  return put32(put32(p, (uint32_t)v), (uint32_t)(v >> 32));
+}
+
+
+static uint16_t get16(const uint8_t*& p)
+{
+  uint16_t v = p[0] | (p[1] << 8);
+  p += 2;
+  return v;
+}
+
+
+static uint32_t get32(const uint8_t*& p)
+{
+  uint32_t lo = get16(p);
+  return lo | ((uint32_t)get16(p) << 16);
+}
+
+
+static uint64_t get64(const uint8_t*& p)
+{
+  uint64_t lo = get32(p);
+  return lo | ((uint64_t)get32(p) << 32);
+}
+
+
+// Little endian: "GS", version, group, beacon seq, time, state seq,
+// apply time, fade, brightness, mode, r, g, b, hue, sat, kelvin
+size_t group_encode(const group_beacon& b, uint8_t* out, size_t size)
+{
+  if (size < GROUP_BEACON_SIZE) return 0;
+  uint8_t* p = out;
+  *p++ = 'G';
+  *p++ = 'S';
+  *p++ = GROUP_VERSION;
+  *p++ = b.group;
+  p = put16(p, b.seq);
+  p = put64(p, b.time_ms);
+  const group_state& s = b.state;
+  p = put16(p, s.seq);
+  p = put64(p, s.apply_ms);
+  p = put32(p, s.fade_ms);
+  *p++ = s.brightness;
+  *p++ = s.color.mode;
+  *p++ = s.color.red;
+  *p++ = s.color.green;
+  *p++ = s.color.blue;
+  p = put16(p, s.color.hue);
+  *p++ = s.color.sat;
+  p = put16(p, s.color.kelvin);
+  return p - out;
+}
+
+
+bool group_decode(group_beacon& b, const uint8_t* in, size_t len)
+{
+  if (len != GROUP_BEACON_SIZE || in[0] != 'G' || in[1] != 'S' || in[2] != GROUP_VERSION) return false;
+  const uint8_t* p = in + 3;
+  b.group = *p++;
+  b.seq = get16(p);
+  b.time_ms = get64(p);
+  group_state& s = b.state;
+  s.seq = get16(p);
+  s.apply_ms = get64(p);
+  s.fade_ms = get32(p);
+  s.brightness = *p++;
+  s.color.mode = *p++;
+  s.color.red = *p++;
+  s.color.green = *p++;
+  s.color.blue = *p++;
+  s.color.hue = get16(p);
+  s.color.sat = *p++;
+  s.color.kelvin = get16(p);
+  return s.brightness <= 100 && s.color.mode <= LED_COLOR_KELVIN;
+}
+
+
+void group_clock_reset(group_clock& c)
+{
+  memset(&c, 0, sizeof(c));
+}
+
+
+int64_t group_clock_sample(group_clock& c, int64_t offset_ms)
+{
+  c.beacons++;
+  if (!c.synced || offset_ms > GROUP_STEP_MS || offset_ms < -GROUP_STEP_MS) {
+    // first beacon or far off: set the clock, the old samples are void
+    c.synced = true;
+    c.count = 0;
+    c.next = 0;
+    c.steps++;
+    c.error = offset_ms > INT32_MAX ? INT32_MAX : offset_ms < INT32_MIN ? INT32_MIN : (int32_t)offset_ms;
+    return offset_ms;
+  }
+
+  c.sample[c.next] = (int32_t)offset_ms;
+  c.next = (c.next + 1) % GROUP_SAMPLES;
+  if (c.count < GROUP_SAMPLES) c.count++;
+
+  // least delayed beacon of the window
+  int32_t best = c.sample[0];
+  for (int i = 1; i < c.count; i++) {
+    if (c.sample[i] > best) best = c.sample[i];
+  }
+  c.error = best;
+  int32_t correction = best;
+  if (correction > GROUP_SLEW_MS) correction = GROUP_SLEW_MS;
+  if (correction < -GROUP_SLEW_MS) correction = -GROUP_SLEW_MS;
+  // the samples were taken against the clock before the correction
+  for (int i = 0; i < c.count; i++) c.sample[i] -= correction;
+  return correction;
+}
@@ -0,0 +1,275 @@
+#include "heap_track.h"
+#include "trace.h"
+
+#include <string.h>
+
+#define HEAP_NO_REGION 0xFF
+
+heap_stats heap;
+
+
+static void init()
+{
+  if (heap.region_count) return;
+  heap.regions[HEAP_REGION_LOOP].name = "loop";
+  heap.regions[HEAP_REGION_OTHER].name = "other tasks";
+  heap.region_count = 2;
+}
+
+
+static uint8_t region_index(const char* name)
+{
+  for (uint8_t i = 2; i < heap.region_count; i++) {
+    if (heap.regions[i].name == name) return i;
+  }
+  if (heap.region_count == HEAP_REGIONS) return HEAP_NO_REGION;
+  heap.regions[heap.region_count].name = name;
+  return heap.region_count++;
+}
+
+
+void heap_track_trace(const char* name, uint8_t phase)
+{
+  init();
+  if (phase == TRACE_PHASE_BEGIN) {
+    if (heap.depth < HEAP_DEPTH) {
+      heap_level& l = heap.stack[heap.depth];
+      l.region = region_index(name);
+      l.live_start = l.high = heap.live;
+      l.allocs = 0;
+    }
+    heap.depth++;
+  } else if (phase == TRACE_PHASE_END && heap.depth) {
+    heap.depth--;
+    if (heap.depth >= HEAP_DEPTH) return;
+    const heap_level& l = heap.stack[heap.depth];
+    if (l.region == HEAP_NO_REGION) return;
+    heap_region& r = heap.regions[l.region];
+    r.passes++;
+    if (l.allocs > r.max_allocs) r.max_allocs = l.allocs;
+    if ((uint32_t)(l.high - l.live_start) > r.peak) r.peak = l.high - l.live_start;
+  }
+}
+
+
+// Innermost region of loop()
+static uint8_t current_region()
+{
+  if (!heap.depth) return HEAP_REGION_LOOP;
+  uint8_t level = heap.depth <= HEAP_DEPTH ? heap.depth - 1 : HEAP_DEPTH - 1;
+  return heap.stack[level].region;
+}
+
+
+static void count_site(uintptr_t pc, uint8_t region, size_t size)
+{
+  for (uint8_t i = 0; i < heap.site_count; i++) {
+    heap_site& s = heap.sites[i];
+    if (s.pc == pc && s.region == region) {
+      s.allocs++;
+      s.bytes += size;
+      return;
+    }
+  }
+  if (heap.site_count == HEAP_SITES) {
+    heap.sites_missed++;
+    return;
+  }
+  heap_site& s = heap.sites[heap.site_count++];
+  s.pc = pc;
+  s.region = region;
+  s.allocs = 1;
+  s.bytes = size;
+}
+
+
+void heap_track_alloc(size_t size, uintptr_t pc, bool other_task)
+{
+  init();
+  heap.live += size;
+  if (heap.live > heap.live_max) heap.live_max = heap.live;
+  heap.allocs++;
+
+  uint8_t region = HEAP_REGION_OTHER;
+  if (!other_task) {
+    // a pass of the outer regions includes the inner ones
+    uint8_t levels = heap.depth < HEAP_DEPTH ? heap.depth : HEAP_DEPTH;
+    for (uint8_t i = 0; i < levels; i++) {
+      heap_level& l = heap.stack[i];
+      l.allocs++;
+      if (heap.live > l.high) l.high = heap.live;
+    }
+    region = current_region();
+    if (region == HEAP_NO_REGION) {
+      heap.regions_missed++;
+      region = HEAP_REGION_LOOP;
+    }
+  }
+  heap.regions[region].allocs++;
+  heap.regions[region].bytes += size;
+  count_site(pc, region, size);
+}
+
+
+void heap_track_free(size_t size, bool other_task)
+{
+  init();
+  heap.live -= size;
+  heap.frees++;
+  uint8_t region = other_task ? HEAP_REGION_OTHER : current_region();
+  heap.regions[region == HEAP_NO_REGION ? HEAP_REGION_LOOP : region].frees++;
+}
+
+
+void heap_track_clear()
+{
+  init();
+  // the names stay, open regions refer to them
+  for (uint8_t i = 0; i < heap.region_count; i++) {
+    const char* name = heap.regions[i].name;
+    memset(&heap.regions[i], 0, sizeof(heap.regions[i]));
+    heap.regions[i].name = name;
+  }
+  for (uint8_t i = 0; i < heap.depth && i < HEAP_DEPTH; i++) {
+    heap.stack[i].live_start = heap.stack[i].high = heap.live;
+    heap.stack[i].allocs = 0;
+  }
+  heap.regions_missed = 0;
+  heap.site_count = 0;
+  heap.sites_missed = 0;
+  heap.live_max = heap.live;
+  heap.allocs = 0;
+  heap.frees = 0;
+}
+
+
+void heap_track_sample(uint32_t now_ms, uint32_t free_bytes, uint32_t largest)
+{
+  heap.free_now = free_bytes;
+  heap.largest_now = largest;
+  if (!heap.current_ms && !heap.samples) heap.lowest = { free_bytes, largest };
+  if (free_bytes < heap.lowest.free_min) heap.lowest.free_min = free_bytes;
+  if (largest < heap.lowest.largest_min) heap.lowest.largest_min = largest;
+
+  if (heap.current_ms && now_ms - heap.current_ms >= HEAP_SAMPLE_MS) {
+    heap.history[heap.samples++ % HEAP_HISTORY] = heap.current;
+    heap.current_ms = 0;
+  }
+  if (!heap.current_ms) {
+    heap.current = { free_bytes, largest };
+    heap.current_ms = now_ms ? now_ms : 1;
+  }
+  if (free_bytes < heap.current.free_min) heap.current.free_min = free_bytes;
+  if (largest < heap.current.largest_min) heap.current.largest_min = largest;
+}
+
+
+uint8_t heap_track_top(const heap_site** out, uint8_t n)
+{
+  uint8_t count = 0;
+  bool taken[HEAP_SITES] = {};
+  while (count < n) {
+    int best = -1;
+    for (uint8_t i = 0; i < heap.site_count; i++) {
+      if (!taken[i] && (best < 0 || heap.sites[i].allocs > heap.sites[best].allocs)) best = i;
+    }
+    if (best < 0) break;
+    taken[best] = true;
+    out[count++] = &heap.sites[best];
+  }
+  return count;
+}
+
+
+#if HEAP_TRACK_ENABLED && defined(ARDUINO)
+
+// Linked with -Wl,--wrap=malloc and so on: the calls of malloc in all
+// objects go to __wrap_malloc, __real_malloc is the one of the IDF.
+
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static TaskHandle_t loop_task;
+static portMUX_TYPE heap_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+void heap_track_begin()
+{
+  loop_task = xTaskGetCurrentTaskHandle();
+}
+
+
+static bool other_task()
+{
+  return !loop_task || xTaskGetCurrentTaskHandle() != loop_task;
+}
+
+
+static void note_alloc(void* p, uintptr_t pc)
+{
+  bool other = other_task();
+  portENTER_CRITICAL(&heap_mux);
+  heap_track_alloc(heap_caps_get_allocated_size(p), pc, other);
+  portEXIT_CRITICAL(&heap_mux);
+  if (!other) TRACE_MARK("malloc");
+}
+
+
+static void note_free(size_t size)
+{
+  bool other = other_task();
+  portENTER_CRITICAL(&heap_mux);
+  heap_track_free(size, other);
+  portEXIT_CRITICAL(&heap_mux);
+}
+
+
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+void __real_free(void* p);
+
+
+void* __wrap_malloc(size_t size)
+{
+  void* p = __real_malloc(size);
+  if (p) note_alloc(p, (uintptr_t)__builtin_return_address(0));
+  return p;
+}
+
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+  void* p = __real_calloc(n, size);
+  if (p) note_alloc(p, (uintptr_t)__builtin_return_address(0));
+  return p;
+}
+
+
+void* __wrap_realloc(void* p, size_t size)
+{
+  size_t old = p ? heap_caps_get_allocated_size(p) : 0;
+  void* q = __real_realloc(p, size);
+  // realloc(p, 0) frees p, a failed one leaves it
+  if (q || !size) {
+    if (p) note_free(old);
+    if (q) note_alloc(q, (uintptr_t)__builtin_return_address(0));
+  }
+  return q;
+}
+
+
+void __wrap_free(void* p)
+{
+  if (!p) return;
+  size_t size = heap_caps_get_allocated_size(p);
+  __real_free(p);
+  note_free(size);
+}
+
+}
+
+#endif
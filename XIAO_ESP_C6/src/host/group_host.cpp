@@ -0,0 +1,226 @@
+// Group mode on loopback (pio run -e native):
+//
+//   .pio/build/native/program group [followers] [seconds] [jitter ms]
+//
+// Starts one leader and some followers as separate processes on the
+// multicast group over 127.0.0.1. Each of them has its own clock with a
+// random offset (up to +-10 s) and drift (up to +-200 ppm). The leader
+// schedules a change every second and sleeps up to jitter ms between taking
+// the time and sending, like a busy WiFi. Every process reports the real
+// time it applied a change, at the end the spread per change is printed.
+// Exit code 1 if a change was missed or the spread exceeds 5 ms.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+
+#include "group_sync.h"
+
+#define GROUP_TEST_SPREAD_US 5000
+
+static int64_t real_us()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// Local clock of one controller: real time with offset and drift, plus the
+// corrections of the group (like rtc_timestamp / last_millis on the device)
+struct host_clock {
+  int64_t start_us;
+  int64_t offset_ms;
+  double drift;
+  int64_t correction_ms;
+};
+
+
+static uint64_t clock_ms(const host_clock& c)
+{
+  int64_t elapsed = real_us() - c.start_us;
+  return (uint64_t)(c.start_us / 1000 + c.offset_ms + (int64_t)(elapsed * (1.0 + c.drift)) / 1000 + c.correction_ms);
+}
+
+
+static int open_socket()
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(GROUP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    exit(2);
+  }
+
+  in_addr loopback;
+  inet_aton("127.0.0.1", &loopback);
+  ip_mreq mreq = {};
+  uint8_t group[4] = { GROUP_ADDRESS };
+  memcpy(&mreq.imr_multiaddr, group, 4);
+  mreq.imr_interface = loopback;
+  if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+    perror("IP_ADD_MEMBERSHIP");
+    exit(2);
+  }
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+  uint8_t loop = 1;
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  return fd;
+}
+
+
+static void send_beacon(int fd, const group_beacon& b)
+{
+  uint8_t buf[GROUP_BEACON_SIZE];
+  size_t len = group_encode(b, buf, sizeof(buf));
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(GROUP_PORT);
+  uint8_t group[4] = { GROUP_ADDRESS };
+  memcpy(&to.sin_addr, group, 4);
+  sendto(fd, buf, len, 0, (sockaddr*)&to, sizeof(to));
+}
+
+
+// One controller, reports "<id> <seq> <real us>" per applied change on out
+static void run_controller(int id, bool leader, int seconds, int jitter_ms, int out)
+{
+  srand(getpid());
+  host_clock clk = { real_us(), rand() % 20001 - 10000, (rand() % 401 - 200) * 1e-6, 0 };
+  int fd = open_socket();
+  group_clock gc;
+  group_clock_reset(gc);
+
+  group_state pending = {};             // scheduled, not applied yet
+  bool has_pending = false;
+  uint16_t applied_seq = 0;
+  uint16_t beacon_seq = 0;
+  uint64_t next_beacon = 0, next_change = 0;
+  int64_t end_us = real_us() + (int64_t)seconds * 1000000;
+
+  // Followers start a bit later, the leader needs its socket first
+  if (leader) next_change = clock_ms(clk) + 1000;
+
+  while (real_us() < end_us) {
+    uint64_t now = clock_ms(clk);
+
+    if (leader && now >= next_change) {
+      // like a change from the web page or a timer
+      pending.seq++;
+      pending.apply_ms = now + GROUP_APPLY_DELAY_MS;
+      pending.brightness = pending.seq % 101;
+      has_pending = true;
+      next_beacon = now;
+      next_change += 1000;
+    }
+    if (leader && now >= next_beacon) {
+      group_beacon b = {};
+      b.group = 1;
+      b.seq = ++beacon_seq;
+      b.state = pending;
+      if (jitter_ms) usleep(rand() % (jitter_ms * 1000 + 1));
+      b.time_ms = clock_ms(clk);
+      send_beacon(fd, b);
+      next_beacon = now + (has_pending ? GROUP_PENDING_BEACON_MS : GROUP_BEACON_MS);
+    }
+
+    // Followers: beacons in
+    pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, 0) > 0) {
+      uint8_t buf[64];
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      group_beacon b;
+      if (leader || n <= 0 || !group_decode(b, buf, n) || b.group != 1) continue;
+      // the leader was held up after stamping, that is the network delay
+      clk.correction_ms += group_clock_sample(gc, (int64_t)(b.time_ms - clock_ms(clk)));
+      if (b.state.seq != applied_seq && (!has_pending || b.state.seq != pending.seq)) {
+        pending = b.state;
+        has_pending = b.state.seq != 0;
+      }
+    }
+
+    now = clock_ms(clk);
+    if (has_pending && now >= pending.apply_ms) {
+      dprintf(out, "%d %u %lld\n", id, pending.seq, (long long)real_us());
+      applied_seq = pending.seq;
+      has_pending = false;
+    }
+    usleep(100);
+  }
+  if (!leader) {
+    fprintf(stderr, "follower %d: %u beacons, %u steps, last error %d ms\n", id, gc.beacons, gc.steps, gc.error);
+  }
+  close(fd);
+}
+
+
+int group_host_main(int argc, char** argv)
+{
+  int followers = argc > 0 ? atoi(argv[0]) : 4;
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  int jitter_ms = argc > 2 ? atoi(argv[2]) : 3;
+  printf("group on loopback: 1 leader, %d followers, %d s, jitter up to %d ms\n", followers, seconds, jitter_ms);
+  fflush(stdout);
+
+  int pipefd[2];
+  if (pipe(pipefd) < 0) return 2;
+  for (int i = 0; i <= followers; i++) {
+    if (fork() == 0) {
+      close(pipefd[0]);
+      run_controller(i, i == 0, seconds, jitter_ms, pipefd[1]);
+      _exit(0);
+    }
+  }
+  close(pipefd[1]);
+
+  // seq -> real times of all controllers that applied it
+  std::map<unsigned, std::vector<long long>> applied;
+  FILE* in = fdopen(pipefd[0], "r");
+  int id;
+  unsigned seq;
+  long long us;
+  while (fscanf(in, "%d %u %lld", &id, &seq, &us) == 3) applied[seq].push_back(us);
+  fclose(in);
+  while (wait(NULL) > 0) {
+  }
+
+  int failed = 0;
+  long long worst = 0, total = 0;
+  int changes = 0;
+  for (auto& a : applied) {
+    long long lo = a.second[0], hi = a.second[0];
+    for (long long t : a.second) {
+      if (t < lo) lo = t;
+      if (t > hi) hi = t;
+    }
+    bool complete = (int)a.second.size() == followers + 1;
+    printf("  change %2u: %d of %d controllers, spread %6.2f ms%s\n", a.first, (int)a.second.size(),
+           followers + 1, (hi - lo) / 1000.0, complete ? "" : "  (missed)");
+    // the first change may come before the followers run
+    if (a.first > 1 && (!complete || hi - lo > GROUP_TEST_SPREAD_US)) failed = 1;
+    if (a.first > 1) {
+      if (hi - lo > worst) worst = hi - lo;
+      total += hi - lo;
+      changes++;
+    }
+  }
+  if (changes) printf("spread: mean %.2f ms, worst %.2f ms\n", total / 1000.0 / changes, worst / 1000.0);
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,254 @@
+// Heap counts (heap_track.h) on the host (pio run -e native):
+//
+//   .pio/build/native/program heap [frames]
+//
+// On the device malloc and free are wrapped at link time, here new and
+// delete of this program count while a test runs. First the render path of
+// strip_service(): base color, four segments with the built-in effects and
+// one with an effect program, power limit and dithering. After the first
+// frame it must not allocate, exit code 1 if it does. Then a region that
+// allocates on purpose must show up with its allocations, peak and site,
+// what a counted allocation costs, and the history of the largest free
+// block over three simulated days.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "heap_track.h"
+#include "led_color.h"
+#include "led_power.h"
+#include "led_segments.h"
+#include "led_vm.h"
+#include "led_vm_compile.h"
+#include "trace.h"
+
+#define NEO_GRB 0x52   // Adafruit_NeoPixel.h
+
+static bool counting;
+
+
+// not inlined: gcc takes the free() in delete for one of a new'ed pointer
+__attribute__((noinline)) void* operator new(size_t size)
+{
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  if (counting) heap_track_alloc(malloc_usable_size(p), (uintptr_t)__builtin_return_address(0), false);
+  return p;
+}
+
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+  if (!p) return;
+  if (counting) heap_track_free(malloc_usable_size(p), false);
+  free(p);
+}
+
+
+void operator delete[](void* p) noexcept
+{
+  operator delete(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+
+void operator delete[](void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+
+// TRACE_SCOPE calls heap_track_trace() only with HEAP_TRACK_ENABLED
+struct region {
+  const char* name;
+  explicit region(const char* n) : name(n) { heap_track_trace(n, TRACE_PHASE_BEGIN); }
+  ~region() { heap_track_trace(name, TRACE_PHASE_END); }
+};
+
+
+static double now_ns()
+{
+  using namespace std::chrono;
+  return duration<double, std::nano>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+static const heap_region& find_region(const char* name)
+{
+  for (uint8_t i = 0; i < heap.region_count; i++) {
+    if (strcmp(heap.regions[i].name, name) == 0) return heap.regions[i];
+  }
+  static heap_region none;
+  return none;
+}
+
+
+static void print_regions()
+{
+  printf("  %-14s %7s %7s %8s %7s %9s %7s\n", "region", "passes", "allocs", "bytes", "frees", "most/pass", "peak");
+  for (uint8_t i = 0; i < heap.region_count; i++) {
+    const heap_region& r = heap.regions[i];
+    printf("  %-14s %7u %7u %8u %7u %9u %7u\n", r.name, r.passes, r.allocs, r.bytes, r.frees, r.max_allocs, r.peak);
+  }
+}
+
+
+// strip_service() without the strip: true if no frame after the first allocated
+static bool render_test(int frames)
+{
+  const int leds = 300;
+  led_color_model model;
+  led_color_begin(model, NEO_GRB);
+  std::vector<uint16_t> frame(leds * 3);
+  std::vector<uint8_t> error(leds * 3), out(leds * 3);
+  led_dither dither;
+  led_dither_begin(dither, frame.data(), error.data(), leds);
+  led_power power;
+  led_power_begin(power);
+  power.budget_ma = 2000;
+
+  led_segments segs;
+  led_segments_clear(segs);
+  for (int i = 0; i < 5; i++) {
+    led_segment& seg = segs.seg[i];
+    snprintf(seg.name, sizeof(seg.name), "zone%d", i);
+    seg.start = i * leds / 5;
+    seg.count = leds / 5;
+    seg.flags = LED_SEGMENT_ON | (i & 1 ? LED_SEGMENT_MIRROR : 0);
+    seg.effect = i < 4 ? i : LED_EFFECT_PROGRAM;
+    seg.speed = 40;
+    seg.brightness = 80;
+    seg.color = { LED_COLOR_HSV, 0, 0, 0, (uint16_t)(i * 70), 255, 2700 };
+    segs.count++;
+    led_segments_changed(segs, i, 0);
+  }
+  std::vector<uint8_t> blob;
+  std::string compile_error;
+  if (!led_vm_compile("frame { p = t * 0.1; } pixel { hsv(x + p, 1, 0.3 + 0.7 * tri(t * 0.25 + x)); }", blob,
+                      compile_error)) {
+    printf("effect program: %s\n", compile_error.c_str());
+    return false;
+  }
+  std::unique_ptr<led_vm> vm(new led_vm());
+  led_vm_load(*vm, blob.data(), blob.size());
+  led_rgb16 base = led_color_rgb(model, 20, 10, 0);
+
+  heap_track_clear();
+  counting = true;
+  uint32_t first = 0;
+  for (int f = 0; f < frames; f++) {
+    region frame_region("strip frame");
+    {
+      region r("render");
+      led_segments_render(segs, model, base, dither, f * 16, vm.get());
+    }
+    uint16_t level = led_power_apply(power, dither, 50000, f * 16);
+    {
+      region r("dither");
+      led_dither_write(dither, model, level, out.data());
+    }
+    if (f == 0) first = heap.allocs;
+  }
+  counting = false;
+  uint32_t steady = heap.allocs - first;
+  printf("render path, %d LEDs, 5 segments (4 effects + program), %d frames:\n", leds, frames);
+  print_regions();
+  printf("  first frame %u allocations, then %u\n", first, steady);
+  return steady == 0;
+}
+
+
+// A region that allocates must be seen as such
+static bool allocating_test()
+{
+  heap_track_clear();
+  counting = true;
+  const int passes = 100;
+  std::vector<std::unique_ptr<std::string>> kept;
+  for (int i = 0; i < passes; i++) {
+    region r("request");
+    // a page line put together from pieces, as String did
+    std::string line = "<p>Red: " + std::to_string(i) + "</p><input type=\"range\" min=\"0\" max=\"255\">";
+    if (i % 10 == 0) kept.emplace_back(new std::string(line));
+  }
+  kept.clear();
+  counting = false;
+  const heap_region& r = find_region("request");
+  const heap_site* top[3];
+  uint8_t n = heap_track_top(top, 3);
+  printf("region that allocates, %d passes:\n", passes);
+  print_regions();
+  for (uint8_t i = 0; i < n; i++) {
+    printf("  site %#lx in %s: %u allocations, %u bytes\n", (unsigned long)top[i]->pc,
+           heap.regions[top[i]->region].name, top[i]->allocs, top[i]->bytes);
+  }
+  return r.passes == passes && r.allocs >= passes && r.max_allocs >= 1 && r.peak >= 64 && n > 0 &&
+         heap.regions[top[0]->region].name == r.name;
+}
+
+
+static void cost_test()
+{
+  const int n = 1000000;
+  double t[2];
+  for (int pass = 0; pass < 2; pass++) {
+    heap_track_clear();
+    counting = pass == 1;
+    double t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+      region r("cost");
+      delete new int(i);
+    }
+    t[pass] = (now_ns() - t0) / n;
+    counting = false;
+  }
+  printf("new + delete in a region %.1f ns, counted %.1f ns\n", t[0], t[1]);
+}
+
+
+// Every 10 s a sample, the largest block shrinks on the last day
+static bool history_test()
+{
+  const uint32_t day = 86400000;
+  uint32_t largest = 110000;
+  for (uint32_t ms = 0; ms < 3 * day; ms += HEAP_SAMPLE_EVERY_MS) {
+    if (ms > 2 * day && ms % 3600000 == 0) largest -= 1500;
+    heap_track_sample(ms, 180000 - (ms / 1000) % 5000, largest - (ms / 1000) % 700);
+  }
+  printf("largest block, lowest per %u min, newest first:", HEAP_SAMPLE_MS / 60000);
+  for (uint32_t i = 0; i < HEAP_HISTORY; i++) {
+    printf("%s%u", i % 12 ? " " : "\n  ", heap.history[(heap.samples - 1 - i) % HEAP_HISTORY].largest_min);
+  }
+  printf("\n  lowest %u bytes free, %u largest block\n", heap.lowest.free_min, heap.lowest.largest_min);
+  return heap.samples >= HEAP_HISTORY && heap.lowest.largest_min == largest - 690;
+}
+
+
+int heap_host_main(int argc, char** argv)
+{
+  int frames = argc > 0 ? atoi(argv[0]) : 2000;
+  bool ok = render_test(frames);
+  ok = allocating_test() && ok;
+  cost_test();
+  ok = history_test() && ok;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+// Host benchmark of the color model (pio run -e native).
+//
+// Converts frames of HSV, RGB and Kelvin colors into a strip buffer and
+// prints the time per pixel, then compares the rounding of the 16 bit
+// brightness stage with Adafruit_NeoPixel::setBrightness() on 8 bit values.
+// Then the dither stage: time per frame and how close the light averaged
+// over the frames gets to the exact value at low brightness. Then the
+// rendering of segments with effects into the frame. Last the current
+// estimate of led_power.h against the dithered output, and the limiter.
+//
+//   .pio/build/native/program [leds] [frames]
+//   .pio/build/native/program group ...     group mode test, see group_host.cpp
+//   .pio/build/native/program serial ...    serial control latency, see serial_host.cpp
+//   .pio/build/native/program vm ...        effect programs, see vm_host.cpp
+//   .pio/build/native/program trace ...     trace points, see trace_host.cpp
+//   .pio/build/native/program log ...       event log in flash, see log_host.cpp
+//   .pio/build/native/program sntp ...      SNTP and the RTC drift, see sntp_host.cpp
+//   .pio/build/native/program heap ...      heap counts of the render path, see heap_host.cpp
+//   .pio/build/native/program strip ...     specialised strip type, see strip_host.cpp
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "led_color.h"
+#include "led_power.h"
+#include "led_segments.h"
+
+#define NEO_GRB 0x52   // Adafruit_NeoPixel.h
+
+static double now_ns()
+{
+  using namespace std::chrono;
+  return duration<double, std::nano>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Keeps the compiler from dropping the conversions
+static uint32_t checksum(const std::vector<uint8_t>& buf)
+{
+  uint32_t sum = 0;
+  for (uint8_t b : buf) sum = sum * 31 + b;
+  return sum;
+}
+
+
+int group_host_main(int argc, char** argv);
+int serial_host_main(int argc, char** argv);
+int vm_host_main(int argc, char** argv);
+int trace_host_main(int argc, char** argv);
+int log_host_main(int argc, char** argv);
+int sntp_host_main(int argc, char** argv);
+int heap_host_main(int argc, char** argv);
+int strip_host_main(int argc, char** argv);
+
+
+int main(int argc, char** argv)
+{
+  if (argc > 1 && strcmp(argv[1], "group") == 0) return group_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "serial") == 0) return serial_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "vm") == 0) return vm_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "trace") == 0) return trace_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "log") == 0) return log_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "sntp") == 0) return sntp_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "heap") == 0) return heap_host_main(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "strip") == 0) return strip_host_main(argc - 2, argv + 2);
+
+  int leds = argc > 1 ? atoi(argv[1]) : 300;
+  int frames = argc > 2 ? atoi(argv[2]) : 2000;
+
+  led_color_model model;
+  led_color_begin(model, NEO_GRB);
+  led_color_set_balance(model, 255, 220, 180);
+  led_color_set_brightness(model, 40000);
+
+  std::vector<uint8_t> out(leds * 3);
+  std::vector<led_hsv> hsv(leds);
+  std::vector<uint8_t> rgb(leds * 3);
+  for (int i = 0; i < leds; i++) {
+    hsv[i] = { (uint16_t)(i * 97 % LED_HUE_MAX), (uint8_t)(128 + i % 128), (uint8_t)(i * 7) };
+    rgb[i * 3] = i * 13;
+    rgb[i * 3 + 1] = i * 29;
+    rgb[i * 3 + 2] = i * 53;
+  }
+
+  printf("%d LEDs, %d frames\n", leds, frames);
+  double pixels = (double)leds * frames;
+  uint32_t sum = 0;
+
+  double t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    for (int i = 0; i < leds; i++) hsv[i].h = (hsv[i].h + 1) % LED_HUE_MAX;
+    led_color_write_hsv(model, hsv.data(), out.data(), leds);
+    sum += checksum(out);
+  }
+  double hsv_ns = (now_ns() - t0) / pixels;
+
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    uint8_t* p = out.data();
+    for (int i = 0; i < leds; i++, p += 3) {
+      led_color_write(model, led_color_rgb(model, rgb[i * 3] + f, rgb[i * 3 + 1], rgb[i * 3 + 2]), p);
+    }
+    sum += checksum(out);
+  }
+  double rgb_ns = (now_ns() - t0) / pixels;
+
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    uint8_t* p = out.data();
+    for (int i = 0; i < leds; i++, p += 3) {
+      led_color_write(model, led_color_kelvin(model, LED_KELVIN_MIN + (i * 37 + f) % 11000), p);
+    }
+    sum += checksum(out);
+  }
+  double kelvin_ns = (now_ns() - t0) / pixels;
+
+  // The checksum loop is part of every measurement, subtract it
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    out[f % out.size()]++;
+    sum += checksum(out);
+  }
+  double sum_ns = (now_ns() - t0) / pixels;
+
+  printf("  hsv    %6.2f ns/pixel\n", hsv_ns - sum_ns);
+  printf("  rgb    %6.2f ns/pixel\n", rgb_ns - sum_ns);
+  printf("  kelvin %6.2f ns/pixel\n", kelvin_ns - sum_ns);
+  printf("  %d LEDs at 60 fps: %.2f %% of the time for hsv (host CPU)\n", leds,
+         (hsv_ns - sum_ns) * leds * 60 / 1e7);
+
+  // Brightness: exact light of a channel vs. what reaches the LED.
+  // setBrightness(b) does (v * (b + 1)) >> 8 on the values that are sent,
+  // the model scales in 16 bit and rounds once at the end.
+  printf("brightness   error setBrightness   error 16 bit   (mean / max in LED steps)\n");
+  led_color_set_balance(model, 255, 255, 255);
+  for (int percent : { 2, 5, 10, 25, 50, 100 }) {
+    uint8_t b = (uint8_t)(percent * 255 / 100);
+    uint16_t scale = (uint16_t)(b * 65535 / 255);
+    led_color_set_brightness(model, scale);
+    double old_sum = 0, new_sum = 0, old_max = 0, new_max = 0;
+    for (int v = 0; v < 256; v++) {
+      // linear value of the input and the exact result in LED steps
+      uint16_t linear = (uint16_t)(powf(v / 255.0f, LED_GAMMA) * 65535.0f + 0.5f);
+      double exact = linear / 65535.0 * 255.0 * scale / 65535.0;
+      uint8_t linear8 = (uint8_t)(linear / 65535.0 * 255.0 + 0.5);
+      double old_err = fabs(((linear8 * (b + 1)) >> 8) - exact);
+      double new_err = fabs(led_quantize(model.lut[0][v]) - exact);
+      old_sum += old_err;
+      new_sum += new_err;
+      if (old_err > old_max) old_max = old_err;
+      if (new_err > new_max) new_max = new_err;
+    }
+    printf("  %3d %%       %5.3f / %5.3f          %5.3f / %5.3f\n", percent, old_sum / 256, old_max,
+           new_sum / 256, new_max);
+  }
+
+  // Dither stage, one frame for the strip of the XIAO and for the benchmark
+  led_color_set_brightness(model, 65535);
+  for (int n : { 37, leds }) {
+    std::vector<uint16_t> frame(n * 3);
+    std::vector<uint8_t> error(n * 3);
+    led_dither dither;
+    led_dither_begin(dither, frame.data(), error.data(), n);
+    for (int i = 0; i < n; i++) led_dither_set(dither, i, led_color_hsv(model, hsv[i % leds]));
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+      led_dither_write(dither, model, (uint16_t)(1000 + f), out.data());
+      sum += out[f % (n * 3)];
+    }
+    double frame_ns = (now_ns() - t0) / frames;
+    printf("dither %3d LEDs  %8.0f ns/frame  %.2f ns/pixel\n", n, frame_ns, frame_ns / n);
+  }
+
+  // A slow fade at the low end, white: every LED step of the output vs. the
+  // exact light, per frame and averaged over 64 frames (at 250 frames/s)
+  printf("fade 0..2 %%      distinct levels   mean error of the 64 frame average (LED steps)\n");
+  {
+    led_rgb16 white = led_color_rgb(model, 255, 255, 255);
+    uint16_t frame[3];
+    uint8_t error[3];
+    led_dither dither;
+    led_dither_begin(dither, frame, error, 1);
+    led_dither_set(dither, 0, white);
+    uint8_t px[3];
+    int steps = 1000;
+    double plain_err = 0, dither_err = 0;
+    int plain_levels = 0, dither_levels = 0, last_plain = -1;
+    std::vector<bool> seen(256 * 64 + 1, false);
+    for (int s = 0; s < steps; s++) {
+      uint16_t level = (uint16_t)((uint32_t)s * 65535 * 2 / 100 / steps);
+      double exact = white.r / 65535.0 * level / 65535.0 * 255.0;
+      uint8_t plain = led_quantize((uint16_t)((uint32_t)white.r * level >> 16));
+      if (plain != last_plain) plain_levels++;
+      last_plain = plain;
+      int total = 0;
+      for (int f = 0; f < 64; f++) {
+        led_dither_write(dither, model, level, px);
+        total += px[1];
+      }
+      if (!seen[total]) dither_levels++;
+      seen[total] = true;
+      plain_err += fabs(plain - exact);
+      dither_err += fabs(total / 64.0 - exact);
+    }
+    printf("  8 bit           %4d              %.3f\n", plain_levels, plain_err / steps);
+    printf("  dithered        %4d              %.3f\n", dither_levels, dither_err / steps);
+  }
+
+  // Segments: base color plus four zones with effects, rendered per frame
+  {
+    std::vector<uint16_t> frame(leds * 3);
+    std::vector<uint8_t> error(leds * 3);
+    led_dither dither;
+    led_dither_begin(dither, frame.data(), error.data(), leds);
+    led_segments segs;
+    led_segments_clear(segs);
+    for (int i = 0; i < 4; i++) {
+      led_segment& seg = segs.seg[i];
+      snprintf(seg.name, sizeof(seg.name), "zone%d", i);
+      seg.start = i * leds / 4;
+      seg.count = leds / 4;
+      seg.flags = LED_SEGMENT_ON | (i & 1 ? LED_SEGMENT_MIRROR : 0);
+      seg.effect = i % LED_EFFECTS;
+      seg.speed = 40;
+      seg.brightness = 80;
+      seg.color = { LED_COLOR_HSV, 0, 0, 0, (uint16_t)(i * 90), 255, 2700 };
+      segs.count++;
+      led_segments_changed(segs, i, 0);
+    }
+    led_rgb16 base = led_color_rgb(model, 20, 10, 0);
+    t0 = now_ns();
+    for (int f = 0; f < frames; f++) {
+      led_segments_render(segs, model, base, dither, f * 4, NULL);
+      sum += frame[f % frame.size()];
+    }
+    double frame_ns = (now_ns() - t0) / frames;
+    printf("segments %d LEDs, 4 zones  %8.0f ns/frame  %.2f ns/pixel\n", leds, frame_ns, frame_ns / leds);
+  }
+
+  // Power: estimate from the channel sums vs. the current of the 8 bit
+  // output (averaged over 64 frames, the dithering), and its cost against
+  // summing the frame up each time
+  {
+    std::vector<uint16_t> frame(leds * 3);
+    std::vector<uint8_t> error(leds * 3);
+    led_dither dither;
+    led_dither_begin(dither, frame.data(), error.data(), leds);
+    led_power power;
+    led_power_begin(power);
+    for (int i = 0; i < leds; i++) led_dither_set(dither, i, led_color_hsv(model, hsv[i % leds]));
+    double worst = 0;
+    for (uint16_t level : { 65535, 20000, 3000, 300 }) {
+      uint64_t out_ua = 0;
+      for (int f = 0; f < 64; f++) {
+        led_dither_write(dither, model, level, out.data());
+        for (int i = 0; i < leds * 3; i++) out_ua += (uint64_t)out[i] * LED_POWER_CHANNEL_UA;
+      }
+      double actual = (out_ua / 64.0 / 255 + (double)leds * LED_POWER_IDLE_UA) / 1000;
+      double estimate = led_power_estimate(power, dither, level);
+      worst = std::max(worst, fabs(estimate - actual) / actual);
+      printf("power %d LEDs at %5u: estimate %7.1f mA, output %7.1f mA\n", leds, level, estimate, actual);
+    }
+    printf("  largest difference %.2f %%\n", worst * 100);
+
+    int n = frames * 10;
+    t0 = now_ns();
+    for (int f = 0; f < n; f++) {
+      led_dither_set(dither, f % leds, led_color_hsv(model, hsv[f % leds]));
+      sum += led_power_estimate(power, dither, 40000);
+    }
+    double incremental = (now_ns() - t0) / n;
+    t0 = now_ns();
+    for (int f = 0; f < n; f++) {
+      led_dither_set(dither, f % leds, led_color_hsv(model, hsv[f % leds]));
+      uint64_t s[3] = { 0, 0, 0 };
+      for (int i = 0; i < leds * 3; i++) s[i % 3] += frame[i];
+      sum += (uint32_t)((s[0] + s[1] + s[2]) * LED_POWER_CHANNEL_UA / 65535 / 1000);
+    }
+    double rescan = (now_ns() - t0) / n;
+    printf("  estimate per frame: %.1f ns from the sums, %.1f ns summing the frame\n", incremental, rescan);
+
+    // limiter: white on all of them, 5 A budget, then a dark color
+    power.budget_ma = 5000;
+    led_dither_fill(dither, led_color_rgb(model, 255, 255, 255));
+    printf("  white, budget %u mA: %lu mA unlimited", power.budget_ma,
+           (unsigned long)led_power_estimate(power, dither, 65535));
+    led_power_apply(power, dither, 65535, 0);
+    printf(", %lu mA at %.1f %%\n", (unsigned long)power.estimate_ma, power.limit * 100.0 / 65535);
+    led_dither_fill(dither, led_color_rgb(model, 60, 0, 30));
+    printf("  then dark purple, limit");
+    for (uint32_t ms = 0; ms <= 1200; ms += 200) {
+      led_power_apply(power, dither, 65535, ms);
+      printf(" %.0f", power.limit * 100.0 / 65535);
+    }
+    printf(" %% at 200 ms steps\n");
+  }
+
+  printf("(checksum %08x)\n", sum);
+  return 0;
+}
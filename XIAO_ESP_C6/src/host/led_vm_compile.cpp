@@ -0,0 +1,357 @@
+#include "led_vm_compile.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <memory>
+
+#include "led_vm.h"
+
+enum { TOK_END, TOK_NUMBER, TOK_NAME, TOK_PUNCT };
+
+struct compiler {
+  const char* p;
+  int line;
+  int kind;                             // current token
+  std::string text;
+  int32_t number;
+  std::vector<uint8_t>* code;           // part being compiled
+  std::vector<size_t> starts;           // of the instructions in code, for folding
+  std::map<std::string, int> regs;      // name -> register
+  std::vector<bool> assigned;           // per register
+  std::string error;
+};
+
+
+static bool fail(compiler& c, const std::string& text)
+{
+  if (c.error.empty()) c.error = "line " + std::to_string(c.line) + ": " + text;
+  return false;
+}
+
+
+static bool next(compiler& c)
+{
+  for (;;) {
+    while (isspace((unsigned char)*c.p)) {
+      if (*c.p == '\n') c.line++;
+      c.p++;
+    }
+    if (*c.p != '#') break;
+    while (*c.p && *c.p != '\n') c.p++;
+  }
+  c.text.clear();
+  if (!*c.p) {
+    c.kind = TOK_END;
+    return true;
+  }
+  if (isdigit((unsigned char)*c.p) || (*c.p == '.' && isdigit((unsigned char)c.p[1]))) {
+    char* end;
+    double v = strtod(c.p, &end);
+    c.text.assign(c.p, end - c.p);
+    c.p = end;
+    if (v >= 32768) return fail(c, c.text + ": too large, at most 32767.9999");
+    c.number = (int32_t)llround(v * LED_VM_ONE);
+    c.kind = TOK_NUMBER;
+    return true;
+  }
+  if (isalpha((unsigned char)*c.p) || *c.p == '_') {
+    while (isalnum((unsigned char)*c.p) || *c.p == '_') c.text += *c.p++;
+    c.kind = TOK_NAME;
+    return true;
+  }
+  c.text = *c.p++;
+  if ((c.text == "<" || c.text == ">") && *c.p == '=') c.text += *c.p++;
+  if (!strchr("+-*/%<>?:=(),;{}", c.text[0])) return fail(c, "unexpected '" + c.text + "'");
+  c.kind = TOK_PUNCT;
+  return true;
+}
+
+
+static bool is(const compiler& c, const char* punct)
+{
+  return c.kind == TOK_PUNCT && c.text == punct;
+}
+
+
+static bool expect(compiler& c, const char* punct)
+{
+  if (!is(c, punct)) return fail(c, std::string("'") + punct + "' expected");
+  return next(c);
+}
+
+
+static void emit(compiler& c, uint8_t op)
+{
+  c.starts.push_back(c.code->size());
+  c.code->push_back(op);
+}
+
+
+static void emit_push(compiler& c, int32_t v)
+{
+  emit(c, LED_OP_PUSH);
+  for (int i = 0; i < 4; i++) c.code->push_back((uint32_t)v >> (8 * i));
+}
+
+
+static void emit_reg(compiler& c, uint8_t op, int reg)
+{
+  emit(c, op);
+  c.code->push_back(reg);
+}
+
+
+// Value of the PUSH k instructions from the end, false if it is none
+static bool pushed(const compiler& c, size_t k, int32_t& v)
+{
+  if (c.starts.size() < k) return false;
+  size_t at = c.starts[c.starts.size() - k];
+  const uint8_t* p = c.code->data() + at;
+  if (p[0] != LED_OP_PUSH) return false;
+  v = p[1] | (p[2] << 8) | (p[3] << 16) | ((uint32_t)p[4] << 24);
+  return true;
+}
+
+
+static void drop(compiler& c, size_t k)
+{
+  c.code->resize(c.starts[c.starts.size() - k]);
+  c.starts.resize(c.starts.size() - k);
+}
+
+
+// Operator, with constants folded like the VM computes them
+static void emit_op(compiler& c, uint8_t op)
+{
+  int32_t a, b;
+  if (op == LED_OP_NEG && pushed(c, 1, a)) {
+    drop(c, 1);
+    emit_push(c, (int32_t)(0u - (uint32_t)a));
+    return;
+  }
+  if ((op == LED_OP_ADD || op == LED_OP_SUB || op == LED_OP_MUL) && pushed(c, 2, a) && pushed(c, 1, b)) {
+    drop(c, 2);
+    if (op == LED_OP_ADD) emit_push(c, (int32_t)((uint32_t)a + (uint32_t)b));
+    if (op == LED_OP_SUB) emit_push(c, (int32_t)((uint32_t)a - (uint32_t)b));
+    if (op == LED_OP_MUL) emit_push(c, (int32_t)(((int64_t)a * b) >> 16));
+    return;
+  }
+  emit(c, op);
+}
+
+
+static bool expression(compiler& c);
+
+struct function {
+  const char* name;
+  uint8_t args;
+  uint8_t op;
+};
+
+static const function functions[] = {
+  { "sin", 1, LED_OP_SIN }, { "cos", 1, LED_OP_SIN }, { "tri", 1, LED_OP_TRI },
+  { "frac", 1, LED_OP_FRAC }, { "floor", 1, LED_OP_FLOOR }, { "abs", 1, LED_OP_ABS },
+  { "min", 2, LED_OP_MIN }, { "max", 2, LED_OP_MAX }, { "clamp", 3, LED_OP_MIN },
+  { "noise", 1, LED_OP_NOISE },
+};
+
+
+static bool call(compiler& c, const function& f)
+{
+  if (!expect(c, "(")) return false;
+  for (int i = 0; i < f.args; i++) {
+    if (i && !expect(c, ",")) return false;
+    if (!expression(c)) return false;
+    // clamp(v, lo, hi) = min(max(v, lo), hi)
+    if (strcmp(f.name, "clamp") == 0 && i == 1) emit_op(c, LED_OP_MAX);
+  }
+  if (!expect(c, ")")) return false;
+  // cos(a) = sin(a + 1/4)
+  if (strcmp(f.name, "cos") == 0) {
+    emit_push(c, LED_VM_ONE / 4);
+    emit_op(c, LED_OP_ADD);
+  }
+  emit_op(c, f.op);
+  return true;
+}
+
+
+static bool primary(compiler& c)
+{
+  if (c.kind == TOK_NUMBER) {
+    emit_push(c, c.number);
+    return next(c);
+  }
+  if (is(c, "(")) {
+    if (!next(c) || !expression(c)) return false;
+    return expect(c, ")");
+  }
+  if (is(c, "-")) {
+    if (!next(c) || !primary(c)) return false;
+    emit_op(c, LED_OP_NEG);
+    return true;
+  }
+  if (c.kind != TOK_NAME) return fail(c, "value expected");
+
+  std::string name = c.text;
+  if (!next(c)) return false;
+  if (is(c, "(")) {
+    for (const function& f : functions) {
+      if (name == f.name) return call(c, f);
+    }
+    return fail(c, name + ": no such function");
+  }
+  auto reg = c.regs.find(name);
+  if (reg == c.regs.end() || !c.assigned[reg->second]) return fail(c, name + ": not assigned");
+  emit_reg(c, LED_OP_LOAD, reg->second);
+  return true;
+}
+
+
+static bool product(compiler& c)
+{
+  if (!primary(c)) return false;
+  while (is(c, "*") || is(c, "/") || is(c, "%")) {
+    uint8_t op = is(c, "*") ? LED_OP_MUL : is(c, "/") ? LED_OP_DIV : LED_OP_MOD;
+    if (!next(c) || !primary(c)) return false;
+    emit_op(c, op);
+  }
+  return true;
+}
+
+
+static bool sum(compiler& c)
+{
+  if (!product(c)) return false;
+  while (is(c, "+") || is(c, "-")) {
+    uint8_t op = is(c, "+") ? LED_OP_ADD : LED_OP_SUB;
+    if (!next(c) || !product(c)) return false;
+    emit_op(c, op);
+  }
+  return true;
+}
+
+
+static bool comparison(compiler& c)
+{
+  if (!sum(c)) return false;
+  uint8_t op = is(c, "<") ? LED_OP_LT : is(c, ">") ? LED_OP_GT : is(c, "<=") ? LED_OP_LE
+             : is(c, ">=") ? LED_OP_GE : 0;
+  if (!op) return true;
+  if (!next(c) || !sum(c)) return false;
+  emit_op(c, op);
+  return true;
+}
+
+
+static bool expression(compiler& c)
+{
+  if (!comparison(c)) return false;
+  if (!is(c, "?")) return true;
+  if (!next(c) || !expression(c) || !expect(c, ":") || !expression(c)) return false;
+  emit_op(c, LED_OP_SEL);
+  return true;
+}
+
+
+static bool statement(compiler& c)
+{
+  if (c.kind != TOK_NAME) return fail(c, "statement expected");
+  std::string name = c.text;
+  if (!next(c)) return false;
+
+  if (name == "hsv" && is(c, "(")) {
+    if (!next(c)) return false;
+    for (int i = 0; i < 3; i++) {
+      if (i && !expect(c, ",")) return false;
+      if (!expression(c)) return false;
+    }
+    emit(c, LED_OP_HSV);
+    return expect(c, ")") && expect(c, ";");
+  }
+
+  if (!expect(c, "=") || !expression(c)) return false;
+  auto reg = c.regs.find(name);
+  if (reg == c.regs.end()) {
+    int n = c.regs.size();
+    if (n >= LED_VM_REGS) return fail(c, name + ": more than " + std::to_string(LED_VM_REGS - LED_REG_VARS) + " variables");
+    reg = c.regs.insert({ name, n }).first;
+  }
+  if (reg->second < LED_REG_INPUTS) return fail(c, name + ": read only");
+  emit_reg(c, LED_OP_STORE, reg->second);
+  c.assigned[reg->second] = true;
+  return expect(c, ";");
+}
+
+
+// Statements up to "}" (in a block) or the end
+static bool statements(compiler& c, std::vector<uint8_t>& code, bool block)
+{
+  c.code = &code;
+  c.starts.clear();
+  while (block ? !is(c, "}") : c.kind != TOK_END) {
+    if (c.kind == TOK_END) return fail(c, "'}' expected");
+    if (!statement(c)) return false;
+  }
+  return !block || next(c);
+}
+
+
+bool led_vm_compile(const char* source, std::vector<uint8_t>& blob, std::string& error)
+{
+  compiler c;
+  c.p = source;
+  c.line = 1;
+  c.assigned.assign(LED_VM_REGS, false);
+  const char* names[] = { "i", "n", "x", "t", "r", "g", "b" };
+  for (int i = 0; i < LED_REG_VARS; i++) {
+    c.regs[names[i]] = i;
+    c.assigned[i] = true;
+  }
+
+  std::vector<uint8_t> frame, pixel;
+  bool ok = next(c);
+  // frame { } and pixel { } or only the pixel part
+  const char* rest = c.p;
+  bool blocks = c.kind == TOK_NAME && (c.text == "frame" || c.text == "pixel");
+  if (blocks) {
+    while (*rest && isspace((unsigned char)*rest)) rest++;
+    blocks = *rest == '{';
+  }
+  if (!blocks) {
+    ok = ok && statements(c, pixel, false);
+  }
+  while (ok && blocks && c.kind != TOK_END) {
+    if (c.kind != TOK_NAME || (c.text != "frame" && c.text != "pixel")) {
+      ok = fail(c, "frame or pixel expected");
+      break;
+    }
+    std::vector<uint8_t>& code = c.text == "frame" ? frame : pixel;
+    if (!code.empty()) {
+      ok = fail(c, c.text + " twice");
+      break;
+    }
+    ok = next(c) && expect(c, "{") && statements(c, code, true);
+  }
+  if (!ok) {
+    error = c.error;
+    return false;
+  }
+
+  blob = { 'V', 'M', LED_VM_VERSION, 0, (uint8_t)frame.size(), (uint8_t)(frame.size() >> 8), (uint8_t)pixel.size(),
+           (uint8_t)(pixel.size() >> 8) };
+  blob.insert(blob.end(), frame.begin(), frame.end());
+  blob.insert(blob.end(), pixel.begin(), pixel.end());
+
+  // what the device would say (stack depth, size)
+  std::unique_ptr<led_vm> vm(new led_vm());
+  const char* load_error = led_vm_load(*vm, blob.data(), blob.size());
+  if (load_error) {
+    error = load_error;
+    return false;
+  }
+  return true;
+}
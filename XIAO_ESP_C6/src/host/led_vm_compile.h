@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Compiler of the effect language to the bytecode of led_vm.h.
+//
+//   # rainbow that breathes
+//   frame {
+//     p = t * 0.1;
+//     l = 0.3 + 0.7 * tri(t * 0.25);
+//   }
+//   pixel {
+//     hsv(x + p, 1, l);
+//   }
+//
+// Statements are "name = expression;" and "hsv(h, s, v);". Without frame /
+// pixel blocks the whole text is the pixel part. Numbers are fixed point
+// (4 decimals), operators + - * / % < > <= >= and c ? a : b, functions
+// sin, cos, tri, frac, floor, abs, min, max, clamp(v, lo, hi), noise.
+// Names: i, n, x, t to read, r, g, b for the color (0..1), up to 9 own
+// variables. They keep their value from pixel to pixel and frame to frame,
+// a name must be assigned before it is read.
+
+// Source -> blob for led_vm_load(), false with "line N: ..." in error
+bool led_vm_compile(const char* source, std::vector<uint8_t>& blob, std::string& error);
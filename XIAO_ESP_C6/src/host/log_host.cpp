@@ -0,0 +1,194 @@
+// Event log (event_log.h) on a simulated flash (pio run -e native):
+//
+//   .pio/build/native/program log [days] [events per day] [sectors]
+//
+// Writes the events of some months like loop() would (queued, flushed
+// every EVENT_LOG_FLUSH_MS), restarts now and then, sometimes in the
+// middle of a record, and checks after each restart that the log holds
+// exactly the newest events that fit. Then queries of random time ranges
+// against a plain list: same result, and how many flash reads the binary
+// search needs compared to reading from the oldest record on. Last the
+// erases per sector.
+//
+// The flash is NOR like the real one: erase sets a sector to 0xFF, a write
+// can only clear bits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "event_log.h"
+
+struct ram_flash {
+  std::vector<uint8_t> mem;
+  std::vector<uint32_t> erases;       // per sector
+  long bad_writes;                    // to bits that were not erased
+  long tear_at;                       // write number to cut in half, -1 = none
+  long writes;
+  std::vector<event_record> records;  // complete record writes, in order
+};
+
+
+static bool ram_read(const event_flash& f, uint32_t addr, void* buf, size_t len)
+{
+  ram_flash& r = *(ram_flash*)f.ctx;
+  if (addr + len > r.mem.size()) return false;
+  memcpy(buf, &r.mem[addr], len);
+  return true;
+}
+
+
+static bool ram_write(const event_flash& f, uint32_t addr, const void* buf, size_t len)
+{
+  ram_flash& r = *(ram_flash*)f.ctx;
+  if (addr + len > r.mem.size()) return false;
+  // power lost in the middle of this write
+  if (r.writes++ == r.tear_at) len /= 2;
+  const uint8_t* p = (const uint8_t*)buf;
+  for (size_t i = 0; i < len; i++) {
+    if ((r.mem[addr + i] & p[i]) != p[i]) r.bad_writes++;
+    r.mem[addr + i] &= p[i];
+  }
+  if (len == EVENT_LOG_RECORD && addr % EVENT_LOG_SECTOR >= EVENT_LOG_HEADER) {
+    r.records.push_back({ p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24), p[4],
+                          (uint16_t)(p[5] | (p[6] << 8)) });
+  }
+  return true;
+}
+
+
+static bool ram_erase(const event_flash& f, uint32_t addr)
+{
+  ram_flash& r = *(ram_flash*)f.ctx;
+  if (addr % EVENT_LOG_SECTOR || addr >= r.mem.size()) return false;
+  memset(&r.mem[addr], 0xFF, EVENT_LOG_SECTOR);
+  r.erases[addr / EVENT_LOG_SECTOR]++;
+  return true;
+}
+
+
+static bool same(const event_record& a, const event_record& b)
+{
+  return a.time == b.time && a.code == b.code && a.arg == b.arg;
+}
+
+
+// All events in the log (flash and queue) against the newest of written.
+// Torn records are lost, their slots still count.
+static bool check_contents(event_log& log, const std::vector<event_record>& written, int torn)
+{
+  event_log_reader r;
+  event_log_find(log, r, 0);
+  std::vector<event_record> got;
+  event_record e;
+  while (event_log_next(log, r, e)) got.push_back(e);
+  if (got.size() > written.size()) return false;
+  size_t skip = written.size() - got.size();
+  for (size_t i = 0; i < got.size(); i++) {
+    if (!same(got[i], written[skip + i])) return false;
+  }
+  // the ring holds at least all but one sector
+  return got.size() + torn >= std::min(written.size(), (size_t)(log.sectors - 1) * EVENT_LOG_PER_SECTOR);
+}
+
+
+int log_host_main(int argc, char** argv)
+{
+  int days = argc > 0 ? atoi(argv[0]) : 365;
+  int per_day = argc > 1 ? atoi(argv[1]) : 12;
+  int sectors = argc > 2 ? atoi(argv[2]) : 4;
+
+  ram_flash ram;
+  ram.mem.assign((size_t)sectors * EVENT_LOG_SECTOR, 0x5A);   // not erased, like a new partition
+  ram.erases.assign(sectors, 0);
+  ram.bad_writes = 0;
+  ram.tear_at = -1;
+  ram.writes = 0;
+  event_flash flash = { (uint32_t)ram.mem.size(), ram_read, ram_write, ram_erase, &ram };
+
+  event_log log;
+  if (!event_log_begin(log, &flash)) {
+    printf("flash too small\n");
+    return 1;
+  }
+  printf("event log: %d sectors, %u records each, %u in total, %d days at %d events\n", sectors,
+         (unsigned)EVENT_LOG_PER_SECTOR, event_log_capacity(log), days, per_day);
+
+  std::mt19937 rng(7);
+  const std::vector<event_record>& written = ram.records;
+  uint32_t time = 1735689600;         // 2025-01-01
+  uint32_t ms = 0;
+  int restarts = 0, torn = 0, errors = 0;
+  for (int day = 0; day < days; day++) {
+    for (int i = 0; i < per_day; i++) {
+      // events come in bursts, a slider or a timer pair
+      uint32_t gap = rng() % 3 ? 1 + rng() % 5 : 86400 / per_day;
+      time += gap;
+      ms += gap * 1000;
+      event_log_add(log, time, 1 + rng() % (EVENT_CODES - 2), rng() & 0xFF, ms);
+      event_log_service(log, ms);
+    }
+    // a restart every few weeks, queued events are lost, sometimes in
+    // the middle of writing a record or a sector header
+    if (day % 23 == 22) {
+      if (rng() % 2 && log.queued) {
+        ram.tear_at = ram.writes + rng() % log.queued;
+        event_log_flush(log);
+        ram.tear_at = -1;
+        torn++;
+      }
+      event_log_begin(log, &flash);
+      restarts++;
+      if (!check_contents(log, written, torn)) {
+        printf("day %d: log differs after the restart\n", day);
+        errors++;
+      }
+    }
+  }
+  event_log_flush(log);
+  printf("%zu events written, %u in the log, %d restarts (%d in a write), %ld writes to unerased bits\n",
+         written.size(), event_log_count(log), restarts, torn, ram.bad_writes);
+
+  // queries: random ranges, binary search vs. the plain list
+  uint32_t oldest = 0;
+  {
+    event_log_reader r;
+    event_log_find(log, r, 0);
+    event_record e;
+    if (event_log_next(log, r, e)) oldest = e.time;
+  }
+  long found = 0, reads = 0, linear_reads = 0;
+  int queries = 1000;
+  for (int q = 0; q < queries; q++) {
+    uint32_t from = oldest + rng() % (time - oldest + 1);
+    uint32_t to = from + rng() % (7 * 86400);
+    std::vector<event_record> expect;
+    for (const event_record& e : written) {
+      if (e.time >= from && e.time <= to && e.time >= oldest) expect.push_back(e);
+    }
+    event_log_reader r;
+    event_log_find(log, r, from);
+    std::vector<event_record> got;
+    event_record e;
+    while (event_log_next(log, r, e) && e.time <= to) got.push_back(e);
+    reads += r.reads;
+    found += got.size();
+    if (got.size() != expect.size() || !std::equal(got.begin(), got.end(), expect.begin(), same)) errors++;
+    // from the oldest record on, in the same blocks
+    event_log_find(log, r, 0);
+    r.reads = 0;
+    while (event_log_next(log, r, e) && e.time <= to) {}
+    linear_reads += r.reads;
+  }
+  printf("%d queries of up to a week: %.1f events, %.1f flash reads each (%.1f reading from the oldest)\n", queries,
+         (double)found / queries, (double)reads / queries, (double)linear_reads / queries);
+
+  uint32_t min_erase = *std::min_element(ram.erases.begin(), ram.erases.end());
+  uint32_t max_erase = *std::max_element(ram.erases.begin(), ram.erases.end());
+  printf("erases per sector: %u..%u (of 100000 the flash is good for)\n", min_erase, max_erase);
+  printf("%s\n", errors ? "FAILED" : "ok");
+  return errors ? 1 : 0;
+}
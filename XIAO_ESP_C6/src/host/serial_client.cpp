@@ -0,0 +1,127 @@
+#include "serial_client.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static long now_ms()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+bool serial_client_open(serial_client& c, const char* path)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) return false;
+  termios tio;
+  if (tcgetattr(fd, &tio) < 0) {
+    close(fd);
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B115200);          // no meaning on USB CDC and pty
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+  tcflush(fd, TCIOFLUSH);
+  serial_client_attach(c, fd);
+  return true;
+}
+
+
+void serial_client_attach(serial_client& c, int fd)
+{
+  c.fd = fd;
+  // another seq than a client before, else its last reply comes back
+  c.seq = (uint8_t)(getpid() ^ now_ms());
+  c.timeout_ms = SERIAL_CLIENT_TIMEOUT_MS;
+  serial_link_reset(c.link);
+  c.requests = 0;
+  c.retries = 0;
+  c.failed = 0;
+}
+
+
+void serial_client_close(serial_client& c)
+{
+  if (c.fd >= 0) close(c.fd);
+  c.fd = -1;
+}
+
+
+static bool write_all(int fd, const uint8_t* p, size_t len)
+{
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+
+// Reply to c.seq / opcode within the timeout, others (late replies of
+// earlier tries) are dropped
+static int wait_reply(serial_client& c, uint8_t opcode, uint8_t* reply, size_t size, size_t* reply_len)
+{
+  long end = now_ms() + c.timeout_ms;
+  uint8_t buf[256];
+  for (;;) {
+    long left = end - now_ms();
+    if (left <= 0) return -1;
+    pollfd pfd = { c.fd, POLLIN, 0 };
+    if (poll(&pfd, 1, (int)left) <= 0) continue;
+    ssize_t n = read(c.fd, buf, sizeof(buf));
+    if (n <= 0) return -1;
+    for (ssize_t i = 0; i < n; i++) {
+      const uint8_t* data;
+      size_t len;
+      if (!serial_link_input(c.link, buf[i], data, len)) continue;
+      if (len < 3 || data[0] != c.seq || data[1] != (opcode | SERIAL_REPLY)) continue;
+      len -= 3;
+      if (reply_len) *reply_len = len < size ? len : size;
+      if (reply) memcpy(reply, data + 3, len < size ? len : size);
+      // the rest of buf belongs to no request of ours
+      serial_link_reset(c.link);
+      return data[2];
+    }
+  }
+}
+
+
+int serial_request(serial_client& c, uint8_t opcode, const void* payload, size_t len, uint8_t* reply, size_t size,
+                   size_t* reply_len)
+{
+  uint8_t data[SERIAL_DATA_MAX];
+  uint8_t wire[SERIAL_WIRE_MAX];
+  if (len + 2 > sizeof(data)) return -1;
+  data[0] = ++c.seq;
+  data[1] = opcode;
+  if (len) memcpy(data + 2, payload, len);
+  size_t n = serial_frame_encode(data, len + 2, wire, sizeof(wire));
+  c.requests++;
+
+  for (int i = 0; i < SERIAL_CLIENT_TRIES; i++) {
+    if (i) c.retries++;
+    if (!write_all(c.fd, wire, n)) break;
+    int status = wait_reply(c, opcode, reply, size, reply_len);
+    if (status >= 0) return status;
+  }
+  c.failed++;
+  return -1;
+}
+
+
+int serial_request_batch(serial_client& c, const serial_batch& b, uint8_t* reply, size_t size, size_t* reply_len)
+{
+  return serial_request(c, SERIAL_BATCH, b.buf, b.len, reply, size, reply_len);
+}
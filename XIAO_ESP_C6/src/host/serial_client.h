@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "serial_proto.h"
+
+// Client of the serial control protocol (serial_proto.h) for a PC, e.g.
+// /dev/ttyACM0 of the XIAO or the pty of the host benchmark.
+//
+//   serial_client c;
+//   if (!serial_client_open(c, "/dev/ttyACM0")) ...
+//   uint8_t rgb[3] = { 255, 120, 0 };
+//   int status = serial_request(c, SERIAL_SET_RGB, rgb, 3, NULL, 0, NULL);
+
+#define SERIAL_CLIENT_TIMEOUT_MS 200    // per try
+#define SERIAL_CLIENT_TRIES 3
+
+struct serial_client {
+  int fd;
+  uint8_t seq;                          // of the last request
+  int timeout_ms;
+  serial_link link;
+  uint32_t requests;
+  uint32_t retries;                     // tries after a timeout
+  uint32_t failed;                      // no reply after all tries
+};
+
+// Device in raw mode (no echo, no line editing, 8N1), false if it can't
+bool serial_client_open(serial_client& c, const char* path);
+
+// An open file descriptor (socket, pty), set up by the caller
+void serial_client_attach(serial_client& c, int fd);
+
+void serial_client_close(serial_client& c);
+
+// Sends one request and waits for its reply, the same seq again after a
+// timeout. Returns the status of the reply (reply payload into reply, its
+// length into reply_len) or -1 without reply.
+int serial_request(serial_client& c, uint8_t opcode, const void* payload, size_t len, uint8_t* reply, size_t size,
+                   size_t* reply_len);
+
+// All commands of b in one round trip, reply: per command length, status,
+// payload (see serial_proto.h)
+int serial_request_batch(serial_client& c, const serial_batch& b, uint8_t* reply, size_t size, size_t* reply_len);
@@ -0,0 +1,282 @@
+// Serial control over a pty (pio run -e native):
+//
+//   .pio/build/native/program serial [requests]
+//
+// A child process is the device: serial_server on the master side of a
+// pseudo terminal, with handlers on a host copy of the strip state (the
+// ones of main.cpp need the Arduino core). The parent is a PC with
+// serial_client on the slave side in raw mode, like /dev/ttyACM0. Prints the
+// round trip times per kind of request, 10 single requests against one
+// batch, then lets a second device lose every 10th reply and checks that
+// the retries execute nothing twice, and that other requests with the same
+// seq (a restarted client) are executed. Exit code 1 if a request fails.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "serial_client.h"
+
+#define HOST_LEDS 37                    // as on the device
+
+// Strip state of the host device
+static struct {
+  uint8_t brightness;
+  led_color_setting color;
+  uint8_t frame[HOST_LEDS * 3];
+  uint32_t executed;                    // commands, to see retries not executed twice
+} host;
+
+
+static uint8_t host_ping(const uint8_t* p, size_t len, serial_reply& out)
+{
+  serial_put(out, p, len);
+  return SERIAL_OK;
+}
+
+
+static uint8_t host_get_state(const uint8_t*, size_t, serial_reply& out)
+{
+  serial_put8(out, host.brightness);
+  serial_put_color(out, host.color);
+  serial_put32(out, host.executed);
+  return SERIAL_OK;
+}
+
+
+static uint8_t host_set_brightness(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 1) return SERIAL_BAD_LENGTH;
+  if (p[0] > 100) return SERIAL_BAD_VALUE;
+  host.brightness = p[0];
+  host.executed++;
+  return SERIAL_OK;
+}
+
+
+static uint8_t host_set_rgb(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 3) return SERIAL_BAD_LENGTH;
+  host.color.mode = LED_COLOR_RGB;
+  host.color.red = p[0];
+  host.color.green = p[1];
+  host.color.blue = p[2];
+  host.executed++;
+  return SERIAL_OK;
+}
+
+
+static uint8_t host_frame(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len < 2 || (len - 2) % 3) return SERIAL_BAD_LENGTH;
+  size_t first = serial_get16(p), n = (len - 2) / 3;
+  if (first + n > HOST_LEDS) return SERIAL_BAD_VALUE;
+  memcpy(host.frame + first * 3, p + 2, n * 3);
+  host.executed++;
+  return SERIAL_OK;
+}
+
+
+static const serial_command host_commands[] = {
+  { SERIAL_PING, host_ping },
+  { SERIAL_GET_STATE, host_get_state },
+  { SERIAL_SET_BRIGHTNESS, host_set_brightness },
+  { SERIAL_SET_RGB, host_set_rgb },
+  { SERIAL_FRAME, host_frame },
+};
+static serial_server host_server = SERIAL_SERVER(host_commands);
+
+
+// Device loop on the pty master, every drop_every-th reply is lost
+static void run_device(int fd, int drop_every)
+{
+  serial_server_begin(host_server);
+  uint8_t buf[256];
+  uint32_t replies = 0;
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      const uint8_t* out;
+      size_t len = serial_server_input(host_server, buf[i], out);
+      if (!len || (drop_every && ++replies % drop_every == 0)) continue;
+      if (write(fd, out, len) != (ssize_t)len) return;
+    }
+  }
+}
+
+
+static pid_t start_device(int drop_every, serial_client& c)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+    perror("posix_openpt");
+    exit(2);
+  }
+  const char* slave = ptsname(master);
+  // raw before the device runs, else the line discipline echoes the first frame
+  if (!serial_client_open(c, slave)) {
+    perror(slave);
+    exit(2);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(c.fd);
+    run_device(master, drop_every);
+    _exit(0);
+  }
+  close(master);
+  return pid;
+}
+
+
+static void stop_device(pid_t pid, serial_client& c)
+{
+  serial_client_close(c);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+
+static double now_us()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+static int failures = 0;
+
+static void print_times(const char* name, std::vector<double>& us, size_t wire)
+{
+  std::sort(us.begin(), us.end());
+  double sum = 0;
+  for (double t : us) sum += t;
+  printf("  %-22s %4zu bytes  mean %7.1f us  p50 %7.1f us  p99 %7.1f us\n", name, wire, sum / us.size(),
+         us[us.size() / 2], us[us.size() * 99 / 100]);
+}
+
+
+// Wire bytes of a request with this payload, for the time on a real UART
+static size_t wire_size(size_t payload)
+{
+  uint8_t data[SERIAL_DATA_MAX] = { 1, 1 };
+  uint8_t wire[SERIAL_WIRE_MAX];
+  return serial_frame_encode(data, payload + 2, wire, sizeof(wire));
+}
+
+
+static void measure(serial_client& c, const char* name, int requests, uint8_t opcode, const uint8_t* payload,
+                    size_t len)
+{
+  std::vector<double> us;
+  for (int i = 0; i < requests; i++) {
+    double start = now_us();
+    if (serial_request(c, opcode, payload, len, NULL, 0, NULL) != SERIAL_OK) failures++;
+    us.push_back(now_us() - start);
+  }
+  print_times(name, us, wire_size(len));
+}
+
+
+// Request straight into the server, true if it executed it
+static bool send_direct(uint8_t seq, uint8_t opcode, const uint8_t* payload, size_t len)
+{
+  uint8_t data[SERIAL_DATA_MAX] = { seq, opcode };
+  uint8_t wire[SERIAL_WIRE_MAX];
+  memcpy(data + 2, payload, len);
+  size_t n = serial_frame_encode(data, len + 2, wire, sizeof(wire));
+  uint32_t executed = host.executed;
+  const uint8_t* out;
+  for (size_t i = 0; i < n; i++) serial_server_input(host_server, wire[i], out);
+  return host.executed != executed;
+}
+
+
+// Only the same request again is a retry, not just the same seq
+static void restart_test()
+{
+  serial_server_begin(host_server);
+  uint8_t rgb[3] = { 1, 2, 3 }, other[3] = { 4, 5, 6 }, brightness = 50;
+  bool ok = send_direct(0, SERIAL_SET_RGB, rgb, 3);
+  ok = !send_direct(0, SERIAL_SET_RGB, rgb, 3) && ok;          // retry
+  ok = send_direct(0, SERIAL_SET_BRIGHTNESS, &brightness, 1) && ok;
+  ok = send_direct(0, SERIAL_SET_RGB, other, 3) && ok;
+  ok = ok && host.color.red == 4 && host.brightness == 50 && host_server.retries == 1;
+  printf("  same seq, other request: %s\n", ok ? "executed" : "DROPPED");
+  if (!ok) failures++;
+}
+
+
+int serial_host_main(int argc, char** argv)
+{
+  int requests = argc > 0 ? atoi(argv[0]) : 2000;
+  printf("serial control over a pty, %d requests per kind\n", requests);
+
+  serial_client c;
+  pid_t device = start_device(0, c);
+
+  uint8_t rgb[3] = { 255, 120, 0 };
+  uint8_t brightness = 40;
+  uint8_t frame[2 + HOST_LEDS * 3] = {};
+  for (int i = 0; i < HOST_LEDS * 3; i++) frame[2 + i] = i * 7;
+
+  measure(c, "ping", requests, SERIAL_PING, NULL, 0);
+  measure(c, "set rgb", requests, SERIAL_SET_RGB, rgb, sizeof(rgb));
+  measure(c, "get state", requests, SERIAL_GET_STATE, NULL, 0);
+  measure(c, "frame 37 LEDs", requests, SERIAL_FRAME, frame, sizeof(frame));
+
+  // 10 changes: one by one against one batch
+  std::vector<double> singles, batches;
+  serial_batch b;
+  serial_batch_begin(b);
+  for (int k = 0; k < 5; k++) {
+    serial_batch_add(b, SERIAL_SET_BRIGHTNESS, &brightness, 1);
+    serial_batch_add(b, SERIAL_SET_RGB, rgb, sizeof(rgb));
+  }
+  uint8_t reply[SERIAL_DATA_MAX];
+  size_t reply_len;
+  for (int i = 0; i < requests / 10; i++) {
+    double start = now_us();
+    for (int k = 0; k < 5; k++) {
+      if (serial_request(c, SERIAL_SET_BRIGHTNESS, &brightness, 1, NULL, 0, NULL) != SERIAL_OK) failures++;
+      if (serial_request(c, SERIAL_SET_RGB, rgb, sizeof(rgb), NULL, 0, NULL) != SERIAL_OK) failures++;
+    }
+    singles.push_back(now_us() - start);
+
+    start = now_us();
+    if (serial_request_batch(c, b, reply, sizeof(reply), &reply_len) != SERIAL_OK || reply_len != 20) failures++;
+    batches.push_back(now_us() - start);
+  }
+  print_times("10 single requests", singles, 5 * (wire_size(1) + wire_size(3)));
+  print_times("batch of 10", batches, wire_size(b.len));
+  stop_device(device, c);
+
+  // Lost replies: every 10th, the client repeats the seq after its timeout
+  device = start_device(10, c);
+  c.timeout_ms = 20;
+  int lossy = 100;
+  for (int i = 0; i < lossy; i++) {
+    if (serial_request(c, SERIAL_SET_RGB, rgb, sizeof(rgb), NULL, 0, NULL) != SERIAL_OK) failures++;
+  }
+  uint32_t executed = 0;
+  if (serial_request(c, SERIAL_GET_STATE, NULL, 0, reply, sizeof(reply), &reply_len) == SERIAL_OK) {
+    executed = serial_get32(reply + 1 + SERIAL_COLOR_SIZE);
+  }
+  printf("  lossy link: %d requests, %u retries, %u failed, %u executed\n", lossy, c.retries, c.failed, executed);
+  if (executed != (uint32_t)lossy) failures++;
+  stop_device(device, c);
+
+  restart_test();
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures != 0;
+}
@@ -0,0 +1,253 @@
+// SNTP and the drift discipline of the RTC (pio run -e native):
+//
+//   .pio/build/native/program sntp [days] [ppm]
+//   .pio/build/native/program sntp server [port]
+//   .pio/build/native/program sntp query <address> [port]
+//
+// Without a command: a stand-in server on loopback in a second process,
+// some requests to it (the offset must be below a ms, both use the same
+// clock), then the simulation. It runs the RTC of the device for some days
+// with millis() fast by ppm, plus 2 ppm over the day for the temperature,
+// and polls of SNTP_BURST requests with a random round trip of 2..40 ms,
+// now and then 400 ms.
+// Printed is the error of the RTC at each minute change, which is when
+// check_timers() fires: without SNTP, SNTP without the drift correction
+// and with it. Exit code 1 if the loopback offset or 1% of the errors with
+// the drift correction are 15 ms or more.
+//
+// "server" answers from the clock of the host, the stand-in for the
+// device in the network of its access point (PATCH /api/state
+// {"sntp_server":"192.168.4.2"}). "query" sends one request.
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "sntp_client.h"
+
+#define SNTP_TEST_PORT 12300
+#define SNTP_TEST_ERROR_MS 15
+
+static uint64_t real_ms()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static int open_socket(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    exit(2);
+  }
+  return fd;
+}
+
+
+static int serve(uint16_t port, int requests)
+{
+  int fd = open_socket(port);
+  printf("SNTP stand-in on port %u\n", port);
+  fflush(stdout);
+  for (int n = 0; requests < 0 || n < requests; n++) {
+    uint8_t in[128], out[SNTP_PACKET_SIZE];
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, in, sizeof(in), 0, (sockaddr*)&from, &from_len);
+    uint64_t t2 = real_ms();
+    size_t answer = len > 0 ? sntp_answer(in, len, t2, real_ms(), out, sizeof(out)) : 0;
+    if (answer) sendto(fd, out, answer, 0, (sockaddr*)&from, from_len);
+  }
+  close(fd);
+  return 0;
+}
+
+
+// One request, false without a valid answer within SNTP_TIMEOUT_MS
+static bool query(const char* host, uint16_t port, sntp_result& r)
+{
+  addrinfo hints = {}, *ai;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &ai) != 0) return false;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  uint8_t buf[128];
+  uint64_t t1 = real_ms();
+  size_t len = sntp_request(buf, sizeof(buf), t1);
+  sendto(fd, buf, len, 0, ai->ai_addr, ai->ai_addrlen);
+  freeaddrinfo(ai);
+  bool ok = false;
+  pollfd p = { fd, POLLIN, 0 };
+  while (!ok && poll(&p, 1, SNTP_TIMEOUT_MS) > 0) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    ok = n > 0 && sntp_parse(buf, n, t1, real_ms(), r);
+  }
+  close(fd);
+  return ok;
+}
+
+
+// Stand-in in a child process, requests to it on loopback
+static bool loopback_test()
+{
+  const int requests = 20;
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    exit(serve(SNTP_TEST_PORT, requests));
+  }
+  usleep(100000);
+  int answers = 0;
+  int64_t max_offset = 0;
+  uint32_t max_delay = 0;
+  for (int i = 0; i < requests; i++) {
+    sntp_result r;
+    if (!query("127.0.0.1", SNTP_TEST_PORT, r)) continue;
+    answers++;
+    max_offset = std::max(max_offset, r.offset_ms < 0 ? -r.offset_ms : r.offset_ms);
+    max_delay = std::max(max_delay, r.delay_ms);
+  }
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  printf("loopback stand-in: %d of %d answered, offset up to %lld ms, round trip up to %u ms\n", answers, requests,
+         (long long)max_offset, max_delay);
+  return answers == requests && max_offset < SNTP_TEST_ERROR_MS;
+}
+
+
+// The RTC of the device as update_rtc() / sntp_service() in main.cpp run it
+struct sim_rtc {
+  bool sntp;
+  bool drift;                 // correct the measured drift between the syncs
+  sntp_clock clk;
+  int64_t correction_ms;      // RTC = millis() + correction_ms
+  uint64_t next_ms;           // millis() of the next request
+  uint64_t poll_ms;
+  uint64_t drift_millis;
+  std::vector<double> errors; // at the minute changes
+};
+
+
+// A poll: SNTP_BURST requests, round trip 2..40 ms split at random, one
+// in 20 stuck for 400 ms. The burst takes some seconds on the device, the
+// clock moves less than 0.1 ms in them: here they are at the same time.
+static void sim_poll(sim_rtc& s, uint64_t local, uint64_t true_ms, double rate, std::mt19937& rng)
+{
+  for (int i = 0; i < SNTP_BURST; i++) {
+    uint32_t there = 1 + rng() % 20, back = 1 + rng() % 20;
+    if (rng() % 20 == 0) back += 400;
+    uint8_t req[SNTP_PACKET_SIZE], ans[SNTP_PACKET_SIZE];
+    uint64_t t1 = local + s.correction_ms;
+    sntp_request(req, sizeof(req), t1);
+    sntp_answer(req, sizeof(req), true_ms + there, true_ms + there, ans, sizeof(ans));
+    uint64_t t4 = t1 + (uint64_t)((there + back) * rate);
+    sntp_result r;
+    if (sntp_parse(ans, sizeof(ans), t1, t4, r)) sntp_clock_answer(s.clk, t4, r);
+  }
+  int64_t correction;
+  if (!sntp_clock_update(s.clk, correction)) {
+    s.next_ms = local + SNTP_RETRY_MS;
+    return;
+  }
+  if (!s.drift) s.clk.ppb = 0;
+  s.correction_ms += correction;
+  bool step = correction <= -SNTP_STEP_MS || correction >= SNTP_STEP_MS;
+  s.poll_ms = step ? SNTP_POLL_MIN_MS : std::min<uint64_t>(s.poll_ms * 2, SNTP_POLL_MAX_MS);
+  s.next_ms = local + s.poll_ms;
+}
+
+
+static void print_errors(const char* name, std::vector<double>& e)
+{
+  std::sort(e.begin(), e.end());
+  printf("  %-22s median %7.1f ms, 99%% %7.1f ms, max %7.1f ms\n", name, e[e.size() / 2],
+         e[e.size() * 99 / 100], e.back());
+}
+
+
+// Simulated time in steps of a second, errors after the first hour
+static bool simulate(int days, double ppm)
+{
+  std::mt19937 rng(3);
+  const uint64_t start = 1760000000000ULL;
+  sim_rtc rtc[3] = {};
+  for (int i = 0; i < 3; i++) {
+    rtc[i].sntp = i > 0;
+    rtc[i].drift = i > 1;
+    sntp_clock_reset(rtc[i].clk, 0);
+    // time set once at the start, 300 ms off (by hand, or from NVS)
+    rtc[i].correction_ms = start + 300;
+    rtc[i].poll_ms = SNTP_POLL_MIN_MS;
+  }
+  double local = 0;
+  double found_ppb = 0;
+  for (uint64_t sec = 0; sec < (uint64_t)days * 86400; sec++) {
+    // millis() fast by ppm, 2 ppm more at midday
+    double rate = 1 + (ppm + 2 * sin(2 * M_PI * sec / 86400.0)) * 1e-6;
+    uint64_t true_ms = start + sec * 1000;
+    uint64_t millis = (uint64_t)local;
+    for (sim_rtc& s : rtc) {
+      if (s.drift) {
+        s.correction_ms += sntp_clock_drift(s.clk, (uint32_t)(millis - s.drift_millis));
+        s.drift_millis = millis;
+      }
+      if (s.sntp && millis >= s.next_ms) sim_poll(s, millis, true_ms, rate, rng);
+      // error at the minute change, the sub ms part of millis() included
+      double error = local + s.correction_ms - true_ms;
+      if (sec % 60 == 0 && sec >= 3600) s.errors.push_back(fabs(error));
+    }
+    local += 1000 * rate;
+    found_ppb = rtc[2].clk.ppb;
+  }
+  printf("%d days, millis() fast by %.0f +-2 ppm, error of the RTC at the minute changes:\n", days, ppm);
+  print_errors("no SNTP", rtc[0].errors);
+  print_errors("SNTP", rtc[1].errors);
+  print_errors("SNTP + drift", rtc[2].errors);
+  printf("  measured drift %.3f ppm, %u measurements\n", found_ppb / 1000, rtc[2].clk.samples);
+  return rtc[2].errors[rtc[2].errors.size() * 99 / 100] < SNTP_TEST_ERROR_MS;
+}
+
+
+int sntp_host_main(int argc, char** argv)
+{
+  if (argc > 0 && strcmp(argv[0], "server") == 0) {
+    return serve(argc > 1 ? atoi(argv[1]) : SNTP_PORT, -1);
+  }
+  if (argc > 0 && strcmp(argv[0], "query") == 0) {
+    sntp_result r;
+    if (argc < 2 || !query(argv[1], argc > 2 ? atoi(argv[2]) : SNTP_PORT, r)) {
+      printf("no answer\n");
+      return 1;
+    }
+    printf("offset %lld ms, round trip %u ms, stratum %u\n", (long long)r.offset_ms, r.delay_ms, r.stratum);
+    return 0;
+  }
+  int days = argc > 0 ? atoi(argv[0]) : 7;
+  double ppm = argc > 1 ? atof(argv[1]) : 40;
+  bool ok = loopback_test();
+  ok = simulate(days, ppm) && ok;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+// The strip type of led_strip.h on the host (pio run -e native):
+//
+//   .pio/build/native/program strip [frames]
+//
+// Per frame: the dither stage into the strip bytes and the encoding of the
+// bytes into RMT symbols. Generic is led_dither_write() with the color
+// order and the count at run time, then the loop of show() in
+// Adafruit_NeoPixel (esp.c, IDF 5) with a branch per bit into rmt_data_t on
+// the stack. Specialised is led_strip_write() and led_strip_encode(). Both
+// get the same frames at changing levels, bytes and symbols must be the
+// same, exit code 1 if not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "led_color.h"
+#include "led_strip.h"
+
+#define NEO_GRB 0x52   // Adafruit_NeoPixel.h
+#define NEO_KHZ800 0x0000
+
+// esp32-hal-rmt.h
+typedef union {
+  struct {
+    uint32_t duration0 : 15;
+    uint32_t level0 : 1;
+    uint32_t duration1 : 15;
+    uint32_t level1 : 1;
+  };
+  uint32_t val;
+} rmt_data_t;
+
+// Keeps the last transfer instead of sending it
+struct host_output {
+  const uint32_t* symbols;
+  size_t count;
+  bool begin() { return true; }
+  void show(const uint32_t* s, size_t n)
+  {
+    symbols = s;
+    count = n;
+  }
+};
+
+static volatile uint32_t sink;
+
+
+static double now_ns()
+{
+  using namespace std::chrono;
+  return duration<double, std::nano>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// The bit loop of espShow(), into out instead of the stack
+__attribute__((noinline)) static void generic_encode(const uint8_t* pixels, uint32_t bytes, rmt_data_t* out)
+{
+  int i = 0;
+  for (uint32_t b = 0; b < bytes; b++) {
+    for (int bit = 0; bit < 8; bit++) {
+      if (pixels[b] & (1 << (7 - bit))) {
+        out[i].level0 = 1;
+        out[i].duration0 = 8;
+        out[i].level1 = 0;
+        out[i].duration1 = 4;
+      } else {
+        out[i].level0 = 1;
+        out[i].duration0 = 4;
+        out[i].level1 = 0;
+        out[i].duration1 = 8;
+      }
+      i++;
+    }
+  }
+}
+
+
+template <uint16_t LEDS>
+static bool bench(const led_color_model& model, int frames)
+{
+  typedef led_strip<LEDS, NEO_GRB + NEO_KHZ800, host_output> strip_type;
+  static strip_type strip;
+  led_strip_begin(strip);
+  std::vector<uint16_t> frame(LEDS * 3);
+  std::vector<uint8_t> error(LEDS * 3), pixels(LEDS * 3);
+  std::vector<rmt_data_t> symbols(LEDS * 24);
+  led_dither dither;
+  led_dither_begin(dither, frame.data(), error.data(), LEDS);
+  for (int i = 0; i < LEDS; i++) {
+    led_hsv hsv = { (uint16_t)(i * 41 % LED_HUE_MAX), 255, (uint8_t)(40 + i % 200) };
+    led_rgb16 c = led_color_hsv(model, hsv);
+    led_dither_set(dither, i, c);
+    led_dither_set(strip.dither, i, c);
+  }
+
+  // the same frames on both, compared
+  bool same = true;
+  for (int f = 0; f < 200 && same; f++) {
+    uint16_t level = 300 + f * 97;
+    bool rest = led_dither_write(dither, model, level, pixels.data());
+    generic_encode(pixels.data(), LEDS * 3, symbols.data());
+    same = led_strip_write(strip, level) == rest && memcmp(strip.pixels, pixels.data(), LEDS * 3) == 0;
+    led_strip_show(strip);
+    same = same && strip.output.count == LEDS * 24u &&
+           memcmp(strip.output.symbols, symbols.data(), LEDS * 24 * sizeof(uint32_t)) == 0;
+  }
+
+  double t[4];
+  double t0 = now_ns();
+  for (int f = 0; f < frames; f++) led_dither_write(dither, model, (uint16_t)(1000 + f), pixels.data());
+  t[0] = (now_ns() - t0) / frames;
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    pixels[f % (LEDS * 3)] = f;
+    generic_encode(pixels.data(), LEDS * 3, symbols.data());
+    sink = sink + symbols[f % (LEDS * 24)].val;
+  }
+  t[1] = (now_ns() - t0) / frames;
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) led_strip_write(strip, (uint16_t)(1000 + f));
+  t[2] = (now_ns() - t0) / frames;
+  t0 = now_ns();
+  for (int f = 0; f < frames; f++) {
+    strip.pixels[f % (LEDS * 3)] = f;
+    led_strip_encode(strip);
+    sink = sink + strip.symbols[f % (LEDS * 24)];
+  }
+  t[3] = (now_ns() - t0) / frames;
+  sink = sink + strip.pixels[0] + pixels[0];
+
+  printf("%3d LEDs  generic     %8.0f %8.0f %8.0f ns/frame\n", LEDS, t[0], t[1], t[0] + t[1]);
+  printf("          specialised %8.0f %8.0f %8.0f ns/frame  %.2fx, %u bytes RAM, output %s\n", t[2], t[3],
+         t[2] + t[3], (t[0] + t[1]) / (t[2] + t[3]), (unsigned)sizeof(strip_type), same ? "same" : "DIFFERENT");
+  return same;
+}
+
+
+int strip_host_main(int argc, char** argv)
+{
+  int frames = argc > 0 ? atoi(argv[0]) : 5000;
+  led_color_model model;
+  led_color_begin(model, NEO_GRB);
+  led_color_set_balance(model, 255, 220, 180);
+  printf("dither + encode per frame   dither   encode    total   (RAM limit %u bytes)\n", LED_STRIP_RAM_MAX);
+  bool ok = bench<37>(model, frames);
+  ok = bench<150>(model, frames) && ok;
+  ok = bench<300>(model, frames) && ok;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+// Trace points (trace.h) on the host (pio run -e native):
+//
+//   .pio/build/native/program trace [frames] [out.json]
+//
+// Renders segment frames with a few trace scopes each, prints what a trace
+// point costs and writes the capture as the device returns it on
+// GET /api/trace (on the host the "cycles" are ns). out.json opens in
+// ui.perfetto.dev.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "led_color.h"
+#include "led_segments.h"
+#include "trace.h"
+
+#define NEO_GRB 0x52   // Adafruit_NeoPixel.h
+
+#if TRACE_ENABLED
+
+static double now_ns()
+{
+  using namespace std::chrono;
+  return duration<double, std::nano>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Empty scopes: the cost of one begin + end
+static double scope_ns(int count)
+{
+  double start = now_ns();
+  for (int i = 0; i < count; i++) {
+    TRACE_SCOPE("empty");
+  }
+  return (now_ns() - start) / count;
+}
+
+
+int trace_host_main(int argc, char** argv)
+{
+  int frames = argc > 0 ? atoi(argv[0]) : 200;
+  const char* out_path = argc > 1 ? argv[1] : NULL;
+  const int leds = 300;
+
+  trace_clear();
+  printf("trace point: %.1f ns per scope (begin + end), ring of %d events, %zu bytes\n", scope_ns(1000000),
+         TRACE_EVENTS, sizeof(trace_buf));
+
+  led_color_model model;
+  led_color_begin(model, NEO_GRB);
+  std::vector<uint16_t> frame(leds * 3);
+  std::vector<uint8_t> error(leds * 3);
+  std::vector<uint8_t> out(leds * 3);
+  led_dither dither;
+  led_dither_begin(dither, frame.data(), error.data(), leds);
+  led_segments segs;
+  led_segments_clear(segs);
+  led_segment& seg = segs.seg[segs.count++];
+  snprintf(seg.name, sizeof(seg.name), "all");
+  seg.count = leds;
+  seg.flags = LED_SEGMENT_ON;
+  seg.effect = LED_EFFECT_RAINBOW;
+  seg.speed = 40;
+  seg.brightness = 80;
+  seg.color = { LED_COLOR_HSV, 0, 0, 0, 0, 255, 2700 };
+  led_segments_changed(segs, 0, 0);
+  led_rgb16 base = led_color_rgb(model, 20, 10, 0);
+
+  trace_clear();
+  double start = now_ns();
+  for (int f = 0; f < frames; f++) {
+    TRACE_SCOPE("strip frame");
+    {
+      TRACE_SCOPE("render");
+      led_segments_render(segs, model, base, dither, f * 16, NULL);
+    }
+    TRACE_BEGIN("dither");
+    led_dither_write(dither, model, 20000, out.data());
+    TRACE_END("dither");
+    if (f % 50 == 0) TRACE_MARK("stats");
+  }
+  double traced = now_ns() - start;
+
+  trace_reader r;
+  trace_read_begin(r, 1000);
+  std::vector<char> json;
+  char piece[128];
+  size_t n;
+  size_t pieces = 0;
+  while ((n = trace_read(r, piece, sizeof(piece))) > 0) {
+    json.insert(json.end(), piece, piece + n);
+    pieces++;
+  }
+  printf("%d frames in %.1f us each, %u events recorded, %zu in the capture (%zu bytes JSON)\n", frames,
+         traced / frames / 1000, trace_buf.next, pieces - 2, json.size());
+  if (out_path) {
+    FILE* f = fopen(out_path, "wb");
+    if (!f || fwrite(json.data(), 1, json.size(), f) != json.size()) {
+      perror(out_path);
+      return 2;
+    }
+    fclose(f);
+  }
+  return 0;
+}
+
+#else
+
+int trace_host_main(int argc, char** argv)
+{
+  printf("built with TRACE_ENABLED=0\n");
+  return 0;
+}
+
+#endif
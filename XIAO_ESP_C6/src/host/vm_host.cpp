@@ -0,0 +1,119 @@
+// Effect programs (led_vm.h) on the host (pio run -e native):
+//
+//   .pio/build/native/program vm <source> [out.bin]   compile, check, write the blob
+//   .pio/build/native/program vm bench [leds] [frames]
+//
+// The blob goes to the controller with
+//   curl -X PUT --data-binary @out.bin http://192.168.4.1/api/effect
+// and runs on every segment with "effect":"program".
+//
+// bench runs some example programs over a strip and prints ns per pixel
+// and the time of a whole frame, with the direct threaded interpreter of
+// the device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "led_vm.h"
+#include "led_vm_compile.h"
+
+static const struct {
+  const char* name;
+  const char* source;
+} examples[] = {
+  { "rainbow", "hsv(x + t * 0.1, 1, 1);" },
+  { "breathing rainbow",
+    "frame { p = t * 0.1; l = 0.3 + 0.7 * tri(t * 0.25); }\n"
+    "pixel { hsv(x + p, 1, l); }" },
+  { "sparkle",
+    "frame { f = floor(t * 20); }\n"
+    "pixel { s = noise(i * 7 + f); s = s > 0.9 ? s : 0.1; r = s; g = s * s; b = s * 0.5; }" },
+  { "comet",
+    "frame { h = frac(t * 0.3); }\n"
+    "pixel { d = frac(x - h); l = d > 0.8 ? (d - 0.8) * 5 : 0; l = l * l;\n"
+    "        r = l; g = l * 0.6; b = clamp(sin(x * 3 + t) * 0.2, 0, 1); }" },
+};
+
+
+static double now_ns()
+{
+  using namespace std::chrono;
+  return duration<double, std::nano>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+static int compile_file(const char* path, const char* out_path)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return 2;
+  }
+  std::string source;
+  char buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) source.append(buf, n);
+  fclose(f);
+
+  std::vector<uint8_t> blob;
+  std::string error;
+  if (!led_vm_compile(source.c_str(), blob, error)) {
+    fprintf(stderr, "%s: %s\n", path, error.c_str());
+    return 1;
+  }
+  std::unique_ptr<led_vm> vm(new led_vm());
+  led_vm_load(*vm, blob.data(), blob.size());
+  printf("%s: %zu bytes, %u frame + %u pixel instructions, %u per frame on 37 LEDs, %u on 300\n", path, blob.size(),
+         vm->frame_ops, vm->pixel_ops, led_vm_cost(*vm, 37), led_vm_cost(*vm, 300));
+  if (out_path) {
+    f = fopen(out_path, "wb");
+    if (!f || fwrite(blob.data(), 1, blob.size(), f) != blob.size()) {
+      perror(out_path);
+      return 2;
+    }
+    fclose(f);
+  }
+  return 0;
+}
+
+
+static int bench(int leds, int frames)
+{
+  printf("effect programs, %d LEDs, %d frames\n", leds, frames);
+  std::unique_ptr<led_vm> vm(new led_vm());
+  std::vector<uint8_t> out(leds * 3);
+  uint32_t checksum = 0;
+  for (const auto& e : examples) {
+    std::vector<uint8_t> blob;
+    std::string error;
+    if (!led_vm_compile(e.source, blob, error)) {
+      printf("%s: %s\n", e.name, error.c_str());
+      return 1;
+    }
+    led_vm_load(*vm, blob.data(), blob.size());
+
+    double start = now_ns();
+    for (int f = 0; f < frames; f++) {
+      led_vm_frame(*vm, f * 16, leds);
+      for (int i = 0; i < leds; i++) led_vm_pixel(*vm, i, out[i * 3], out[i * 3 + 1], out[i * 3 + 2]);
+      checksum = checksum * 31 + out[f % leds * 3];
+    }
+    double ns = now_ns() - start;
+    printf("  %-18s %3u ops/pixel %7.1f ns/pixel %5.2f ns/op %8.1f us/frame\n", e.name, vm->pixel_ops,
+           ns / frames / leds, ns / frames / leds / vm->pixel_ops, ns / frames / 1000);
+  }
+  printf("(checksum %08x)\n", checksum);
+  return 0;
+}
+
+
+int vm_host_main(int argc, char** argv)
+{
+  if (argc > 0 && strcmp(argv[0], "bench") != 0) return compile_file(argv[0], argc > 1 ? argv[1] : NULL);
+  return bench(argc > 1 ? atoi(argv[1]) : 300, argc > 2 ? atoi(argv[2]) : 2000);
+}
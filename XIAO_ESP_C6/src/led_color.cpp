@@ -0,0 +1,171 @@
+#include "led_color.h"
+
+#include <math.h>
+
+#define KELVIN_STEPS ((LED_KELVIN_MAX - LED_KELVIN_MIN) / LED_KELVIN_STEP + 1)
+
+// Linear white for every 100 K, 65535 = brightest channel
+static led_rgb16 kelvin_table[KELVIN_STEPS];
+static bool kelvin_ready = false;
+
+
+static float clamp_unit(float v)
+{
+  return v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+}
+
+
+// Fit of the black body color in sRGB (Tanner Helland), converted to linear
+static void build_kelvin_table()
+{
+  for (int i = 0; i < KELVIN_STEPS; i++) {
+    float t = (LED_KELVIN_MIN + i * LED_KELVIN_STEP) / 100.0f;
+    float r, g, b;
+    if (t <= 66.0f) {
+      r = 1.0f;
+      g = (99.4708025861f * logf(t) - 161.1195681661f) / 255.0f;
+    } else {
+      r = 329.698727446f * powf(t - 60.0f, -0.1332047592f) / 255.0f;
+      g = 288.1221695283f * powf(t - 60.0f, -0.0755148492f) / 255.0f;
+    }
+    if (t >= 66.0f) b = 1.0f;
+    else if (t <= 19.0f) b = 0.0f;
+    else b = (138.5177312231f * logf(t - 10.0f) - 305.0447927307f) / 255.0f;
+
+    float lr = powf(clamp_unit(r), LED_GAMMA);
+    float lg = powf(clamp_unit(g), LED_GAMMA);
+    float lb = powf(clamp_unit(b), LED_GAMMA);
+    float peak = fmaxf(lr, fmaxf(lg, lb));
+    kelvin_table[i].r = (uint16_t)(lr / peak * 65535.0f + 0.5f);
+    kelvin_table[i].g = (uint16_t)(lg / peak * 65535.0f + 0.5f);
+    kelvin_table[i].b = (uint16_t)(lb / peak * 65535.0f + 0.5f);
+  }
+  kelvin_ready = true;
+}
+
+
+static void build_tables(led_color_model& m)
+{
+  for (int c = 0; c < 3; c++) {
+    uint32_t scale = ((uint32_t)m.balance[c] * m.brightness + 32767) / 65535;
+    m.scale[c] = scale;
+    for (int i = 0; i < 256; i++) {
+      float linear = powf(i / 255.0f, LED_GAMMA);
+      m.lut[c][i] = (uint16_t)(linear * scale + 0.5f);
+    }
+  }
+}
+
+
+void led_color_begin(led_color_model& m, uint8_t type)
+{
+  // NEO_xxx: bits 5..4 offset of red, 3..2 green, 1..0 blue
+  m.offset[0] = (type >> 4) & 3;
+  m.offset[1] = (type >> 2) & 3;
+  m.offset[2] = type & 3;
+  m.balance[0] = m.balance[1] = m.balance[2] = 65535;
+  m.brightness = 65535;
+  if (!kelvin_ready) build_kelvin_table();
+  build_tables(m);
+}
+
+
+void led_color_set_balance(led_color_model& m, uint8_t r, uint8_t g, uint8_t b)
+{
+  // The measured values are sRGB like the input, the balance works on linear
+  m.balance[0] = (uint16_t)(powf(r / 255.0f, LED_GAMMA) * 65535.0f + 0.5f);
+  m.balance[1] = (uint16_t)(powf(g / 255.0f, LED_GAMMA) * 65535.0f + 0.5f);
+  m.balance[2] = (uint16_t)(powf(b / 255.0f, LED_GAMMA) * 65535.0f + 0.5f);
+  build_tables(m);
+}
+
+
+void led_color_set_brightness(led_color_model& m, uint16_t brightness)
+{
+  if (brightness == m.brightness) return;
+  m.brightness = brightness;
+  build_tables(m);
+}
+
+
+led_rgb16 led_color_kelvin(const led_color_model& m, uint16_t kelvin)
+{
+  if (kelvin < LED_KELVIN_MIN) kelvin = LED_KELVIN_MIN;
+  if (kelvin > LED_KELVIN_MAX) kelvin = LED_KELVIN_MAX;
+  uint32_t pos = kelvin - LED_KELVIN_MIN;
+  uint32_t i = pos / LED_KELVIN_STEP;
+  uint32_t f = (pos % LED_KELVIN_STEP) * 65536 / LED_KELVIN_STEP;
+  const led_rgb16& a = kelvin_table[i];
+  const led_rgb16& b = kelvin_table[i + (i + 1 < KELVIN_STEPS)];
+  uint32_t r = a.r + (((int32_t)(b.r - a.r) * (int32_t)f) >> 16);
+  uint32_t g = a.g + (((int32_t)(b.g - a.g) * (int32_t)f) >> 16);
+  uint32_t bl = a.b + (((int32_t)(b.b - a.b) * (int32_t)f) >> 16);
+  return { (uint16_t)((r * m.scale[0]) >> 16), (uint16_t)((g * m.scale[1]) >> 16),
+           (uint16_t)((bl * m.scale[2]) >> 16) };
+}
+
+
+led_rgb16 led_color_of(const led_color_model& m, const led_color_setting& c)
+{
+  if (c.mode == LED_COLOR_HSV) {
+    led_hsv hsv = { (uint16_t)((uint32_t)(c.hue % 360) * LED_HUE_MAX / 360), c.sat, 255 };
+    return led_color_hsv(m, hsv);
+  }
+  if (c.mode == LED_COLOR_KELVIN) return led_color_kelvin(m, c.kelvin);
+  return led_color_rgb(m, c.red, c.green, c.blue);
+}
+
+
+void led_color_write_hsv(const led_color_model& m, const led_hsv* in, uint8_t* out, size_t count)
+{
+  for (size_t i = 0; i < count; i++, out += 3) {
+    led_color_write(m, led_color_hsv(m, in[i]), out);
+  }
+}
+
+
+void led_color_fill(const led_color_model& m, led_rgb16 c, uint8_t* out, size_t count)
+{
+  uint8_t pixel[3];
+  led_color_write(m, c, pixel);
+  for (size_t i = 0; i < count; i++, out += 3) {
+    out[0] = pixel[0];
+    out[1] = pixel[1];
+    out[2] = pixel[2];
+  }
+}
+
+
+void led_dither_begin(led_dither& d, uint16_t* frame, uint8_t* error, size_t count)
+{
+  d.frame = frame;
+  d.error = error;
+  d.count = count;
+  d.sum[0] = d.sum[1] = d.sum[2] = 0;
+  for (size_t i = 0; i < count * 3; i++) {
+    frame[i] = 0;
+    // Different start per LED, else all LEDs of one color step in the same frame
+    error[i] = (uint8_t)(i * 167);
+  }
+}
+
+
+bool led_dither_write(led_dither& d, const led_color_model& m, uint16_t level, uint8_t* out)
+{
+  uint32_t scale = level + (level >> 15);      // 0..65536
+  uint32_t rest = 0;
+  const uint16_t* in = d.frame;
+  uint8_t* error = d.error;
+  for (size_t i = 0; i < d.count; i++, in += 3, error += 3, out += 3) {
+    for (int c = 0; c < 3; c++) {
+      uint32_t v = (in[c] * scale) >> 16;
+      // 0..65535 -> 0..255 * 256, plus the rest of the last frames
+      v -= v >> 8;
+      uint32_t sum = v + error[c];
+      out[m.offset[c]] = sum >> 8;
+      error[c] = sum;
+      rest |= v & 0xFF;
+    }
+  }
+  return rest != 0;
+}
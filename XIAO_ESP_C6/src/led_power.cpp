@@ -0,0 +1,50 @@
+#include "led_power.h"
+
+
+void led_power_begin(led_power& p)
+{
+  for (int c = 0; c < 3; c++) p.cal.channel_ua[c] = LED_POWER_CHANNEL_UA;
+  p.cal.idle_ua = LED_POWER_IDLE_UA;
+  p.budget_ma = 0;
+  p.limit = 65535;
+  p.target = 65535;
+  p.last_ms = 0;
+  p.estimate_ma = 0;
+  p.limited_frames = 0;
+}
+
+
+// uA of the channels at full level
+static uint64_t full_ua(const led_power& p, const led_dither& d)
+{
+  uint64_t ua = 0;
+  for (int c = 0; c < 3; c++) ua += (uint64_t)d.sum[c] * p.cal.channel_ua[c];
+  return ua / 65535;
+}
+
+
+uint32_t led_power_estimate(const led_power& p, const led_dither& d, uint16_t level)
+{
+  uint64_t ua = (uint64_t)d.count * p.cal.idle_ua + full_ua(p, d) * level / 65535;
+  return (uint32_t)(ua / 1000);
+}
+
+
+uint16_t led_power_apply(led_power& p, const led_dither& d, uint16_t level, uint32_t now_ms)
+{
+  uint64_t need = full_ua(p, d) * level / 65535;
+  int64_t room = (int64_t)p.budget_ma * 1000 - (int64_t)d.count * p.cal.idle_ua;
+  if (!p.budget_ma || (int64_t)need <= room) p.target = 65535;
+  else p.target = room <= 0 ? 0 : (uint16_t)(room * 65535 / need);
+
+  // down at once, up over LED_POWER_RELEASE_MS
+  uint32_t step = (uint64_t)(now_ms - p.last_ms) * 65535 / LED_POWER_RELEASE_MS;
+  p.last_ms = now_ms;
+  if (p.target <= p.limit) p.limit = p.target;
+  else p.limit = (uint32_t)(p.target - p.limit) <= step ? p.target : p.limit + step;
+
+  uint16_t out = (uint32_t)level * p.limit / 65535;
+  if (out < level) p.limited_frames++;
+  p.estimate_ma = led_power_estimate(p, d, out);
+  return out;
+}
@@ -0,0 +1,143 @@
+#include "led_segments.h"
+
+#include <math.h>
+#include <string.h>
+
+const char* const led_effect_names[LED_EFFECTS] = { "solid", "rainbow", "breathe", "program" };
+
+
+void led_segments_clear(led_segments& s)
+{
+  memset(&s, 0, sizeof(s));
+}
+
+
+int led_segments_find(const led_segments& s, const char* name)
+{
+  for (int i = 0; i < s.count; i++) {
+    if (strncmp(s.seg[i].name, name, LED_SEGMENT_NAME) == 0) return i;
+  }
+  return -1;
+}
+
+
+void led_segments_changed(led_segments& s, int i, uint32_t now_ms)
+{
+  float level = s.seg[i].brightness / 100.0f;
+  s.state[i].level = (uint16_t)(powf(level, LED_GAMMA) * 65535.0f + 0.5f);
+  s.state[i].start_ms = now_ms;
+}
+
+
+static inline led_rgb16 scale(led_rgb16 c, uint32_t level)
+{
+  level += level >> 15;                         // 0..65536
+  return { (uint16_t)((c.r * level) >> 16), (uint16_t)((c.g * level) >> 16), (uint16_t)((c.b * level) >> 16) };
+}
+
+
+// Effect phase 0..65535, one round in 65 s at speed 1, 0.26 s at 255
+static inline uint16_t phase(const led_segment& seg, const led_segment_state& st, uint32_t now_ms)
+{
+  return (uint16_t)((now_ms - st.start_ms) * seg.speed);
+}
+
+
+// Pixel i of the segment -> position in the effect
+static inline size_t position(const led_segment& seg, size_t count, size_t length, size_t i)
+{
+  if ((seg.flags & LED_SEGMENT_MIRROR) && i >= length) i = count - 1 - i;
+  if (seg.flags & LED_SEGMENT_REVERSE) i = length - 1 - i;
+  return i;
+}
+
+
+// True if the segment moves
+static bool render_segment(const led_segment& seg, const led_segment_state& st, const led_color_model& m,
+                           led_dither& d, uint32_t now_ms, led_vm* vm)
+{
+  if (seg.start >= d.count) return false;
+  size_t count = seg.count;
+  if (seg.start + count > d.count) count = d.count - seg.start;
+  if (!count) return false;
+
+  // mirror: the effect is as long as half of the segment
+  size_t length = (seg.flags & LED_SEGMENT_MIRROR) ? (count + 1) / 2 : count;
+  uint16_t ph = phase(seg, st, now_ms);
+  led_rgb16 solid = led_color_of(m, seg.color);
+
+  // the program, unless there is none or it is too long for this segment
+  bool program = seg.effect == LED_EFFECT_PROGRAM && vm && vm->loaded;
+  if (program && led_vm_cost(*vm, count) > LED_VM_BUDGET) {
+    vm->over_budget++;
+    program = false;
+  }
+  if (program) {
+    led_vm_frame(*vm, now_ms - st.start_ms, length);
+    for (size_t i = 0; i < count; i++) {
+      uint8_t r, g, b;
+      led_vm_pixel(*vm, position(seg, count, length, i), r, g, b);
+      led_dither_set(d, seg.start + i, scale(led_color_rgb(m, r, g, b), st.level));
+    }
+    return vm->animated;
+  }
+
+  if (seg.effect == LED_EFFECT_BREATHE) {
+    // triangle 0..1..0, squared so the dark end lasts longer
+    uint32_t tri = ph < 32768 ? ph * 2 : (65535 - ph) * 2;
+    solid = scale(solid, (tri * tri) >> 16);
+  }
+  if (seg.effect != LED_EFFECT_RAINBOW) {
+    led_rgb16 c = scale(solid, st.level);
+    for (size_t i = 0; i < count; i++) led_dither_set(d, seg.start + i, c);
+    return seg.effect == LED_EFFECT_BREATHE && seg.speed;
+  }
+
+  led_hsv hsv = { 0, seg.color.sat, 255 };
+  uint32_t hue0 = (uint32_t)(seg.color.hue % 360) * LED_HUE_MAX / 360 + ((uint32_t)ph * LED_HUE_MAX >> 16);
+  for (size_t i = 0; i < count; i++) {
+    hsv.h = (hue0 + position(seg, count, length, i) * LED_HUE_MAX / length) % LED_HUE_MAX;
+    led_dither_set(d, seg.start + i, scale(led_color_hsv(m, hsv), st.level));
+  }
+  return seg.speed;
+}
+
+
+bool led_segments_render(const led_segments& s, const led_color_model& m, led_rgb16 base, led_dither& d,
+                         uint32_t now_ms, led_vm* vm)
+{
+  led_dither_fill(d, base);
+  bool moving = false;
+  for (int i = 0; i < s.count; i++) {
+    const led_segment& seg = s.seg[i];
+    if (!(seg.flags & LED_SEGMENT_ON)) continue;
+    if (render_segment(seg, s.state[i], m, d, now_ms, vm)) moving = true;
+  }
+  return moving;
+}
+
+
+size_t led_segments_pack(const led_segments& s, uint8_t* out, size_t size)
+{
+  size_t len = 2 + s.count * sizeof(led_segment);
+  if (len > size) return 0;
+  out[0] = LED_SEGMENTS_VERSION;
+  out[1] = s.count;
+  memcpy(out + 2, s.seg, s.count * sizeof(led_segment));
+  return len;
+}
+
+
+bool led_segments_unpack(led_segments& s, const uint8_t* in, size_t len, uint32_t now_ms)
+{
+  led_segments_clear(s);
+  if (len < 2 || in[0] != LED_SEGMENTS_VERSION || in[1] > LED_SEGMENTS_MAX) return false;
+  if (len != 2 + in[1] * sizeof(led_segment)) return false;
+  s.count = in[1];
+  memcpy(s.seg, in + 2, s.count * sizeof(led_segment));
+  for (int i = 0; i < s.count; i++) {
+    s.seg[i].name[LED_SEGMENT_NAME - 1] = 0;
+    led_segments_changed(s, i, now_ms);
+  }
+  return true;
+}
@@ -0,0 +1,285 @@
+#include "led_vm.h"
+#include "led_color.h"
+
+#include <string.h>
+
+// sin of 256 steps per turn, Q1.15, one more for the interpolation
+static const int16_t sine[257] = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+  12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+  23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+  30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+  32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285, 32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+  30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+  23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+  12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179, 6393, 5602, 4808, 4011, 3212, 2410, 1608, 804,
+  0, -804, -1608, -2410, -3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+  -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159, -20787, -21403,
+  -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790, -27245, -27683, -28105, -28510,
+  -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971, -32137, -32285,
+  -32412, -32521, -32609, -32678, -32728, -32757, -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+  -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510,
+  -28105, -27683, -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+  -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279, -12539, -11793,
+  -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011, -3212, -2410, -1608, -804, 0,
+};
+
+// Stack effect and operand bytes per opcode
+static const uint8_t op_pops[LED_OPS] = { 0, 0, 0, 1, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 3, 2, 2, 1, 1, 1, 1, 1, 1, 3 };
+static const uint8_t op_pushes[LED_OPS] = { 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0 };
+static const uint8_t op_operand[LED_OPS] = { 0, 4, 1, 1 };
+
+
+// 0..1 -> 0..255, clamped
+static inline uint8_t to8(int32_t v)
+{
+  if (v <= 0) return 0;
+  if (v >= LED_VM_ONE) return 255;
+  return (uint32_t)(v * 255 + 32768) >> 16;
+}
+
+
+// Runs code up to LED_OP_END. code NULL: returns the handler addresses.
+static const void* const* exec(const led_vm_cell* pc, int32_t* reg)
+{
+  static const void* const ops[LED_OPS] = {
+    &&op_end, &&op_push, &&op_load, &&op_store, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_neg,
+    &&op_lt, &&op_gt, &&op_le, &&op_ge, &&op_sel, &&op_min, &&op_max, &&op_abs, &&op_floor, &&op_frac,
+    &&op_sin, &&op_tri, &&op_noise, &&op_hsv,
+  };
+  if (!pc) return ops;
+
+  int32_t stack[LED_VM_STACK + 1];
+  int32_t* sp = stack;                  // top, stack[0] is never used
+  const led_vm_cell* c;
+  int32_t a, b;
+  uint32_t u;
+
+#define NEXT do { c = pc++; goto *c->op; } while (0)
+  NEXT;
+
+op_end:
+  return NULL;
+op_push:
+  *++sp = c->arg;
+  NEXT;
+op_load:
+  *++sp = reg[c->arg];
+  NEXT;
+op_store:
+  reg[c->arg] = *sp--;
+  NEXT;
+op_add:
+  a = *sp--;
+  *sp = (int32_t)((uint32_t)*sp + (uint32_t)a);
+  NEXT;
+op_sub:
+  a = *sp--;
+  *sp = (int32_t)((uint32_t)*sp - (uint32_t)a);
+  NEXT;
+op_mul:
+  a = *sp--;
+  *sp = (int32_t)(((int64_t)*sp * a) >> 16);
+  NEXT;
+op_div:
+  a = *sp--;
+  if (a) {
+    int64_t q = ((int64_t)*sp << 16) / a;
+    *sp = q > INT32_MAX ? INT32_MAX : q < INT32_MIN ? INT32_MIN : (int32_t)q;
+  } else {
+    *sp = 0;
+  }
+  NEXT;
+op_mod:
+  a = *sp--;
+  if (a == 0 || a == -1) {
+    *sp = 0;
+  } else {
+    b = *sp % a;
+    *sp = (b && (b ^ a) < 0) ? b + a : b;
+  }
+  NEXT;
+op_neg:
+  *sp = (int32_t)(0u - (uint32_t)*sp);
+  NEXT;
+op_lt:
+  a = *sp--;
+  *sp = *sp < a ? LED_VM_ONE : 0;
+  NEXT;
+op_gt:
+  a = *sp--;
+  *sp = *sp > a ? LED_VM_ONE : 0;
+  NEXT;
+op_le:
+  a = *sp--;
+  *sp = *sp <= a ? LED_VM_ONE : 0;
+  NEXT;
+op_ge:
+  a = *sp--;
+  *sp = *sp >= a ? LED_VM_ONE : 0;
+  NEXT;
+op_sel:
+  b = *sp--;
+  a = *sp--;
+  *sp = *sp ? a : b;
+  NEXT;
+op_min:
+  a = *sp--;
+  if (a < *sp) *sp = a;
+  NEXT;
+op_max:
+  a = *sp--;
+  if (a > *sp) *sp = a;
+  NEXT;
+op_abs:
+  if (*sp < 0) *sp = (int32_t)(0u - (uint32_t)*sp);
+  NEXT;
+op_floor:
+  *sp &= ~0xFFFF;
+  NEXT;
+op_frac:
+  *sp &= 0xFFFF;
+  NEXT;
+op_sin:
+  u = (uint32_t)*sp & 0xFFFF;
+  a = sine[u >> 8];
+  *sp = (a + (((sine[(u >> 8) + 1] - a) * (int32_t)(u & 0xFF)) >> 8)) * 2;
+  NEXT;
+op_tri:
+  u = (uint32_t)*sp & 0xFFFF;
+  *sp = u < 0x8000 ? u * 2 : (0x10000 - u) * 2;
+  NEXT;
+op_noise:
+  u = (uint32_t)(*sp >> 16) * 0x9E3779B1u;
+  u ^= u >> 15;
+  u *= 0x85EBCA77u;
+  u ^= u >> 13;
+  *sp = u & 0xFFFF;
+  NEXT;
+op_hsv: {
+    uint8_t v = to8(*sp--), s = to8(*sp--);
+    led_hsv hsv = { (uint16_t)((((uint32_t)*sp-- & 0xFFFF) * LED_HUE_MAX) >> 16), s, v };
+    uint8_t r8, g8, b8;
+    led_hsv_to_rgb8(hsv, r8, g8, b8);
+    reg[LED_REG_R] = r8 * 257;
+    reg[LED_REG_G] = g8 * 257;
+    reg[LED_REG_B] = b8 * 257;
+  }
+  NEXT;
+#undef NEXT
+}
+
+
+// One part: checks it (out NULL) or translates it to out. Number of
+// instructions or -1 with error set.
+static int part(const uint8_t* code, size_t len, led_vm_cell* out, bool& uses_t, const char*& error)
+{
+  const void* const* ops = exec(NULL, NULL);
+  int depth = 0, n = 0;
+  size_t i = 0;
+  while (i < len) {
+    uint8_t op = code[i++];
+    if (op == LED_OP_END || op >= LED_OPS) {
+      error = "program: unknown instruction";
+      return -1;
+    }
+    if (i + op_operand[op] > len) {
+      error = "program: truncated";
+      return -1;
+    }
+    int32_t arg = 0;
+    if (op_operand[op] == 4) arg = code[i] | (code[i + 1] << 8) | (code[i + 2] << 16) | ((uint32_t)code[i + 3] << 24);
+    if (op_operand[op] == 1) {
+      arg = code[i];
+      if (arg >= LED_VM_REGS) {
+        error = "program: no such register";
+        return -1;
+      }
+      if (op == LED_OP_STORE && arg < LED_REG_INPUTS) {
+        error = "program: i, n, x and t are read only";
+        return -1;
+      }
+      if (op == LED_OP_LOAD && arg == LED_REG_T) uses_t = true;
+    }
+    i += op_operand[op];
+
+    depth -= op_pops[op];
+    if (depth < 0) {
+      error = "program: stack underflow";
+      return -1;
+    }
+    depth += op_pushes[op];
+    if (depth > LED_VM_STACK) {
+      error = "program: stack too deep";
+      return -1;
+    }
+    if (out) out[n] = { ops[op], arg };
+    n++;
+  }
+  if (depth) {
+    error = "program: values left on the stack";
+    return -1;
+  }
+  return n;
+}
+
+
+const char* led_vm_load(led_vm& vm, const uint8_t* blob, size_t len)
+{
+  if (len < 8 || blob[0] != 'V' || blob[1] != 'M') return "program: no bytecode";
+  if (blob[2] != LED_VM_VERSION) return "program: other version";
+  if (len > LED_VM_CODE_MAX) return "program: too large";
+  size_t frame_len = blob[4] | (blob[5] << 8), pixel_len = blob[6] | (blob[7] << 8);
+  if (len != 8 + frame_len + pixel_len) return "program: truncated";
+  const uint8_t* frame = blob + 8;
+  const uint8_t* pixel = frame + frame_len;
+
+  const char* error = NULL;
+  bool uses_t = false;
+  int frame_ops = part(frame, frame_len, NULL, uses_t, error);
+  int pixel_ops = frame_ops < 0 ? -1 : part(pixel, pixel_len, NULL, uses_t, error);
+  if (pixel_ops < 0) return error;
+  if (frame_ops + pixel_ops > LED_VM_CELLS_MAX) return "program: too many instructions";
+
+  const void* const* ops = exec(NULL, NULL);
+  part(frame, frame_len, vm.code, uses_t, error);
+  vm.code[frame_ops] = { ops[LED_OP_END], 0 };
+  vm.pixel_start = frame_ops + 1;
+  part(pixel, pixel_len, vm.code + vm.pixel_start, uses_t, error);
+  vm.code[vm.pixel_start + pixel_ops] = { ops[LED_OP_END], 0 };
+  vm.frame_ops = frame_ops;
+  vm.pixel_ops = pixel_ops;
+  vm.animated = uses_t;
+  vm.loaded = true;
+  memset(vm.reg, 0, sizeof(vm.reg));
+  return NULL;
+}
+
+
+void led_vm_unload(led_vm& vm)
+{
+  vm.loaded = false;
+  vm.animated = false;
+  vm.frame_ops = 0;
+  vm.pixel_ops = 0;
+}
+
+
+void led_vm_frame(led_vm& vm, uint32_t t_ms, uint16_t count)
+{
+  vm.reg[LED_REG_T] = (int32_t)((((uint64_t)t_ms << 16) / 1000) & 0x7FFFFFFF);
+  vm.reg[LED_REG_N] = (int32_t)count << 16;
+  vm.step = count ? LED_VM_ONE / count : 0;
+  exec(vm.code, vm.reg);
+}
+
+
+void led_vm_pixel(led_vm& vm, uint16_t i, uint8_t& r, uint8_t& g, uint8_t& b)
+{
+  vm.reg[LED_REG_I] = (int32_t)i << 16;
+  vm.reg[LED_REG_X] = i * vm.step;
+  exec(vm.code + vm.pixel_start, vm.reg);
+  r = to8(vm.reg[LED_REG_R]);
+  g = to8(vm.reg[LED_REG_G]);
+  b = to8(vm.reg[LED_REG_B]);
+}
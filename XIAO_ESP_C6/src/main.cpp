@@ -2,15 +2,44 @@
 
 // Load Wi-Fi library
 #include <WiFi.h>
-#include <Adafruit_NeoPixel.h>      //Adiciona a biblioteca Adafruit NeoPixel
+#include <Adafruit_NeoPixel.h>      //NEO_xxx color orders
 #include <Preferences.h>            //For NVS (Non-Volatile Storage)
 #include <time.h>                   //For time functions
+#include <sys/time.h>               //System time, runs on over software resets
+#include <http_core.h>
+#include <http_json.h>
+#include "led_color.h"
+#include "led_strip.h"
+#include "led_segments.h"
+#include "led_power.h"
+#include "led_vm.h"
+#include "group_sync.h"
+#include "serial_proto.h"
+#include "trace.h"
+#include "event_log.h"
+#include "sntp_client.h"
+#include "heap_track.h"
 
 
 #define D_in D10          // arduino pin to handle data line
 #define led_count 37       // Count of leds of stripe
+#define led_type (NEO_GRB + NEO_KHZ800)
 #define NVS_NAMESPACE "nvm_params"
 
+// White balance of the stripe: r, g, b that look neutral white on it
+#define WHITE_BALANCE_R 255
+#define WHITE_BALANCE_G 255
+#define WHITE_BALANCE_B 255
+
+// Current the power supply can give the strip, the brightness is lowered
+// above (led_power.h). 0 = no limit. PATCH /api/state "power" changes it.
+#define POWER_BUDGET_MA 2000
+
+// Time server (sntp_client.h), "" = none. PATCH /api/state "sntp_server"
+// changes it, a name or an address, e.g. of a stand-in in the network of
+// the access point (program sntp server).
+#define SNTP_SERVER "pool.ntp.org"
+
 // Structure for a single timer slot (on or off time)
 struct timer_slot {
   uint8_t hour;   // 0-23
@@ -29,15 +58,27 @@ struct timer_pair {
 // Structure for persistent parameters
 struct nvm_parameters {
   uint8_t brightness;
-  uint8_t red;
-  uint8_t green;
-  uint8_t blue;
+  led_color_setting color;  // rgb, hsv or kelvin (led_color.h)
   uint32_t timestamp;  // Unix timestamp for RTC
   int8_t tz_offset_hours; // timezone offset hours (e.g. +1 for CET)
   uint8_t auto_dst; // 1=auto DST enabled, 0=disabled
+  uint8_t group_role; // GROUP_OFF, GROUP_LEADER, GROUP_FOLLOWER (after restart)
+  uint8_t group_id;   // beacons of other groups are ignored
+  uint16_t power_budget_ma;         // 0 = no limit
+  led_power_calibration power_cal;  // current per channel and LED
+  char sntp_server[32];             // "" = no SNTP
+  int32_t drift_ppb;                // millis() runs fast by, measured by SNTP
 };
 
-Adafruit_NeoPixel pixels(led_count, D_in);
+led_strip<led_count, led_type, led_rmt_output<D_in>> strip;   // buffers, RMT output (led_strip.h)
+led_color_model color_model;   // gamma, white balance (led_color.h)
+led_dither& strip_dither = strip.dither;   // 16 bit frame, dithered to the 8 bit LEDs
+led_segments segments;          // zones on top of the base color (led_segments.h)
+led_vm effect_vm;               // uploaded program of the "program" effect (led_vm.h)
+uint8_t effect_blob[LED_VM_CODE_MAX];   // as uploaded, for NVS
+size_t effect_len = 0;
+led_rgb16 strip_base;           // base color from nvm_params, linear
+led_power strip_power;          // current estimate and limit per frame
 Preferences preferences;
 nvm_parameters nvm_params;
 
@@ -49,58 +90,197 @@ uint32_t rtc_timestamp = 0;
 unsigned long last_millis = 0;
 uint32_t last_printed_second = 0;
 
+// Changes from the web server are collected and applied from loop(): the
+// strip at most once per frame, NVS at most once per commit window. A slider
+// sends many requests per second, each of them used to rewrite the strip
+// and the flash.
+#define CHANGE_STRIP 0x01     // color / brightness
+#define CHANGE_PARAMS 0x02    // nvm_params to NVS
+#define CHANGE_TIMERS 0x04    // timers to NVS
+#define CHANGE_SEGMENTS 0x08  // segments to NVS
+#define CHANGE_EFFECT 0x10    // effect program to NVS
+#define CHANGE_NVS (CHANGE_PARAMS | CHANGE_TIMERS | CHANGE_SEGMENTS | CHANGE_EFFECT)
+#define NVS_COMMIT_MS 2000
+uint8_t pending_changes = 0;
+unsigned long first_change_ms = 0;   // oldest change not in NVS yet
+uint16_t coalesced_changes = 0;
+
+// Strip output. Frames go out only while something changes: a fade, or a
+// rest below one LED step that the dithering spreads over the frames. A
+// frame of 37 LEDs is ~1.2 ms on the wire, 4 ms apart leaves the loop
+// enough time for the web server.
+#define STRIP_FRAME_US 4000
+#define SLIDER_FADE_MS 150      // brightness from the web page
+#define TIMER_FADE_MS 60000     // brightness from the timers
+#define STRIP_STATS_MS 10000
+uint16_t fade_from = 0;         // brightness 0..65535 (perceived, before gamma)
+uint16_t fade_to = 0;
+uint8_t fade_target = 0;        // percent fade_to was set for
+unsigned long fade_start_ms = 0;
+unsigned long fade_ms = 0;
+bool strip_dirty = true;        // frame content changed
+bool strip_animated = false;    // a segment effect moves
+bool strip_dithering = false;   // last frame left a rest
+unsigned long strip_frame_us = 0;
+unsigned long strip_stats_ms = 0;
+uint32_t strip_frames = 0;
+uint32_t strip_dither_us = 0;   // sum over strip_frames
+uint32_t strip_show_us = 0;
+bool strip_live = false;        // frame from the serial port, no base color / segments
+unsigned long strip_live_ms = 0;
+
+// Group mode (group_sync.h): the leader is the access point and sends
+// clock and strip state by multicast, followers join its network, follow
+// its clock and apply the changes at the same time. Followers skip their
+// own timers, the leader's reach them as changes.
+#define GROUP_OFF 0
+#define GROUP_LEADER 1
+#define GROUP_FOLLOWER 2
+WiFiUDP group_udp;
+bool group_listening = false;
+group_clock group_clk;            // follower: RTC discipline
+group_state group_pending;        // scheduled change, applied at apply_ms
+bool group_has_pending = false;
+uint16_t group_applied_seq = 0;
+uint16_t group_beacon_seq = 0;
+unsigned long group_beacon_ms = 0;
+
+// History of timer triggers, RTC sets, saves and resets in the "evlog"
+// partition (event_log.h), GET /api/log. Events are queued and written
+// from loop().
+event_flash log_flash;
+event_log events;
+
+// SNTP (sntp_client.h): the RTC follows nvm_params.sntp_server whenever it
+// answers, one request out at a time, never waiting for it. Between the
+// syncs update_rtc() corrects the measured drift. Group followers take the
+// leader's clock instead.
+#define SNTP_LOCAL_PORT 4123
+#define SNTP_SAVE_MS 3600000UL        // time and drift to NVS at most this often
+#define RTC_VALID_TIME 1600000000UL   // system time after a software reset, else NVS
+WiFiUDP sntp_udp;
+bool sntp_listening = false;
+sntp_clock sntp_clk;
+sntp_result sntp_last;                // last answer used
+uint64_t sntp_sent_ms = 0;            // RTC at the request out, 0 = none
+unsigned long sntp_sent_millis = 0;
+unsigned long sntp_next_ms = 0;       // millis() of the next request
+uint8_t sntp_burst = 0;               // requests of this poll sent
+unsigned long sntp_poll_ms = SNTP_POLL_MIN_MS;
+unsigned long sntp_saved_ms = 0;
+bool sntp_saved = false;
+uint32_t sntp_last_sync = 0;          // RTC seconds
+uint32_t sntp_syncs = 0;
+uint32_t sntp_failures = 0;
+unsigned long drift_millis = 0;       // drift corrected up to
+
+// How late check_timers() sees the minute changes, GET /stats. A busy
+// loop() (a slow request, many clients) delays the timers by as much.
+#define TIMER_LATE_MS 10
+uint32_t timer_edges = 0;
+uint32_t timer_late_max_ms = 0;
+uint32_t timer_late = 0;              // over TIMER_LATE_MS
+
 // Replace with your network credentials
 //const char* ssid     = "ESP32-Weihnachten";
 const char* ssid     = "ESP32-Mopedbuddy";
 const char* password = "123456789";
 
-// Set web server port number to 80
-WiFiServer server(80);
-
-// Variable to store the HTTP request
-String header;
-
 // prototypes
 void update_color_table();
 void load_nvm_parameters();
 void save_nvm_parameters();
+void load_segments();
+void save_segments();
+void load_effect();
+void save_effect();
 void set_default_nvm_parameters();
-void handle_wifi_client();
 void update_rtc();
 void set_rtc_time(uint32_t timestamp);
-String get_rtc_string();
+uint64_t rtc_now_ms();
+void rtc_adjust_ms(int64_t ms);
+void rtc_set_system();
+const char* format_rtc(char* out, size_t size);
 void load_timers();
 void save_timers();
 void check_timers();
 void set_timer_slot(uint8_t slot, uint8_t hour, uint8_t minute, uint8_t type, uint8_t enabled);
 void set_timer_pair_enabled(uint8_t pair, uint8_t enabled);
+void mark_changed(uint8_t changes);
+void apply_changes();
+void start_fade(uint8_t percent, unsigned long ms);
+void fade_brightness(uint8_t percent, unsigned long ms);
+void strip_service();
+void group_service();
+void group_schedule(uint32_t fade_ms);
+void sntp_service();
+void sntp_restart();
+void serial_service();
+void log_event(uint8_t code, uint16_t arg);
+void heap_service();
+size_t print_format(Print& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+#if TRACE_ENABLED
+static void trace_request(const char* name, bool end);
+#endif
+extern http_server web;
+extern serial_server serial_ctl;
 
 
 
 void setup() 
 {
+#if HEAP_TRACK_ENABLED
+  heap_track_begin();                // allocations of loop() in the regions
+#endif
   Serial.begin(115200);
-  pixels.begin();
+  if (!led_strip_begin(strip)) Serial.println("Strip: no RMT channel");
+  led_color_begin(color_model, led_type);
+  led_color_set_balance(color_model, WHITE_BALANCE_R, WHITE_BALANCE_G, WHITE_BALANCE_B);
+  led_power_begin(strip_power);
 
   // Load persistent parameters
   load_nvm_parameters();
+  load_segments();
+  load_effect();
 
   // Load timers from NVS
   load_timers();
 
-  update_color_table();
-
-  // Connect to Wi-Fi network with SSID and password
-  Serial.print("Setting AP (Access Point)…");
-  // Remove the password parameter, if you want the AP (Access Point) to be open
-  
-  WiFi.softAP(ssid, password);
-  IPAddress IP = WiFi.softAPIP();
+  if (!event_flash_partition(log_flash, "evlog") || !event_log_begin(events, &log_flash)) {
+    Serial.println("No evlog partition, no event history");
+  }
+  Serial.printf("Event log: %lu of %lu events\n", (unsigned long)event_log_count(events),
+                (unsigned long)event_log_capacity(events));
+  log_event(EVENT_BOOT, esp_reset_reason());
 
-  Serial.print("AP IP address: ");
-  Serial.println(IP);
+  update_color_table();
 
-  server.begin();
+  if (nvm_params.group_role == GROUP_FOLLOWER) {
+    // Join the network of the leader, group_service() waits for it
+    Serial.printf("Group %u follower, joining %s\n", nvm_params.group_id, ssid);
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+  } else {
+    // Connect to Wi-Fi network with SSID and password
+    Serial.print("Setting AP (Access Point)…");
+    // Remove the password parameter, if you want the AP (Access Point) to be open
+
+    WiFi.softAP(ssid, password);
+    IPAddress IP = WiFi.softAPIP();
+
+    Serial.print("AP IP address: ");
+    Serial.println(IP);
+  }
+  group_clock_reset(group_clk);
+
+  // Web server on port 80
+  web.log = &Serial;                 // one line per request
+#if TRACE_ENABLED
+  web.trace = trace_request;         // requests in GET /api/trace
+#endif
+  http_server_begin(web, 80);
+  // Binary commands on the same port as the debug output
+  serial_server_begin(serial_ctl);
 }
 
 
@@ -108,20 +288,363 @@ void loop()
 {
   // Update software RTC
   update_rtc();
-  // Check and apply timers
-  check_timers();
-  // Handle incoming client requests
-  handle_wifi_client();
+  // Check and apply timers, in a group only the leader's
+  if (nvm_params.group_role != GROUP_FOLLOWER) check_timers();
+  // Group beacons out / in, scheduled changes
+  group_service();
+  // Time server request out / answer in
+  sntp_service();
+  // Handle incoming client requests, never waits for a client
+  http_server_poll(web);
+  // Binary commands from the USB serial port (serial_proto.h)
+  serial_service();
+  // Strip and NVS for what the requests changed
+  apply_changes();
+  // Queued history events to flash
+  event_log_service(events, millis());
+  // Free heap and largest block for GET /heap
+  heap_service();
+  // Next strip frame when a fade or the dithering needs one
+  strip_service();
 }
 
+// Base color of the stripe from nvm_params, strip_service() renders it with
+// the segments into the 16 bit frame. The brightness (0..100 %) is applied
+// per frame by the dither stage, not by setBrightness() on the 8 bit values.
 void update_color_table()
 {
-  pixels.clear(); // desliga todos os LEDs
-  pixels.setBrightness(nvm_params.brightness);
-  for (int i = 0; i < led_count; i++)
-  {     
-    pixels.setPixelColor(i, pixels.Color(nvm_params.red, nvm_params.green, nvm_params.blue)); 
-    pixels.show();                           
+  strip_base = led_color_of(color_model, nvm_params.color);
+  strip_dirty = true;
+  strip_power.budget_ma = nvm_params.power_budget_ma;
+  strip_power.cal = nvm_params.power_cal;
+
+  // Brightness from the web page: short fade, so a slider doesn't step
+  if (nvm_params.brightness != fade_target) start_fade(nvm_params.brightness, SLIDER_FADE_MS);
+}
+
+
+// Current brightness of the fade, 0..65535 perceived
+static uint16_t fade_level(unsigned long now)
+{
+  unsigned long t = now - fade_start_ms;
+  if (t >= fade_ms) return fade_to;
+  return fade_from + (int32_t)(fade_to - fade_from) * (int32_t)t / (int32_t)fade_ms;
+}
+
+
+void start_fade(uint8_t percent, unsigned long ms)
+{
+  unsigned long now = millis();
+  fade_from = fade_level(now);
+  fade_to = (uint32_t)percent * 65535 / 100;
+  fade_target = percent;
+  fade_start_ms = now;
+  fade_ms = ms;
+}
+
+
+// Brightness from the timers, in a group together with the followers
+void fade_brightness(uint8_t percent, unsigned long ms)
+{
+  nvm_params.brightness = percent;
+  if (nvm_params.group_role == GROUP_LEADER) group_schedule(ms);
+  else start_fade(percent, ms);
+  mark_changed(CHANGE_PARAMS);
+}
+
+
+void strip_service()
+{
+  unsigned long now = millis();
+  bool fading = now - fade_start_ms < fade_ms;
+  // no live frame for a while: base color and segments again
+  if (strip_live && now - strip_live_ms >= SERIAL_LIVE_MS) {
+    strip_live = false;
+    strip_dirty = true;
+  }
+  if (!strip_dirty && !strip_animated && !fading && !strip_dithering && !led_power_releasing(strip_power)) return;
+  unsigned long start = micros();
+  if (start - strip_frame_us < STRIP_FRAME_US) return;
+  strip_frame_us = start;
+  TRACE_SCOPE("strip frame");
+
+  // base color and segments, in one pass over the frame. A live frame is
+  // in the frame already.
+  if (strip_dirty || strip_animated) {
+    TRACE_SCOPE("render");
+    strip_animated = !strip_live && led_segments_render(segments, color_model, strip_base, strip_dither, now,
+                                                                &effect_vm);
+    strip_dirty = false;
+  }
+  // perceived brightness -> linear light
+  float level = fade_level(now) / 65535.0f;
+  uint16_t linear = (uint16_t)(powf(level, LED_GAMMA) * 65535.0f + 0.5f);
+  // within the budget of the power supply
+  linear = led_power_apply(strip_power, strip_dither, linear, now);
+  TRACE_BEGIN("dither");
+  strip_dithering = led_strip_write(strip, linear);
+  TRACE_END("dither");
+  unsigned long dithered = micros();
+  // one transfer for the whole strip
+  TRACE_BEGIN("show");
+  led_strip_show(strip);
+  TRACE_END("show");
+
+  strip_frames++;
+  strip_dither_us += dithered - start;
+  strip_show_us += micros() - dithered;
+  if (now - strip_stats_ms >= STRIP_STATS_MS) {
+    print_format(Serial, "Strip: %lu frames/s, dither %lu us, show %lu us per frame, %lu mA%s\n",
+                 (unsigned long)strip_frames * 1000 / (now - strip_stats_ms),
+                 (unsigned long)(strip_dither_us / strip_frames), (unsigned long)(strip_show_us / strip_frames),
+                 (unsigned long)strip_power.estimate_ma, strip_power.limit < 65535 ? " (limited)" : "");
+    strip_stats_ms = now;
+    strip_frames = 0;
+    strip_dither_us = 0;
+    strip_show_us = 0;
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Group mode, see group_sync.h
+
+// Leader: the strip state of nvm_params goes to the group and is applied by
+// all of them GROUP_APPLY_DELAY_MS from now. Changes while one is scheduled
+// join it, so a slider still moves the strip every GROUP_APPLY_DELAY_MS.
+void group_schedule(uint32_t fade_ms)
+{
+  if (!group_has_pending) group_pending.apply_ms = rtc_now_ms() + GROUP_APPLY_DELAY_MS;
+  if (!++group_pending.seq) group_pending.seq = 1;   // 0 = nothing sent yet
+  group_pending.fade_ms = fade_ms;
+  group_pending.brightness = nvm_params.brightness;
+  group_pending.color = nvm_params.color;
+  group_has_pending = true;
+  group_beacon_ms = millis() - GROUP_BEACON_MS;       // beacon right away
+}
+
+
+static void apply_group_state(const group_state& s)
+{
+  TRACE_SCOPE("group apply");
+  nvm_params.brightness = s.brightness;
+  nvm_params.color = s.color;
+  start_fade(s.brightness, s.fade_ms);
+  update_color_table();
+  group_applied_seq = s.seq;
+}
+
+
+static void group_send_beacon()
+{
+  TRACE_SCOPE("group beacon");
+  group_beacon b;
+  b.group = nvm_params.group_id;
+  b.seq = ++group_beacon_seq;
+  b.state = group_pending;
+  b.time_ms = rtc_now_ms();
+  uint8_t buf[GROUP_BEACON_SIZE];
+  size_t len = group_encode(b, buf, sizeof(buf));
+  group_udp.beginMulticastPacket();
+  group_udp.write(buf, len);
+  group_udp.endPacket();
+}
+
+
+static void group_receive()
+{
+  uint8_t buf[GROUP_BEACON_SIZE + 1];
+  while (group_udp.parsePacket() > 0) {
+    TRACE_SCOPE("group receive");
+    int n = group_udp.read(buf, sizeof(buf));
+    uint64_t now = rtc_now_ms();
+    group_beacon b;
+    if (n <= 0 || !group_decode(b, buf, n) || b.group != nvm_params.group_id) continue;
+    int64_t correction = group_clock_sample(group_clk, (int64_t)(b.time_ms - now));
+    if (correction) rtc_adjust_ms(correction);
+    if (b.state.seq && b.state.seq != group_applied_seq) {
+      group_pending = b.state;
+      group_has_pending = true;
+    }
+  }
+}
+
+
+void group_service()
+{
+  if (nvm_params.group_role == GROUP_OFF) return;
+  if (!group_listening) {
+    // a follower only once it is in the network of the leader
+    if (nvm_params.group_role == GROUP_FOLLOWER && WiFi.status() != WL_CONNECTED) return;
+    group_listening = group_udp.beginMulticast(IPAddress(GROUP_ADDRESS), GROUP_PORT);
+    if (!group_listening) return;
+    Serial.printf("Group %u: %s on port %u\n", nvm_params.group_id,
+                  nvm_params.group_role == GROUP_LEADER ? "leader" : "follower", GROUP_PORT);
+    // the followers start with the state of the leader
+    if (nvm_params.group_role == GROUP_LEADER) group_schedule(SLIDER_FADE_MS);
+  }
+
+  if (nvm_params.group_role == GROUP_LEADER) {
+    unsigned long now = millis();
+    if (now - group_beacon_ms >= (group_has_pending ? GROUP_PENDING_BEACON_MS : GROUP_BEACON_MS)) {
+      group_beacon_ms = now;
+      group_send_beacon();
+    }
+  } else {
+    group_receive();
+  }
+
+  if (group_has_pending && rtc_now_ms() >= group_pending.apply_ms) {
+    apply_group_state(group_pending);
+    group_has_pending = false;
+  }
+}
+
+
+// Next poll at once, with the shortest interval
+void sntp_restart()
+{
+  sntp_sent_ms = 0;
+  sntp_burst = 0;
+  sntp_next_ms = millis();
+  sntp_poll_ms = SNTP_POLL_MIN_MS;
+  sntp_clock_forget(sntp_clk);
+}
+
+
+// End of a poll: the best answer moves the RTC, to NVS after a step and
+// every SNTP_SAVE_MS
+static void sntp_update()
+{
+  int64_t correction;
+  sntp_burst = 0;
+  if (!sntp_clock_update(sntp_clk, correction)) {
+    sntp_failures++;
+    sntp_next_ms = millis() + SNTP_RETRY_MS;
+    return;
+  }
+  TRACE_SCOPE("sntp sync");
+  uint32_t before = rtc_timestamp;
+  rtc_adjust_ms(correction);
+  rtc_set_system();
+  bool step = correction <= -SNTP_STEP_MS || correction >= SNTP_STEP_MS;
+  if (step) {
+    int32_t jump = ((int64_t)rtc_timestamp - before) / 60;
+    log_event(EVENT_RTC_SET, (uint16_t)(jump < -32768 ? -32768 : jump > 32767 ? 32767 : jump));
+    Serial.print("SNTP: RTC set to: ");
+    char time_text[20];
+    Serial.println(format_rtc(time_text, sizeof(time_text)));
+  }
+  if (step || !sntp_saved || millis() - sntp_saved_ms >= SNTP_SAVE_MS) {
+    nvm_params.timestamp = rtc_timestamp;
+    nvm_params.drift_ppb = sntp_clk.ppb;
+    mark_changed(CHANGE_PARAMS);
+    sntp_saved = true;
+    sntp_saved_ms = millis();
+  }
+  sntp_last = sntp_clk.best;
+  sntp_last_sync = rtc_timestamp;
+  sntp_syncs++;
+  sntp_poll_ms = step ? SNTP_POLL_MIN_MS : sntp_poll_ms * 2 > SNTP_POLL_MAX_MS ? SNTP_POLL_MAX_MS : sntp_poll_ms * 2;
+  sntp_next_ms = millis() + sntp_poll_ms;
+}
+
+
+// An answer or a timeout: next request of the burst, or its end
+static void sntp_request_done()
+{
+  sntp_sent_ms = 0;
+  if (sntp_burst < SNTP_BURST) sntp_next_ms = millis() + SNTP_BURST_MS;
+  else sntp_update();
+}
+
+
+static void sntp_receive()
+{
+  uint8_t buf[SNTP_PACKET_SIZE];
+  while (sntp_udp.parsePacket() > 0) {
+    uint64_t t4 = rtc_now_ms();
+    int n = sntp_udp.read(buf, sizeof(buf));
+    sntp_result r;
+    // answers to an older request are dropped here
+    if (n <= 0 || !sntp_parse(buf, n, sntp_sent_ms, t4, r)) continue;
+    sntp_clock_answer(sntp_clk, t4, r);
+    sntp_request_done();
+    return;
+  }
+}
+
+
+void sntp_service()
+{
+  if (!nvm_params.sntp_server[0] || nvm_params.group_role == GROUP_FOLLOWER) return;
+  unsigned long now = millis();
+  if (sntp_sent_ms) {
+    sntp_receive();
+    if (sntp_sent_ms && now - sntp_sent_millis >= SNTP_TIMEOUT_MS) sntp_request_done();
+    return;
+  }
+  if ((long)(now - sntp_next_ms) < 0) return;
+
+  // an address works in the access point mode too, a name needs DNS
+  IPAddress server;
+  if (!server.fromString(nvm_params.sntp_server) &&
+      (WiFi.status() != WL_CONNECTED || !WiFi.hostByName(nvm_params.sntp_server, server))) {
+    if (sntp_burst) sntp_update();
+    else sntp_next_ms = now + SNTP_RETRY_MS;
+    return;
+  }
+  if (!sntp_listening) sntp_listening = sntp_udp.begin(SNTP_LOCAL_PORT);
+  if (!sntp_listening) {
+    sntp_next_ms = now + SNTP_RETRY_MS;
+    return;
+  }
+
+  uint8_t buf[SNTP_PACKET_SIZE];
+  uint64_t t1 = rtc_now_ms();
+  size_t len = sntp_request(buf, sizeof(buf), t1);
+  sntp_udp.beginPacket(server, SNTP_PORT);
+  sntp_udp.write(buf, len);
+  sntp_burst++;
+  sntp_sent_ms = t1;
+  sntp_sent_millis = now;
+  if (!sntp_udp.endPacket()) sntp_request_done();
+}
+
+
+void mark_changed(uint8_t changes)
+{
+  if ((changes & CHANGE_NVS) && !(pending_changes & CHANGE_NVS)) {
+    first_change_ms = millis();
+  }
+  pending_changes |= changes;
+  coalesced_changes++;
+}
+
+
+void apply_changes()
+{
+  if (!pending_changes) return;
+  TRACE_SCOPE("apply changes");
+  unsigned long now = millis();
+
+  // only the 16 bit frame, strip_service() paces the output. The leader
+  // of a group applies it together with the followers.
+  if (pending_changes & CHANGE_STRIP) {
+    if (nvm_params.group_role == GROUP_LEADER) group_schedule(SLIDER_FADE_MS);
+    else update_color_table();
+    pending_changes &= ~CHANGE_STRIP;
+  }
+
+  if ((pending_changes & CHANGE_NVS) && now - first_change_ms >= NVS_COMMIT_MS) {
+    Serial.printf("NVS commit after %u changes\n", coalesced_changes);
+    log_event(EVENT_SAVE, pending_changes & CHANGE_NVS);
+    if (pending_changes & CHANGE_PARAMS) save_nvm_parameters();
+    if (pending_changes & CHANGE_TIMERS) save_timers();
+    if (pending_changes & CHANGE_SEGMENTS) save_segments();
+    if (pending_changes & CHANGE_EFFECT) save_effect();
+    pending_changes &= ~CHANGE_NVS;
+    coalesced_changes = 0;
   }
 }
 
@@ -132,44 +655,83 @@ void load_nvm_parameters()
   
   // Load parameters, use defaults if not found
   nvm_params.brightness = preferences.getUChar("brightness", 100);
-  nvm_params.red = preferences.getUChar("red", 0);
-  nvm_params.green = preferences.getUChar("green", 0);
-  nvm_params.blue = preferences.getUChar("blue", 0);
+  nvm_params.color.red = preferences.getUChar("red", 0);
+  nvm_params.color.green = preferences.getUChar("green", 0);
+  nvm_params.color.blue = preferences.getUChar("blue", 0);
+  nvm_params.color.mode = preferences.getUChar("mode", LED_COLOR_RGB);
+  nvm_params.color.hue = preferences.getUShort("hue", 0);
+  nvm_params.color.sat = preferences.getUChar("sat", 255);
+  nvm_params.color.kelvin = preferences.getUShort("kelvin", 2700);
   nvm_params.timestamp = preferences.getULong("timestamp", 0);
   nvm_params.tz_offset_hours = preferences.getChar("tz", 1);
   nvm_params.auto_dst = preferences.getUChar("auto_dst", 1);
+  nvm_params.group_role = preferences.getUChar("grp_role", GROUP_OFF);
+  nvm_params.group_id = preferences.getUChar("grp_id", 1);
+  nvm_params.power_budget_ma = preferences.getUShort("pw_budget", POWER_BUDGET_MA);
+  nvm_params.power_cal.channel_ua[0] = preferences.getUShort("pw_r", LED_POWER_CHANNEL_UA);
+  nvm_params.power_cal.channel_ua[1] = preferences.getUShort("pw_g", LED_POWER_CHANNEL_UA);
+  nvm_params.power_cal.channel_ua[2] = preferences.getUShort("pw_b", LED_POWER_CHANNEL_UA);
+  nvm_params.power_cal.idle_ua = preferences.getUShort("pw_idle", LED_POWER_IDLE_UA);
+  if (!preferences.getString("sntp", nvm_params.sntp_server, sizeof(nvm_params.sntp_server))) {
+    strcpy(nvm_params.sntp_server, SNTP_SERVER);
+  }
+  nvm_params.drift_ppb = preferences.getInt("drift_ppb", 0);
   
   preferences.end();
   
   // Set RTC from saved timestamp and tz
   rtc_timestamp = nvm_params.timestamp;
   last_millis = millis();
+  // The system time runs on over software resets and deep sleep, NVS only
+  // has the last save
+  struct timeval tv;
+  if (gettimeofday(&tv, NULL) == 0 && (unsigned long)tv.tv_sec > RTC_VALID_TIME) {
+    rtc_timestamp = tv.tv_sec;
+    last_millis = millis() - tv.tv_usec / 1000;
+  }
+  sntp_clock_reset(sntp_clk, nvm_params.drift_ppb);
+  drift_millis = millis();
   
   Serial.println("NVM Parameters loaded:");
   Serial.print("  Brightness: ");
   Serial.println(nvm_params.brightness);
   Serial.print("  Red: ");
-  Serial.println(nvm_params.red);
+  Serial.println(nvm_params.color.red);
   Serial.print("  Green: ");
-  Serial.println(nvm_params.green);
+  Serial.println(nvm_params.color.green);
   Serial.print("  Blue: ");
-  Serial.println(nvm_params.blue);
+  Serial.println(nvm_params.color.blue);
   Serial.print("  RTC: ");
-  Serial.println(get_rtc_string());
+  char time_text[20];
+  Serial.println(format_rtc(time_text, sizeof(time_text)));
 }
 
 
 void save_nvm_parameters()
 {
+  TRACE_SCOPE("save_nvm_parameters");
   preferences.begin(NVS_NAMESPACE, false); // write mode
   
   preferences.putUChar("brightness", nvm_params.brightness);
-  preferences.putUChar("red", nvm_params.red);
-  preferences.putUChar("green", nvm_params.green);
-  preferences.putUChar("blue", nvm_params.blue);
+  preferences.putUChar("red", nvm_params.color.red);
+  preferences.putUChar("green", nvm_params.color.green);
+  preferences.putUChar("blue", nvm_params.color.blue);
+  preferences.putUChar("mode", nvm_params.color.mode);
+  preferences.putUShort("hue", nvm_params.color.hue);
+  preferences.putUChar("sat", nvm_params.color.sat);
+  preferences.putUShort("kelvin", nvm_params.color.kelvin);
   preferences.putULong("timestamp", rtc_timestamp);
   preferences.putChar("tz", nvm_params.tz_offset_hours);
   preferences.putUChar("auto_dst", nvm_params.auto_dst);
+  preferences.putUChar("grp_role", nvm_params.group_role);
+  preferences.putUChar("grp_id", nvm_params.group_id);
+  preferences.putUShort("pw_budget", nvm_params.power_budget_ma);
+  preferences.putUShort("pw_r", nvm_params.power_cal.channel_ua[0]);
+  preferences.putUShort("pw_g", nvm_params.power_cal.channel_ua[1]);
+  preferences.putUShort("pw_b", nvm_params.power_cal.channel_ua[2]);
+  preferences.putUShort("pw_idle", nvm_params.power_cal.idle_ua);
+  preferences.putString("sntp", nvm_params.sntp_server);
+  preferences.putInt("drift_ppb", nvm_params.drift_ppb);
   
   preferences.end();
   
@@ -177,17 +739,102 @@ void save_nvm_parameters()
 }
 
 
+// Segments are one blob "segs" in NVS, see led_segments_pack()
+void load_segments()
+{
+  uint8_t blob[LED_SEGMENTS_BLOB];
+  preferences.begin(NVS_NAMESPACE, true);
+  size_t len = preferences.getBytesLength("segs");
+  if (len > sizeof(blob)) len = 0;
+  if (len) preferences.getBytes("segs", blob, len);
+  preferences.end();
+
+  if (len && !led_segments_unpack(segments, blob, len, millis())) {
+    Serial.println("Segments in NVS from another version, ignored");
+  }
+  Serial.printf("%u segments loaded\n", segments.count);
+}
+
+
+void save_segments()
+{
+  TRACE_SCOPE("save_segments");
+  uint8_t blob[LED_SEGMENTS_BLOB];
+  size_t len = led_segments_pack(segments, blob, sizeof(blob));
+  preferences.begin(NVS_NAMESPACE, false);
+  preferences.putBytes("segs", blob, len);
+  preferences.end();
+  Serial.printf("%u segments saved (%u bytes)\n", segments.count, (unsigned)len);
+}
+
+
+// The effect program is the uploaded blob "effect", checked again on load
+void load_effect()
+{
+  preferences.begin(NVS_NAMESPACE, true);
+  size_t len = preferences.getBytesLength("effect");
+  if (len > sizeof(effect_blob)) len = 0;
+  if (len) preferences.getBytes("effect", effect_blob, len);
+  preferences.end();
+
+  const char* error = len ? led_vm_load(effect_vm, effect_blob, len) : NULL;
+  if (error) Serial.printf("Effect program in NVS ignored, %s\n", error);
+  effect_len = error ? 0 : len;
+  if (effect_len) Serial.printf("Effect program loaded (%u bytes)\n", (unsigned)effect_len);
+}
+
+
+void save_effect()
+{
+  TRACE_SCOPE("save_effect");
+  preferences.begin(NVS_NAMESPACE, false);
+  if (effect_len) preferences.putBytes("effect", effect_blob, effect_len);
+  else preferences.remove("effect");
+  preferences.end();
+  Serial.printf("Effect program saved (%u bytes)\n", (unsigned)effect_len);
+}
+
+
+// Event for the history, with the RTC time
+void log_event(uint8_t code, uint16_t arg)
+{
+  event_log_add(events, rtc_timestamp, code, arg, millis());
+}
+
+
+// Free heap and largest free block for GET /heap (heap_track.h)
+void heap_service()
+{
+  static unsigned long last_ms = 0;
+  static bool sampled = false;
+  unsigned long now = millis();
+  if (sampled && now - last_ms < HEAP_SAMPLE_EVERY_MS) return;
+  sampled = true;
+  last_ms = now;
+  TRACE_SCOPE("heap sample");
+  heap_track_sample(now, ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+}
+
+
 void set_default_nvm_parameters()
 {
   nvm_params.brightness = 100;
-  nvm_params.red = 255;
-  nvm_params.green = 255;
-  nvm_params.blue = 255;
+  nvm_params.color.red = 255;
+  nvm_params.color.green = 255;
+  nvm_params.color.blue = 255;
+  nvm_params.color.mode = LED_COLOR_RGB;
+  nvm_params.color.hue = 0;
+  nvm_params.color.sat = 255;
+  nvm_params.color.kelvin = 2700;
   nvm_params.timestamp = 0;  // Default to 1970-01-01
   nvm_params.tz_offset_hours = 1; // default CET
   nvm_params.auto_dst = 1; // enable DST by default
-  save_nvm_parameters();
-  update_color_table();
+  nvm_params.group_role = GROUP_OFF;
+  nvm_params.group_id = 1;
+  strcpy(nvm_params.sntp_server, SNTP_SERVER);
+  // power budget, calibration and drift belong to the hardware, they stay
+  led_segments_clear(segments);
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS | CHANGE_SEGMENTS);
 }
 
 
@@ -203,29 +850,71 @@ void update_rtc()
     // advance last_millis by the consumed whole seconds to keep remainder
     last_millis += sec_increment * 1000;
 
+    // drift measured by SNTP, a ms now and then (a follower has the leader's clock)
+    int32_t drift = sntp_clock_drift(sntp_clk, current_millis - drift_millis);
+    drift_millis = current_millis;
+    if (drift && nvm_params.group_role != GROUP_FOLLOWER) {
+      rtc_adjust_ms(drift);
+      rtc_set_system();
+    }
+
     // Print the current time once per second (when seconds change)
     if (rtc_timestamp != last_printed_second) {
+      TRACE_SCOPE("rtc print");
       last_printed_second = rtc_timestamp;
       Serial.print("RTC: ");
-      Serial.println(get_rtc_string());
+      char time_text[20];
+      Serial.println(format_rtc(time_text, sizeof(time_text)));
     }
   }
 }
 
 
+// RTC in unix ms, the part below the second is millis() - last_millis
+uint64_t rtc_now_ms()
+{
+  return (uint64_t)rtc_timestamp * 1000 + (millis() - last_millis);
+}
+
+
+// Move the RTC by ms (group discipline), keeps last_millis <= millis()
+void rtc_adjust_ms(int64_t ms)
+{
+  uint64_t now = rtc_now_ms();
+  now = (ms < 0 && (uint64_t)-ms > now) ? 0 : now + ms;
+  rtc_timestamp = now / 1000;
+  last_millis = millis() - (unsigned long)(now % 1000);
+}
+
+
+// RTC to the system time, it is kept over software resets
+void rtc_set_system()
+{
+  uint64_t now = rtc_now_ms();
+  struct timeval tv = { (time_t)(now / 1000), (suseconds_t)(now % 1000 * 1000) };
+  settimeofday(&tv, NULL);
+}
+
+
 void set_rtc_time(uint32_t timestamp)
 {
+  int32_t jump = ((int64_t)timestamp - rtc_timestamp) / 60;
   rtc_timestamp = timestamp;
   last_millis = millis();
   nvm_params.timestamp = rtc_timestamp;
-  save_nvm_parameters();
+  mark_changed(CHANGE_PARAMS);
+  rtc_set_system();
+  sntp_clock_forget(sntp_clk);
+  log_event(EVENT_RTC_SET, (uint16_t)(jump < -32768 ? -32768 : jump > 32767 ? 32767 : jump));
   
   Serial.print("RTC set to: ");
-  Serial.println(get_rtc_string());
+  char time_text[20];
+  Serial.println(format_rtc(time_text, sizeof(time_text)));
 }
 
 
-String get_rtc_string()
+// Local time "YYYY-MM-DD hh:mm:ss" into out (20 bytes), returns out
+const char* format_rtc(char* out, size_t size)
 {
   // Apply timezone offset stored in nvm_params and format as local time
   time_t adj = (time_t)rtc_timestamp + (int32_t)nvm_params.tz_offset_hours * 3600;
@@ -278,9 +967,16 @@ String get_rtc_string()
 
   struct tm* timeinfo = gmtime(&adj); // use gmtime since we've adjusted
 
-  char buffer[30];
-  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-  return String(buffer);
+  if (!strftime(out, size, "%Y-%m-%d %H:%M:%S", timeinfo)) out[0] = 0;
+  return out;
+}
+
+
+// NVS key of a timer field, "t0_on_h" and so on, into key (12 bytes)
+static const char* timer_key(char* key, int pair, const char* field)
+{
+  snprintf(key, 12, "t%d_%s", pair, field);
+  return key;
 }
 
 
@@ -290,23 +986,18 @@ void load_timers()
   
   // Load all 2 timer pairs
   for (int i = 0; i < 2; i++) {
-    String on_h_key = "t" + String(i) + "_on_h";
-    String on_m_key = "t" + String(i) + "_on_m";
-    String off_h_key = "t" + String(i) + "_off_h";
-    String off_m_key = "t" + String(i) + "_off_m";
-    String en_key = "t" + String(i) + "_en";
-    
-    timers[i].on_time.hour = preferences.getUChar(on_h_key.c_str(), 8);
-    timers[i].on_time.minute = preferences.getUChar(on_m_key.c_str(), 0);
+    char key[12];
+    timers[i].on_time.hour = preferences.getUChar(timer_key(key, i, "on_h"), 8);
+    timers[i].on_time.minute = preferences.getUChar(timer_key(key, i, "on_m"), 0);
     timers[i].on_time.type = 1; // always on
     timers[i].on_time.enabled = 1;
     
-    timers[i].off_time.hour = preferences.getUChar(off_h_key.c_str(), 22);
-    timers[i].off_time.minute = preferences.getUChar(off_m_key.c_str(), 0);
+    timers[i].off_time.hour = preferences.getUChar(timer_key(key, i, "off_h"), 22);
+    timers[i].off_time.minute = preferences.getUChar(timer_key(key, i, "off_m"), 0);
     timers[i].off_time.type = 0; // always off
     timers[i].off_time.enabled = 1;
     
-    timers[i].pair_enabled = preferences.getUChar(en_key.c_str(), (i == 0) ? 1 : 0);
+    timers[i].pair_enabled = preferences.getUChar(timer_key(key, i, "en"), (i == 0) ? 1 : 0);
   }
   
   preferences.end();
@@ -317,20 +1008,16 @@ void load_timers()
 
 void save_timers()
 {
+  TRACE_SCOPE("save_timers");
   preferences.begin(NVS_NAMESPACE, false); // write mode
   
   for (int i = 0; i < 2; i++) {
-    String on_h_key = "t" + String(i) + "_on_h";
-    String on_m_key = "t" + String(i) + "_on_m";
-    String off_h_key = "t" + String(i) + "_off_h";
-    String off_m_key = "t" + String(i) + "_off_m";
-    String en_key = "t" + String(i) + "_en";
-    
-    preferences.putUChar(on_h_key.c_str(), timers[i].on_time.hour);
-    preferences.putUChar(on_m_key.c_str(), timers[i].on_time.minute);
-    preferences.putUChar(off_h_key.c_str(), timers[i].off_time.hour);
-    preferences.putUChar(off_m_key.c_str(), timers[i].off_time.minute);
-    preferences.putUChar(en_key.c_str(), timers[i].pair_enabled);
+    char key[12];
+    preferences.putUChar(timer_key(key, i, "on_h"), timers[i].on_time.hour);
+    preferences.putUChar(timer_key(key, i, "on_m"), timers[i].on_time.minute);
+    preferences.putUChar(timer_key(key, i, "off_h"), timers[i].off_time.hour);
+    preferences.putUChar(timer_key(key, i, "off_m"), timers[i].off_time.minute);
+    preferences.putUChar(timer_key(key, i, "en"), timers[i].pair_enabled);
   }
   
   preferences.end();
@@ -346,6 +1033,22 @@ void check_timers()
   struct tm* timeinfo = gmtime(&now);
   int cur_hour = timeinfo->tm_hour;
   int cur_min = timeinfo->tm_min;
+
+  // once per minute, the timers fade instead of switching. An SNTP
+  // correction may set the clock back over a minute change by a few ms,
+  // the minute is not checked twice for it.
+  static long last_minute = -1;
+  long minute = (long)(rtc_timestamp / 60);
+  if (minute == last_minute || minute + 1 == last_minute) return;
+  if (minute == last_minute + 1) {
+    // not after a start or a time set
+    uint32_t late = rtc_now_ms() % 60000;
+    timer_edges++;
+    if (late > timer_late_max_ms) timer_late_max_ms = late;
+    if (late > TIMER_LATE_MS) timer_late++;
+  }
+  last_minute = minute;
+  TRACE_SCOPE("check_timers");
   
   // Check each enabled timer pair
   for (int i = 0; i < 2; i++) {
@@ -353,24 +1056,20 @@ void check_timers()
     
     // Check if we match the ON time exactly
     if (cur_hour == timers[i].on_time.hour && cur_min == timers[i].on_time.minute) {
-      nvm_params.brightness = 100;
-      save_nvm_parameters();
-      update_color_table();
+      fade_brightness(100, TIMER_FADE_MS);
+      log_event(EVENT_TIMER_ON, i);
       Serial.print("Timer ");
       Serial.print(i);
       Serial.println(" ON triggered");
-      delay(30000); // prevent re-trigger within 30 seconds
     }
     
     // Check if we match the OFF time exactly
     if (cur_hour == timers[i].off_time.hour && cur_min == timers[i].off_time.minute) {
-      nvm_params.brightness = 0;
-      save_nvm_parameters();
-      update_color_table();
+      fade_brightness(0, TIMER_FADE_MS);
+      log_event(EVENT_TIMER_OFF, i);
       Serial.print("Timer ");
       Serial.print(i);
       Serial.println(" OFF triggered");
-      delay(30000); // prevent re-trigger within 30 seconds
     }
   }
 }
@@ -392,7 +1091,7 @@ void set_timer_slot(uint8_t pair, uint8_t hour, uint8_t minute, uint8_t type, ui
     timers[pair].off_time.enabled = enabled;
   }
   
-  save_timers();
+  mark_changed(CHANGE_TIMERS);
 }
 
 
@@ -400,7 +1099,7 @@ void set_timer_pair_enabled(uint8_t pair, uint8_t enabled)
 {
   if (pair >= 2) return;
   timers[pair].pair_enabled = (enabled != 0) ? 1 : 0;
-  save_timers();
+  mark_changed(CHANGE_TIMERS);
   
   Serial.print("Timer pair ");
   Serial.print(pair);
@@ -409,308 +1108,1299 @@ void set_timer_pair_enabled(uint8_t pair, uint8_t enabled)
 }
 
 
-void handle_wifi_client()
-{
-  WiFiClient client = server.accept(); // Listen for incoming clients
-
-  if (client)
-  {                                // If a new client connects,
-    Serial.println("New Client."); // print a message out in the serial port
-    String currentLine = "";       // make a String to hold incoming data from the client
-    while (client.connected())
-    { // loop while the client's connected
-      if (client.available())
-      {                         // if there's bytes to read from the client,
-        char c = client.read(); // read a byte, then
-        Serial.write(c);        // print it out the serial monitor
-        header += c;
-        if (c == '\n')
-        { // if the byte is a newline character
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so send a response:
-          if (currentLine.length() == 0)
-          {
-            // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-            // and a content-type so the client knows what's coming, then a blank line:
-            client.println("HTTP/1.1 200 OK");
-            client.println("Content-type:text/html");
-            client.println("Connection: close");
-            client.println();
-
-            // Parse HTTP requests for brightness control
-            if (header.indexOf("GET /brightness/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /brightness/") + 16;
-              int endIdx = header.indexOf(" ", startIdx);
-              String brightnessStr = header.substring(startIdx, endIdx);
-              uint8_t brightnessValue = brightnessStr.toInt();
-              nvm_params.brightness = brightnessValue;
-              save_nvm_parameters();
-              update_color_table();
-              Serial.print("Brightness set to: ");
-              Serial.println(nvm_params.brightness);
-            }
-            // Parse HTTP requests for red control
-            else if (header.indexOf("GET /red/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /red/") + 9;
-              int endIdx = header.indexOf(" ", startIdx);
-              String redStr = header.substring(startIdx, endIdx);
-              uint8_t redValue = redStr.toInt();
-              nvm_params.red = redValue;
-              save_nvm_parameters();
-              update_color_table();
-              Serial.print("Red set to: ");
-              Serial.println(nvm_params.red);
-            }
-            // Parse HTTP requests for green control
-            else if (header.indexOf("GET /green/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /green/") + 11;
-              int endIdx = header.indexOf(" ", startIdx);
-              String greenStr = header.substring(startIdx, endIdx);
-              uint8_t greenValue = greenStr.toInt();
-              nvm_params.green = greenValue;
-              save_nvm_parameters();
-              update_color_table();
-              Serial.print("Green set to: ");
-              Serial.println(nvm_params.green);
-            }
-            // Parse HTTP requests for blue control
-            else if (header.indexOf("GET /blue/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /blue/") + 10;
-              int endIdx = header.indexOf(" ", startIdx);
-              String blueStr = header.substring(startIdx, endIdx);
-              uint8_t blueValue = blueStr.toInt();
-              nvm_params.blue = blueValue;
-              save_nvm_parameters();
-              update_color_table();
-              Serial.print("Blue set to: ");
-              Serial.println(nvm_params.blue);
-            }
-            // Parse HTTP requests for RTC time setting (format: /settime/1234567890)
-            else if (header.indexOf("GET /settime/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /settime/") + 13;
-              int endIdx = header.indexOf(" ", startIdx);
-              String timestampStr = header.substring(startIdx, endIdx);
-              uint32_t newTimestamp = (uint32_t)timestampStr.toInt();
-              set_rtc_time(newTimestamp);
-            }
-            // Parse HTTP requests for timezone setting (format: /settz/<hours>)
-            else if (header.indexOf("GET /settz/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /settz/") + 11;
-              int endIdx = header.indexOf(" ", startIdx);
-              String tzStr = header.substring(startIdx, endIdx);
-              int tz = tzStr.toInt();
-              nvm_params.tz_offset_hours = (int8_t)tz;
-              save_nvm_parameters();
-              Serial.print("Timezone offset set to: ");
-              Serial.println(nvm_params.tz_offset_hours);
-            }
-            // Parse HTTP requests for auto DST setting (format: /setautodst/0 or /setautodst/1)
-            else if (header.indexOf("GET /setautodst/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /setautodst/") + 16;
-              int endIdx = header.indexOf(" ", startIdx);
-              String v = header.substring(startIdx, endIdx);
-              int val = v.toInt();
-              nvm_params.auto_dst = (val != 0) ? 1 : 0;
-              save_nvm_parameters();
-              Serial.print("Auto DST set to: ");
-              Serial.println(nvm_params.auto_dst);
-            }
-            // Parse HTTP requests for timer control (format: /settimer/pair/type/hour/minute)
-            // type: 0=off time, 1=on time
-            else if (header.indexOf("GET /settimer/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /settimer/") + 14;
-              // Parse: /settimer/pair/type/hour/minute
-              int idx1 = header.indexOf("/", startIdx);
-              int idx2 = header.indexOf("/", idx1 + 1);
-              int idx3 = header.indexOf("/", idx2 + 1);
-              int idx4 = header.indexOf(" ", idx3 + 1);
-              
-              String pair_str = header.substring(startIdx, idx1);
-              String type_str = header.substring(idx1 + 1, idx2);
-              String hour_str = header.substring(idx2 + 1, idx3);
-              String minute_str = header.substring(idx3 + 1, idx4);
-              
-              uint8_t pair = pair_str.toInt();
-              uint8_t type = type_str.toInt();
-              uint8_t hour = hour_str.toInt();
-              uint8_t minute = minute_str.toInt();
-              
-              set_timer_slot(pair, hour, minute, type, 1);
-              
-              Serial.print("Timer ");
-              Serial.print(pair);
-              Serial.print(" ");
-              Serial.print(type ? "ON" : "OFF");
-              Serial.print(" set to ");
-              Serial.print(hour);
-              Serial.print(":");
-              if (minute < 10) Serial.print("0");
-              Serial.println(minute);
-            }
-            // Parse HTTP requests for timer pair enable/disable (format: /settimeren/pair/0|1)
-            else if (header.indexOf("GET /settimeren/") >= 0)
-            {
-              int startIdx = header.indexOf("GET /settimeren/") + 16;
-              int idx1 = header.indexOf("/", startIdx);
-              int idx2 = header.indexOf(" ", idx1 + 1);
-              
-              String pair_str = header.substring(startIdx, idx1);
-              String enabled_str = header.substring(idx1 + 1, idx2);
-              
-              uint8_t pair = pair_str.toInt();
-              uint8_t enabled = enabled_str.toInt();
-              
-              set_timer_pair_enabled(pair, enabled);
-            }
-            // Parse HTTP requests for reset
-            else if (header.indexOf("GET /reset") >= 0)
-            {
-              Serial.println("Resetting to default parameters");
-              set_default_nvm_parameters();
-            }
-            // Parse HTTP requests for color control
-            // Display the HTML web page
-            client.println("<!DOCTYPE html><html>");
-            client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-            client.println("<link rel=\"icon\" href=\"data:,\">");
-            // CSS to style the on/off buttons
-            client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-            client.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
-            client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-            client.println(".button2 {background-color: #555555;}");
-            client.println("input[type=range] { width: 300px; height: 20px; margin: 10px; }");
-            client.println("</style></head>");
-
-            // Web Page Heading
-            client.println("<body><h1>ESP32 Web Server</h1>");
-
-            // Display RTC Section
-            client.println("<h2>System Time (RTC)</h2>");
-            client.println("<p>Current Time: " + get_rtc_string() + "</p>");
-            //client.println("<p>Unix Timestamp: " + String(rtc_timestamp) + "</p>");
-            //client.println("<p>Timezone offset (hours): " + String(nvm_params.tz_offset_hours) + "</p>");
-            //client.println("<input type=\"text\" id=\"tzInput\" placeholder=\"e.g. 1 or -5\" value=\"" + String(nvm_params.tz_offset_hours) + "\" style=\"width:80px; padding:6px; margin:6px; font-size:16px;\">");
-            //client.println("<button onclick=\"setTz()\" class=\"button\" style=\"padding: 8px 20px; font-size: 16px;\">Set TZ</button>");
-            //client.println("<label style=\"margin-left:10px; font-size:16px;\"><input type=\"checkbox\" id=\"autoDstCb\" " + String(nvm_params.auto_dst ? "checked" : "") + " onclick=\"setAutoDst()\" /> Auto DST</label>");
-            client.println("<button onclick=\"syncNow()\" class=\"button\" style=\"padding: 8px 20px; font-size: 16px;\">Sync time with smartphone</button>");
-
-            // Display LED Color Control Section
-            client.println("<h2>LED Color Control</h2>");
-            client.println("<p>Brightness: " + String(nvm_params.brightness) + "</p>");
-            client.println("<input type=\"range\" min=\"0\" max=\"100\" value=\"" + String(nvm_params.brightness) + "\" id=\"brightnessSlider\">");
-            
-            client.println("<p>Red: " + String(nvm_params.red) + "</p>");
-            client.println("<input type=\"range\" min=\"0\" max=\"255\" value=\"" + String(nvm_params.red) + "\" id=\"redSlider\">");
-            
-            client.println("<p>Green: " + String(nvm_params.green) + "</p>");
-            client.println("<input type=\"range\" min=\"0\" max=\"255\" value=\"" + String(nvm_params.green) + "\" id=\"greenSlider\">");
-
-            client.println("<p>Blue: " + String(nvm_params.blue) + "</p>");
-            client.println("<input type=\"range\" min=\"0\" max=\"255\" value=\"" + String(nvm_params.blue) + "\" id=\"blueSlider\">");
-
-            client.println("<p><a href=\"/reset\"><button class=\"button button2\">Reset to Default</button></a></p>");
-
-            // JavaScript to handle slider inputs and RTC functions
-            client.println("<script>");
-            client.println("document.getElementById('brightnessSlider').addEventListener('input', function() {");
-            client.println("  window.location = '/brightness/' + this.value;");
-            client.println("});");
-            client.println("document.getElementById('redSlider').addEventListener('input', function() {");
-            client.println("  window.location = '/red/' + this.value;");
-            client.println("});");
-            client.println("document.getElementById('greenSlider').addEventListener('input', function() {");
-            client.println("  window.location = '/green/' + this.value;");
-            client.println("});");
-            client.println("document.getElementById('blueSlider').addEventListener('input', function() {");
-            client.println("  window.location = '/blue/' + this.value;");
-            client.println("});");
-            client.println("");
-            client.println("function setTz() {");
-            client.println("  var tz = document.getElementById('tzInput').value;");
-            client.println("  if (tz !== '') {");
-            client.println("    window.location = '/settz/' + tz;");
-            client.println("  } else {");
-            client.println("    alert('Please enter a timezone offset (e.g. 1 or -5)');");
-            client.println("  }");
-            client.println("}");
-            client.println("function setAutoDst() {");
-            client.println("  var cb = document.getElementById('autoDstCb');");
-            client.println("  var v = cb.checked ? 1 : 0;");
-            client.println("  window.location = '/setautodst/' + v;");
-            client.println("}");
-            client.println("function syncNow() {");
-            client.println("  var now = Math.floor(Date.now() / 1000);");
-            client.println("  window.location = '/settime/' + now;");
-            client.println("}");
-            
-            // Timer functions
-            client.println("function setTimer(pair, type) {");
-            client.println("  var hour = document.getElementById('timer' + pair + '_' + type + '_h').value;");
-            client.println("  var minute = document.getElementById('timer' + pair + '_' + type + '_m').value;");
-            client.println("  window.location = '/settimer/' + pair + '/' + type + '/' + hour + '/' + minute;");
-            client.println("}");
-            client.println("function setTimerEnabled(pair) {");
-            client.println("  var enabled = document.getElementById('timerCb' + pair).checked ? 1 : 0;");
-            client.println("  window.location = '/settimeren/' + pair + '/' + enabled;");
-            client.println("}");
-            
-            client.println("</script>");
-            
-            // Add Timer Schedule section before closing body
-            client.println("<h2>Timer Schedule</h2>");
-            
-            for (int i = 0; i < 2; i++) {
-              client.println("<div style=\"border:1px solid #ccc; margin:10px; padding:10px; border-radius:5px;\">");
-              client.println("<label><input type=\"checkbox\" id=\"timerCb" + String(i) + "\" " + 
-                String(timers[i].pair_enabled ? "checked" : "") + 
-                " onchange=\"setTimerEnabled(" + String(i) + ")\" /> Pair " + String(i + 1) + " Enabled</label>");
-              
-              // ON time - button inline
-              client.println("<p>Turn ON at: ");
-              client.println("<input type=\"number\" id=\"timer" + String(i) + "_1_h\" min=\"0\" max=\"23\" value=\"" + String(timers[i].on_time.hour) + "\" style=\"width:50px;\"> : ");
-              client.println("<input type=\"number\" id=\"timer" + String(i) + "_1_m\" min=\"0\" max=\"59\" value=\"" + String(timers[i].on_time.minute) + "\" style=\"width:50px;\"> ");
-              client.println("<button style=\"padding:6px 12px; font-size:14px;\" onclick=\"setTimer(" + String(i) + ", 1)\">Set</button></p>");
-              
-              // OFF time - button inline
-              client.println("<p>Turn OFF at: ");
-              client.println("<input type=\"number\" id=\"timer" + String(i) + "_0_h\" min=\"0\" max=\"23\" value=\"" + String(timers[i].off_time.hour) + "\" style=\"width:50px;\"> : ");
-              client.println("<input type=\"number\" id=\"timer" + String(i) + "_0_m\" min=\"0\" max=\"59\" value=\"" + String(timers[i].off_time.minute) + "\" style=\"width:50px;\"> ");
-              client.println("<button style=\"padding:6px 12px; font-size:14px;\" onclick=\"setTimer(" + String(i) + ", 0)\">Set</button></p>");
-              
-              client.println("</div>");
-            }
-            
-            client.println("</body></html>");
-
-            // The HTTP response ends with another blank line
-            client.println();
-            // Break out of the while loop
-            break;
-          }
-          else
-          { // if you got a newline, then clear currentLine
-            currentLine = "";
-          }
-        }
-        else if (c != '\r')
-        {                   // if you got anything else but a carriage return character,
-          currentLine += c; // add it to the end of the currentLine
-        }
+// ---------------------------------------------------------------------------
+// Web server, see http_core.h. The page changes settings with fetch() on
+// the JSON API (/api/state). The old GET routes per field (/red/128, ...)
+// still work and send the page back.
+
+// Next number of a path like "0/1/8/30", p is moved behind the '/'
+static long next_number(const char*& p)
+{
+  char* end;
+  long value = strtol(p, &end, 10);
+  p = (*end == '/') ? end + 1 : end;
+  return value;
+}
+
+
+// printf without the heap: Print::printf of the core allocates a buffer
+// for more than 64 characters, this formats up to 256 on the stack
+size_t print_format(Print& out, const char* format, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (n < (int)sizeof(buf)) return n > 0 ? out.write((const uint8_t*)buf, n) : 0;
+
+  // longer: like the core, GET /heap shows it
+  char* big = (char*)malloc(n + 1);
+  if (!big) return 0;
+  va_start(args, format);
+  vsnprintf(big, n + 1, format, args);
+  va_end(args);
+  size_t written = out.write((const uint8_t*)big, n);
+  free(big);
+  return written;
+}
+
+
+void print_segments_json(Print& out);
+
+
+void print_page(Print& out)
+{
+  // Display the HTML web page
+  out.println("<!DOCTYPE html><html>");
+  out.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  out.println("<link rel=\"icon\" href=\"data:,\">");
+  // CSS to style the on/off buttons
+  out.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
+  out.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
+  out.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
+  out.println(".button2 {background-color: #555555;}");
+  out.println("input[type=range] { width: 300px; height: 20px; margin: 10px; }");
+  out.println("</style></head>");
+
+  // Web Page Heading
+  out.println("<body><h1>ESP32 Web Server</h1>");
+
+  // Display RTC Section
+  out.println("<h2>System Time (RTC)</h2>");
+  char time_text[20];
+  print_format(out, "<p>Current Time: <span id=\"time\">%s</span></p>\r\n", format_rtc(time_text, sizeof(time_text)));
+  //out.printf("<p>Unix Timestamp: %lu</p>\r\n", (unsigned long)rtc_timestamp);
+  //out.printf("<p>Timezone offset (hours): %d</p>\r\n", nvm_params.tz_offset_hours);
+  //out.printf("<input type=\"text\" id=\"tzInput\" placeholder=\"e.g. 1 or -5\" value=\"%d\" style=\"width:80px; padding:6px; margin:6px; font-size:16px;\">\r\n", nvm_params.tz_offset_hours);
+  //out.println("<button onclick=\"setTz()\" class=\"button\" style=\"padding: 8px 20px; font-size: 16px;\">Set TZ</button>");
+  //out.printf("<label style=\"margin-left:10px; font-size:16px;\"><input type=\"checkbox\" id=\"autoDstCb\" %s onclick=\"setAutoDst()\" /> Auto DST</label>\r\n", nvm_params.auto_dst ? "checked" : "");
+  out.println("<button onclick=\"syncNow()\" class=\"button\" style=\"padding: 8px 20px; font-size: 16px;\">Sync time with smartphone</button>");
+
+  // Display LED Color Control Section
+  out.println("<h2>LED Color Control</h2>");
+  print_format(out, "<p>Brightness: <span id=\"brightness\">%u</span></p>\r\n", nvm_params.brightness);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"100\" value=\"%u\" oninput=\"patch({brightness: +this.value})\">\r\n", nvm_params.brightness);
+
+  print_format(out, "<p>Red: <span id=\"red\">%u</span></p>\r\n", nvm_params.color.red);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"255\" value=\"%u\" oninput=\"patch({red: +this.value})\">\r\n", nvm_params.color.red);
+
+  print_format(out, "<p>Green: <span id=\"green\">%u</span></p>\r\n", nvm_params.color.green);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"255\" value=\"%u\" oninput=\"patch({green: +this.value})\">\r\n", nvm_params.color.green);
+
+  print_format(out, "<p>Blue: <span id=\"blue\">%u</span></p>\r\n", nvm_params.color.blue);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"255\" value=\"%u\" oninput=\"patch({blue: +this.value})\">\r\n", nvm_params.color.blue);
+
+  print_format(out, "<p>Hue: <span id=\"hue\">%u</span></p>\r\n", nvm_params.color.hue);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"359\" value=\"%u\" oninput=\"patch({hue: +this.value})\">\r\n", nvm_params.color.hue);
+
+  print_format(out, "<p>Saturation: <span id=\"sat\">%u</span></p>\r\n", nvm_params.color.sat);
+  print_format(out, "<input type=\"range\" min=\"0\" max=\"255\" value=\"%u\" oninput=\"patch({sat: +this.value})\">\r\n", nvm_params.color.sat);
+
+  print_format(out, "<p>White (Kelvin): <span id=\"kelvin\">%u</span></p>\r\n", nvm_params.color.kelvin);
+  print_format(out, "<input type=\"range\" min=\"%u\" max=\"%u\" step=\"100\" value=\"%u\" oninput=\"patch({kelvin: +this.value})\">\r\n",
+               LED_KELVIN_MIN, LED_KELVIN_MAX, nvm_params.color.kelvin);
+
+  // Segments as JSON, see /api/segments
+  out.println("<h2>Segments</h2>");
+  out.print("<textarea id=\"segments\" rows=\"8\" cols=\"40\">");
+  print_segments_json(out);
+  out.println("</textarea>");
+  out.println("<p><button onclick=\"saveSegments()\" class=\"button\" style=\"padding: 8px 20px; font-size: 16px;\">Save segments</button></p>");
+
+  out.println("<p><a href=\"/reset\"><button class=\"button button2\">Reset to Default</button></a></p>");
+
+  // JavaScript: every change is a PATCH of /api/state with the changed
+  // fields only. One request at a time, what changes meanwhile is merged
+  // into the next one, so a slider can't queue up requests.
+  out.println("<script>");
+  out.println("var busy = false, pending = null;");
+  out.println("function patch(change) {");
+  out.println("  pending = Object.assign(pending || {}, change);");
+  out.println("  if (busy) return;");
+  out.println("  busy = true;");
+  out.println("  var body = JSON.stringify(pending);");
+  out.println("  pending = null;");
+  out.println("  fetch('/api/state', { method: 'PATCH', headers: { 'Content-Type': 'application/json' }, body: body })");
+  out.println("    .then(function(r) { return r.json(); })");
+  out.println("    .then(show)");
+  out.println("    .catch(function(e) { console.log(e); })");
+  out.println("    .then(function() { busy = false; if (pending) patch({}); });");
+  out.println("}");
+  out.println("function show(s) {");
+  out.println("  if (s.error) { alert(s.error); return; }");
+  out.println("  ['brightness', 'red', 'green', 'blue', 'hue', 'sat', 'kelvin'].forEach(function(k) {");
+  out.println("    document.getElementById(k).textContent = s[k];");
+  out.println("  });");
+  out.println("  document.getElementById('time').textContent = s.local_time;");
+  out.println("}");
+  out.println("");
+  out.println("function setTz() {");
+  out.println("  var tz = document.getElementById('tzInput').value;");
+  out.println("  if (tz !== '') {");
+  out.println("    patch({ tz: +tz });");
+  out.println("  } else {");
+  out.println("    alert('Please enter a timezone offset (e.g. 1 or -5)');");
+  out.println("  }");
+  out.println("}");
+  out.println("function setAutoDst() {");
+  out.println("  patch({ auto_dst: document.getElementById('autoDstCb').checked });");
+  out.println("}");
+  out.println("function saveSegments() {");
+  out.println("  fetch('/api/segments', { method: 'PUT', headers: { 'Content-Type': 'application/json' }, body: document.getElementById('segments').value })");
+  out.println("    .then(function(r) { return r.json(); })");
+  out.println("    .then(function(s) { if (s.error) alert(s.error); else document.getElementById('segments').value = JSON.stringify(s); });");
+  out.println("}");
+  out.println("function syncNow() {");
+  out.println("  patch({ time: Math.floor(Date.now() / 1000) });");
+  out.println("}");
+
+  // Timer functions, timers[pair] with the changed fields
+  out.println("function setTimer(pair, type) {");
+  out.println("  var t = [{}, {}], k = type ? 'on' : 'off';");
+  out.println("  t[pair][k + '_h'] = +document.getElementById('timer' + pair + '_' + type + '_h').value;");
+  out.println("  t[pair][k + '_m'] = +document.getElementById('timer' + pair + '_' + type + '_m').value;");
+  out.println("  patch({ timers: t });");
+  out.println("}");
+  out.println("function setTimerEnabled(pair) {");
+  out.println("  var t = [{}, {}];");
+  out.println("  t[pair].enabled = document.getElementById('timerCb' + pair).checked;");
+  out.println("  patch({ timers: t });");
+  out.println("}");
+
+  out.println("</script>");
+
+  // Add Timer Schedule section before closing body
+  out.println("<h2>Timer Schedule</h2>");
+
+  for (int i = 0; i < 2; i++) {
+    out.println("<div style=\"border:1px solid #ccc; margin:10px; padding:10px; border-radius:5px;\">");
+    print_format(out, "<label><input type=\"checkbox\" id=\"timerCb%d\" %s onchange=\"setTimerEnabled(%d)\" /> Pair %d Enabled</label>\r\n",
+                 i, timers[i].pair_enabled ? "checked" : "", i, i + 1);
+
+    // ON time - button inline
+    out.println("<p>Turn ON at: ");
+    print_format(out, "<input type=\"number\" id=\"timer%d_1_h\" min=\"0\" max=\"23\" value=\"%u\" style=\"width:50px;\"> : \r\n", i, timers[i].on_time.hour);
+    print_format(out, "<input type=\"number\" id=\"timer%d_1_m\" min=\"0\" max=\"59\" value=\"%u\" style=\"width:50px;\"> \r\n", i, timers[i].on_time.minute);
+    print_format(out, "<button style=\"padding:6px 12px; font-size:14px;\" onclick=\"setTimer(%d, 1)\">Set</button></p>\r\n", i);
+
+    // OFF time - button inline
+    out.println("<p>Turn OFF at: ");
+    print_format(out, "<input type=\"number\" id=\"timer%d_0_h\" min=\"0\" max=\"23\" value=\"%u\" style=\"width:50px;\"> : \r\n", i, timers[i].off_time.hour);
+    print_format(out, "<input type=\"number\" id=\"timer%d_0_m\" min=\"0\" max=\"59\" value=\"%u\" style=\"width:50px;\"> \r\n", i, timers[i].off_time.minute);
+    print_format(out, "<button style=\"padding:6px 12px; font-size:14px;\" onclick=\"setTimer(%d, 0)\">Set</button></p>\r\n", i);
+
+    out.println("</div>");
+  }
+
+  out.println("</body></html>");
+}
+
+
+// ---------------------------------------------------------------------------
+// JSON API
+//   GET /api/state     the whole state
+//   PATCH /api/state   any subset of it, e.g. {"red":255,"timers":[{},{"on_h":7}]}
+// Both answer with the state as JSON. A PATCH is checked completely before
+// anything is changed, errors are {"error":"..."} with 400 / 413 / 422.
+
+static const char* const color_modes[] = { "rgb", "hsv", "kelvin" };
+static const char* const group_roles[] = { "off", "leader", "follower" };
+
+// "mode":..,"red":..,..,"kelvin":.. (without braces, also used for segments)
+static void print_color_json(Print& out, const led_color_setting& c)
+{
+  print_format(out, "\"mode\":\"%s\",\"red\":%u,\"green\":%u,\"blue\":%u,\"hue\":%u,\"sat\":%u,\"kelvin\":%u",
+               color_modes[c.mode < 3 ? c.mode : 0], c.red, c.green, c.blue, c.hue, c.sat, c.kelvin);
+}
+
+
+void print_state_json(Print& out)
+{
+  print_format(out, "{\"brightness\":%u,", nvm_params.brightness);
+  print_color_json(out, nvm_params.color);
+  char time_text[20];
+  print_format(out, ",\"time\":%lu,\"local_time\":\"%s\",\"tz\":%d,\"auto_dst\":%s,",
+               (unsigned long)rtc_timestamp, format_rtc(time_text, sizeof(time_text)), nvm_params.tz_offset_hours,
+               nvm_params.auto_dst ? "true" : "false");
+  print_format(out, "\"group_role\":\"%s\",\"group_id\":%u,\"group_synced\":%s,\"group_error_ms\":%ld,",
+               group_roles[nvm_params.group_role <= GROUP_FOLLOWER ? nvm_params.group_role : 0], nvm_params.group_id,
+               group_clk.synced ? "true" : "false", (long)group_clk.error);
+  // ma: estimate of the last frame, limit: % of the brightness the budget allows
+  const led_power_calibration& cal = nvm_params.power_cal;
+  print_format(out, "\"power\":{\"budget_ma\":%u,\"ma\":%lu,\"limit\":%u,\"limited_frames\":%lu,"
+               "\"r_ua\":%u,\"g_ua\":%u,\"b_ua\":%u,\"idle_ua\":%u},",
+               nvm_params.power_budget_ma, (unsigned long)strip_power.estimate_ma,
+               (unsigned)((uint32_t)strip_power.limit * 100 / 65535), (unsigned long)strip_power.limited_frames,
+               cal.channel_ua[0], cal.channel_ua[1], cal.channel_ua[2], cal.idle_ua);
+  // offset_ms, delay_ms: of the last answer used, drift_ppm: corrected between the syncs
+  print_format(out, "\"sntp\":{\"server\":\"%s\",\"synced\":%s,\"last_sync\":%lu,\"offset_ms\":%ld,\"delay_ms\":%lu,"
+               "\"stratum\":%u,\"drift_ppm\":%.3f,\"syncs\":%lu,\"failures\":%lu},",
+               nvm_params.sntp_server, sntp_clk.synced ? "true" : "false", (unsigned long)sntp_last_sync,
+               (long)sntp_last.offset_ms, (unsigned long)sntp_last.delay_ms, sntp_last.stratum, sntp_clk.ppb / 1000.0,
+               (unsigned long)sntp_syncs, (unsigned long)sntp_failures);
+  out.print("\"timers\":[");
+  for (int i = 0; i < 2; i++) {
+    const timer_pair& t = timers[i];
+    print_format(out, "%s{\"enabled\":%s,\"on_h\":%u,\"on_m\":%u,\"off_h\":%u,\"off_m\":%u}",
+                 i ? "," : "", t.pair_enabled ? "true" : "false", t.on_time.hour, t.on_time.minute,
+                 t.off_time.hour, t.off_time.minute);
+  }
+  out.print("]}");
+}
+
+
+static void api_error(http_response& res, uint16_t status, const char* error)
+{
+  http_status(res, status, "application/json");
+  print_format(res, "{\"error\":\"%s\"}", error);
+}
+
+
+// Integer value of the current key in min..max, else error is set
+static bool read_range(json_reader& r, long min_value, long max_value, long& value, const char*& error,
+                       const char* message)
+{
+  if (!json_int(r, value)) {
+    error = "invalid JSON";
+    return false;
+  }
+  if (value < min_value || value > max_value) {
+    error = message;
+    return false;
+  }
+  return true;
+}
+
+
+// Color fields: red/green/blue, hue/sat or kelvin also select the mode.
+// 1 = read, 0 = no color key, -1 = error is set
+static int parse_color_key(json_reader& r, const char* key, led_color_setting& c, const char*& error)
+{
+  long v;
+  uint8_t* channel = (strcmp(key, "red") == 0) ? &c.red : (strcmp(key, "green") == 0) ? &c.green
+                   : (strcmp(key, "blue") == 0) ? &c.blue : NULL;
+  if (channel) {
+    if (!read_range(r, 0, 255, v, error, "colors: 0..255")) return -1;
+    *channel = v;
+    c.mode = LED_COLOR_RGB;
+  } else if (strcmp(key, "hue") == 0 || strcmp(key, "sat") == 0) {
+    bool hue = key[0] == 'h';
+    if (!read_range(r, 0, hue ? 359 : 255, v, error, hue ? "hue: 0..359" : "sat: 0..255")) return -1;
+    if (hue) c.hue = v;
+    else c.sat = v;
+    c.mode = LED_COLOR_HSV;
+  } else if (strcmp(key, "kelvin") == 0) {
+    if (!read_range(r, LED_KELVIN_MIN, LED_KELVIN_MAX, v, error, "kelvin: 1000..12000")) return -1;
+    c.kelvin = v;
+    c.mode = LED_COLOR_KELVIN;
+  } else if (strcmp(key, "mode") == 0) {
+    char mode[8];
+    if (!json_string(r, mode, sizeof(mode))) {
+      error = "invalid JSON";
+      return -1;
+    }
+    int i = 0;
+    while (i < 3 && strcmp(mode, color_modes[i]) != 0) i++;
+    if (i == 3) {
+      error = "mode: rgb, hsv or kelvin";
+      return -1;
+    }
+    c.mode = i;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+
+// One entry of "timers", {} = unchanged
+static const char* parse_timer_patch(json_reader& r, timer_pair& t)
+{
+  char key[8];
+  const char* error = NULL;
+  long v;
+  if (json_null(r)) return NULL;
+  if (!json_enter(r, '{')) return "invalid JSON";
+  while (json_next_key(r, key, sizeof(key))) {
+    if (strcmp(key, "enabled") == 0) {
+      bool b;
+      if (!json_bool(r, b)) return "invalid JSON";
+      t.pair_enabled = b;
+    } else if (strcmp(key, "on_h") == 0) {
+      if (!read_range(r, 0, 23, v, error, "on_h: 0..23")) return error;
+      t.on_time.hour = v;
+    } else if (strcmp(key, "on_m") == 0) {
+      if (!read_range(r, 0, 59, v, error, "on_m: 0..59")) return error;
+      t.on_time.minute = v;
+    } else if (strcmp(key, "off_h") == 0) {
+      if (!read_range(r, 0, 23, v, error, "off_h: 0..23")) return error;
+      t.off_time.hour = v;
+    } else if (strcmp(key, "off_m") == 0) {
+      if (!read_range(r, 0, 59, v, error, "off_m: 0..59")) return error;
+      t.off_time.minute = v;
+    } else {
+      json_skip(r);
+    }
+  }
+  return r.error ? "invalid JSON" : NULL;
+}
+
+
+// "power": budget and calibration, {} = unchanged
+static const char* parse_power_patch(json_reader& r, nvm_parameters& p)
+{
+  static const char* const channels[] = { "r_ua", "g_ua", "b_ua" };
+  char key[12];
+  const char* error = NULL;
+  long v;
+  if (!json_enter(r, '{')) return "invalid JSON";
+  while (json_next_key(r, key, sizeof(key))) {
+    int c = 0;
+    while (c < 3 && strcmp(key, channels[c]) != 0) c++;
+    if (c < 3) {
+      if (!read_range(r, 0, 65535, v, error, "power: r_ua, g_ua, b_ua 0..65535")) return error;
+      p.power_cal.channel_ua[c] = v;
+    } else if (strcmp(key, "idle_ua") == 0) {
+      if (!read_range(r, 0, 65535, v, error, "power: idle_ua 0..65535")) return error;
+      p.power_cal.idle_ua = v;
+    } else if (strcmp(key, "budget_ma") == 0) {
+      if (!read_range(r, 0, 65535, v, error, "power: budget_ma 0..65535, 0 = no limit")) return error;
+      p.power_budget_ma = v;
+    } else {
+      // read only fields (ma, limit, limited_frames)
+      json_skip(r);
+    }
+  }
+  return r.error ? "invalid JSON" : NULL;
+}
+
+
+// SNTP server: a host name or an address, "" = no SNTP
+static bool valid_sntp_server(const char* server)
+{
+  for (const char* c = server; *c; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '.' && *c != '-') return false;
+  }
+  return true;
+}
+
+
+// Apply the document to copies of the state, changes = CHANGE_* flags
+static const char* parse_state_patch(const char* body, size_t len, nvm_parameters& p, timer_pair* t,
+                                     long& time, uint8_t& changes)
+{
+  json_reader r;
+  json_begin(r, body, len);
+  char key[16];
+  const char* error = NULL;
+  long v;
+  if (!json_enter(r, '{')) return "invalid JSON";
+  while (json_next_key(r, key, sizeof(key))) {
+    int color = parse_color_key(r, key, p.color, error);
+    if (color < 0) return error;
+    if (color) {
+      changes |= CHANGE_STRIP | CHANGE_PARAMS;
+    } else if (strcmp(key, "brightness") == 0) {
+      if (!read_range(r, 0, 100, v, error, "brightness: 0..100")) return error;
+      p.brightness = v;
+      changes |= CHANGE_STRIP | CHANGE_PARAMS;
+    } else if (strcmp(key, "tz") == 0) {
+      if (!read_range(r, -12, 14, v, error, "tz: -12..14")) return error;
+      p.tz_offset_hours = v;
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "auto_dst") == 0) {
+      bool b;
+      if (!json_bool(r, b)) return "invalid JSON";
+      p.auto_dst = b;
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "group_role") == 0) {
+      // takes effect after a restart (WiFi access point or station)
+      char role[10];
+      if (!json_string(r, role, sizeof(role))) return "invalid JSON";
+      int i = 0;
+      while (i <= GROUP_FOLLOWER && strcmp(role, group_roles[i]) != 0) i++;
+      if (i > GROUP_FOLLOWER) return "group_role: off, leader or follower";
+      p.group_role = i;
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "group_id") == 0) {
+      if (!read_range(r, 0, 255, v, error, "group_id: 0..255")) return error;
+      p.group_id = v;
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "power") == 0) {
+      error = parse_power_patch(r, p);
+      if (error) return error;
+      changes |= CHANGE_STRIP | CHANGE_PARAMS;
+    } else if (strcmp(key, "sntp_server") == 0) {
+      char server[sizeof(p.sntp_server) + 1];
+      if (!json_string(r, server, sizeof(server))) return "invalid JSON";
+      if (strlen(server) >= sizeof(p.sntp_server)) return "sntp_server: up to 31 characters";
+      if (!valid_sntp_server(server)) return "sntp_server: host name or address";
+      strcpy(p.sntp_server, server);
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "time") == 0) {
+      if (!read_range(r, 0, 0x7FFFFFFF, time, error, "time: unix timestamp")) return error;
+      changes |= CHANGE_PARAMS;
+    } else if (strcmp(key, "timers") == 0) {
+      if (!json_enter(r, '[')) return "invalid JSON";
+      int i = 0;
+      while (json_next_item(r)) {
+        if (i >= 2) return "timers: 2 pairs";
+        error = parse_timer_patch(r, t[i++]);
+        if (error) return error;
+      }
+      changes |= CHANGE_TIMERS;
+    } else {
+      // read only fields (local_time) and unknown ones
+      json_skip(r);
+    }
+  }
+  return json_done(r) ? NULL : "invalid JSON";
+}
+
+
+void handle_api_state(http_request& req, http_response& res)
+{
+  http_status(res, 200, "application/json");
+  print_state_json(res);
+}
+
+
+// Whole request body into buf, false (and 413 sent) if it doesn't fit
+static bool read_body(http_request& req, http_response& res, char* buf, size_t size, size_t& len)
+{
+  if (req.content_length > size) {
+    api_error(res, 413, "body too large");
+    return false;
+  }
+  size_t n;
+  len = 0;
+  while (len < req.content_length && (n = http_read_body(req, (uint8_t*)buf + len, size - len)) > 0) {
+    len += n;
+  }
+  return true;
+}
+
+
+void handle_api_patch(http_request& req, http_response& res)
+{
+  char body[512];
+  size_t len;
+  if (!read_body(req, res, body, sizeof(body), len)) return;
+
+  nvm_parameters params = nvm_params;
+  timer_pair new_timers[2];
+  memcpy(new_timers, timers, sizeof(timers));
+  long time = -1;
+  uint8_t changes = 0;
+  const char* error = parse_state_patch(body, len, params, new_timers, time, changes);
+  if (error) {
+    api_error(res, strcmp(error, "invalid JSON") == 0 ? 400 : 422, error);
+    return;
+  }
+
+  bool new_server = strcmp(params.sntp_server, nvm_params.sntp_server) != 0;
+  nvm_params = params;
+  memcpy(timers, new_timers, sizeof(timers));
+  if (time >= 0) set_rtc_time(time);     // also into the event log
+  if (new_server) sntp_restart();
+  if (changes) mark_changed(changes);
+
+  http_status(res, 200, "application/json");
+  print_state_json(res);
+}
+
+
+// ---------------------------------------------------------------------------
+// Segments (led_segments.h)
+//   GET /api/segments            {"segments":[{"name":"left","start":0,"count":12,...}]}
+//   PUT /api/segments            the whole list, same format
+//   PATCH /api/segments/<name>   fields of one segment, e.g. {"effect":"rainbow","speed":40}
+//   DELETE /api/segments/<name>
+// Fields: name, start, count, on, reverse, mirror, effect (solid, rainbow,
+// breathe, program), speed, brightness and the color fields as in /api/state.
+
+static void print_segment_json(Print& out, const led_segment& seg)
+{
+  print_format(out, "{\"name\":\"%s\",\"start\":%u,\"count\":%u,\"on\":%s,\"reverse\":%s,\"mirror\":%s,"
+               "\"effect\":\"%s\",\"speed\":%u,\"brightness\":%u,",
+               seg.name, seg.start, seg.count, (seg.flags & LED_SEGMENT_ON) ? "true" : "false",
+               (seg.flags & LED_SEGMENT_REVERSE) ? "true" : "false", (seg.flags & LED_SEGMENT_MIRROR) ? "true" : "false",
+               led_effect_names[seg.effect < LED_EFFECTS ? seg.effect : 0], seg.speed, seg.brightness);
+  print_color_json(out, seg.color);
+  out.print("}");
+}
+
+
+void print_segments_json(Print& out)
+{
+  out.print("{\"segments\":[");
+  for (int i = 0; i < segments.count; i++) {
+    if (i) out.print(",");
+    print_segment_json(out, segments.seg[i]);
+  }
+  out.print("]}");
+}
+
+
+// A new segment: the whole strip, white
+static void default_segment(led_segment& seg)
+{
+  memset(&seg, 0, sizeof(seg));
+  seg.count = led_count;
+  seg.flags = LED_SEGMENT_ON;
+  seg.brightness = 100;
+  seg.color.mode = LED_COLOR_RGB;
+  seg.color.red = seg.color.green = seg.color.blue = 255;
+  seg.color.sat = 255;
+  seg.color.kelvin = 2700;
+}
+
+
+static bool valid_segment_name(const char* name)
+{
+  size_t n = strlen(name);
+  return n && n < LED_SEGMENT_NAME
+      && strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") == n;
+}
+
+
+// Fields of one segment into seg, the others stay
+static const char* parse_segment(json_reader& r, led_segment& seg)
+{
+  char key[12];
+  const char* error = NULL;
+  long v;
+  bool count_set = false;
+  if (!json_enter(r, '{')) return "invalid JSON";
+  while (json_next_key(r, key, sizeof(key))) {
+    int color = parse_color_key(r, key, seg.color, error);
+    if (color < 0) return error;
+    if (color) continue;
+
+    uint8_t flag = (strcmp(key, "on") == 0) ? LED_SEGMENT_ON : (strcmp(key, "reverse") == 0) ? LED_SEGMENT_REVERSE
+                 : (strcmp(key, "mirror") == 0) ? LED_SEGMENT_MIRROR : 0;
+    if (flag) {
+      bool b;
+      if (!json_bool(r, b)) return "invalid JSON";
+      seg.flags = b ? (seg.flags | flag) : (seg.flags & ~flag);
+    } else if (strcmp(key, "name") == 0) {
+      char name[LED_SEGMENT_NAME + 1];
+      if (!json_string(r, name, sizeof(name))) return "invalid JSON";
+      if (!valid_segment_name(name)) return "name: 1..9 of a-z, 0-9, _, -";
+      strcpy(seg.name, name);
+    } else if (strcmp(key, "start") == 0) {
+      if (!read_range(r, 0, led_count - 1, v, error, "start: beyond the strip")) return error;
+      seg.start = v;
+    } else if (strcmp(key, "count") == 0) {
+      if (!read_range(r, 1, led_count, v, error, "count: 1..LEDs of the strip")) return error;
+      seg.count = v;
+      count_set = true;
+    } else if (strcmp(key, "effect") == 0) {
+      char effect[12];
+      if (!json_string(r, effect, sizeof(effect))) return "invalid JSON";
+      int i = 0;
+      while (i < LED_EFFECTS && strcmp(effect, led_effect_names[i]) != 0) i++;
+      if (i == LED_EFFECTS) return "effect: solid, rainbow, breathe or program";
+      seg.effect = i;
+    } else if (strcmp(key, "speed") == 0) {
+      if (!read_range(r, 0, 255, v, error, "speed: 0..255")) return error;
+      seg.speed = v;
+    } else if (strcmp(key, "brightness") == 0) {
+      if (!read_range(r, 0, 100, v, error, "brightness: 0..100")) return error;
+      seg.brightness = v;
+    } else {
+      json_skip(r);
+    }
+  }
+  if (r.error) return "invalid JSON";
+  // only a new start: the segment ends with the strip at the latest
+  if (!count_set && seg.start + seg.count > led_count) seg.count = led_count - seg.start;
+  if (seg.start + seg.count > led_count) return "start + count: beyond the strip";
+  return NULL;
+}
+
+
+// Segment i (-1: all) takes the new settings, strip and NVS follow
+static void segments_changed(int i)
+{
+  for (int k = 0; k < segments.count; k++) {
+    if (i < 0 || k == i) led_segments_changed(segments, k, millis());
+  }
+  strip_dirty = true;
+  mark_changed(CHANGE_SEGMENTS);
+}
+
+
+static void segment_error(http_response& res, const char* error)
+{
+  api_error(res, strcmp(error, "invalid JSON") == 0 ? 400 : 422, error);
+}
+
+
+void handle_api_segments(http_request& req, http_response& res)
+{
+  http_status(res, 200, "application/json");
+  print_segments_json(res);
+}
+
+
+void handle_api_segments_put(http_request& req, http_response& res)
+{
+  static char body[1536];       // 8 segments with all fields
+  size_t len;
+  if (!read_body(req, res, body, sizeof(body), len)) return;
+
+  led_segments list;
+  led_segments_clear(list);
+  json_reader r;
+  json_begin(r, body, len);
+  char key[12];
+  const char* error = NULL;
+  if (!json_enter(r, '{')) error = "invalid JSON";
+  while (!error && json_next_key(r, key, sizeof(key))) {
+    if (strcmp(key, "segments") != 0) {
+      json_skip(r);
+      continue;
+    }
+    if (!json_enter(r, '[')) error = "invalid JSON";
+    list.count = 0;
+    while (!error && json_next_item(r)) {
+      if (list.count >= LED_SEGMENTS_MAX) {
+        error = "segments: at most 8";
+        break;
       }
+      led_segment& seg = list.seg[list.count];
+      default_segment(seg);
+      error = parse_segment(r, seg);
+      if (!error && !seg.name[0]) error = "name: missing";
+      if (!error && led_segments_find(list, seg.name) >= 0) error = "name: twice";
+      list.count++;
     }
-    // Clear the header variable
-    header = "";
-    // Close the connection
-    client.stop();
-    Serial.println("Client disconnected.");
-    Serial.println("");
+  }
+  if (!error && !json_done(r)) error = "invalid JSON";
+  if (error) {
+    segment_error(res, error);
+    return;
+  }
+
+  memcpy(segments.seg, list.seg, sizeof(list.seg));
+  segments.count = list.count;
+  segments_changed(-1);
+  http_status(res, 200, "application/json");
+  print_segments_json(res);
+}
+
+
+void handle_api_segment_patch(http_request& req, http_response& res)
+{
+  char body[512];
+  size_t len;
+  if (!read_body(req, res, body, sizeof(body), len)) return;
+
+  int i = led_segments_find(segments, req.rest);
+  bool create = i < 0;
+  if (create && !valid_segment_name(req.rest)) {
+    api_error(res, 422, "name: 1..9 of a-z, 0-9, _, -");
+    return;
+  }
+  if (create && segments.count >= LED_SEGMENTS_MAX) {
+    api_error(res, 422, "segments: at most 8");
+    return;
+  }
+  led_segment seg;
+  if (create) {
+    // PATCH of an unknown name creates the segment
+    default_segment(seg);
+    strncpy(seg.name, req.rest, LED_SEGMENT_NAME - 1);
+  } else {
+    seg = segments.seg[i];
+  }
+  json_reader r;
+  json_begin(r, body, len);
+  const char* error = parse_segment(r, seg);
+  if (!error && !json_done(r)) error = "invalid JSON";
+  int other = led_segments_find(segments, seg.name);
+  if (!error && other >= 0 && other != i) error = "name: twice";
+  if (error) {
+    segment_error(res, error);
+    return;
+  }
+
+  if (create) i = segments.count++;
+  segments.seg[i] = seg;
+  segments_changed(i);
+  http_status(res, 200, "application/json");
+  print_segment_json(res, seg);
+}
+
+
+static void remove_segment(int i)
+{
+  segments.count--;
+  memmove(&segments.seg[i], &segments.seg[i + 1], (segments.count - i) * sizeof(led_segment));
+  memmove(&segments.state[i], &segments.state[i + 1], (segments.count - i) * sizeof(led_segment_state));
+  strip_dirty = true;
+  mark_changed(CHANGE_SEGMENTS);
+}
+
+
+void handle_api_segment_delete(http_request& req, http_response& res)
+{
+  int i = led_segments_find(segments, req.rest);
+  if (i < 0) {
+    api_error(res, 404, "no such segment");
+    return;
+  }
+  remove_segment(i);
+  http_status(res, 200, "application/json");
+  print_segments_json(res);
+}
+
+
+// ---------------------------------------------------------------------------
+// Effect program (led_vm.h), compiled on a PC with "program vm" of env:native
+//   GET /api/effect      {"loaded":true,"bytes":52,"frame_ops":4,"pixel_ops":6,...}
+//   PUT /api/effect      the bytecode as body (curl --data-binary @out.bin)
+//   DELETE /api/effect
+// cost is the number of instructions per frame on the whole strip, a
+// segment runs the program while its cost is within budget.
+
+static void print_effect_json(Print& out)
+{
+  print_format(out, "{\"loaded\":%s,\"bytes\":%u,\"frame_ops\":%u,\"pixel_ops\":%u,\"animated\":%s,"
+               "\"cost\":%lu,\"budget\":%u,\"over_budget\":%lu}",
+               effect_vm.loaded ? "true" : "false", (unsigned)effect_len, effect_vm.frame_ops, effect_vm.pixel_ops,
+               effect_vm.animated ? "true" : "false", (unsigned long)led_vm_cost(effect_vm, led_count), LED_VM_BUDGET,
+               (unsigned long)effect_vm.over_budget);
+}
+
+
+void handle_api_effect(http_request& req, http_response& res)
+{
+  http_status(res, 200, "application/json");
+  print_effect_json(res);
+}
+
+
+void handle_api_effect_put(http_request& req, http_response& res)
+{
+  static uint8_t body[LED_VM_CODE_MAX];
+  size_t len;
+  if (!read_body(req, res, (char*)body, sizeof(body), len)) return;
+  const char* error = led_vm_load(effect_vm, body, len);
+  if (error) {
+    api_error(res, 422, error);
+    return;
+  }
+  memcpy(effect_blob, body, len);
+  effect_len = len;
+  strip_dirty = true;
+  mark_changed(CHANGE_EFFECT);
+  http_status(res, 200, "application/json");
+  print_effect_json(res);
+}
+
+
+void handle_api_effect_delete(http_request& req, http_response& res)
+{
+  led_vm_unload(effect_vm);
+  effect_len = 0;
+  strip_dirty = true;
+  mark_changed(CHANGE_EFFECT);
+  http_status(res, 200, "application/json");
+  print_effect_json(res);
+}
+
+
+// Brightness control (format: /brightness/<0..100>)
+void handle_brightness(http_request& req, http_response& res)
+{
+  int value = atoi(req.rest);
+  nvm_params.brightness = value < 0 ? 0 : value > 100 ? 100 : value;   // as in PATCH /api/state
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  Serial.print("Brightness set to: ");
+  Serial.println(nvm_params.brightness);
+  print_page(res);
+}
+
+
+// Color control (format: /red/<0..255>, /green/..., /blue/...)
+void handle_color(http_request& req, http_response& res)
+{
+  uint8_t value = atoi(req.rest);
+  const char* name;
+  if (strncmp(req.path, "/red/", 5) == 0) {
+    nvm_params.color.red = value;
+    name = "Red";
+  } else if (strncmp(req.path, "/green/", 7) == 0) {
+    nvm_params.color.green = value;
+    name = "Green";
+  } else {
+    nvm_params.color.blue = value;
+    name = "Blue";
+  }
+  nvm_params.color.mode = LED_COLOR_RGB;
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  Serial.printf("%s set to: %u\n", name, value);
+  print_page(res);
+}
+
+
+// RTC time setting (format: /settime/1234567890)
+void handle_settime(http_request& req, http_response& res)
+{
+  set_rtc_time(strtoul(req.rest, NULL, 10));
+  print_page(res);
+}
+
+
+// Timezone setting (format: /settz/<hours>)
+void handle_settz(http_request& req, http_response& res)
+{
+  nvm_params.tz_offset_hours = (int8_t)atoi(req.rest);
+  mark_changed(CHANGE_PARAMS);
+  Serial.print("Timezone offset set to: ");
+  Serial.println(nvm_params.tz_offset_hours);
+  print_page(res);
+}
+
+
+// Auto DST setting (format: /setautodst/0 or /setautodst/1)
+void handle_setautodst(http_request& req, http_response& res)
+{
+  nvm_params.auto_dst = (atoi(req.rest) != 0) ? 1 : 0;
+  mark_changed(CHANGE_PARAMS);
+  Serial.print("Auto DST set to: ");
+  Serial.println(nvm_params.auto_dst);
+  print_page(res);
+}
+
+
+// Timer control (format: /settimer/pair/type/hour/minute)
+// type: 0=off time, 1=on time
+void handle_settimer(http_request& req, http_response& res)
+{
+  const char* p = req.rest;
+  uint8_t pair = next_number(p);
+  uint8_t type = next_number(p);
+  uint8_t hour = next_number(p);
+  uint8_t minute = next_number(p);
+
+  set_timer_slot(pair, hour, minute, type, 1);
+
+  Serial.printf("Timer %u %s set to %u:%02u\n", pair, type ? "ON" : "OFF", hour, minute);
+  print_page(res);
+}
+
+
+// Timer pair enable/disable (format: /settimeren/pair/0|1)
+void handle_settimeren(http_request& req, http_response& res)
+{
+  const char* p = req.rest;
+  uint8_t pair = next_number(p);
+  uint8_t enabled = next_number(p);
+
+  set_timer_pair_enabled(pair, enabled);
+  print_page(res);
+}
+
+
+// Reset to the default parameters
+void handle_reset(http_request& req, http_response& res)
+{
+  Serial.println("Resetting to default parameters");
+  set_default_nvm_parameters();
+  log_event(EVENT_RESET, 0);
+  print_page(res);
+}
+
+
+void handle_page(http_request& req, http_response& res)
+{
+  print_page(res);
+}
+
+
+// Events of the history, oldest first: ?from= and ?to= unix seconds,
+// ?limit= at most that many ("more":true if there are more)
+void handle_api_log(http_request& req, http_response& res)
+{
+  uint32_t from = http_query_int(req, "from", 0);
+  uint32_t to = http_query_int(req, "to", 0);
+  long limit = http_query_int(req, "limit", 500);
+  http_status(res, 200, "application/json");
+  print_format(res, "{\"count\":%lu,\"capacity\":%lu,\"events\":[", (unsigned long)event_log_count(events),
+               (unsigned long)event_log_capacity(events));
+  event_log_reader r;
+  event_log_find(events, r, from);
+  event_record e;
+  long n = 0;
+  bool more = false;
+  while (event_log_next(events, r, e) && (!to || e.time <= to)) {
+    if (n == limit) {
+      more = true;
+      break;
+    }
+    print_format(res, "%s{\"time\":%lu,\"event\":\"%s\",\"arg\":%d}", n++ ? "," : "", (unsigned long)e.time,
+                 e.code < EVENT_CODES ? event_names[e.code] : "?", e.code == EVENT_RTC_SET ? (int16_t)e.arg : e.arg);
+  }
+  print_format(res, "],\"more\":%s}", more ? "true" : "false");
+}
+
+
+// Web server and loop() timing as text, for the load test
+// (lib/HttpCore/bench/http_load.cpp). ?clear=1 starts a new measurement.
+void handle_stats(http_request& req, http_response& res)
+{
+  http_status(res, 200, "text/plain");
+  http_print_stats(web, res);
+  print_format(res, "Timers: %lu minute changes, up to %lu ms late, %lu times over %u ms\n", (unsigned long)timer_edges,
+               (unsigned long)timer_late_max_ms, (unsigned long)timer_late, TIMER_LATE_MS);
+  if (http_query_int(req, "clear", 0)) {
+    http_clear_stats(web);
+    timer_edges = timer_late_max_ms = timer_late = 0;
+  }
+}
+
+
+// Heap as text: free, largest block and their history, with
+// HEAP_TRACK_ENABLED the allocations per region and the top sites
+// (heap_track.h). ?clear=1 starts a new count.
+void handle_heap(http_request& req, http_response& res)
+{
+  http_status(res, 200, "text/plain");
+  print_format(res, "Heap: %lu bytes free, largest block %lu, lowest %lu / %lu since the start\n",
+               (unsigned long)heap.free_now, (unsigned long)heap.largest_now, (unsigned long)heap.lowest.free_min,
+               (unsigned long)heap.lowest.largest_min);
+  print_format(res, "Largest block, lowest per %u min, newest first:", (unsigned)(HEAP_SAMPLE_MS / 60000));
+  if (heap.current_ms) print_format(res, " %lu", (unsigned long)heap.current.largest_min);
+  for (uint32_t i = 0; i < heap.samples && i < HEAP_HISTORY; i++) {
+    print_format(res, " %lu", (unsigned long)heap.history[(heap.samples - 1 - i) % HEAP_HISTORY].largest_min);
+  }
+  res.print("\n");
+#if HEAP_TRACK_ENABLED
+  print_format(res, "Allocations: %lu, %lu frees, %ld bytes in use (at most %ld)\n", (unsigned long)heap.allocs,
+               (unsigned long)heap.frees, (long)heap.live, (long)heap.live_max);
+  print_format(res, "%-20s %8s %8s %8s %8s %9s %8s\n", "region", "passes", "allocs", "bytes", "frees", "most/pass",
+               "peak");
+  for (uint8_t i = 0; i < heap.region_count; i++) {
+    const heap_region& r = heap.regions[i];
+    print_format(res, "%-20s %8lu %8lu %8lu %8lu %9lu %8lu\n", r.name, (unsigned long)r.passes,
+                 (unsigned long)r.allocs, (unsigned long)r.bytes, (unsigned long)r.frees, (unsigned long)r.max_allocs,
+                 (unsigned long)r.peak);
+  }
+  if (heap.regions_missed) {
+    print_format(res, "%lu allocations of regions without a slot\n", (unsigned long)heap.regions_missed);
+  }
+  const heap_site* top[10];
+  uint8_t n = heap_track_top(top, 10);
+  res.print("Sites (addr2line -pfiaC -e firmware.elf):\n");
+  for (uint8_t i = 0; i < n; i++) {
+    print_format(res, "0x%08lx %-20s %8lu allocs %8lu bytes\n", (unsigned long)top[i]->pc,
+                 heap.regions[top[i]->region].name, (unsigned long)top[i]->allocs, (unsigned long)top[i]->bytes);
+  }
+  if (heap.sites_missed) print_format(res, "%lu allocations of other sites\n", (unsigned long)heap.sites_missed);
+  if (http_query_int(req, "clear", 0)) heap_track_clear();
+#else
+  res.print("Allocations are counted in the build env seeed_xiao_esp32_c6_heap\n");
+#endif
+}
+
+
+#if TRACE_ENABLED
+// Chrome trace_event JSON of the last TRACE_EVENTS trace points, see trace.h.
+// ?clear=1 starts a new capture afterwards.
+void handle_api_trace(http_request& req, http_response& res)
+{
+  http_status(res, 200, "application/json");
+  trace_reader r;
+  trace_read_begin(r, ESP.getCpuFreqMHz());
+  char piece[128];
+  size_t n;
+  while ((n = trace_read(r, piece, sizeof(piece))) > 0) res.write((const uint8_t*)piece, n);
+  if (http_query_int(req, "clear", 0)) trace_clear();
+}
+
+
+// Every request as one slice, named by its route
+static void trace_request(const char* name, bool end)
+{
+  trace_record(name, end ? TRACE_PHASE_END : TRACE_PHASE_BEGIN);
+}
+#endif
+
+
+const http_route routes[] = {
+  { HTTP_GET, "/api/state", handle_api_state },
+  { HTTP_PATCH, "/api/state", handle_api_patch },
+  { HTTP_GET, "/api/segments", handle_api_segments },
+  { HTTP_PUT, "/api/segments", handle_api_segments_put },
+  { HTTP_PATCH, "/api/segments/*", handle_api_segment_patch },
+  { HTTP_DELETE, "/api/segments/*", handle_api_segment_delete },
+  { HTTP_GET, "/api/effect", handle_api_effect },
+  { HTTP_PUT, "/api/effect", handle_api_effect_put },
+  { HTTP_DELETE, "/api/effect", handle_api_effect_delete },
+  { HTTP_GET, "/api/log", handle_api_log },
+  { HTTP_GET, "/stats", handle_stats },
+  { HTTP_GET, "/heap", handle_heap },
+#if TRACE_ENABLED
+  { HTTP_GET, "/api/trace", handle_api_trace },
+#endif
+  { HTTP_GET, "/brightness/*", handle_brightness },
+  { HTTP_GET, "/red/*", handle_color },
+  { HTTP_GET, "/green/*", handle_color },
+  { HTTP_GET, "/blue/*", handle_color },
+  { HTTP_GET, "/settime/*", handle_settime },
+  { HTTP_GET, "/settz/*", handle_settz },
+  { HTTP_GET, "/setautodst/*", handle_setautodst },
+  { HTTP_GET, "/settimer/*", handle_settimer },
+  { HTTP_GET, "/settimeren/*", handle_settimeren },
+  { HTTP_GET, "/reset", handle_reset },
+  { HTTP_GET, "*", handle_page },
+};
+http_server web = HTTP_SERVER(routes);
+
+
+// ---------------------------------------------------------------------------
+// Serial control, see serial_proto.h. The same state as the web API, same
+// ranges, same mark_changed(): strip per frame, NVS per commit window.
+
+static uint8_t serial_ping(const uint8_t* p, size_t len, serial_reply& out)
+{
+  serial_put(out, p, len);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_get_state(const uint8_t*, size_t, serial_reply& out)
+{
+  serial_put8(out, nvm_params.brightness);
+  serial_put_color(out, nvm_params.color);
+  serial_put32(out, rtc_timestamp);
+  serial_put8(out, (uint8_t)nvm_params.tz_offset_hours);
+  serial_put8(out, nvm_params.auto_dst);
+  for (int i = 0; i < 2; i++) {
+    serial_put8(out, timers[i].pair_enabled);
+    serial_put8(out, timers[i].on_time.hour);
+    serial_put8(out, timers[i].on_time.minute);
+    serial_put8(out, timers[i].off_time.hour);
+    serial_put8(out, timers[i].off_time.minute);
+  }
+  serial_put8(out, nvm_params.group_role);
+  serial_put8(out, nvm_params.group_id);
+  serial_put16(out, nvm_params.power_budget_ma);
+  for (int c = 0; c < 3; c++) serial_put16(out, nvm_params.power_cal.channel_ua[c]);
+  serial_put16(out, nvm_params.power_cal.idle_ua);
+  size_t n = strlen(nvm_params.sntp_server);
+  serial_put(out, nvm_params.sntp_server, n);
+  for (; n < SERIAL_SNTP_SIZE; n++) serial_put8(out, 0);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_brightness(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 1) return SERIAL_BAD_LENGTH;
+  if (p[0] > 100) return SERIAL_BAD_VALUE;
+  nvm_params.brightness = p[0];
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_rgb(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 3) return SERIAL_BAD_LENGTH;
+  nvm_params.color.red = p[0];
+  nvm_params.color.green = p[1];
+  nvm_params.color.blue = p[2];
+  nvm_params.color.mode = LED_COLOR_RGB;
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_hsv(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 3) return SERIAL_BAD_LENGTH;
+  uint16_t hue = serial_get16(p);
+  if (hue > 359) return SERIAL_BAD_VALUE;
+  nvm_params.color.hue = hue;
+  nvm_params.color.sat = p[2];
+  nvm_params.color.mode = LED_COLOR_HSV;
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_kelvin(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 2) return SERIAL_BAD_LENGTH;
+  uint16_t kelvin = serial_get16(p);
+  if (kelvin < LED_KELVIN_MIN || kelvin > LED_KELVIN_MAX) return SERIAL_BAD_VALUE;
+  nvm_params.color.kelvin = kelvin;
+  nvm_params.color.mode = LED_COLOR_KELVIN;
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_time(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 4) return SERIAL_BAD_LENGTH;
+  set_rtc_time(serial_get32(p));
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_tz(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 2) return SERIAL_BAD_LENGTH;
+  int8_t tz = (int8_t)p[0];
+  if (tz < -12 || tz > 14 || p[1] > 1) return SERIAL_BAD_VALUE;
+  nvm_params.tz_offset_hours = tz;
+  nvm_params.auto_dst = p[1];
+  mark_changed(CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_timer(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 6) return SERIAL_BAD_LENGTH;
+  if (p[0] >= 2 || p[1] > 1 || p[2] > 23 || p[3] > 59 || p[4] > 23 || p[5] > 59) return SERIAL_BAD_VALUE;
+  set_timer_slot(p[0], p[2], p[3], 1, 1);
+  set_timer_slot(p[0], p[4], p[5], 0, 1);
+  set_timer_pair_enabled(p[0], p[1]);
+  return SERIAL_OK;
+}
+
+
+// Live picture: straight into the 16 bit frame, strip_service() shows it
+// with the dithering at the current brightness
+static uint8_t serial_frame(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len < 2 || (len - 2) % 3) return SERIAL_BAD_LENGTH;
+  size_t first = serial_get16(p), n = (len - 2) / 3;
+  if (first + n > led_count) return SERIAL_BAD_VALUE;
+  p += 2;
+  for (size_t i = 0; i < n; i++, p += 3) {
+    led_dither_set(strip_dither, first + i, led_color_rgb(color_model, p[0], p[1], p[2]));
+  }
+  strip_live = true;
+  strip_live_ms = millis();
+  strip_dirty = true;
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_segment(const uint8_t* p, size_t len, serial_reply&)
+{
+  led_segment seg;
+  if (len != SERIAL_SEGMENT_SIZE) return SERIAL_BAD_LENGTH;
+  if (!serial_get_segment(p, seg) || !valid_segment_name(seg.name) || seg.start + seg.count > led_count) {
+    return SERIAL_BAD_VALUE;
+  }
+  int i = led_segments_find(segments, seg.name);
+  if (i < 0) {
+    if (segments.count >= LED_SEGMENTS_MAX) return SERIAL_FULL;
+    i = segments.count++;
+  }
+  segments.seg[i] = seg;
+  segments_changed(i);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_delete_segment(const uint8_t* p, size_t len, serial_reply&)
+{
+  char name[LED_SEGMENT_NAME];
+  if (!len || len >= LED_SEGMENT_NAME) return SERIAL_BAD_LENGTH;
+  memcpy(name, p, len);
+  name[len] = 0;
+  int i = led_segments_find(segments, name);
+  if (i < 0) return SERIAL_BAD_VALUE;
+  remove_segment(i);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_reset(const uint8_t*, size_t, serial_reply&)
+{
+  set_default_nvm_parameters();
+  log_event(EVENT_RESET, 1);
+  return SERIAL_OK;
+}
+
+
+// Takes effect after a restart, as group_role / group_id of PATCH /api/state
+static uint8_t serial_set_group(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != 2) return SERIAL_BAD_LENGTH;
+  if (p[0] > GROUP_FOLLOWER) return SERIAL_BAD_VALUE;
+  nvm_params.group_role = p[0];
+  nvm_params.group_id = p[1];
+  mark_changed(CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_power(const uint8_t* p, size_t len, serial_reply&)
+{
+  if (len != SERIAL_POWER_SIZE) return SERIAL_BAD_LENGTH;
+  nvm_params.power_budget_ma = serial_get16(p);
+  for (int c = 0; c < 3; c++) nvm_params.power_cal.channel_ua[c] = serial_get16(p + 2 + c * 2);
+  nvm_params.power_cal.idle_ua = serial_get16(p + 8);
+  mark_changed(CHANGE_STRIP | CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+static uint8_t serial_set_sntp(const uint8_t* p, size_t len, serial_reply&)
+{
+  char server[sizeof(nvm_params.sntp_server)];
+  if (len >= sizeof(server)) return SERIAL_BAD_LENGTH;
+  memcpy(server, p, len);
+  server[len] = 0;
+  if (strlen(server) != len || !valid_sntp_server(server)) return SERIAL_BAD_VALUE;
+  if (strcmp(server, nvm_params.sntp_server) == 0) return SERIAL_OK;
+  strcpy(nvm_params.sntp_server, server);
+  sntp_restart();
+  mark_changed(CHANGE_PARAMS);
+  return SERIAL_OK;
+}
+
+
+const serial_command serial_commands[] = {
+  { SERIAL_PING, serial_ping },
+  { SERIAL_GET_STATE, serial_get_state },
+  { SERIAL_SET_BRIGHTNESS, serial_set_brightness },
+  { SERIAL_SET_RGB, serial_set_rgb },
+  { SERIAL_SET_HSV, serial_set_hsv },
+  { SERIAL_SET_KELVIN, serial_set_kelvin },
+  { SERIAL_SET_TIME, serial_set_time },
+  { SERIAL_SET_TZ, serial_set_tz },
+  { SERIAL_SET_TIMER, serial_set_timer },
+  { SERIAL_FRAME, serial_frame },
+  { SERIAL_SET_SEGMENT, serial_set_segment },
+  { SERIAL_DELETE_SEGMENT, serial_delete_segment },
+  { SERIAL_RESET, serial_reset },
+  { SERIAL_SET_GROUP, serial_set_group },
+  { SERIAL_SET_POWER, serial_set_power },
+  { SERIAL_SET_SNTP, serial_set_sntp },
+};
+serial_server serial_ctl = SERIAL_SERVER(serial_commands);
+
+
+// Whatever the port has, a request is answered as soon as its last byte is in
+void serial_service()
+{
+  if (Serial.available() <= 0) return;
+  TRACE_SCOPE("serial");
+  while (Serial.available() > 0) {
+    const uint8_t* out;
+    size_t n = serial_server_input(serial_ctl, Serial.read(), out);
+    if (n) Serial.write(out, n);
   }
 }
@@ -0,0 +1,286 @@
+#include "serial_proto.h"
+
+#include <string.h>
+
+
+uint16_t serial_crc16(const uint8_t* data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+
+// COBS of one byte stream, continued over several calls (data, then CRC)
+struct cobs_writer {
+  uint8_t* out;
+  size_t size;
+  size_t pos;
+  size_t code_pos;                  // where the length of the current block goes
+  uint8_t code;
+};
+
+
+static bool cobs_byte(cobs_writer& w, uint8_t b)
+{
+  if (w.pos >= w.size) return false;
+  if (b) {
+    w.out[w.pos++] = b;
+    w.code++;
+  }
+  if (!b || w.code == 0xFF) {
+    w.out[w.code_pos] = w.code;
+    w.code_pos = w.pos++;
+    w.code = 1;
+  }
+  return w.pos <= w.size;
+}
+
+
+size_t serial_frame_encode(const uint8_t* data, size_t len, uint8_t* out, size_t size)
+{
+  if (size < 3) return 0;
+  uint16_t crc = serial_crc16(data, len);
+  out[0] = 0;
+  cobs_writer w = { out, size - 1, 2, 1, 1 };
+  for (size_t i = 0; i < len; i++) {
+    if (!cobs_byte(w, data[i])) return 0;
+  }
+  if (!cobs_byte(w, crc & 0xFF) || !cobs_byte(w, crc >> 8)) return 0;
+  out[w.code_pos] = w.code;
+  out[w.pos++] = 0;
+  return w.pos;
+}
+
+
+void serial_link_reset(serial_link& l)
+{
+  memset(&l, 0, sizeof(l));
+}
+
+
+// In place, the decoded data is never longer than the COBS input
+static size_t cobs_decode(uint8_t* buf, size_t len)
+{
+  size_t in = 0, out = 0;
+  while (in < len) {
+    uint8_t code = buf[in++];
+    if (!code || in + code - 1 > len) return 0;
+    for (uint8_t i = 1; i < code; i++) buf[out++] = buf[in++];
+    if (code != 0xFF && in < len) buf[out++] = 0;
+  }
+  return out;
+}
+
+
+bool serial_link_input(serial_link& l, uint8_t byte, const uint8_t*& data, size_t& len)
+{
+  if (byte) {
+    if (l.len < sizeof(l.buf)) l.buf[l.len++] = byte;
+    else l.overflow = true;
+    return false;
+  }
+
+  // 0x00: end of a frame (or the start delimiter, then nothing is pending)
+  size_t n = l.len;
+  bool overflow = l.overflow;
+  l.len = 0;
+  l.overflow = false;
+  if (overflow) {
+    l.overflows++;
+    return false;
+  }
+  if (!n) return false;
+  n = cobs_decode(l.buf, n);
+  if (n < 3 || serial_crc16(l.buf, n - 2) != serial_get16(l.buf + n - 2)) {
+    l.crc_errors++;
+    return false;
+  }
+  l.frames++;
+  data = l.buf;
+  len = n - 2;
+  return true;
+}
+
+
+void serial_put8(serial_reply& r, uint8_t v)
+{
+  serial_put(r, &v, 1);
+}
+
+
+void serial_put16(serial_reply& r, uint16_t v)
+{
+  uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+  serial_put(r, b, 2);
+}
+
+
+void serial_put32(serial_reply& r, uint32_t v)
+{
+  serial_put16(r, v);
+  serial_put16(r, v >> 16);
+}
+
+
+void serial_put(serial_reply& r, const void* data, size_t len)
+{
+  if (r.len + len > r.size) {
+    r.full = true;
+    return;
+  }
+  memcpy(r.buf + r.len, data, len);
+  r.len += len;
+}
+
+
+void serial_put_color(serial_reply& r, const led_color_setting& c)
+{
+  serial_put8(r, c.mode);
+  serial_put8(r, c.red);
+  serial_put8(r, c.green);
+  serial_put8(r, c.blue);
+  serial_put16(r, c.hue);
+  serial_put8(r, c.sat);
+  serial_put16(r, c.kelvin);
+}
+
+
+bool serial_get_color(const uint8_t* p, led_color_setting& c)
+{
+  c.mode = p[0];
+  c.red = p[1];
+  c.green = p[2];
+  c.blue = p[3];
+  c.hue = serial_get16(p + 4);
+  c.sat = p[6];
+  c.kelvin = serial_get16(p + 7);
+  return c.mode <= LED_COLOR_KELVIN && c.hue < 360 && c.kelvin >= LED_KELVIN_MIN && c.kelvin <= LED_KELVIN_MAX;
+}
+
+
+void serial_put_segment(serial_reply& r, const led_segment& seg)
+{
+  char name[LED_SEGMENT_NAME] = {};
+  memcpy(name, seg.name, strnlen(seg.name, LED_SEGMENT_NAME - 1));
+  serial_put(r, name, LED_SEGMENT_NAME);
+  serial_put16(r, seg.start);
+  serial_put16(r, seg.count);
+  serial_put8(r, seg.flags);
+  serial_put8(r, seg.effect);
+  serial_put8(r, seg.speed);
+  serial_put8(r, seg.brightness);
+  serial_put_color(r, seg.color);
+}
+
+
+bool serial_get_segment(const uint8_t* p, led_segment& seg)
+{
+  memcpy(seg.name, p, LED_SEGMENT_NAME);
+  if (seg.name[LED_SEGMENT_NAME - 1]) return false;
+  seg.start = serial_get16(p + 10);
+  seg.count = serial_get16(p + 12);
+  seg.flags = p[14];
+  seg.effect = p[15];
+  seg.speed = p[16];
+  seg.brightness = p[17];
+  return serial_get_color(p + 18, seg.color) && seg.count && seg.effect < LED_EFFECTS && seg.brightness <= 100
+      && !(seg.flags & ~(LED_SEGMENT_ON | LED_SEGMENT_REVERSE | LED_SEGMENT_MIRROR));
+}
+
+
+void serial_server_begin(serial_server& s)
+{
+  serial_link_reset(s.link);
+  s.has_last = false;
+  s.last_len = 0;
+  s.requests = 0;
+  s.retries = 0;
+}
+
+
+static uint8_t run_command(const serial_server& s, uint8_t opcode, const uint8_t* payload, size_t len,
+                           serial_reply& out)
+{
+  for (uint8_t i = 0; i < s.count; i++) {
+    if (s.commands[i].opcode != opcode) continue;
+    uint8_t status = s.commands[i].handler(payload, len, out);
+    return out.full ? SERIAL_FULL : status;
+  }
+  return SERIAL_UNKNOWN;
+}
+
+
+// Batch: per command length, opcode, payload -> per command length, status, payload
+static uint8_t run_batch(const serial_server& s, const uint8_t* p, size_t len, serial_reply& out)
+{
+  while (len) {
+    uint8_t n = p[0];
+    if (n < 1 || (size_t)n + 1 > len) return SERIAL_BAD_LENGTH;
+    if (out.len + 2 > out.size) return SERIAL_FULL;
+    size_t start = out.len;
+    out.len += 2;
+    serial_reply sub = { out.buf + out.len, 0, out.size - out.len, false };
+    uint8_t status = p[1] == SERIAL_BATCH ? SERIAL_UNKNOWN : run_command(s, p[1], p + 2, n - 1, sub);
+    if (sub.len > 254) status = SERIAL_FULL;
+    if (status != SERIAL_OK) sub.len = 0;
+    out.buf[start] = sub.len + 1;
+    out.buf[start + 1] = status;
+    out.len += sub.len;
+    p += n + 1;
+    len -= n + 1;
+  }
+  return SERIAL_OK;
+}
+
+
+size_t serial_server_input(serial_server& s, uint8_t byte, const uint8_t*& out)
+{
+  const uint8_t* data;
+  size_t len;
+  if (!serial_link_input(s.link, byte, data, len) || len < 2) return 0;
+
+  out = s.wire;
+  uint16_t crc = serial_crc16(data, len);
+  if (s.has_last && len == s.last_request && crc == s.last_crc) {
+    s.retries++;
+    return s.last_len;
+  }
+  s.requests++;
+
+  uint8_t seq = data[0], opcode = data[1];
+  serial_reply reply = { s.data + 3, 0, sizeof(s.data) - 3, false };
+  uint8_t status = opcode == SERIAL_BATCH ? run_batch(s, data + 2, len - 2, reply)
+                                          : run_command(s, opcode, data + 2, len - 2, reply);
+  if (status != SERIAL_OK && opcode != SERIAL_BATCH) reply.len = 0;
+  s.data[0] = seq;
+  s.data[1] = opcode | SERIAL_REPLY;
+  s.data[2] = status;
+  s.last_len = serial_frame_encode(s.data, reply.len + 3, s.wire, sizeof(s.wire));
+  s.last_crc = crc;
+  s.last_request = len;
+  s.has_last = true;
+  return s.last_len;
+}
+
+
+void serial_batch_begin(serial_batch& b)
+{
+  b.len = 0;
+  b.count = 0;
+}
+
+
+bool serial_batch_add(serial_batch& b, uint8_t opcode, const uint8_t* payload, size_t len)
+{
+  if (len > 253 || b.len + len + 2 > sizeof(b.buf)) return false;
+  b.buf[b.len] = len + 1;
+  b.buf[b.len + 1] = opcode;
+  memcpy(b.buf + b.len + 2, payload, len);
+  b.len += len + 2;
+  b.count++;
+  return true;
+}
@@ -0,0 +1,145 @@
+#include "sntp_client.h"
+
+#include <string.h>
+
+#define NTP_UNIX_OFFSET 2208988800ULL   // 1900 -> 1970 in s
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_VERSION 4
+
+
+static void put_time(uint8_t* p, uint64_t unix_ms)
+{
+  uint32_t s = (uint32_t)(unix_ms / 1000 + NTP_UNIX_OFFSET);
+  uint32_t f = (uint32_t)(((unix_ms % 1000) << 32) / 1000);
+  for (int i = 0; i < 4; i++) {
+    p[i] = s >> (24 - 8 * i);
+    p[4 + i] = f >> (24 - 8 * i);
+  }
+}
+
+
+static uint64_t get_raw(const uint8_t* p)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+
+// NTP -> unix ms, rounded. Era 0 ends 2036, seconds below 1970 are the next era.
+static uint64_t get_time(const uint8_t* p)
+{
+  uint64_t raw = get_raw(p);
+  uint64_t s = raw >> 32;
+  if (s < NTP_UNIX_OFFSET) s += 1ULL << 32;
+  return (s - NTP_UNIX_OFFSET) * 1000 + (((raw & 0xFFFFFFFF) * 1000 + (1ULL << 31)) >> 32);
+}
+
+
+size_t sntp_request(uint8_t* out, size_t size, uint64_t local_ms)
+{
+  if (size < SNTP_PACKET_SIZE) return 0;
+  memset(out, 0, SNTP_PACKET_SIZE);
+  out[0] = NTP_VERSION << 3 | NTP_MODE_CLIENT;
+  put_time(out + 40, local_ms);
+  return SNTP_PACKET_SIZE;
+}
+
+
+bool sntp_parse(const uint8_t* in, size_t len, uint64_t t1, uint64_t t4, sntp_result& r)
+{
+  if (len < SNTP_PACKET_SIZE) return false;
+  uint8_t leap = in[0] >> 6, mode = in[0] & 7;
+  // 3 = alarm, the server has no time; stratum 0 = kiss-o'-death
+  if (mode != NTP_MODE_SERVER || leap == 3 || in[1] == 0 || in[1] > 15) return false;
+  // originate = our transmit time, else it is an old or a foreign answer
+  uint8_t sent[8];
+  put_time(sent, t1);
+  if (memcmp(in + 24, sent, 8) != 0) return false;
+  if (!get_raw(in + 32) || !get_raw(in + 40)) return false;
+
+  int64_t t2 = get_time(in + 32), t3 = get_time(in + 40);
+  r.offset_ms = ((t2 - (int64_t)t1) + (t3 - (int64_t)t4)) / 2;
+  int64_t delay = ((int64_t)t4 - (int64_t)t1) - (t3 - t2);
+  r.delay_ms = delay < 0 ? 0 : (uint32_t)delay;
+  r.stratum = in[1];
+  return true;
+}
+
+
+size_t sntp_answer(const uint8_t* in, size_t len, uint64_t t2, uint64_t t3, uint8_t* out, size_t size)
+{
+  if (len < SNTP_PACKET_SIZE || size < SNTP_PACKET_SIZE || (in[0] & 7) != NTP_MODE_CLIENT) return 0;
+  memset(out, 0, SNTP_PACKET_SIZE);
+  out[0] = (in[0] & 0x38) | NTP_MODE_SERVER;
+  out[1] = 2;                           // stratum, behind a real clock
+  out[2] = in[2];                       // poll
+  out[3] = (uint8_t)-20;                // precision ~1 us
+  memcpy(out + 12, "LOCL", 4);          // reference id
+  put_time(out + 16, t2);               // reference time
+  memcpy(out + 24, in + 40, 8);         // originate = their transmit
+  put_time(out + 32, t2);
+  put_time(out + 40, t3);
+  return SNTP_PACKET_SIZE;
+}
+
+
+void sntp_clock_reset(sntp_clock& c, int32_t ppb)
+{
+  memset(&c, 0, sizeof(c));
+  c.ppb = ppb < -SNTP_MAX_PPB || ppb > SNTP_MAX_PPB ? 0 : ppb;
+}
+
+
+void sntp_clock_forget(sntp_clock& c)
+{
+  c.since_ms = 0;
+  c.applied_ms = 0;
+  c.best_ms = 0;
+}
+
+
+void sntp_clock_answer(sntp_clock& c, uint64_t local_ms, const sntp_result& r)
+{
+  if (r.delay_ms > SNTP_MAX_DELAY_MS || (c.best_ms && r.delay_ms >= c.best.delay_ms)) return;
+  c.best = r;
+  c.best_ms = local_ms;
+}
+
+
+bool sntp_clock_update(sntp_clock& c, int64_t& correction)
+{
+  if (!c.best_ms) return false;
+  const sntp_result& r = c.best;
+  uint64_t now = c.best_ms + r.offset_ms;
+  c.best_ms = 0;
+  correction = r.offset_ms;
+  c.synced = true;
+  if (r.offset_ms <= -SNTP_STEP_MS || r.offset_ms >= SNTP_STEP_MS || !c.since_ms) {
+    // a new start for the drift measurement
+    c.since_ms = now;
+    c.applied_ms = 0;
+    return true;
+  }
+  c.applied_ms += r.offset_ms;
+  if (now - c.since_ms < SNTP_DRIFT_MIN_MS) return true;
+
+  // the clock lost applied_ms over the time since: it is fast by -applied
+  int64_t measured = -c.applied_ms * 1000000000LL / (int64_t)(now - c.since_ms);
+  int64_t ppb = c.ppb + (c.samples ? measured / 4 : measured);
+  c.ppb = ppb < -SNTP_MAX_PPB ? -SNTP_MAX_PPB : ppb > SNTP_MAX_PPB ? SNTP_MAX_PPB : ppb;
+  if (c.samples < 255) c.samples++;
+  c.since_ms = now;
+  c.applied_ms = 0;
+  return true;
+}
+
+
+int32_t sntp_clock_drift(sntp_clock& c, uint32_t elapsed_ms)
+{
+  c.rest += (int64_t)elapsed_ms * c.ppb;
+  int32_t ms = (int32_t)(c.rest / 1000000000LL);
+  c.rest -= (int64_t)ms * 1000000000LL;
+  return -ms;
+}
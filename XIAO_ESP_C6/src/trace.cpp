@@ -0,0 +1,84 @@
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#include <stdio.h>
+#include <string.h>
+#ifndef ARDUINO
+#include <time.h>
+#endif
+
+trace_buffer trace_buf;
+
+#define READ_HEADER 0
+#define READ_EVENTS 1
+#define READ_END 2
+#define READ_DONE 3
+
+
+#ifndef ARDUINO
+uint32_t trace_cycles()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+#endif
+
+
+void trace_read_begin(trace_reader& r, uint32_t cycles_per_us)
+{
+  trace_buf.paused = true;
+  r.end = trace_buf.next;
+  r.index = r.end > TRACE_EVENTS ? r.end - TRACE_EVENTS : 0;
+  r.cycles_per_us = cycles_per_us ? cycles_per_us : 1;
+  r.last_cycles = r.index < r.end ? trace_buf.events[r.index & (TRACE_EVENTS - 1)].cycles : 0;
+  r.elapsed = 0;
+  r.depth = 0;
+  r.state = READ_HEADER;
+}
+
+
+size_t trace_read(trace_reader& r, char* out, size_t size)
+{
+  int n = 0;
+  while (!n) {
+    if (r.state == READ_HEADER) {
+      n = snprintf(out, size, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[{\"name\":\"process_name\",\"ph\":\"M\","
+                              "\"pid\":1,\"tid\":1,\"args\":{\"name\":\"XIAO_ESP_C6\"}}");
+      r.state = READ_EVENTS;
+    } else if (r.state == READ_EVENTS) {
+      if (r.index == r.end) {
+        r.state = READ_END;
+        continue;
+      }
+      const trace_event& e = trace_buf.events[r.index++ & (TRACE_EVENTS - 1)];
+      // the counter wraps (after 26 s at 160 MHz), events are closer than that
+      r.elapsed += e.cycles - r.last_cycles;
+      r.last_cycles = e.cycles;
+      // the begin of this one was overwritten already
+      if (e.phase == TRACE_PHASE_END && !r.depth) continue;
+      r.depth += e.phase == TRACE_PHASE_BEGIN ? 1 : e.phase == TRACE_PHASE_END ? -1 : 0;
+      uint64_t us = r.elapsed / r.cycles_per_us;
+      unsigned ns = (unsigned)(r.elapsed % r.cycles_per_us * 1000 / r.cycles_per_us);
+      n = snprintf(out, size, ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":1%s}", e.name,
+                   e.phase, (unsigned long long)us, ns, e.phase == TRACE_PHASE_MARK ? ",\"s\":\"t\"" : "");
+    } else if (r.state == READ_END) {
+      n = snprintf(out, size, "]}\n");
+      r.state = READ_DONE;
+      trace_buf.paused = false;
+    } else {
+      return 0;
+    }
+  }
+  return n < (int)size ? n : size - 1;
+}
+
+
+void trace_clear()
+{
+  trace_buf.next = 0;
+  trace_buf.paused = false;
+}
+
+#endif
@@ -0,0 +1,268 @@
+#include "gpio_pwm.h"
+
+#include <driver/ledc.h>
+
+// the only mode every ESP32 variant has
+#define PWM_MODE LEDC_LOW_SPEED_MODE
+
+// Bits of the fade task notification: channel n finished a segment (ISR),
+// channel n got a new fade (gpio_pwm_fade)
+#define SEGMENT_DONE(n) (1UL << (n))
+#define NEW_FADE(n) (1UL << ((n) + 16))
+// a segment not ended this long after its time lost the end interrupt
+#define END_MARGIN_MS 50
+
+struct pwm_channel {
+  int8_t output;          // table index, -1 = channel unused
+  uint8_t bits;
+  bool active_low;
+  // fade plan, shared by gpio_pwm_fade() and the fade task (pwm_mux)
+  uint8_t level;          // level at the end of the running segment
+  uint8_t from;
+  uint8_t target;
+  uint8_t segment;        // next segment 1..GPIO_PWM_SEGMENTS, more = done
+  uint16_t segment_ms;
+  // fade task only
+  bool running;           // a hardware fade is running
+  uint32_t end_ms;        // when it has to be done at the latest
+};
+
+static pwm_channel channels[GPIO_PWM_MAX_CHANNELS];
+static uint8_t channel_count = 0;
+static int8_t channel_of_output[GPIO_TABLE_MAX];
+
+static uint32_t timer_freq[LEDC_TIMER_MAX];
+static uint8_t timer_bits[LEDC_TIMER_MAX];
+static uint8_t timer_count = 0;
+
+static uint16_t gamma16[256];
+static TaskHandle_t fade_task = NULL;
+static portMUX_TYPE pwm_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+uint32_t gpio_pwm_duty(uint8_t level, uint8_t bits)
+{
+  // 255 gives 2^bits, which the LEDC takes as 100% (no gap at all)
+  return ((uint64_t)gamma16[level] << bits) / 65535;
+}
+
+
+static uint32_t channel_duty(const pwm_channel& c, uint8_t level)
+{
+  uint32_t duty = gpio_pwm_duty(level, c.bits);
+  return c.active_low ? (1UL << c.bits) - duty : duty;
+}
+
+
+// ---------------------------------------------------------------------------
+// Fade task
+
+static bool IRAM_ATTR fade_end_isr(const ledc_cb_param_t* param, void* user)
+{
+  BaseType_t woken = pdFALSE;
+  if (param->event == LEDC_FADE_END_EVT) {
+    xTaskNotifyFromISR(fade_task, SEGMENT_DONE((uint32_t)(intptr_t)user), eSetBits, &woken);
+  }
+  return woken == pdTRUE;
+}
+
+
+// Start the next segment(s) of the fade plan. Segments without time or
+// without a change of the duty are set at once, the hardware fades the rest.
+static void start_segment(uint8_t ch)
+{
+  pwm_channel& c = channels[ch];
+  for (;;) {
+    portENTER_CRITICAL(&pwm_mux);
+    if (c.segment > GPIO_PWM_SEGMENTS) {
+      portEXIT_CRITICAL(&pwm_mux);
+      return;
+    }
+    uint8_t previous = c.level;
+    uint8_t level = c.from + ((int)c.target - c.from) * c.segment / GPIO_PWM_SEGMENTS;
+    uint16_t ms = c.segment_ms;
+    c.segment++;
+    c.level = level;
+    portEXIT_CRITICAL(&pwm_mux);
+
+    uint32_t duty = channel_duty(c, level);
+    if (ms == 0 || duty == channel_duty(c, previous)) {
+      ledc_set_duty(PWM_MODE, (ledc_channel_t)ch, duty);
+      ledc_update_duty(PWM_MODE, (ledc_channel_t)ch);
+      continue;
+    }
+    c.running = true;
+    c.end_ms = millis() + ms + END_MARGIN_MS;
+    ledc_set_fade_with_time(PWM_MODE, (ledc_channel_t)ch, duty, ms);
+    ledc_fade_start(PWM_MODE, (ledc_channel_t)ch, LEDC_FADE_NO_WAIT);
+    return;
+  }
+}
+
+
+// Level whose duty is the first at or above the one of the channel now
+static uint8_t current_level(const pwm_channel& c, uint8_t ch)
+{
+  uint32_t duty = ledc_get_duty(PWM_MODE, (ledc_channel_t)ch);
+  if (c.active_low) duty = (1UL << c.bits) - duty;
+  uint8_t low = 0, high = 255;
+  while (low < high) {
+    uint8_t mid = (low + high) / 2;
+    if (gpio_pwm_duty(mid, c.bits) < duty) low = mid + 1;
+    else high = mid;
+  }
+  return low;
+}
+
+
+static void fade_loop(void*)
+{
+  for (;;) {
+    // sleeps until a notification, or the end interrupt of the first
+    // running segment is overdue
+    TickType_t wait = portMAX_DELAY;
+    uint32_t now = millis();
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      const pwm_channel& c = channels[ch];
+      if (!c.running) continue;
+      int32_t left = (int32_t)(c.end_ms - now);
+      TickType_t ticks = left > 0 ? pdMS_TO_TICKS(left) + 1 : 0;
+      if (ticks < wait) wait = ticks;
+    }
+
+    uint32_t bits = 0;
+    xTaskNotifyWait(0, 0xFFFFFFFF, &bits, wait);
+
+    now = millis();
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      pwm_channel& c = channels[ch];
+      if ((bits & NEW_FADE(ch)) && c.running) {
+        // a new fade doesn't wait for the end of the segment: stopped
+        // where it is, the new plan starts from there
+        ledc_fade_stop(PWM_MODE, (ledc_channel_t)ch);
+        // an end interrupt of the stopped segment, in bits or still pending,
+        // would end the first segment of the new plan
+        ulTaskNotifyValueClear(NULL, SEGMENT_DONE(ch));
+        bits &= ~SEGMENT_DONE(ch);
+        uint8_t level = current_level(c, ch);
+        portENTER_CRITICAL(&pwm_mux);
+        c.from = level;
+        c.level = level;
+        portEXIT_CRITICAL(&pwm_mux);
+        c.running = false;
+      }
+      // a lost end interrupt must not stop the channel for good
+      if ((bits & SEGMENT_DONE(ch)) || (c.running && (int32_t)(now - c.end_ms) > 0)) {
+        c.running = false;
+      }
+      if (!c.running) start_segment(ch);
+    }
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+
+static int8_t get_timer(uint32_t freq, uint8_t bits)
+{
+  for (uint8_t i = 0; i < timer_count; i++) {
+    if (timer_freq[i] == freq && timer_bits[i] == bits) return i;
+  }
+  if (timer_count >= LEDC_TIMER_MAX) return -1;
+
+  ledc_timer_config_t timer = {};
+  timer.speed_mode = PWM_MODE;
+  timer.duty_resolution = (ledc_timer_bit_t)bits;
+  timer.timer_num = (ledc_timer_t)timer_count;
+  timer.freq_hz = freq;
+  timer.clk_cfg = LEDC_AUTO_CLK;
+  if (ledc_timer_config(&timer) != ESP_OK) return -1;
+
+  timer_freq[timer_count] = freq;
+  timer_bits[timer_count] = bits;
+  return timer_count++;
+}
+
+
+bool gpio_pwm_begin(const gpio_table& t)
+{
+  for (int i = 0; i < 256; i++) {
+    gamma16[i] = (uint16_t)(powf(i / 255.0f, GPIO_PWM_GAMMA) * 65535.0f + 0.5f);
+  }
+  for (int i = 0; i < GPIO_TABLE_MAX; i++) channel_of_output[i] = -1;
+
+  bool ok = true;
+  const uint8_t max_channels = min<uint8_t>(GPIO_PWM_MAX_CHANNELS, LEDC_CHANNEL_MAX);
+  for (uint8_t i = 0; i < t.count; i++) {
+    const gpio_output& o = t.outputs[i];
+    if (!o.pwm_freq) continue;
+    int8_t timer = get_timer(o.pwm_freq, o.pwm_bits);
+    if (timer < 0 || channel_count >= max_channels) {
+      ok = false;
+      continue;
+    }
+
+    uint8_t ch = channel_count;
+    pwm_channel& c = channels[ch];
+    c.output = i;
+    c.bits = o.pwm_bits;
+    c.active_low = o.active_low;
+    c.level = o.initial ? 255 : 0;
+    c.from = c.level;
+    c.target = c.level;
+    c.segment = GPIO_PWM_SEGMENTS + 1;
+    c.running = false;
+
+    ledc_channel_config_t config = {};
+    config.gpio_num = o.pin;
+    config.speed_mode = PWM_MODE;
+    config.channel = (ledc_channel_t)ch;
+    config.intr_type = LEDC_INTR_DISABLE;
+    config.timer_sel = (ledc_timer_t)timer;
+    config.duty = channel_duty(c, c.level);
+    if (ledc_channel_config(&config) != ESP_OK) {
+      ok = false;
+      continue;
+    }
+    channel_of_output[i] = ch;
+    channel_count++;
+  }
+  if (!channel_count) return ok;
+
+  // ESP_ERR_INVALID_STATE: already installed by someone else
+  esp_err_t err = ledc_fade_func_install(0);
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false;
+  if (!fade_task && xTaskCreate(fade_loop, "pwm_fade", 2048, NULL, 5, &fade_task) != pdPASS) {
+    return false;
+  }
+  ledc_cbs_t callbacks = {};
+  callbacks.fade_cb = fade_end_isr;
+  for (uint8_t ch = 0; ch < channel_count; ch++) {
+    ledc_cb_register(PWM_MODE, (ledc_channel_t)ch, &callbacks, (void*)(intptr_t)ch);
+  }
+  return ok;
+}
+
+
+bool gpio_pwm_fade(const gpio_table& t, uint8_t index, uint8_t level, uint16_t ms)
+{
+  if (index >= t.count || !fade_task) return false;
+  int8_t ch = channel_of_output[index];
+  if (ch < 0) return false;
+
+  pwm_channel& c = channels[ch];
+  portENTER_CRITICAL(&pwm_mux);
+  // the fade task stops a running segment and starts from its duty then
+  c.from = c.level;
+  c.target = level;
+  c.segment = 1;
+  c.segment_ms = ms / GPIO_PWM_SEGMENTS;
+  if (c.segment_ms == 0) {
+    c.from = level;
+    c.segment = GPIO_PWM_SEGMENTS;
+  }
+  portEXIT_CRITICAL(&pwm_mux);
+
+  xTaskNotify(fade_task, NEW_FADE(ch), eSetBits);
+  return true;
+}
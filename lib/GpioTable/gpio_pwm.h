@@ -0,0 +1,28 @@
+#pragma once
+
+#include "gpio_table.h"
+
+// LEDC backend of the PWM outputs in a gpio_table, used by gpio_table.cpp.
+//
+// Every PWM output gets its own LEDC channel, outputs with the same
+// frequency and resolution share a timer. A fade from one level to another
+// is split into GPIO_PWM_SEGMENTS linear hardware fades along the gamma
+// curve. The LEDC interrupt at the end of a segment wakes a small task that
+// starts the next one, the CPU is only involved a few times per fade. A new
+// fade (or a level at once) stops the running segment right away and goes
+// on from the duty it had reached.
+
+#define GPIO_PWM_GAMMA 2.2f
+#define GPIO_PWM_SEGMENTS 8
+#define GPIO_PWM_MAX_CHANNELS 8
+
+// Set up the channels of all PWM outputs in the table, false if there are
+// more PWM outputs than channels / timers or the LEDC setup failed
+bool gpio_pwm_begin(const gpio_table& t);
+
+// Start a fade of output index to level (0..255) in ms, 0 = at once,
+// replaces a running fade
+bool gpio_pwm_fade(const gpio_table& t, uint8_t index, uint8_t level, uint16_t ms);
+
+// Duty for a level at the given resolution, gamma corrected
+uint32_t gpio_pwm_duty(uint8_t level, uint8_t bits);
@@ -0,0 +1,283 @@
+#include "gpio_table.h"
+#include "gpio_pwm.h"
+
+#include <soc/gpio_reg.h>
+
+static portMUX_TYPE gpio_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Register masks for the outputs in bits: pins 0-31 and (ESP32) 32-39
+static void output_masks(const gpio_table& t, uint32_t bits, uint32_t& high_lo, uint32_t& high_hi,
+                         uint32_t& low_lo, uint32_t& low_hi, bool on)
+{
+  for (uint8_t i = 0; bits && i < t.count; i++, bits >>= 1) {
+    if (!(bits & 1)) continue;
+    const gpio_output& o = t.outputs[i];
+    if (o.pwm_freq) continue;
+    bool level = on != o.active_low;
+    uint32_t& lo = level ? high_lo : low_lo;
+    uint32_t& hi = level ? high_hi : low_hi;
+    if (o.pin < 32) {
+      lo |= 1UL << o.pin;
+    } else {
+      hi |= 1UL << (o.pin - 32);
+    }
+  }
+}
+
+
+// Set and clear are two stores right after each other: the pins going high
+// switch together, the pins going low one store later. W1TS / W1TC only
+// touch the bits in the mask, so digitalWrite(), the SPI driver or the other
+// core writing pins outside the table lose nothing. gpio_mux keeps the
+// interrupts of this core and other gpio_table calls from coming in between.
+static inline void write_registers(uint32_t high_lo, uint32_t high_hi, uint32_t low_lo, uint32_t low_hi)
+{
+  REG_WRITE(GPIO_OUT_W1TS_REG, high_lo);
+  REG_WRITE(GPIO_OUT_W1TC_REG, low_lo);
+#ifdef GPIO_OUT1_W1TS_REG
+  if (high_hi | low_hi) {
+    REG_WRITE(GPIO_OUT1_W1TS_REG, high_hi);
+    REG_WRITE(GPIO_OUT1_W1TC_REG, low_hi);
+  }
+#endif
+}
+
+
+void gpio_table_apply(gpio_table& t, uint32_t on, uint32_t off)
+{
+  off &= ~on;
+  uint32_t high_lo = 0, high_hi = 0, low_lo = 0, low_hi = 0;
+  output_masks(t, on, high_lo, high_hi, low_lo, low_hi, true);
+  output_masks(t, off, high_lo, high_hi, low_lo, low_hi, false);
+
+  portENTER_CRITICAL(&gpio_mux);
+  write_registers(high_lo, high_hi, low_lo, low_hi);
+  t.state = (t.state | on) & ~off;
+  portEXIT_CRITICAL(&gpio_mux);
+
+  // PWM outputs fade in hardware, all started right after each other
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (!gpio_table_is_pwm(t, i)) continue;
+    if ((on >> i) & 1) {
+      t.level[i] = 255;
+    } else if ((off >> i) & 1) {
+      t.level[i] = 0;
+    } else {
+      continue;
+    }
+    gpio_pwm_fade(t, i, t.level[i], t.outputs[i].fade_ms);
+  }
+}
+
+
+bool gpio_table_fade(gpio_table& t, uint8_t index, uint8_t level, uint16_t ms)
+{
+  if (index >= t.count || !gpio_table_is_pwm(t, index)) return false;
+  t.level[index] = level;
+  if (level) {
+    t.state |= 1UL << index;
+  } else {
+    t.state &= ~(1UL << index);
+  }
+  return gpio_pwm_fade(t, index, level, ms);
+}
+
+
+void gpio_table_set_state(gpio_table& t, uint32_t state)
+{
+  uint32_t all = (t.count >= 32) ? 0xFFFFFFFF : (1UL << t.count) - 1;
+  gpio_table_apply(t, state & all, ~state & all);
+}
+
+
+void gpio_table_begin(gpio_table& t)
+{
+  uint32_t initial = 0;
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (t.outputs[i].initial) initial |= 1UL << i;
+  }
+  // PWM outputs start with their initial level, without fade
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (gpio_table_is_pwm(t, i)) t.level[i] = t.outputs[i].initial ? 255 : 0;
+  }
+  gpio_pwm_begin(t);
+  t.state = initial;
+
+  // set the output latches first, so active low relays don't click while
+  // the pins become outputs
+  uint32_t high_lo = 0, high_hi = 0, low_lo = 0, low_hi = 0;
+  output_masks(t, initial, high_lo, high_hi, low_lo, low_hi, true);
+  output_masks(t, ~initial, high_lo, high_hi, low_lo, low_hi, false);
+  portENTER_CRITICAL(&gpio_mux);
+  write_registers(high_lo, high_hi, low_lo, low_hi);
+  portEXIT_CRITICAL(&gpio_mux);
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (!gpio_table_is_pwm(t, i)) pinMode(t.outputs[i].pin, OUTPUT);
+  }
+  portENTER_CRITICAL(&gpio_mux);
+  write_registers(high_lo, high_hi, low_lo, low_hi);
+  portEXIT_CRITICAL(&gpio_mux);
+}
+
+
+// ---------------------------------------------------------------------------
+// Requests
+
+static inline bool is_name_end(char c)
+{
+  return c == 0 || c == ',' || c == '&' || c == ' ' || c == '/';
+}
+
+
+int8_t gpio_table_find(const gpio_table& t, const char* name, size_t len)
+{
+  if (!len) {
+    while (!is_name_end(name[len])) len++;
+  }
+  if (!len) return -1;
+
+  for (uint8_t i = 0; i < t.count; i++) {
+    const char* n = t.outputs[i].name;
+    if (n && strlen(n) == len && strncmp(n, name, len) == 0) return i;
+  }
+  // also accept the pin number
+  char* end;
+  long pin = strtol(name, &end, 10);
+  if (end != name + len) return -1;
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (t.outputs[i].pin == pin) return i;
+  }
+  return -1;
+}
+
+
+// Comma separated list of outputs -> bits, p is moved behind the list
+static uint32_t parse_list(const gpio_table& t, const char*& p)
+{
+  uint32_t bits = 0;
+  while (!is_name_end(*p) || *p == ',') {
+    if (*p == ',') {
+      p++;
+      continue;
+    }
+    size_t len = 0;
+    while (!is_name_end(p[len])) len++;
+    int8_t i = gpio_table_find(t, p, len);
+    if (i >= 0) bits |= 1UL << i;
+    p += len;
+  }
+  return bits;
+}
+
+
+bool gpio_table_parse_request(const gpio_table& t, const char* request, uint32_t& on, uint32_t& off)
+{
+  on = 0;
+  off = 0;
+  const char* p = strstr(request, "GET /");
+  if (!p) return false;
+  p += 5;
+
+  if (strncmp(p, "gpio?", 5) == 0) {
+    p += 5;
+    while (*p && *p != ' ') {
+      if (strncmp(p, "on=", 3) == 0) {
+        p += 3;
+        on |= parse_list(t, p);
+      } else if (strncmp(p, "off=", 4) == 0) {
+        p += 4;
+        off |= parse_list(t, p);
+      } else if (strncmp(p, "state=", 6) == 0) {
+        char* end;
+        uint32_t state = strtoul(p + 6, &end, 0);
+        uint32_t all = (t.count >= 32) ? 0xFFFFFFFF : (1UL << t.count) - 1;
+        on |= state & all;
+        off |= ~state & all;
+        p = end;
+      }
+      while (*p && *p != '&' && *p != ' ') p++;
+      if (*p == '&') p++;
+    }
+    return true;
+  }
+
+  // /<name>/on, /<name>/off
+  size_t len = 0;
+  while (!is_name_end(p[len])) len++;
+  if (p[len] != '/') return false;
+  int8_t i = gpio_table_find(t, p, len);
+  if (i < 0) return false;
+  const char* action = p + len + 1;
+  if (strncmp(action, "on", 2) == 0 && is_name_end(action[2])) {
+    on = 1UL << i;
+  } else if (strncmp(action, "off", 3) == 0 && is_name_end(action[3])) {
+    off = 1UL << i;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+// /pwm?set=name:level,name:level&ms=fade time
+static bool handle_pwm_request(gpio_table& t, const char* request)
+{
+  const char* p = strstr(request, "GET /pwm?");
+  if (!p) return false;
+  p += 9;
+
+  const char* ms_arg = strstr(p, "ms=");
+  const char* space = strchr(p, ' ');
+  uint16_t ms = (ms_arg && (!space || ms_arg < space)) ? atoi(ms_arg + 3) : 0;
+
+  const char* set = strstr(p, "set=");
+  if (!set || (space && set > space)) return true;
+  p = set + 4;
+  while (*p && *p != '&' && *p != ' ') {
+    size_t len = 0;
+    while (p[len] && p[len] != ':' && !is_name_end(p[len])) len++;
+    int8_t i = gpio_table_find(t, p, len);
+    p += len;
+    if (*p == ':') {
+      long level = strtol(p + 1, (char**)&p, 10);
+      if (i >= 0) gpio_table_fade(t, i, constrain(level, 0, 255), ms);
+    }
+    if (*p == ',') p++;
+    else if (*p != '&' && *p != ' ' && *p) p++;
+  }
+  return true;
+}
+
+
+bool gpio_table_handle_request(gpio_table& t, const char* request)
+{
+  if (handle_pwm_request(t, request)) return true;
+
+  uint32_t on, off;
+  if (!gpio_table_parse_request(t, request, on, off)) return false;
+  gpio_table_apply(t, on, off);
+  return true;
+}
+
+
+void gpio_table_print_buttons(const gpio_table& t, Print& out)
+{
+  for (uint8_t i = 0; i < t.count; i++) {
+    const char* name = t.outputs[i].name;
+    bool on = gpio_table_is_on(t, i);
+    if (gpio_table_is_pwm(t, i)) {
+      out.printf("<p>GPIO %s - Level %u</p>\n", name, t.level[i]);
+      out.printf("<p><input type=\"range\" min=\"0\" max=\"255\" value=\"%u\" "
+                 "onchange=\"location='/pwm?set=%s:'+this.value+'&ms=%u'\"></p>\n",
+                 t.level[i], name, t.outputs[i].fade_ms);
+    } else {
+      out.printf("<p>GPIO %s - State %s</p>\n", name, on ? "on" : "off");
+    }
+    if (on) {
+      out.printf("<p><a href=\"/%s/off\"><button class=\"button button2\">OFF</button></a></p>\n", name);
+    } else {
+      out.printf("<p><a href=\"/%s/on\"><button class=\"button\">ON</button></a></p>\n", name);
+    }
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Table-driven GPIO outputs for the web servers of the sketches.
+//
+// The outputs are declared once in a constant table. Their state is one bit
+// per table entry, and any number of outputs can be switched with one call:
+// the bits are turned into the masks of the GPIO set and clear registers
+// (W1TS / W1TC) and written right after each other, so all outputs switching
+// on change in the same clock cycle and all switching off in the next store,
+// instead of one digitalWrite() after the other. That matters for relay banks
+// where the channels have to switch together. (Pins 32-39 of the ESP32 are in
+// a second pair of registers.)
+//
+// Example:
+//   const gpio_output outputs[] = {
+//     { 26, "26", false, false },
+//     { 27, "27", false, false },
+//   };
+//   gpio_table gpio = GPIO_TABLE(outputs);
+//   gpio_table_begin(gpio);
+//   gpio_table_apply(gpio, 0b01, 0b10);     // 26 on and 27 off together
+//
+// Web requests (see gpio_table_handle_request):
+//   GET /gpio?on=26,27&off=28      several outputs in one request
+//   GET /gpio?state=5              set the whole bitset (bit i = table entry i)
+//   GET /26/on  GET /26/off        single output, as the original sketch
+//
+// PWM outputs: an entry with pwm_freq set is driven by the LEDC peripheral
+// instead (see gpio_pwm.cpp). Its brightness is a level 0..255 that goes
+// through a gamma table, and changes are hardware fades, so dimming and soft
+// starts cost no CPU time and keep running while the web server is busy.
+// On/off requests fade such an output to 255 / 0 in fade_ms.
+//   { 26, "lamp", false, false, 5000, 12, 800 },   // 5kHz, 12bit, 0.8s soft start
+//
+//   GET /pwm?set=lamp:128,27:0&ms=2000     fade several outputs at once
+
+#define GPIO_TABLE_MAX 32
+
+struct gpio_output {
+  uint8_t pin;
+  const char* name;       // used in URLs and on the web page
+  bool active_low;        // relay boards that switch on with LOW
+  bool initial;           // state after gpio_table_begin()
+  uint32_t pwm_freq;      // 0 = plain on/off output, else PWM frequency in Hz
+  uint8_t pwm_bits;       // PWM resolution (1..14, the higher the frequency the lower)
+  uint16_t fade_ms;       // PWM: fade time of on/off requests
+};
+
+struct gpio_table {
+  const gpio_output* outputs;
+  uint8_t count;
+  uint32_t state;         // bit i = outputs[i] is on
+  uint8_t level[GPIO_TABLE_MAX];  // PWM outputs: target level 0..255
+};
+
+// Number of entries, a table larger than the state bitset doesn't compile
+template <size_t N>
+constexpr uint8_t gpio_table_count(const gpio_output (&)[N])
+{
+  static_assert(N <= GPIO_TABLE_MAX, "gpio_table: more than GPIO_TABLE_MAX outputs");
+  return N;
+}
+
+#define GPIO_TABLE(outputs) { outputs, gpio_table_count(outputs), 0 }
+
+// Configure all pins as outputs (PWM outputs on LEDC channels) and apply the
+// initial states (all together)
+void gpio_table_begin(gpio_table& t);
+
+// Switch the outputs in on and off (bit i = table entry i) with one register
+// write each for set and clear. Bits in both masks are switched on. PWM
+// outputs fade to 255 / 0 in their fade_ms instead.
+void gpio_table_apply(gpio_table& t, uint32_t on, uint32_t off);
+
+// Replace the whole state
+void gpio_table_set_state(gpio_table& t, uint32_t state);
+
+inline bool gpio_table_is_on(const gpio_table& t, uint8_t index)
+{
+  return (t.state >> index) & 1;
+}
+
+// Fade a PWM output to level (0..255, gamma corrected) in ms milliseconds,
+// 0 = at once. Returns false if the output is no PWM output.
+bool gpio_table_fade(gpio_table& t, uint8_t index, uint8_t level, uint16_t ms);
+
+inline bool gpio_table_is_pwm(const gpio_table& t, uint8_t index)
+{
+  return t.outputs[index].pwm_freq != 0;
+}
+
+// Table index of an output by name (or pin number), -1 if unknown.
+// The name ends at len characters or at the first ',', '&', ' ' or '/'.
+int8_t gpio_table_find(const gpio_table& t, const char* name, size_t len = 0);
+
+// Parse the request line of a HTTP request (e.g. "GET /gpio?on=26 HTTP/1.1")
+// into on / off masks. Returns false if it is no GPIO request.
+bool gpio_table_parse_request(const gpio_table& t, const char* request, uint32_t& on, uint32_t& off);
+
+// Parse and apply /gpio, /<name>/on|off and /pwm requests, returns false if
+// it is no GPIO request
+bool gpio_table_handle_request(gpio_table& t, const char* request);
+
+// Status lines and on/off buttons (PWM: a slider) for every output, for the
+// web page
+void gpio_table_print_buttons(const gpio_table& t, Print& out);
@@ -0,0 +1,55 @@
+#pragma once
+
+// Minimal stand-in for the Arduino core for the host benchmark: Print and the
+// Client interface, which is all http_core.cpp uses.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* data, size_t len)
+  {
+    size_t n = 0;
+    while (len--) n += write(*data++);
+    return n;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t println(const char* s = "") { return print(s) + write("\r\n"); }
+  size_t println(long v) { return print(v) + write("\r\n"); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    return write((const uint8_t*)buf, min<size_t>(n, sizeof(buf) - 1));
+  }
+};
+
+class Client : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read(uint8_t* buf, size_t size) = 0;
+  virtual uint8_t connected() = 0;
+  virtual void stop() = 0;
+  using Print::write;
+};
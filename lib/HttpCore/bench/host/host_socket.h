@@ -0,0 +1,68 @@
+#pragma once
+
+// The Arduino Client on a socket, and a listener on loopback, for the host
+// programs in bench/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Client.h"
+
+struct socket_client : public Client {
+  int fd = -1;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t len) override
+  {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = send(fd, data + done, len - done, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      done += n;
+    }
+    return done;
+  }
+  int available() override
+  {
+    int n = 0;
+    if (ioctl(fd, FIONREAD, &n) < 0) return 0;
+    return n;
+  }
+  int read(uint8_t* buf, size_t size) override { return recv(fd, buf, size, MSG_DONTWAIT); }
+  uint8_t connected() override
+  {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  void stop() override
+  {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+};
+
+
+// Non-blocking, exits if the port is taken
+inline int listen_on(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    perror("listen");
+    exit(1);
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
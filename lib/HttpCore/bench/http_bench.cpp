@@ -0,0 +1,485 @@
+// Host benchmark of the HTTP core against the old "String header" loop of
+// the sketches:
+//   1. parsing + routing of a browser request, in memory
+//   2. writes to the client for a page of ~45 lines, and chunked
+//      responses up to two full buffers (exit code 1 if one is wrong)
+//   3. requests over TCP on localhost: keep-alive, new connection per
+//      request, and the old byte by byte loop with Connection: close
+//
+//   cd lib/HttpCore
+//   g++ -O2 -std=gnu++17 -Ibench/host -I. bench/http_bench.cpp http_core.cpp -o /tmp/http_bench -lpthread
+//   /tmp/http_bench
+
+#include "http_core.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host_socket.h"
+
+static auto t0 = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static double now_us()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+static const char browser_request[] =
+  "GET /red/128 HTTP/1.1\r\n"
+  "Host: 192.168.4.1\r\n"
+  "Connection: keep-alive\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (Linux; Android 14; Pixel 7) AppleWebKit/537.36 (KHTML, like Gecko) "
+  "Chrome/126.0.0.0 Mobile Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+  "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+  "Referer: http://192.168.4.1/red/120\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: de-DE,de;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+  "\r\n";
+
+
+// ---------------------------------------------------------------------------
+// Page and routes, the size of the XIAO page
+
+static int red = 0;
+
+static void print_page(Print& out)
+{
+  out.println("<!DOCTYPE html><html>");
+  out.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  out.println("<link rel=\"icon\" href=\"data:,\">");
+  out.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
+  out.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
+  out.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
+  out.println("</style></head><body><h1>ESP32 Web Server</h1>");
+  for (int i = 0; i < 4; i++) {
+    out.printf("<p>Channel %d: %d</p>\r\n", i, red);
+    out.printf("<input type=\"range\" min=\"0\" max=\"255\" value=\"%d\" id=\"slider%d\">\r\n", red, i);
+  }
+  out.println("<script>");
+  for (int i = 0; i < 4; i++) {
+    out.printf("document.getElementById('slider%d').addEventListener('input', function() {\r\n", i);
+    out.println("  window.location = '/red/' + this.value;");
+    out.println("});");
+  }
+  for (int i = 0; i < 2; i++) {
+    out.println("<div style=\"border:1px solid #ccc; margin:10px; padding:10px; border-radius:5px;\">");
+    out.printf("<p>Turn ON at: <input type=\"number\" id=\"timer%d_1_h\" min=\"0\" max=\"23\" value=\"8\"> : ", i);
+    out.printf("<input type=\"number\" id=\"timer%d_1_m\" min=\"0\" max=\"59\" value=\"0\"></p>\r\n", i);
+    out.println("</div>");
+  }
+  out.println("</script></body></html>");
+}
+
+static void handle_red(http_request& req, http_response& res)
+{
+  red = atoi(req.rest);
+  print_page(res);
+}
+
+static void handle_page(http_request&, http_response& res)
+{
+  print_page(res);
+}
+
+static const http_route routes[] = {
+  { HTTP_GET, "/brightness/*", handle_red },
+  { HTTP_GET, "/red/*", handle_red },
+  { HTTP_GET, "/green/*", handle_red },
+  { HTTP_GET, "/blue/*", handle_red },
+  { HTTP_GET, "/settime/*", handle_red },
+  { HTTP_GET, "/settimer/*", handle_red },
+  { HTTP_GET, "*", handle_page },
+};
+static http_server web = HTTP_SERVER(routes);
+
+
+// Old loop: every byte appended to a String, routing with indexOf
+static int old_route(const std::string& header)
+{
+  static const char* prefixes[] = { "GET /brightness/", "GET /red/", "GET /green/", "GET /blue/",
+                                    "GET /settime/", "GET /settimer/" };
+  for (int i = 0; i < 6; i++) {
+    size_t at = header.find(prefixes[i]);
+    if (at != std::string::npos) {
+      size_t start = at + strlen(prefixes[i]);
+      size_t end = header.find(' ', start);
+      return atoi(header.substr(start, end - start).c_str());
+    }
+  }
+  return -1;
+}
+
+
+// ---------------------------------------------------------------------------
+// 1. Parsing + routing in memory
+
+static volatile int sink;
+
+static void bench_parse()
+{
+  const int count = 200000;
+  const size_t len = sizeof(browser_request) - 1;
+
+  double start = now_us();
+  for (int n = 0; n < count; n++) {
+    std::string header, current_line;
+    for (size_t i = 0; i < len; i++) {
+      char c = browser_request[i];
+      header += c;
+      if (c == '\n') {
+        if (current_line.empty()) break;
+        current_line.clear();
+      } else if (c != '\r') {
+        current_line += c;
+      }
+    }
+    sink = old_route(header);
+  }
+  double old_ns = (now_us() - start) * 1000 / count;
+
+  http_request req;
+  start = now_us();
+  for (int n = 0; n < count; n++) {
+    memcpy(req.buf, browser_request, len);
+    req.len = len;
+    req.scanned = 0;
+    req.header_len = 0;
+    req.header_count = 0;
+    http_parse(req);
+    // routing as the server does it
+    for (const http_route& r : routes) {
+      size_t l = strlen(r.path);
+      if (r.path[l - 1] == '*' && strncmp(req.path, r.path, l - 1) == 0) {
+        sink = atoi(req.path + l - 1);
+        break;
+      }
+    }
+  }
+  double new_ns = (now_us() - start) * 1000 / count;
+
+  printf("parse + route, %u byte request:  String loop %.0f ns   http_core %.0f ns   (%.1fx)\n",
+         (unsigned)len, old_ns, new_ns, old_ns / new_ns);
+}
+
+
+// ---------------------------------------------------------------------------
+// 2. Client writes for one page
+
+struct counting_client : public Client {
+  size_t writes = 0, bytes = 0;
+  size_t write(uint8_t) override { writes++; bytes++; return 1; }
+  size_t write(const uint8_t*, size_t len) override { writes++; bytes += len; return len; }
+  int available() override { return 0; }
+  int read(uint8_t*, size_t) override { return 0; }
+  uint8_t connected() override { return 1; }
+  void stop() override {}
+};
+
+static void bench_writes()
+{
+  // println on the Arduino Print is two writes (text, CRLF), every one a
+  // TCP segment of its own with Nagle off
+  counting_client old_client;
+  print_page(old_client);
+
+  counting_client new_client;
+  http_response& res = web.res;
+  res.client = &new_client;
+  res.status = 200;
+  res.type = "text/html";
+  res.extra_len = 0;
+  res.len = 0;
+  res.sent_head = false;
+  res.chunked = true;
+  res.keep_alive = true;
+  res.head_only = false;
+  res.failed = false;
+  res.bytes = 0;
+  print_page(res);
+  http_finish(res);
+
+  printf("page of %u bytes:  String loop %u client writes   http_core %u writes (%u bytes with header)\n",
+         (unsigned)old_client.bytes, (unsigned)old_client.writes, (unsigned)new_client.writes,
+         (unsigned)new_client.bytes);
+}
+
+
+struct capture_client : public Client {
+  std::string out;
+  size_t write(uint8_t c) override { out += (char)c; return 1; }
+  size_t write(const uint8_t* data, size_t len) override { out.append((const char*)data, len); return len; }
+  int available() override { return 0; }
+  int read(uint8_t*, size_t) override { return 0; }
+  uint8_t connected() override { return 1; }
+  void stop() override {}
+};
+
+// Chunked bodies up to two full buffers: the chunk CRLF and the last chunk
+// go behind the body in res.buf and must not reach the fields after it
+static bool test_chunked()
+{
+  bool ok = true;
+  http_response& res = web.res;
+  std::string body;
+  for (size_t n = 0; n <= 2 * HTTP_BODY_MAX + 1 && ok; n++) {
+    capture_client client;
+    res.client = &client;
+    res.status = 200;
+    res.type = "text/plain";
+    res.extra_len = 0;
+    res.len = 0;
+    res.sent_head = false;
+    res.chunked = true;
+    res.keep_alive = true;
+    res.head_only = false;
+    res.failed = false;
+    res.bytes = 0;
+    body.resize(n);
+    for (size_t i = 0; i < n; i++) body[i] = 'a' + i % 26;
+    res.write((const uint8_t*)body.data(), n);
+    http_finish(res);
+
+    uint8_t flags[3];
+    memcpy(&flags[0], &res.sent_head, 1);
+    memcpy(&flags[1], &res.chunked, 1);
+    memcpy(&flags[2], &res.keep_alive, 1);
+    ok = flags[0] == 1 && flags[1] <= 1 && flags[2] == 1;
+
+    // Content-Length for one buffer, else chunks
+    std::string got;
+    size_t pos = client.out.find("\r\n\r\n") + 4;
+    if (client.out.find("Transfer-Encoding: chunked") < pos) {
+      for (;;) {
+        size_t size = strtoul(client.out.c_str() + pos, NULL, 16);
+        pos = client.out.find("\r\n", pos) + 2;
+        if (!size) break;
+        got.append(client.out, pos, size);
+        pos += size + 2;
+      }
+      ok = ok && pos + 2 == client.out.size();
+    } else {
+      got = client.out.substr(pos);
+    }
+    ok = ok && got == body;
+    if (!ok) printf("chunked response of %u bytes: wrong\n", (unsigned)n);
+  }
+  printf("chunked responses of 0..%u bytes: %s\n", 2 * HTTP_BODY_MAX + 1, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+
+// ---------------------------------------------------------------------------
+// 3. TCP on localhost
+
+struct stdout_print : public Print {
+  size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t* data, size_t len) override { return fwrite(data, 1, len, stdout); }
+};
+
+static std::atomic<bool> running;
+
+// Same as http_server_poll() on the ESP32, with sockets
+static void core_server(uint16_t port)
+{
+  int listener = listen_on(port);
+  socket_client clients[HTTP_MAX_CONNECTIONS];
+  while (running) {
+    http_server_tick(web, micros());
+    int fd = accept(listener, NULL, NULL);
+    if (fd >= 0) {
+      int8_t slot = http_server_free_slot(web);
+      if (slot < 0) {
+        close(fd);
+      } else {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        clients[slot].fd = fd;
+        http_connection_open(web, slot, &clients[slot]);
+      }
+    }
+    for (http_connection& c : web.conn) http_connection_poll(web, c);
+    std::this_thread::yield();
+  }
+  for (http_connection& c : web.conn) http_connection_close(web, c);
+  close(listener);
+}
+
+// The loop of the sketches: byte by byte into a String, println per line
+static void old_server(uint16_t port)
+{
+  int listener = listen_on(port);
+  while (running) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    socket_client client;
+    client.fd = fd;
+    std::string header, current_line;
+    while (client.connected()) {
+      if (client.available()) {
+        uint8_t c;
+        client.read(&c, 1);
+        header += c;
+        if (c == '\n') {
+          if (current_line.empty()) {
+            red = old_route(header);
+            client.println("HTTP/1.1 200 OK");
+            client.println("Content-type:text/html");
+            client.println("Connection: close");
+            client.println();
+            print_page(client);
+            client.println();
+            break;
+          }
+          current_line.clear();
+        } else if (c != '\r') {
+          current_line += c;
+        }
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    client.stop();
+  }
+  close(listener);
+}
+
+static int connect_to(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// Read one response: until the connection is closed, or the end of the
+// Content-Length / chunked body on a kept connection. keep_alive is cleared
+// when the server closes the connection (after HTTP_MAX_REQUESTS).
+static bool read_response(int fd, bool& keep_alive)
+{
+  static char buf[16384];
+  size_t len = 0;
+  for (;;) {
+    ssize_t n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+    if (n <= 0) return !keep_alive && len > 0;
+    len += n;
+    buf[len] = 0;
+    if (!keep_alive) continue;
+    const char* body = strstr(buf, "\r\n\r\n");
+    if (!body) continue;
+    body += 4;
+    if (strcasestr(buf, "Connection: close")) {
+      keep_alive = false;
+      continue;
+    }
+    const char* cl = strcasestr(buf, "Content-Length:");
+    if (cl && cl < body) {
+      if (len - (body - buf) >= strtoul(cl + 15, NULL, 10)) return true;
+    } else if (len >= 5 && memcmp(buf + len - 5, "0\r\n\r\n", 5) == 0) {
+      return true;
+    }
+  }
+}
+
+static void run_clients(const char* name, uint16_t port, bool keep_alive, int count)
+{
+  char request[sizeof(browser_request) + 32];
+  std::string r = browser_request;
+  if (!keep_alive) r.replace(r.find("keep-alive"), 10, "close");
+  strcpy(request, r.c_str());
+
+  std::vector<double> latency;
+  latency.reserve(count);
+  int fd = -1;
+  double start = now_us();
+  for (int i = 0; i < count; i++) {
+    double t = now_us();
+    if (fd < 0) fd = connect_to(port);
+    send(fd, request, strlen(request), MSG_NOSIGNAL);
+    bool kept = keep_alive;
+    if (!read_response(fd, kept)) {
+      printf("%s: request %d failed\n", name, i);
+      break;
+    }
+    if (!kept) {
+      close(fd);
+      fd = -1;
+    }
+    latency.push_back(now_us() - t);
+  }
+  double total = now_us() - start;
+  if (fd >= 0) close(fd);
+
+  std::sort(latency.begin(), latency.end());
+  size_t n = latency.size();
+  if (!n) return;
+  printf("%-34s %6.0f requests/s   latency p50 %5.0f us  p99 %5.0f us\n", name, n * 1e6 / total,
+         latency[n / 2], latency[n * 99 / 100]);
+}
+
+static void bench_tcp()
+{
+  const int count = 3000;
+  running = true;
+  std::thread core(core_server, 18080);
+  std::thread old(old_server, 18081);
+  delay(50);
+  run_clients("http_core, keep-alive", 18080, true, count);
+  run_clients("http_core, connection per request", 18080, false, count);
+  run_clients("String loop, connection per request", 18081, false, count);
+  running = false;
+  core.join();
+  old.join();
+  stdout_print out;
+  http_print_stats(web, out);
+}
+
+
+int main()
+{
+  bench_parse();
+  bench_writes();
+  bool ok = test_chunked();
+  bench_tcp();
+  return ok ? 0 : 1;
+}
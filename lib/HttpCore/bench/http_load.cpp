@@ -0,0 +1,537 @@
+// Load test of the web servers of the sketches, against a device or the
+// core on this host:
+//
+//   cd lib/HttpCore
+//   g++ -O2 -std=gnu++17 -Ibench/host -I. bench/http_load.cpp http_core.cpp -o /tmp/http_load -lpthread
+//   /tmp/http_load [-p xiao|frame|xmas] [-c 1,2,4,8] [-t seconds] [-l slow clients] [address[:port]]
+//
+// Phones, each on one keep-alive connection like a browser tab: load the
+// page (XIAO: and /api/state), wait a moment, drag a slider for 0.5..2 s
+// (XIAO: a PATCH /api/state per input event, the next one when the answer
+// is there, as the page does), wait 1..3 s, again. The picture frame and
+// the Christmas sketch only get page loads, their buttons switch outputs.
+// Slow clients send a request a byte every 500 ms, half of them in the
+// header, half in the body of a PATCH.
+//
+// The sweep runs t seconds per number of phones (-c) and prints per route
+// requests/s, latency percentiles and errors (no connection, no answer
+// within 5 s, closed, status 4xx / 5xx; resent: sent again on a new
+// connection, as browsers do when the server closed an idle one). Then
+// from GET /stats?clear=1 (/pipeline on the picture frame) how far apart
+// loop() polled the server and, on the XIAO, how late check_timers() saw
+// the minute changes.
+//
+// Without an address the core runs in this process on loopback with the
+// loop of the XIAO around it: a strip frame of 1.2 ms every 4 ms (show()
+// waits for the LEDs), a "minute change" every second, and answers of the
+// size of the real ones.
+
+#include "http_core.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "host_socket.h"
+
+#define LOAD_NATIVE_PORT 18090
+#define LOAD_TIMEOUT_MS 5000        // no answer: error
+#define LOAD_INPUT_MS 16            // slider input events, ~60 per second
+#define LOAD_SLOW_BYTE_MS 500
+
+static auto t0 = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static double now_ms()
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+
+// ---------------------------------------------------------------------------
+// Native target: the core in the loop of the XIAO
+
+static int brightness = 50;
+static uint32_t timer_edges, timer_late_max_ms, timer_late;
+static std::atomic<bool> serving;
+extern http_server web;
+
+// ~5.7 KB like the XIAO page
+static void print_page(Print& out)
+{
+  out.println("<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  for (int i = 0; i < 60; i++) {
+    out.printf("<p>Setting %d: <input type=\"range\" min=\"0\" max=\"100\" value=\"%d\" id=\"s%d\"></p>\r\n", i,
+               brightness, i);
+  }
+  out.println("<script>function patch(change) { fetch('/api/state', { method: 'PATCH', body: change }); }</script>");
+  out.println("</body></html>");
+}
+
+// ~0.6 KB like /api/state
+static void print_state(Print& out)
+{
+  out.printf("{\"brightness\":%d,\"mode\":\"rgb\",\"red\":255,\"green\":255,\"blue\":255,\"hue\":0,\"sat\":255,"
+             "\"kelvin\":2700,\"time\":1760000000,\"local_time\":\"2025-10-09 10:53:20\",\"tz\":1,\"auto_dst\":true,",
+             brightness);
+  out.print("\"group_role\":\"off\",\"group_id\":1,\"group_synced\":false,\"group_error_ms\":0,\"power\":{\"budget_ma\""
+            ":2000,\"ma\":0,\"limit\":100,\"limited_frames\":0,\"r_ua\":12000,\"g_ua\":12000,\"b_ua\":12000,\"idle_ua\""
+            ":700},\"sntp\":{\"server\":\"pool.ntp.org\",\"synced\":false,\"last_sync\":0,\"offset_ms\":0},\"timers\":"
+            "[{\"enabled\":false,\"on_h\":7,\"on_m\":0,\"off_h\":8,\"off_m\":0},{\"enabled\":false,\"on_h\":18,"
+            "\"on_m\":0,\"off_h\":23,\"off_m\":0}]}");
+}
+
+static void handle_state(http_request&, http_response& res)
+{
+  http_status(res, 200, "application/json");
+  print_state(res);
+}
+
+static void handle_patch(http_request& req, http_response& res)
+{
+  char body[512];
+  size_t len = 0, n;
+  while (len < sizeof(body) - 1 && (n = http_read_body(req, (uint8_t*)body + len, sizeof(body) - 1 - len)) > 0) {
+    len += n;
+  }
+  body[len] = 0;
+  const char* b = strstr(body, "\"brightness\":");
+  if (b) brightness = atoi(b + 13);
+  handle_state(req, res);
+}
+
+static void handle_page(http_request&, http_response& res)
+{
+  print_page(res);
+}
+
+static void handle_stats(http_request& req, http_response& res)
+{
+  http_status(res, 200, "text/plain");
+  http_print_stats(web, res);
+  res.printf("Timers: %lu minute changes, up to %lu ms late, %lu times over %u ms\n", (unsigned long)timer_edges,
+             (unsigned long)timer_late_max_ms, (unsigned long)timer_late, 10);
+  if (http_query_int(req, "clear", 0)) {
+    http_clear_stats(web);
+    timer_edges = timer_late_max_ms = timer_late = 0;
+  }
+}
+
+static const http_route routes[] = {
+  { HTTP_GET, "/api/state", handle_state },
+  { HTTP_PATCH, "/api/state", handle_patch },
+  { HTTP_GET, "/stats", handle_stats },
+  { HTTP_GET, "*", handle_page },
+};
+http_server web = HTTP_SERVER(routes);
+
+static void busy_us(uint32_t us)
+{
+  uint32_t start = micros();
+  while (micros() - start < us) {}
+}
+
+// loop() of the XIAO: RTC / timers, the server, a strip frame
+static void native_loop(uint16_t port)
+{
+  int listener = listen_on(port);
+  socket_client clients[HTTP_MAX_CONNECTIONS];
+  uint32_t frame_us = micros();
+  uint32_t edge_us = micros() + 1000000;
+  while (serving) {
+    uint32_t now = micros();
+    if ((int32_t)(now - edge_us) >= 0) {
+      uint32_t late = (now - edge_us) / 1000;
+      timer_edges++;
+      if (late > timer_late_max_ms) timer_late_max_ms = late;
+      if (late > 10) timer_late++;
+      edge_us += 1000000;
+    }
+    http_server_tick(web, now);
+    // as http_server_poll(): without a free slot the client waits in the backlog
+    pollfd waiting = { listener, POLLIN, 0 };
+    int8_t slot = poll(&waiting, 1, 0) > 0 ? http_server_free_slot(web) : -1;
+    int fd = slot >= 0 ? accept(listener, NULL, NULL) : -1;
+    if (fd >= 0) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      clients[slot].fd = fd;
+      http_connection_open(web, slot, &clients[slot]);
+    }
+    for (http_connection& c : web.conn) http_connection_poll(web, c);
+    if (now - frame_us >= 4000) {
+      frame_us = now;
+      busy_us(1200);
+    }
+  }
+  for (http_connection& c : web.conn) http_connection_close(web, c);
+  close(listener);
+}
+
+
+// ---------------------------------------------------------------------------
+// Clients
+
+enum profile { PROFILE_XIAO, PROFILE_FRAME, PROFILE_XMAS };
+
+static sockaddr_in target;
+static profile traffic = PROFILE_XIAO;
+
+struct route_result {
+  std::vector<double> ms;
+  uint32_t errors = 0;
+  uint32_t resent = 0;              // on a new connection, see request()
+};
+
+struct results {
+  std::mutex lock;
+  std::map<std::string, route_result> routes;
+  uint32_t slow_requests = 0;       // slow clients that got to the end of their request
+  uint32_t slow_dropped = 0;        // closed by the server before
+  double slow_held_ms = 0;          // connection time until then
+};
+
+struct connection {
+  int fd = -1;
+  void drop()
+  {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+};
+
+static int connect_target()
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval tv = { LOAD_TIMEOUT_MS / 1000, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (sockaddr*)&target, sizeof(target)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const std::string& s)
+{
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+// One response: status, -1 if the connection ended or timed out before it
+// was complete, -2 if it ended before any byte of it. keep_alive is cleared
+// on "Connection: close".
+static int read_response(int fd, bool& keep_alive)
+{
+  std::string buf;
+  char chunk[4096];
+  size_t body = std::string::npos;
+  for (;;) {
+    if (body == std::string::npos) {
+      size_t end = buf.find("\r\n\r\n");
+      if (end != std::string::npos) body = end + 4;
+    }
+    if (body != std::string::npos) {
+      std::string head = buf.substr(0, body);
+      for (char& c : head) c = tolower(c);
+      if (head.find("connection: close") != std::string::npos) keep_alive = false;
+      size_t cl = head.find("content-length:");
+      bool complete = cl != std::string::npos ? buf.size() - body >= strtoul(head.c_str() + cl + 15, NULL, 10)
+                    : head.find("transfer-encoding: chunked") != std::string::npos
+                      ? buf.size() >= body + 5 && buf.compare(buf.size() - 5, 5, "0\r\n\r\n") == 0
+                      : false;
+      if (complete) return atoi(buf.c_str() + 9);
+    }
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      // without a length the end of the connection ends the body
+      keep_alive = false;
+      if (buf.empty()) return -2;
+      return body != std::string::npos && n == 0 ? atoi(buf.c_str() + 9) : -1;
+    }
+    buf.append(chunk, n);
+  }
+}
+
+// One request on the keep-alive connection, reconnects if the server closed
+// it meanwhile. Status, -1 on errors. Like a browser it is sent again on a
+// new connection if the reused one ended before the answer began: the
+// server closes idle connections when its slots are taken.
+static int request(connection& c, const char* method, const char* path, const std::string& body, double& ms,
+                   bool& resent)
+{
+  if (c.fd >= 0) {
+    char b;
+    ssize_t n = recv(c.fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) c.drop();
+  }
+  std::string r = std::string(method) + " " + path + " HTTP/1.1\r\nHost: device\r\nConnection: keep-alive\r\n";
+  if (!body.empty()) {
+    r += "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  r += "\r\n" + body;
+
+  double start = now_ms();
+  int status = -1;
+  resent = false;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused = c.fd >= 0;
+    if (c.fd < 0) c.fd = connect_target();
+    bool keep_alive = true;
+    bool sent = c.fd >= 0 && send_all(c.fd, r);
+    status = sent ? read_response(c.fd, keep_alive) : -2;
+    if (status < 0 || !keep_alive) c.drop();
+    if (status != -2 || !reused) break;
+    resent = true;
+  }
+  ms = now_ms() - start;
+  return status;
+}
+
+static void record(results& out, const std::string& route, int status, double ms, bool resent)
+{
+  std::lock_guard<std::mutex> guard(out.lock);
+  route_result& r = out.routes[route];
+  if (status >= 200 && status < 400) r.ms.push_back(ms);
+  else r.errors++;
+  if (resent) r.resent++;
+}
+
+static void wait_until(double t, double end)
+{
+  double now = now_ms();
+  double until = std::min(t, end);
+  if (until > now) delay((unsigned long)(until - now));
+}
+
+static void phone(double end, unsigned seed, results& out)
+{
+  std::mt19937 rng(seed);
+  connection c;
+  double ms;
+  int status;
+  bool resent;
+  while (now_ms() < end) {
+    status = request(c, "GET", "/", "", ms, resent);
+    record(out, "GET /", status, ms, resent);
+    if (traffic == PROFILE_XIAO && now_ms() < end) {
+      status = request(c, "GET", "/api/state", "", ms, resent);
+      record(out, "GET /api/state", status, ms, resent);
+    }
+    wait_until(now_ms() + 500 + rng() % 1000, end);
+
+    if (traffic == PROFILE_XIAO) {
+      // the page sends the next PATCH when the answer is there, with what
+      // the input events changed meanwhile
+      double drag_end = now_ms() + 500 + rng() % 1500;
+      int value = rng() % 101;
+      while (now_ms() < std::min(drag_end, end)) {
+        double start = now_ms();
+        value = std::max(0, std::min(100, value + (int)(rng() % 7) - 3));
+        status = request(c, "PATCH", "/api/state", "{\"brightness\":" + std::to_string(value) + "}", ms, resent);
+        record(out, "PATCH /api/state", status, ms, resent);
+        wait_until(start + LOAD_INPUT_MS, end);
+      }
+    }
+    wait_until(now_ms() + 1000 + rng() % 2000, end);
+  }
+  c.drop();
+}
+
+// A byte every LOAD_SLOW_BYTE_MS, in the header or in the body
+static void slow_client(double end, bool in_body, results& out)
+{
+  while (now_ms() < end) {
+    int fd = connect_target();
+    if (fd < 0) {
+      delay(100);
+      continue;
+    }
+    double start = now_ms();
+    std::string r = in_body ? "PATCH /api/state HTTP/1.1\r\nHost: device\r\nContent-Length: 20\r\n\r\n"
+                            : "GET / HTTP/1.1\r\nHost: device\r\n";
+    std::string rest = in_body ? "{\"brightness\":50}   " : "X-Slow: 0123456789abcdef\r\n\r\n";
+    bool closed = !send_all(fd, r);
+    size_t sent = 0;
+    while (!closed && sent < rest.size() && now_ms() < end) {
+      delay(LOAD_SLOW_BYTE_MS);
+      closed = !send_all(fd, rest.substr(sent++, 1));
+      char b;
+      ssize_t n = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      // an answer (408) or the end before the request is complete
+      if (n >= 0 && sent < rest.size()) closed = true;
+    }
+    close(fd);
+    std::lock_guard<std::mutex> guard(out.lock);
+    if (sent == rest.size()) out.slow_requests++;
+    else if (closed) out.slow_dropped++;
+    out.slow_held_ms += now_ms() - start;
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Stats of the target and the sweep
+
+static const char* stats_path()
+{
+  return traffic == PROFILE_FRAME ? "/pipeline?clear=1" : "/stats?clear=1";
+}
+
+// Lines of the stats that start with "HTTP: loop" or "Timers:", "" if none
+static std::string fetch_stats()
+{
+  connection c;
+  std::string lines;
+  c.fd = connect_target();
+  if (c.fd < 0) return lines;
+  std::string r = std::string("GET ") + stats_path() + " HTTP/1.1\r\nHost: device\r\nConnection: close\r\n\r\n";
+  send_all(c.fd, r);
+  std::string buf;
+  char chunk[2048];
+  ssize_t n;
+  while ((n = recv(c.fd, chunk, sizeof(chunk), 0)) > 0) buf.append(chunk, n);
+  c.drop();
+  for (const char* key : { "HTTP: loop", "Timers:" }) {
+    size_t at = buf.find(key);
+    if (at != std::string::npos) lines += "  " + buf.substr(at, buf.find('\n', at) - at) + "\n";
+  }
+  return lines;
+}
+
+static double percentile(const std::vector<double>& v, int p)
+{
+  return v.empty() ? 0 : v[std::min(v.size() - 1, v.size() * p / 100)];
+}
+
+static void run_step(int phones, int slow, double seconds)
+{
+  fetch_stats();                    // clears them
+  results out;
+  double start = now_ms(), end = start + seconds * 1000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < phones; i++) threads.emplace_back(phone, end, 1000 + i, std::ref(out));
+  for (int i = 0; i < slow; i++) threads.emplace_back(slow_client, end, i % 2 == 1, std::ref(out));
+  for (std::thread& t : threads) t.join();
+  double elapsed = (now_ms() - start) / 1000;
+
+  uint32_t total = 0, errors = 0;
+  for (auto& r : out.routes) {
+    total += r.second.ms.size() + r.second.errors;
+    errors += r.second.errors;
+  }
+  printf("%d phones, %d slow clients, %.0f s: %.1f requests/s, %u errors\n", phones, slow, elapsed, total / elapsed,
+         errors);
+  printf("  %-18s %7s %7s %7s %7s %7s %7s %7s\n", "route", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "errors",
+         "resent");
+  for (auto& r : out.routes) {
+    std::vector<double>& ms = r.second.ms;
+    std::sort(ms.begin(), ms.end());
+    printf("  %-18s %7.1f %7.1f %7.1f %7.1f %7.1f %7u %7u\n", r.first.c_str(), (ms.size() + r.second.errors) / elapsed,
+           percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), ms.empty() ? 0 : ms.back(), r.second.errors,
+           r.second.resent);
+  }
+  if (slow) {
+    printf("  slow clients: %u requests completed, %u dropped by the server, held a connection %.1f s each\n",
+           out.slow_requests, out.slow_dropped,
+           out.slow_held_ms / 1000 / std::max<uint32_t>(1, out.slow_requests + out.slow_dropped));
+  }
+  std::string stats = fetch_stats();
+  printf("%s", stats.empty() ? "  no stats from the target\n" : stats.c_str());
+}
+
+
+int main(int argc, char** argv)
+{
+  std::vector<int> sweep = { 1, 2, 4, 8 };
+  double seconds = 10;
+  int slow = 0;
+  const char* address = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      const char* p = argv[++i];
+      traffic = strcmp(p, "frame") == 0 ? PROFILE_FRAME : strcmp(p, "xmas") == 0 ? PROFILE_XMAS : PROFILE_XIAO;
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      sweep.clear();
+      for (char* s = argv[++i]; *s; s += *s == ',') sweep.push_back(strtol(s, &s, 10));
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      slow = atoi(argv[++i]);
+    } else {
+      address = argv[i];
+    }
+  }
+
+  std::thread server;
+  target.sin_family = AF_INET;
+  if (address) {
+    std::string host = address;
+    size_t colon = host.find(':');
+    target.sin_port = htons(colon == std::string::npos ? 80 : atoi(host.c_str() + colon + 1));
+    if (colon != std::string::npos) host.resize(colon);
+    addrinfo hints = {}, *ai;
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host.c_str(), NULL, &hints, &ai) != 0) {
+      printf("%s: unknown host\n", host.c_str());
+      return 2;
+    }
+    target.sin_addr = ((sockaddr_in*)ai->ai_addr)->sin_addr;
+    freeaddrinfo(ai);
+    printf("target %s:%u\n", host.c_str(), ntohs(target.sin_port));
+  } else {
+    traffic = PROFILE_XIAO;
+    serving = true;
+    server = std::thread(native_loop, LOAD_NATIVE_PORT);
+    target.sin_port = htons(LOAD_NATIVE_PORT);
+    target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    delay(50);
+    printf("target: http_core on loopback in the loop of the XIAO\n");
+  }
+  int probe = connect_target();
+  if (probe < 0) {
+    printf("no connection\n");
+    serving = false;
+    if (server.joinable()) server.join();
+    return 2;
+  }
+  close(probe);
+
+  for (int phones : sweep) run_step(phones, slow, seconds);
+  serving = false;
+  if (server.joinable()) server.join();
+  return 0;
+}
@@ -0,0 +1,666 @@
+#include "http_core.h"
+
+#include <strings.h>
+
+// Room in front of the body in http_response.buf for status line, headers
+// and the chunk size, the body follows at BODY_START
+#define BODY_START (HTTP_EXTRA_MAX + 160)
+
+
+static const char* method_name(uint8_t method)
+{
+  switch (method) {
+    case HTTP_GET: return "GET";
+    case HTTP_POST: return "POST";
+    case HTTP_PUT: return "PUT";
+    case HTTP_PATCH: return "PATCH";
+    case HTTP_DELETE: return "DELETE";
+    case HTTP_HEAD: return "HEAD";
+  }
+  return "?";
+}
+
+
+static const char* status_text(uint16_t status)
+{
+  switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 415: return "Unsupported Media Type";
+    case 422: return "Unprocessable Entity";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+  }
+  return "";
+}
+
+
+// ---------------------------------------------------------------------------
+// Request parser
+
+static void reset_request(http_request& req)
+{
+  req.scanned = 0;
+  req.header_len = 0;
+  req.method = 0;
+  req.version = 1;
+  req.keep_alive = false;
+  req.path = "";
+  req.query = "";
+  req.rest = "";
+  req.header_count = 0;
+  req.content_length = 0;
+  req.body_read = 0;
+}
+
+
+// Null terminate the line starting at p, returns the start of the next line
+static char* cut_line(char* p)
+{
+  char* nl = strchr(p, '\n');
+  if (!nl) return p + strlen(p);
+  if (nl > p && nl[-1] == '\r') nl[-1] = 0;
+  *nl = 0;
+  return nl + 1;
+}
+
+
+static bool parse_request_line(http_request& req, char* line)
+{
+  char* target = strchr(line, ' ');
+  if (!target) return false;
+  *target++ = 0;
+  char* version = strchr(target, ' ');
+  if (!version) return false;
+  *version++ = 0;
+
+  if (strcmp(line, "GET") == 0) req.method = HTTP_GET;
+  else if (strcmp(line, "POST") == 0) req.method = HTTP_POST;
+  else if (strcmp(line, "PUT") == 0) req.method = HTTP_PUT;
+  else if (strcmp(line, "PATCH") == 0) req.method = HTTP_PATCH;
+  else if (strcmp(line, "DELETE") == 0) req.method = HTTP_DELETE;
+  else if (strcmp(line, "HEAD") == 0) req.method = HTTP_HEAD;
+  else return false;
+
+  if (strncmp(version, "HTTP/1.", 7) != 0) return false;
+  req.version = (version[7] == '0') ? 0 : 1;
+
+  if (*target != '/') return false;
+  char* query = strchr(target, '?');
+  if (query) *query++ = 0;
+  req.path = target;
+  req.query = query ? query : "";
+  return true;
+}
+
+
+http_parse_result http_parse(http_request& req)
+{
+  if (req.header_len) return HTTP_PARSE_DONE;
+
+  // empty lines in front of a request are allowed (RFC 9112 2.2)
+  if (req.scanned == 0) {
+    uint16_t skip = 0;
+    while (skip < req.len && (req.buf[skip] == '\r' || req.buf[skip] == '\n')) skip++;
+    if (skip) {
+      memmove(req.buf, req.buf + skip, req.len - skip);
+      req.len -= skip;
+    }
+  }
+
+  // the header ends with an empty line, "\n\r\n" or "\n\n"
+  uint16_t end = 0;
+  uint16_t i = req.scanned;
+  while (i < req.len) {
+    const char* nl = (const char*)memchr(req.buf + i, '\n', req.len - i);
+    if (!nl) {
+      i = req.len;
+      break;
+    }
+    uint16_t p = nl - req.buf;
+    if (p + 1 < req.len && req.buf[p + 1] == '\n') {
+      end = p + 2;
+      break;
+    }
+    if (p + 2 < req.len && req.buf[p + 1] == '\r' && req.buf[p + 2] == '\n') {
+      end = p + 3;
+      break;
+    }
+    if (p + 1 >= req.len || (p + 2 >= req.len && req.buf[p + 1] == '\r')) {
+      // can't tell yet, look at this newline again with the next bytes
+      i = p;
+      break;
+    }
+    i = p + 1;
+  }
+  if (!end) {
+    req.scanned = i;
+    return (req.len >= HTTP_HEADER_MAX) ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_MORE;
+  }
+
+  // the empty line becomes the terminator of the last header line
+  req.buf[end - 1] = 0;
+  char* line = req.buf;
+  char* next = cut_line(line);
+  if (!parse_request_line(req, line)) return HTTP_PARSE_BAD;
+
+  bool close = false, keep_alive = false;
+  while (next < req.buf + end - 1 && *next && *next != '\r') {
+    line = next;
+    next = cut_line(line);
+    char* colon = strchr(line, ':');
+    if (!colon) return HTTP_PARSE_BAD;
+    *colon = 0;
+    char* value = colon + 1;
+    while (*value == ' ' || *value == '\t') value++;
+    char* value_end = value + strlen(value);
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) *--value_end = 0;
+
+    if (strcasecmp(line, "Content-Length") == 0) {
+      req.content_length = strtoul(value, NULL, 10);
+    } else if (strcasecmp(line, "Connection") == 0) {
+      close = strcasestr(value, "close") != NULL;
+      keep_alive = strcasestr(value, "keep-alive") != NULL;
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+      // chunked request bodies are not supported, nobody sends them here
+      return HTTP_PARSE_BAD;
+    }
+    if (req.header_count < HTTP_MAX_HEADERS) {
+      req.headers[req.header_count].name = line;
+      req.headers[req.header_count].value = value;
+      req.header_count++;
+    }
+  }
+  req.keep_alive = req.version ? !close : keep_alive;
+  req.header_len = end;
+  return HTTP_PARSE_DONE;
+}
+
+
+void http_request_next(http_request& req)
+{
+  uint32_t used = req.header_len + req.content_length;
+  if (req.header_len && used < req.len) {
+    memmove(req.buf, req.buf + used, req.len - used);
+    req.len -= used;
+  } else {
+    req.len = 0;
+  }
+  reset_request(req);
+}
+
+
+const char* http_header_value(const http_request& req, const char* name)
+{
+  for (uint8_t i = 0; i < req.header_count; i++) {
+    if (strcasecmp(req.headers[i].name, name) == 0) return req.headers[i].value;
+  }
+  return NULL;
+}
+
+
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+bool http_query_value(const http_request& req, const char* name, char* out, size_t size)
+{
+  size_t name_len = strlen(name);
+  const char* p = req.query;
+  while (*p) {
+    const char* end = strchr(p, '&');
+    if (!end) end = p + strlen(p);
+    if (strncmp(p, name, name_len) == 0 && (p[name_len] == '=' || p + name_len == end)) {
+      const char* v = p + name_len + (p[name_len] == '=');
+      size_t n = 0;
+      while (v < end && n + 1 < size) {
+        int hi, lo;
+        if (*v == '+') {
+          out[n++] = ' ';
+          v++;
+        } else if (*v == '%' && v + 2 < end && (hi = hex_digit(v[1])) >= 0 && (lo = hex_digit(v[2])) >= 0) {
+          out[n++] = (char)(hi << 4 | lo);
+          v += 3;
+        } else {
+          out[n++] = *v++;
+        }
+      }
+      if (size) out[n] = 0;
+      return true;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return false;
+}
+
+
+long http_query_int(const http_request& req, const char* name, long fallback)
+{
+  char value[16];
+  if (!http_query_value(req, name, value, sizeof(value)) || !value[0]) return fallback;
+  return strtol(value, NULL, 0);
+}
+
+
+size_t http_read_body(http_request& req, uint8_t* buf, size_t len)
+{
+  uint32_t left = req.content_length - req.body_read;
+  if (len > left) len = left;
+  if (!len) return 0;
+
+  // first the part that came with the header
+  uint32_t pos = req.header_len + req.body_read;
+  uint32_t buffered_end = min<uint32_t>(req.len, req.header_len + req.content_length);
+  if (pos < buffered_end) {
+    size_t n = min<size_t>(len, buffered_end - pos);
+    memcpy(buf, req.buf + pos, n);
+    req.body_read += n;
+    return n;
+  }
+
+  uint32_t start = millis();
+  for (;;) {
+    int available = req.client->available();
+    if (available > 0) {
+      int n = req.client->read(buf, min<size_t>(len, available));
+      if (n > 0) {
+        req.body_read += n;
+        return n;
+      }
+    }
+    if (!req.client->connected() || millis() - start > HTTP_BODY_TIMEOUT_MS) return 0;
+    delay(1);
+  }
+}
+
+
+const char* http_request_line(const http_request& req, char* out, size_t size)
+{
+  snprintf(out, size, "%s %s%s%s HTTP/1.%u", method_name(req.method), req.path,
+           req.query[0] ? "?" : "", req.query, req.version);
+  return out;
+}
+
+
+// ---------------------------------------------------------------------------
+// Response
+
+static void client_write(http_response& res, const uint8_t* data, size_t len)
+{
+  if (res.failed || !len) return;
+  size_t n = res.client->write(data, len);
+  res.bytes += n;
+  if (n != len) res.failed = true;
+}
+
+
+// Send the buffer with the head in front (first time) or as the next chunk.
+// last: the handler is done, so the length is known if nothing went out yet.
+static void send_buffer(http_response& res, bool last)
+{
+  char head[BODY_START];
+  size_t hl = 0;
+  uint8_t* body = res.buf + BODY_START;
+
+  if (!res.sent_head) {
+    // length known: Content-Length. Else chunked (res.chunked is set for
+    // HTTP/1.1 clients), or the end of the data is the end of the connection.
+    if (last) {
+      res.chunked = false;
+    } else if (!res.chunked) {
+      res.keep_alive = false;
+    }
+    hl += snprintf(head + hl, sizeof(head) - hl, "HTTP/1.1 %u %s\r\n", res.status, status_text(res.status));
+    if (res.type) hl += snprintf(head + hl, sizeof(head) - hl, "Content-Type: %s\r\n", res.type);
+    if (res.chunked) {
+      hl += snprintf(head + hl, sizeof(head) - hl, "Transfer-Encoding: chunked\r\n");
+    } else if (last) {
+      hl += snprintf(head + hl, sizeof(head) - hl, "Content-Length: %u\r\n", res.len);
+    }
+    hl += snprintf(head + hl, sizeof(head) - hl, "Connection: %s\r\n", res.keep_alive ? "keep-alive" : "close");
+    if (hl + res.extra_len + 2 < sizeof(head)) {
+      memcpy(head + hl, res.extra, res.extra_len);
+      hl += res.extra_len;
+    }
+    head[hl++] = '\r';
+    head[hl++] = '\n';
+    res.sent_head = true;
+  }
+
+  size_t len = res.len;
+  if (res.head_only) len = 0;
+  if (res.chunked && len) {
+    hl += snprintf(head + hl, sizeof(head) - hl, "%x\r\n", (unsigned)len);
+    body[len++] = '\r';
+    body[len++] = '\n';
+  }
+  if (res.chunked && last) {
+    memcpy(body + len, "0\r\n\r\n", 5);
+    len += 5;
+  }
+
+  // one write for head and body, they usually fit one segment together
+  memcpy(body - hl, head, hl);
+  client_write(res, body - hl, hl + len);
+  res.len = 0;
+}
+
+
+size_t http_response::write(const uint8_t* data, size_t size)
+{
+  size_t left = size;
+  while (left) {
+    size_t n = min<size_t>(left, HTTP_BODY_MAX - len);
+    memcpy(buf + BODY_START + len, data, n);
+    len += n;
+    data += n;
+    left -= n;
+    if (len == HTTP_BODY_MAX) send_buffer(*this, false);
+  }
+  return size;
+}
+
+
+size_t http_response::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+
+void http_status(http_response& res, uint16_t status, const char* type)
+{
+  res.status = status;
+  res.type = type;
+}
+
+
+void http_add_header(http_response& res, const char* name, const char* value)
+{
+  int n = snprintf(res.extra + res.extra_len, HTTP_EXTRA_MAX - res.extra_len, "%s: %s\r\n", name, value);
+  if (n > 0 && res.extra_len + n < HTTP_EXTRA_MAX) res.extra_len += n;
+}
+
+
+void http_send(http_response& res, uint16_t status, const char* type, const char* body)
+{
+  http_status(res, status, type);
+  if (body) res.print(body);
+}
+
+
+void http_finish(http_response& res)
+{
+  send_buffer(res, true);
+}
+
+
+// ---------------------------------------------------------------------------
+// Server
+
+static const http_route* find_route(const http_server& s, http_request& req, bool& wrong_method)
+{
+  uint8_t method = (req.method == HTTP_HEAD) ? HTTP_GET : req.method;
+  wrong_method = false;
+  for (uint8_t i = 0; i < s.count; i++) {
+    const http_route& r = s.routes[i];
+    size_t n = strlen(r.path);
+    const char* rest;
+    if (n && r.path[n - 1] == '*') {
+      if (strncmp(req.path, r.path, n - 1) != 0) continue;
+      rest = req.path + n - 1;
+    } else {
+      if (strcmp(req.path, r.path) != 0) continue;
+      rest = "";
+    }
+    if (!(r.methods & method)) {
+      wrong_method = true;
+      continue;
+    }
+    req.rest = rest;
+    return &r;
+  }
+  return NULL;
+}
+
+
+static void begin_response(http_server& s, http_connection& c)
+{
+  http_response& res = s.res;
+  res.client = c.client;
+  res.status = 200;
+  res.type = "text/html";
+  res.extra_len = 0;
+  res.len = 0;
+  res.sent_head = false;
+  res.chunked = c.req.version == 1;   // only used if the body gets too large
+  res.keep_alive = c.req.keep_alive && c.requests + 1 < HTTP_MAX_REQUESTS;
+  res.head_only = c.req.method == HTTP_HEAD;
+  res.failed = false;
+  res.bytes = 0;
+}
+
+
+// Error from the server itself, the connection is closed afterwards
+static void send_error(http_server& s, http_connection& c, uint16_t status)
+{
+  begin_response(s, c);
+  s.res.keep_alive = false;
+  http_send(s.res, status, "text/plain", status_text(status));
+  http_finish(s.res);
+  s.stats.errors++;
+  s.stats.bytes_out += s.res.bytes;
+  if (s.log) s.log->printf("HTTP error %u\n", status);
+}
+
+
+static void serve(http_server& s, http_connection& c)
+{
+  http_request& req = c.req;
+  http_response& res = s.res;
+  uint32_t start = micros();
+
+  begin_response(s, c);
+  // curl and others wait for this before they send a larger body
+  const char* expect = http_header_value(req, "Expect");
+  if (expect && strcasecmp(expect, "100-continue") == 0 && req.header_len + req.content_length > req.len) {
+    static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    c.client->write((const uint8_t*)cont, sizeof(cont) - 1);
+  }
+  bool wrong_method;
+  const http_route* route = find_route(s, req, wrong_method);
+  const char* name = route ? route->path : "(no route)";
+  if (s.trace) s.trace(name, false);
+  if (route) {
+    route->handler(req, res);
+  } else {
+    http_send(res, wrong_method ? 405 : 404, "text/plain", status_text(wrong_method ? 405 : 404));
+  }
+  // body not read by the handler and still at the client: the next request
+  // would start in the middle of it
+  if (req.body_read < req.content_length && req.header_len + req.content_length > req.len) {
+    res.keep_alive = false;
+  }
+  http_finish(res);
+  if (s.trace) s.trace(name, true);
+
+  uint32_t us = micros() - start;
+  s.stats.requests++;
+  s.stats.bytes_out += res.bytes;
+  s.stats.total_us += us;
+  if (us > s.stats.max_us) s.stats.max_us = us;
+  if (s.log) {
+    s.log->printf("%s %s%s%s -> %u, %lu bytes, %lu us\n", method_name(req.method), req.path,
+                  req.query[0] ? "?" : "", req.query, res.status, (unsigned long)res.bytes, (unsigned long)us);
+  }
+}
+
+
+void http_connection_open(http_server& s, uint8_t slot, Client* client)
+{
+  http_connection& c = s.conn[slot];
+  c.client = client;
+  c.req.client = client;
+  c.req.len = 0;
+  reset_request(c.req);
+  c.last_ms = c.start_ms = millis();
+  c.requests = 0;
+  s.stats.connections++;
+}
+
+
+void http_connection_close(http_server& s, http_connection& c)
+{
+  if (!c.client) return;
+  c.client->stop();
+  c.client = NULL;
+  c.req.len = 0;
+  reset_request(c.req);
+}
+
+
+int8_t http_server_free_slot(http_server& s)
+{
+  int8_t idle = -1;
+  for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    const http_connection& c = s.conn[i];
+    if (!c.client) return i;
+    if (c.req.len == 0 && (idle < 0 || (int32_t)(c.last_ms - s.conn[idle].last_ms) < 0)) idle = i;
+  }
+  if (idle >= 0) http_connection_close(s, s.conn[idle]);
+  return idle;
+}
+
+
+void http_connection_poll(http_server& s, http_connection& c)
+{
+  if (!c.client) return;
+  Client& client = *c.client;
+  http_request& req = c.req;
+  uint32_t now = millis();
+
+  int available = client.available();
+  if (available > 0 && req.len < HTTP_HEADER_MAX) {
+    int n = client.read((uint8_t*)req.buf + req.len, min(available, HTTP_HEADER_MAX - req.len));
+    if (n > 0) {
+      if (req.len == 0) c.start_ms = now;
+      req.len += n;
+      c.last_ms = now;
+      s.stats.bytes_in += n;
+    }
+  }
+
+  if (req.len) {
+    http_parse_result result = http_parse(req);
+    if (result == HTTP_PARSE_DONE) {
+      // a body that fits the buffer is awaited here, not in the handler: a
+      // slow client would hold loop() in http_read_body()
+      uint32_t end = req.header_len + req.content_length;
+      if (end <= HTTP_HEADER_MAX && req.len < end && !http_header_value(req, "Expect")) {
+        if (now - c.start_ms > HTTP_HEADER_TIMEOUT_MS) {
+          s.stats.timeouts++;
+          send_error(s, c, 408);
+          http_connection_close(s, c);
+        }
+        return;
+      }
+      serve(s, c);
+      c.requests++;
+      if (!s.res.keep_alive || s.res.failed) {
+        http_connection_close(s, c);
+        return;
+      }
+      http_request_next(req);
+      c.last_ms = c.start_ms = millis();
+    } else if (result != HTTP_PARSE_MORE) {
+      send_error(s, c, (result == HTTP_PARSE_TOO_LARGE) ? 431 : 400);
+      http_connection_close(s, c);
+    } else if (now - c.start_ms > HTTP_HEADER_TIMEOUT_MS) {
+      s.stats.timeouts++;
+      send_error(s, c, 408);
+      http_connection_close(s, c);
+    }
+    return;
+  }
+
+  if (now - c.last_ms > HTTP_KEEPALIVE_MS || !client.connected()) {
+    http_connection_close(s, c);
+  }
+}
+
+
+#ifdef ARDUINO
+void http_server_begin(http_server& s, uint16_t port)
+{
+  if (!s.listener) s.listener = new WiFiServer(port);
+  s.listener->begin();
+  s.listener->setNoDelay(true);
+}
+
+
+void http_server_poll(http_server& s)
+{
+  if (!s.listener) return;
+  http_server_tick(s, micros());
+  if (s.listener->hasClient()) {
+    // no free slot: the client waits in the backlog until one is done
+    int8_t slot = http_server_free_slot(s);
+    if (slot >= 0) {
+      s.clients[slot] = s.listener->accept();
+      if (s.clients[slot]) {
+        s.clients[slot].setNoDelay(true);
+        http_connection_open(s, slot, &s.clients[slot]);
+      }
+    }
+  }
+  for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    http_connection_poll(s, s.conn[i]);
+  }
+}
+#endif
+
+
+void http_server_tick(http_server& s, uint32_t now_us)
+{
+  http_stats& st = s.stats;
+  if (st.last_poll_us) {
+    uint32_t gap = now_us - st.last_poll_us;
+    if (gap > st.loop_max_us) st.loop_max_us = gap;
+    if (gap > HTTP_LOOP_LATE_US) st.loop_late++;
+  }
+  st.last_poll_us = now_us ? now_us : 1;
+}
+
+
+void http_print_stats(const http_server& s, Print& out)
+{
+  const http_stats& st = s.stats;
+  out.printf("HTTP: %lu requests on %lu connections, %lu errors, %lu timeouts\n",
+             (unsigned long)st.requests, (unsigned long)st.connections,
+             (unsigned long)st.errors, (unsigned long)st.timeouts);
+  out.printf("HTTP: %lu bytes in, %lu bytes out, %lu us per request (max %lu us)\n",
+             (unsigned long)st.bytes_in, (unsigned long)st.bytes_out,
+             (unsigned long)(st.requests ? st.total_us / st.requests : 0), (unsigned long)st.max_us);
+  out.printf("HTTP: loop up to %lu us between polls, %lu times over %lu us\n", (unsigned long)st.loop_max_us,
+             (unsigned long)st.loop_late, (unsigned long)HTTP_LOOP_LATE_US);
+}
+
+
+void http_clear_stats(http_server& s)
+{
+  memset(&s.stats, 0, sizeof(s.stats));
+}
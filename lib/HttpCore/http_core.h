@@ -0,0 +1,219 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#ifdef ARDUINO
+#include <WiFi.h>
+#endif
+
+// Small HTTP/1.1 server for the web pages of the sketches.
+//
+// Replaces the copied "WiFiServer + String header" loop: no String at all,
+// every connection has one fixed buffer for the request header, the client
+// is read in blocks instead of byte by byte, and the response goes out in
+// full TCP segments through one buffer. Connections stay open (keep-alive),
+// so a slider on the web page does not need a new TCP handshake per step,
+// and slow or dead clients are dropped after a timeout instead of blocking
+// loop() for good.
+//
+// Routes are a constant table, like the outputs of gpio_table:
+//   void handle_red(http_request& req, http_response& res) {
+//     red = atoi(req.rest);                  // "/red/*": rest = "128"
+//     print_page(res);
+//   }
+//   const http_route routes[] = {
+//     { HTTP_GET, "/red/*", handle_red },
+//     { HTTP_GET, "*", handle_page },        // everything else
+//   };
+//   http_server web = HTTP_SERVER(routes);
+//   setup():  http_server_begin(web, 80);
+//   loop():   http_server_poll(web);
+//
+// A handler writes the body with print / printf on res (it is a Print),
+// status and content type default to 200 text/html. Small responses get a
+// Content-Length, larger ones are sent chunked while they are written.
+//
+// Everything except http_server_begin / http_server_poll works on the
+// Arduino Client interface only, bench/ runs it on the host over sockets.
+
+#define HTTP_HEADER_MAX 1024        // request line + headers per connection
+#define HTTP_MAX_HEADERS 16
+#define HTTP_MAX_CONNECTIONS 4
+#define HTTP_BODY_MAX 1436          // response buffer = one TCP segment (lwIP MSS)
+#define HTTP_EXTRA_MAX 160          // headers added by the handler
+#define HTTP_KEEPALIVE_MS 5000      // idle connection is closed after
+#define HTTP_HEADER_TIMEOUT_MS 2000 // request header (and a body up to HTTP_HEADER_MAX) complete after
+#define HTTP_BODY_TIMEOUT_MS 2000   // no body data for
+#define HTTP_MAX_REQUESTS 100       // per connection, then it is closed
+#ifndef HTTP_LOOP_LATE_US
+#define HTTP_LOOP_LATE_US 10000     // polls further apart: loop() missed its deadlines
+#endif
+
+// Methods, also the bits of http_route.methods
+#define HTTP_GET 0x01
+#define HTTP_POST 0x02
+#define HTTP_PUT 0x04
+#define HTTP_PATCH 0x08
+#define HTTP_DELETE 0x10
+#define HTTP_HEAD 0x20              // served by the GET routes without body
+#define HTTP_ANY 0xFF
+
+enum http_parse_result {
+  HTTP_PARSE_MORE,                  // header not complete yet
+  HTTP_PARSE_DONE,
+  HTTP_PARSE_BAD,                   // 400
+  HTTP_PARSE_TOO_LARGE,             // 431, header does not fit the buffer
+};
+
+struct http_field {
+  const char* name;
+  const char* value;
+};
+
+struct http_request {
+  // parsed in place, all strings point into buf
+  char buf[HTTP_HEADER_MAX];
+  uint16_t len;                     // bytes in buf
+  uint16_t scanned;                 // searched for the header end up to here
+  uint16_t header_len;              // 0 = not parsed yet, else start of the body
+  uint8_t method;
+  uint8_t version;                  // 0 = HTTP/1.0, 1 = HTTP/1.1
+  bool keep_alive;
+  const char* path;                 // without query, e.g. "/red/128"
+  const char* query;                // behind '?', "" if none
+  const char* rest;                 // route "/red/*": the part for '*'
+  http_field headers[HTTP_MAX_HEADERS];
+  uint8_t header_count;
+  uint32_t content_length;
+  uint32_t body_read;               // by the handler with http_read_body
+  Client* client;
+};
+
+struct http_response : public Print {
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* data, size_t len) override;
+  using Print::write;
+
+  Client* client;
+  uint16_t status;
+  const char* type;
+  char extra[HTTP_EXTRA_MAX];       // header lines added with http_add_header
+  uint16_t extra_len;
+  // head is put in front of the body when the buffer is sent, the chunk
+  // CRLF and the last chunk "0\r\n\r\n" after it
+  uint8_t buf[HTTP_EXTRA_MAX + 160 + HTTP_BODY_MAX + 7];
+  uint16_t len;                     // body bytes in the buffer
+  bool sent_head;
+  bool chunked;
+  bool keep_alive;
+  bool head_only;
+  bool failed;                      // client gone, the rest is dropped
+  uint32_t bytes;                   // sent in total
+};
+
+typedef void (*http_handler)(http_request& req, http_response& res);
+
+struct http_route {
+  uint8_t methods;                  // HTTP_GET | HTTP_POST ...
+  const char* path;                 // exact, "/prefix/*" or "*" for all
+  http_handler handler;
+};
+
+struct http_connection {
+  Client* client;                   // NULL = free
+  http_request req;
+  uint32_t last_ms;                 // last data received
+  uint32_t start_ms;                // first byte of the current request
+  uint8_t requests;                 // served on this connection
+};
+
+struct http_stats {
+  uint32_t requests;
+  uint32_t connections;
+  uint32_t errors;                  // 4xx / 5xx from the server itself
+  uint32_t timeouts;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint32_t total_us;                // time in the handlers and sending
+  uint32_t max_us;
+  // time between two polls, one pass of loop() with the requests in it
+  uint32_t last_poll_us;            // 0 = no poll yet
+  uint32_t loop_max_us;
+  uint32_t loop_late;               // over HTTP_LOOP_LATE_US
+};
+
+struct http_server {
+  const http_route* routes;
+  uint8_t count;
+  Print* log;                       // one line per request if set
+  // called around each request (end false, then true) if set, for a
+  // profiler; name is the path of the route
+  void (*trace)(const char* name, bool end);
+  http_connection conn[HTTP_MAX_CONNECTIONS];
+  http_response res;                // one at a time, handlers don't overlap
+  http_stats stats;
+#ifdef ARDUINO
+  WiFiServer* listener;
+  WiFiClient clients[HTTP_MAX_CONNECTIONS];
+#endif
+};
+
+#define HTTP_SERVER(routes) { routes, (uint8_t)(sizeof(routes) / sizeof(routes[0])) }
+
+#ifdef ARDUINO
+// Listen on port, call after WiFi is up
+void http_server_begin(http_server& s, uint16_t port = 80);
+
+// Accept new clients and serve complete requests, never waits for a client.
+// Call from loop() as often as possible.
+void http_server_poll(http_server& s);
+#endif
+
+// Slot for a new connection: a free one, else the longest idle keep-alive
+// connection is closed. -1 if all connections are in the middle of a request.
+int8_t http_server_free_slot(http_server& s);
+void http_connection_open(http_server& s, uint8_t slot, Client* client);
+
+// Time since the last poll into the stats, done by http_server_poll().
+// A loop on the host calls it itself.
+void http_server_tick(http_server& s, uint32_t now_us);
+
+// Read what the client sent, serve complete requests and handle timeouts
+void http_connection_poll(http_server& s, http_connection& c);
+void http_connection_close(http_server& s, http_connection& c);
+
+// Look for the end of the header in req.buf[0..len] and parse it in place.
+// Only scans the new bytes, so it can be called after every read.
+http_parse_result http_parse(http_request& req);
+
+// Forget the served request, pipelined bytes behind it are kept
+void http_request_next(http_request& req);
+
+// Header value by name (not case sensitive), NULL if not sent
+const char* http_header_value(const http_request& req, const char* name);
+
+// Query parameter, URL decoded into out. False if not in the query.
+bool http_query_value(const http_request& req, const char* name, char* out, size_t size);
+long http_query_int(const http_request& req, const char* name, long fallback);
+
+// Read up to len bytes of the request body: first what came with the
+// header, then from the client (waits up to HTTP_BODY_TIMEOUT_MS).
+// 0 at the end of the body or on timeout.
+size_t http_read_body(http_request& req, uint8_t* buf, size_t len);
+
+// Rebuild "GET /path?query HTTP/1.1" for code that parses the request line
+// itself (gpio_table_handle_request)
+const char* http_request_line(const http_request& req, char* out, size_t size);
+
+// Status and content type, before the first byte of the body
+void http_status(http_response& res, uint16_t status, const char* type = "text/html");
+void http_add_header(http_response& res, const char* name, const char* value);
+void http_send(http_response& res, uint16_t status, const char* type, const char* body);
+
+// Send the rest of the response, called by the server after the handler
+void http_finish(http_response& res);
+
+// Text, one line each for requests, bytes and loop(). Clearing starts a
+// new measurement (load test).
+void http_print_stats(const http_server& s, Print& out);
+void http_clear_stats(http_server& s);
@@ -0,0 +1,219 @@
+#include "http_json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static void skip_space(json_reader& r)
+{
+  while (r.p < r.end && (*r.p == ' ' || *r.p == '\t' || *r.p == '\r' || *r.p == '\n')) r.p++;
+}
+
+
+static bool fail(json_reader& r)
+{
+  r.error = true;
+  r.p = r.end;
+  return false;
+}
+
+
+void json_begin(json_reader& r, const char* text, size_t len)
+{
+  r.p = text;
+  r.end = text + len;
+  r.error = false;
+  r.first = true;
+}
+
+
+bool json_enter(json_reader& r, char open)
+{
+  skip_space(r);
+  if (r.p >= r.end || *r.p != open) return fail(r);
+  r.p++;
+  r.first = true;
+  return true;
+}
+
+
+// ',' between members, false at the closing bracket
+static bool next_member(json_reader& r, char close)
+{
+  skip_space(r);
+  if (r.p >= r.end) return fail(r);
+  if (*r.p == close) {
+    r.p++;
+    r.first = false;
+    return false;
+  }
+  if (!r.first) {
+    if (*r.p != ',') return fail(r);
+    r.p++;
+    skip_space(r);
+  }
+  r.first = false;
+  return true;
+}
+
+
+bool json_next_key(json_reader& r, char* key, size_t size)
+{
+  if (r.error || !next_member(r, '}')) return false;
+  if (!json_string(r, key, size)) return false;
+  skip_space(r);
+  if (r.p >= r.end || *r.p != ':') return fail(r);
+  r.p++;
+  return true;
+}
+
+
+bool json_next_item(json_reader& r)
+{
+  return !r.error && next_member(r, ']');
+}
+
+
+static bool number(json_reader& r, double& value)
+{
+  skip_space(r);
+  if (r.p >= r.end) return fail(r);
+  char buf[24];
+  size_t n = 0;
+  while (r.p + n < r.end && n < sizeof(buf) - 1 && strchr("+-0123456789.eE", r.p[n])) {
+    buf[n] = r.p[n];
+    n++;
+  }
+  buf[n] = 0;
+  char* end;
+  value = strtod(buf, &end);
+  if (!n || end != buf + n) return fail(r);
+  r.p += n;
+  return true;
+}
+
+
+bool json_int(json_reader& r, long& value)
+{
+  double v;
+  if (!number(r, v)) return false;
+  // 32 bit on the ESP32, no fractions (also false for NaN)
+  if (!(v >= -2147483648.0 && v <= 2147483647.0) || v != (double)(int32_t)v) return fail(r);
+  value = (long)v;
+  return true;
+}
+
+
+bool json_bool(json_reader& r, bool& value)
+{
+  skip_space(r);
+  if (r.end - r.p >= 4 && strncmp(r.p, "true", 4) == 0) {
+    r.p += 4;
+    value = true;
+    return true;
+  }
+  if (r.end - r.p >= 5 && strncmp(r.p, "false", 5) == 0) {
+    r.p += 5;
+    value = false;
+    return true;
+  }
+  long v;
+  if (!json_int(r, v)) return false;
+  value = v != 0;
+  return true;
+}
+
+
+bool json_string(json_reader& r, char* out, size_t size)
+{
+  skip_space(r);
+  if (r.p >= r.end || *r.p != '"') return fail(r);
+  r.p++;
+  size_t n = 0;
+  while (r.p < r.end && *r.p != '"') {
+    char c = *r.p++;
+    if (c == '\\' && r.p < r.end) {
+      c = *r.p++;
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'u': {
+          // only ASCII, everything else becomes '?'
+          if (r.end - r.p < 4) return fail(r);
+          char hex[5] = { r.p[0], r.p[1], r.p[2], r.p[3], 0 };
+          long code = strtol(hex, NULL, 16);
+          c = (code > 0 && code < 0x80) ? (char)code : '?';
+          r.p += 4;
+          break;
+        }
+      }
+    }
+    if (n + 1 < size) out[n++] = c;
+  }
+  if (r.p >= r.end) return fail(r);
+  r.p++;
+  if (size) out[n] = 0;
+  return true;
+}
+
+
+bool json_null(json_reader& r)
+{
+  skip_space(r);
+  if (r.end - r.p >= 4 && strncmp(r.p, "null", 4) == 0) {
+    r.p += 4;
+    return true;
+  }
+  return false;
+}
+
+
+static void skip(json_reader& r, int depth)
+{
+  skip_space(r);
+  if (r.p >= r.end) {
+    fail(r);
+    return;
+  }
+  char c = *r.p;
+  if (c == '{' || c == '[') {
+    // the body comes from the client, the stack of loop() is small
+    if (depth == JSON_DEPTH_MAX) {
+      fail(r);
+      return;
+    }
+    json_enter(r, c);
+    if (c == '{') {
+      char key[2];
+      while (json_next_key(r, key, sizeof(key))) skip(r, depth + 1);
+    } else {
+      while (json_next_item(r)) skip(r, depth + 1);
+    }
+  } else if (c == '"') {
+    char dummy[1];
+    json_string(r, dummy, sizeof(dummy));
+  } else if (r.end - r.p >= 4 && (strncmp(r.p, "true", 4) == 0 || strncmp(r.p, "null", 4) == 0)) {
+    r.p += 4;
+  } else if (r.end - r.p >= 5 && strncmp(r.p, "false", 5) == 0) {
+    r.p += 5;
+  } else {
+    double v;
+    number(r, v);
+  }
+}
+
+
+void json_skip(json_reader& r)
+{
+  skip(r, 0);
+}
+
+
+bool json_done(json_reader& r)
+{
+  skip_space(r);
+  return !r.error && r.p == r.end;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small pull reader for JSON request bodies, no allocation, no DOM.
+// The caller walks the document in the order it expects it:
+//
+//   json_reader r;
+//   json_begin(r, body, len);
+//   char key[16];
+//   if (json_enter(r, '{')) {
+//     while (json_next_key(r, key, sizeof(key))) {
+//       long v;
+//       if (strcmp(key, "red") == 0 && json_int(r, v)) red = v;
+//       else json_skip(r);                   // unknown keys are ignored
+//     }
+//   }
+//   if (r.error) ...                         // syntax error or wrong type
+//
+// Arrays: json_enter(r, '[') and while (json_next_item(r)) { read value }.
+
+#define JSON_DEPTH_MAX 16      // nested objects / arrays in a skipped value
+
+struct json_reader {
+  const char* p;
+  const char* end;
+  bool error;
+  bool first;           // no ',' expected before the next key / item
+};
+
+void json_begin(json_reader& r, const char* text, size_t len);
+
+// Expect '{' or '[', false (and error) if something else comes
+bool json_enter(json_reader& r, char open);
+
+// Next key of the object, false at the closing '}'
+bool json_next_key(json_reader& r, char* key, size_t size);
+
+// Next item of the array, false at the closing ']'
+bool json_next_item(json_reader& r);
+
+// Values, false (and error) on a wrong type. json_int: 32 bit integers
+// only, no fractions.
+bool json_int(json_reader& r, long& value);
+bool json_bool(json_reader& r, bool& value);      // also accepts 0 / 1
+bool json_string(json_reader& r, char* out, size_t size);
+bool json_null(json_reader& r);                   // true (and skipped) if null
+
+// Skip any value including nested objects / arrays, error if they are
+// nested deeper than JSON_DEPTH_MAX
+void json_skip(json_reader& r);
+
+// At the end of the document (only white space left)
+bool json_done(json_reader& r);